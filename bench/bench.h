@@ -0,0 +1,51 @@
+#ifndef SEPL_BENCH_H
+#define SEPL_BENCH_H
+
+#include "../sepl.h"
+#include "../sepl_com.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Each benchmark is run this many times and the fastest run is reported */
+#define BENCH_RUNS 5
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Compiles src into mod, exits on failure */
+static inline void bench_compile(SeplModule *mod, const char *src) {
+    SeplEnv env = {0};
+    SeplCompiler com = sepl_com_init(src, mod, env);
+    sepl_com_block(&com);
+    SeplError err = sepl_com_finish(&com);
+    if (err.code != SEPL_ERR_OK) {
+        fprintf(stderr, "Failed to compile:\n%s\nError code: %d\n", src,
+                err.code);
+        exit(1);
+    }
+}
+
+/* Runs a compiled module, exits on failure */
+static inline SeplValue bench_exec(SeplModule *mod) {
+    SeplEnv env = {0};
+    SeplError err = {0};
+    SeplValue val = sepl_mod_exec(mod, &err, env);
+    if (err.code != SEPL_ERR_OK) {
+        fprintf(stderr, "Failed to run: error code %d\n", err.code);
+        exit(1);
+    }
+    return val;
+}
+
+static inline void bench_report(const char *name, double secs, double units,
+                                const char *unit) {
+    printf("%-28s %10.3f ms %12.2f %s\n", name, secs * 1e3, units / secs,
+           unit);
+}
+
+#endif
@@ -0,0 +1,78 @@
+/* Measures compile throughput on a large generated source, next to a pass
+ * of the lexer alone over the same source. */
+#define SEPL_IMPLEMENTATION
+#include "bench.h"
+
+#include <string.h>
+
+#define COMPILE_CHUNKS 20000
+#define COMPILE_BYTES (1 << 23)
+#define COMPILE_VALUES 256
+
+static const char compile_head[] =
+    "{ @s = 0; @f = $(x, y) { return x + y; };\n";
+static const char compile_chunk[] =
+    "{ @a = s * 2 + 1; @b = (a - 3) / 2;\n"
+    "  if (a < b || b >= 10) { s = s + a; } else { s = s - b; };\n"
+    "  while (b > 0) { b = b - 1; };\n"
+    "  @t = \"str\"; s = f(a, b) + 0.5; };\n";
+static const char compile_tail[] = "return s; }";
+
+static char *compile_source(void) {
+    size_t head = strlen(compile_head), chunk = strlen(compile_chunk);
+    size_t size = head + chunk * COMPILE_CHUNKS + sizeof(compile_tail);
+    char *src = malloc(size), *at = src;
+    int i;
+
+    if (src == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    memcpy(at, compile_head, head);
+    at += head;
+    for (i = 0; i < COMPILE_CHUNKS; i++) {
+        memcpy(at, compile_chunk, chunk);
+        at += chunk;
+    }
+    memcpy(at, compile_tail, sizeof(compile_tail));
+    return src;
+}
+
+int main() {
+    static unsigned char bytes[COMPILE_BYTES];
+    static SeplValue values[COMPILE_VALUES];
+    char *src = compile_source();
+    double mb = (double)strlen(src) / (1 << 20);
+    double lex_best = 1e30, com_best = 1e30;
+    size_t toks = 0;
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        SeplLexer lex = sepl_lex_init(src);
+        double start = bench_now(), secs;
+        toks = 0;
+        while (sepl_lex_next(&lex).type != SEPL_TOK_EOF) {
+            toks++;
+        }
+        secs = bench_now() - start;
+        if (secs < lex_best)
+            lex_best = secs;
+    }
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        SeplModule mod =
+            sepl_mod_new(bytes, COMPILE_BYTES, values, COMPILE_VALUES);
+        double start = bench_now(), secs;
+        bench_compile(&mod, src);
+        secs = bench_now() - start;
+        if (secs < com_best)
+            com_best = secs;
+    }
+
+    printf("compile: %.2f MB, %lu tokens\n", mb, (unsigned long)toks);
+    bench_report("lex", lex_best, mb, "MB/s");
+    bench_report("compile", com_best, mb, "MB/s");
+    bench_report("compile", com_best, (double)toks / 1e6, "Mtok/s");
+    free(src);
+    return 0;
+}
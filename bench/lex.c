@@ -0,0 +1,76 @@
+/* Measures lexer throughput on generated sources of different shapes.
+ * Build once as-is and once with SEPL_SIMD to compare the scanning paths. */
+#define SEPL_IMPLEMENTATION
+#include "bench.h"
+
+#include <string.h>
+
+#define LEX_SIZE (1 << 23)
+
+static const struct {
+    const char *name;
+    const char *chunk;
+} lex_cases[] = {
+    {"code",
+     "{ @a = s * 2 + 1; @b = (a - 3) / 2;\n"
+     "  if (a < b || b >= 10) { s = s + a; } else { s = s - b; };\n"
+     "  while (b > 0) { b = b - 1; }; };\n"},
+    {"indented",
+     "                if (value) {\n"
+     "                                result = value;\n"
+     "                }\n"},
+    {"identifiers",
+     "rule_match_request_header_content_type = "
+     "rule_match_request_header_content_length;\n"},
+    {"strings",
+     "@message = \"The request was rejected because the header did not "
+     "match any of the configured \\\"allow\\\" rules\";\n"},
+};
+
+/* Repeats chunk up to LEX_SIZE bytes */
+static char *lex_source(const char *chunk) {
+    size_t len = strlen(chunk), size = 0;
+    char *src = malloc(LEX_SIZE + 1);
+
+    if (src == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    while (size + len <= LEX_SIZE) {
+        memcpy(src + size, chunk, len);
+        size += len;
+    }
+    src[size] = '\0';
+    return src;
+}
+
+int main() {
+    size_t i;
+
+#if defined(SEPL_SIMD) && defined(__AVX2__)
+    printf("lex: SEPL_SIMD (AVX2)\n");
+#elif defined(SEPL_SIMD) && defined(__SSE2__)
+    printf("lex: SEPL_SIMD (SSE2)\n");
+#else
+    printf("lex: default\n");
+#endif
+
+    for (i = 0; i < sizeof(lex_cases) / sizeof(lex_cases[0]); i++) {
+        char *src = lex_source(lex_cases[i].chunk);
+        double mb = (double)strlen(src) / (1 << 20), best = 1e30;
+        int run;
+
+        for (run = 0; run < BENCH_RUNS; run++) {
+            SeplLexer lex = sepl_lex_init(src);
+            double start = bench_now(), secs;
+            while (sepl_lex_next(&lex).type != SEPL_TOK_EOF);
+            secs = bench_now() - start;
+            if (secs < best)
+                best = secs;
+        }
+
+        bench_report(lex_cases[i].name, best, mb, "MB/s");
+        free(src);
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* Measures number literal conversion on a literal heavy corpus against the
+ * digit by digit loop sepl_lex_num used before, and counts the results that
+ * differ from strtod. */
+#define SEPL_IMPLEMENTATION
+#include "bench.h"
+
+#include <string.h>
+
+#define NUM_COUNT 200000
+
+static const char *num_shapes[] = {
+    "%d",                   /* integers */
+    "%d.%03d",              /* short decimals */
+    "%d.%09d%09d",          /* long decimals */
+    "0.%09d%09d%09d%09d",   /* very long fractions */
+};
+
+/* The conversion loop used before correct rounding */
+static double num_loop(SeplToken tok) {
+    double result = 0.0;
+    sepl_size factor = 10;
+
+    for (; tok.start != tok.end;) {
+        char c = *tok.start++;
+        if (c == '.') {
+            break;
+        }
+        result = result * 10 + sepl_to_digit(c);
+    }
+
+    for (; tok.start != tok.end;) {
+        char c = *tok.start++;
+        result = result + ((double)sepl_to_digit(c) / factor);
+        factor *= 10;
+    }
+
+    return result;
+}
+
+static char *num_corpus(const char *shape, SeplToken *toks) {
+    char *src = malloc(NUM_COUNT * 48), *at = src;
+    SeplLexer lex;
+    int i;
+
+    if (src == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    srand(1);
+    for (i = 0; i < NUM_COUNT; i++) {
+        at += sprintf(at, shape, rand() % 100000, rand() % 1000000000,
+                      rand() % 1000000000, rand() % 1000000000);
+        *at++ = ' ';
+    }
+    *at = '\0';
+
+    lex = sepl_lex_init(src);
+    for (i = 0; i < NUM_COUNT; i++) {
+        toks[i] = sepl_lex_next(&lex);
+        if (toks[i].type != SEPL_TOK_NUM) {
+            fprintf(stderr, "Failed to lex %s\n", toks[i].start);
+            exit(1);
+        }
+    }
+    return src;
+}
+
+static void num_run(const char *name, const SeplToken *toks,
+                    double (*conv)(SeplToken)) {
+    volatile double sink = 0;
+    double best = 1e30;
+    char word[64];
+    int run, i, wrong = 0;
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now(), secs;
+        for (i = 0; i < NUM_COUNT; i++) {
+            sink += conv(toks[i]);
+        }
+        secs = bench_now() - start;
+        if (secs < best)
+            best = secs;
+    }
+
+    for (i = 0; i < NUM_COUNT; i++) {
+        size_t len = (size_t)(toks[i].end - toks[i].start);
+        memcpy(word, toks[i].start, len);
+        word[len] = '\0';
+        wrong += conv(toks[i]) != strtod(word, NULL);
+    }
+
+    bench_report(name, best, NUM_COUNT / 1e6, "Mnum/s");
+    printf("%-28s %10d of %d differ from strtod\n", "", wrong, NUM_COUNT);
+}
+
+int main() {
+    static SeplToken toks[NUM_COUNT];
+    char name[64];
+    size_t i;
+
+    for (i = 0; i < sizeof(num_shapes) / sizeof(num_shapes[0]); i++) {
+        char *src = num_corpus(num_shapes[i], toks);
+
+        snprintf(name, sizeof(name), "loop %s", num_shapes[i]);
+        num_run(name, toks, num_loop);
+        snprintf(name, sizeof(name), "sepl_lex_num %s", num_shapes[i]);
+        num_run(name, toks, sepl_lex_num);
+        free(src);
+    }
+    return 0;
+}
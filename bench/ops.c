@@ -0,0 +1,89 @@
+/* Measures the hot opcodes of the interpreter loop (CONST, GET, SET, JUMP,
+ * arithmetic, CALL).
+ * Build once as-is and once with SEPL_ALIGNED to compare operand loads, with
+ * SEPL_NANBOX to compare value sizes or with SEPL_QUICKEN to compare in place
+ * specialization. */
+#define SEPL_IMPLEMENTATION
+#include "bench.h"
+
+#define OPS_ITERS "1000000"
+
+static const struct {
+    const char *name;
+    const char *src;
+} ops_cases[] = {
+    {"const",
+     "{ @i = 0; @x = 0; while (i < " OPS_ITERS ") {"
+     "  x = 0.5 + 0.25 + 1.125 + 2.5;"
+     "  i = i + 1; } return x; }"},
+    {"get/set",
+     "{ @i = 0; @a = 0; @b = 0; @c = 0; while (i < " OPS_ITERS ") {"
+     "  a = i; b = a; c = b; a = c;"
+     "  i = i + 1; } return c; }"},
+    {"jump",
+     "{ @i = 0; @n = 0; while (i < " OPS_ITERS ") {"
+     "  if (i < 0) { n = 1; } if (i < 0) { n = 2; }"
+     "  i = i + 1; } return n; }"},
+    {"arith",
+     "{ @i = 0; @x = 1; while (i < " OPS_ITERS ") {"
+     "  x = x * 3 - x / 2 + i; if (x > 1000) { x = x / 1000; }"
+     "  i = i + 1; } return x; }"},
+    {"call",
+     "{ @f = $(a, b) { return a * b + a; }; @i = 0; @x = 0;"
+     "  while (i < " OPS_ITERS ") { x = f(i, 2); i = i + 1; } return x; }"},
+    /* 3500 runs of fib(11) make about as many calls as OPS_ITERS */
+    {"recursion",
+     "{ @fib = $(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2);"
+     "  }; @i = 0; @x = 0; while (i < 3500) { x = fib(11); i = i + 1; }"
+     "  return x; }"},
+    /* 100000 runs of a tail call chain 10 deep */
+    {"tailcall",
+     "{ @count = $(n, acc) { if (n < 1) { return acc; }"
+     "  return count(n - 1, acc + 1); }; @i = 0; @x = 0;"
+     "  while (i < 100000) { x = x + count(10, 0); i = i + 1; } return x; }"},
+};
+
+/* Runs every case with the code buffer starting at the given offset.
+ * A non zero offset misaligns the constant pool unless SEPL_ALIGNED is set */
+static void ops_run(sepl_size offset) {
+    static unsigned char bytes[4096 + SEPL_KSLOT];
+    static SeplValue values[64];
+    char name[64];
+    sepl_size i;
+
+    for (i = 0; i < sizeof(ops_cases) / sizeof(ops_cases[0]); i++) {
+        SeplModule mod =
+            sepl_mod_new(bytes + offset, 4096, values, 64);
+        double best = 1e30;
+        int run;
+
+        bench_compile(&mod, ops_cases[i].src);
+        for (run = 0; run < BENCH_RUNS; run++) {
+            SeplModule copy = mod;
+            double start = bench_now();
+            bench_exec(&copy);
+            double secs = bench_now() - start;
+            if (secs < best)
+                best = secs;
+        }
+
+        snprintf(name, sizeof(name), "%s (offset %d)", ops_cases[i].name,
+                 (int)offset);
+        bench_report(name, best, atof(OPS_ITERS) / 1e6, "Miter/s");
+    }
+}
+
+int main() {
+#ifdef SEPL_ALIGNED
+    printf("ops: SEPL_ALIGNED\n");
+#elif defined(SEPL_NANBOX)
+    printf("ops: SEPL_NANBOX\n");
+#elif defined(SEPL_QUICKEN)
+    printf("ops: SEPL_QUICKEN\n");
+#else
+    printf("ops: default\n");
+#endif
+    ops_run(0);
+    ops_run(1);
+    return 0;
+}
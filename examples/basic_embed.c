@@ -29,7 +29,7 @@ int main() {
         return 1;
     }
 
-    printf("The number returned: %lf\n", result.as.num);
+    printf("The number returned: %lf\n", sepl_val_getnum(result));
 
     return 0;
 }
@@ -224,18 +224,18 @@ void assert_error(SeplError error, const char *msg) {
 
 SeplValue gv_print(SeplArgs args, SeplError *_) {
     for (sepl_size i = 0; i < args.size; i++) {
-        switch (args.values[i].type) {
+        switch (sepl_val_gettype(args.values[i])) {
             case SEPL_VAL_NONE:
                 printf("NONE ");
                 break;
             case SEPL_VAL_NUM:
-                printf("%lf ", args.values[i].as.num);
+                printf("%lf ", sepl_val_getnum(args.values[i]));
                 break;
             case SEPL_VAL_STR:
-                printf("%s ", (const char *)args.values[i].as.obj);
+                printf("%s ", (const char *)sepl_val_getobj(args.values[i]));
                 break;
             default:
-                printf("%p ", args.values[i].as.obj);
+                printf("%p ", sepl_val_getobj(args.values[i]));
                 break;
         }
     }
@@ -264,6 +264,9 @@ int main(int argc, char *argv[]) {
     unsigned char bc_buf[MAX_BC_BUF];
     SeplValue val_buf[MAX_VAL_BUF];
     SeplModule module = sepl_mod_new(bc_buf, MAX_BC_BUF, val_buf, MAX_VAL_BUF);
+    // Unwinding only visits the slots the bitmap marks as holding objects
+    unsigned char obj_map[sepl_mod_mapsize(MAX_VAL_BUF)];
+    sepl_mod_setobjmap(&module, obj_map, sizeof(obj_map));
 
     SeplValuePair globals[] = {{"print", sepl_val_cfunc(gv_print)},
                                {"input", sepl_val_cfunc(gv_input)}};
@@ -314,5 +317,5 @@ int main(int argc, char *argv[]) {
     // Cleanup any global variables
     sepl_mod_cleanup(&module, env);
 
-    return (int)retv.as.num;
+    return (int)sepl_val_getnum(retv);
 }
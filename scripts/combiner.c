@@ -15,12 +15,16 @@ const char *header_files[] = {
     SRC_DIR "val.h",
     SRC_DIR "env.h",
     SRC_DIR "mod.h",
+    SRC_DIR "opt.h",
+    SRC_DIR "ver.h",
 };
 
 const char *src_files[] = {
     SRC_DIR "lex.c",
     SRC_DIR "val.c",
     SRC_DIR "mod.c",
+    SRC_DIR "opt.c",
+    SRC_DIR "ver.c",
 };
 
 typedef struct {
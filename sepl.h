@@ -40,6 +40,23 @@ typedef SEPL_DEF_SIZE sepl_size;
 sepl__static_assert(sepl__is_unsigned(sepl_size), is_unsigned);
 #endif
 
+#ifdef SEPL_NANBOX
+/* NaN-boxed values need a 64 bit word and an integer wide enough to hold a
+ * pointer, override these where the defaults do not fit */
+#ifndef SEPL_DEF_U64
+typedef unsigned long long sepl_u64;
+#else
+typedef SEPL_DEF_U64 sepl_u64;
+#endif
+#ifndef SEPL_DEF_UPTR
+typedef unsigned long sepl_uptr;
+#else
+typedef SEPL_DEF_UPTR sepl_uptr;
+#endif
+sepl__static_assert(sizeof(sepl_u64) == 8, u64_is_8_bytes);
+sepl__static_assert(sizeof(sepl_uptr) >= sizeof(void *), uptr_holds_pointer);
+#endif
+
 #ifndef SEPL_NULL
 #ifdef __cplusplus
 #define SEPL_NULL nullptr
@@ -57,7 +74,6 @@ sepl__static_assert(sepl__is_unsigned(sepl_size), is_unsigned);
 #endif
 
 
-
 typedef enum {
     SEPL_TOK_ERROR,
     SEPL_TOK_SEMICOLON,
@@ -109,10 +125,21 @@ typedef struct {
     sepl_size line;
 } SeplToken;
 
+/* Tokens kept ahead of the current one, must be a power of two */
+#define SEPL_LEX_AHEAD 4
+
+/*
+ * Peeked tokens are kept in a ring buffer so every token is scanned once.
+ * source and line are the position of the scanner, which can be ahead of
+ * the current token, the line of a token is stored in the token itself.
+ */
 typedef struct {
     const char *source;
     sepl_size line;
     SeplToken current;
+    SeplToken ahead[SEPL_LEX_AHEAD];
+    unsigned char head;
+    unsigned char count;
 } SeplLexer;
 
 SEPL_LIB char sepl_is_digit(char c);
@@ -125,10 +152,11 @@ SEPL_LIB char sepl_to_special(char c);
 SEPL_LIB SeplLexer sepl_lex_init(const char *source);
 SEPL_LIB SeplToken sepl_lex_next(SeplLexer *lex);
 SEPL_LIB SeplToken sepl_lex_peek(SeplLexer lex);
+/* Returns the token n places after the current one, n < SEPL_LEX_AHEAD */
+SEPL_LIB SeplToken sepl_lex_ahead(SeplLexer *lex, sepl_size n);
 SEPL_LIB double sepl_lex_num(SeplToken tok);
 
 
-
 typedef enum {
     SEPL_ERR_OK,
 
@@ -193,7 +221,6 @@ typedef struct {
 #define sepl_err_iden(e, code, i) (sepl_err_new(e, code), (e)->info.iden = i)
 
 
-
 typedef struct SeplValue SeplValue;
 
 typedef enum {
@@ -207,14 +234,24 @@ typedef enum {
     SEPL_VAL_OBJ
 } SeplValueType;
 
+struct SeplModule;
+struct SeplEnv;
+
 typedef struct {
     SeplValue *values;
     sepl_size size;
+
+    /* Module and environment running a cfunc, which it may pass to
+     * sepl_mod_reenter. SEPL_NULL when the host calls it */
+    struct SeplModule *mod;
+    const struct SeplEnv *env;
 } SeplArgs;
 
 typedef SeplValue (*sepl_c_func)(SeplArgs, SeplError *);
 typedef void (*sepl_free_func)(SeplValue);
+typedef void (*sepl_free_batch_func)(SeplValue *, sepl_size);
 
+#ifndef SEPL_NANBOX
 struct SeplValue {
     sepl_size type;
     union {
@@ -229,16 +266,76 @@ struct SeplValue {
     } as;
 };
 
-extern const SeplValue SEPL_NONE;
+#define sepl_val_gettype(val) ((val).type)
+#define sepl_val_getnum(val) ((val).as.num)
+#define sepl_val_getpos(val) ((val).as.pos)
+#define sepl_val_getcfunc(val) ((val).as.cfunc)
+#define sepl_val_getobj(val) ((val).as.obj)
+
+#define sepl_val_isnone(val) ((val).type == SEPL_VAL_NONE)
+#define sepl_val_isscp(val) ((val).type == SEPL_VAL_SCOPE)
+#define sepl_val_isnum(val) ((val).type == SEPL_VAL_NUM)
+#define sepl_val_isstr(val) ((val).type == SEPL_VAL_STR)
+#define sepl_val_isfun(val) ((val).type == SEPL_VAL_FUNC)
+#define sepl_val_iscfun(val) ((val).type == SEPL_VAL_CFUNC)
+#define sepl_val_isref(val) ((val).type == SEPL_VAL_REF)
+#define sepl_val_isobj(val) ((val).type >= SEPL_VAL_OBJ)
+#else
+/*
+ * Defining SEPL_NANBOX packs values into the 8 bytes of a double. Numbers are
+ * stored as they are, everything else is a NaN: all exponent bits set, the
+ * sign bit and the top 4 mantissa bits holding a tag and the low 48 bits
+ * holding the position or pointer. Tags with their low 3 bits clear are left
+ * to numbers, so infinities and the NaNs arithmetic produces still read as
+ * numbers, and sepl_val_number replaces any other NaN with a canonical one.
+ *
+ * That leaves room for type ids below SEPL_NANBOX_TYPES, so custom ids
+ * passed to sepl_val_type must stay below SEPL_NANBOX_TYPES - SEPL_VAL_OBJ,
+ * and pointers must fit in 48 bits as they do in user space on x86-64 and
+ * AArch64.
+ */
+struct SeplValue {
+    sepl_u64 bits;
+};
 
-#define sepl_val_isnone(val) (val.type == SEPL_VAL_NONE)
-#define sepl_val_isscp(val) (val.type == SEPL_VAL_SCOPE)
-#define sepl_val_isnum(val) (val.type == SEPL_VAL_NUM)
-#define sepl_val_isstr(val) (val.type == SEPL_VAL_STR)
-#define sepl_val_isfun(val) (val.type == SEPL_VAL_FUNC)
-#define sepl_val_iscfun(val) (val.type == SEPL_VAL_CFUNC)
-#define sepl_val_isref(val) (val.type == SEPL_VAL_REF)
-#define sepl_val_isobj(val) (val.type >= SEPL_VAL_OBJ)
+#define SEPL_NANBOX_TYPES 28
+
+#define SEPL__NB_EXP ((sepl_u64)0x7ff << 52)
+#define SEPL__NB_LOW ((sepl_u64)7 << 48)
+#define SEPL__NB_HEAD ((sepl_u64)0xffff << 48)
+#define SEPL__NB_PAYLOAD (((sepl_u64)1 << 48) - 1)
+
+/* Type id t is stored as tag t + 1 + t / 7, skipping the number tags */
+#define sepl__nb_tag(t) ((sepl_u64)(t) + 1 + (sepl_u64)(t) / 7)
+#define sepl__nb_head(t)                                   \
+    (SEPL__NB_EXP | (sepl__nb_tag(t) & 0x10) << 59 |       \
+     (sepl__nb_tag(t) & 0xf) << 48)
+#define sepl__nb_isbox(bits) \
+    (((bits) & SEPL__NB_EXP) == SEPL__NB_EXP && ((bits) & SEPL__NB_LOW) != 0)
+#define sepl__nb_is(val, t) (((val).bits & SEPL__NB_HEAD) == sepl__nb_head(t))
+
+SEPL_LIB sepl_size sepl__nb_type(sepl_u64 bits);
+SEPL_LIB double sepl__nb_num(sepl_u64 bits);
+
+#define sepl_val_gettype(val) sepl__nb_type((val).bits)
+#define sepl_val_getnum(val) sepl__nb_num((val).bits)
+#define sepl_val_getpos(val) ((sepl_size)((val).bits & SEPL__NB_PAYLOAD))
+#define sepl_val_getcfunc(val) \
+    ((sepl_c_func)(sepl_uptr)((val).bits & SEPL__NB_PAYLOAD))
+#define sepl_val_getobj(val) \
+    ((void *)(sepl_uptr)((val).bits & SEPL__NB_PAYLOAD))
+
+#define sepl_val_isnone(val) sepl__nb_is(val, SEPL_VAL_NONE)
+#define sepl_val_isscp(val) sepl__nb_is(val, SEPL_VAL_SCOPE)
+#define sepl_val_isnum(val) (!sepl__nb_isbox((val).bits))
+#define sepl_val_isstr(val) sepl__nb_is(val, SEPL_VAL_STR)
+#define sepl_val_isfun(val) sepl__nb_is(val, SEPL_VAL_FUNC)
+#define sepl_val_iscfun(val) sepl__nb_is(val, SEPL_VAL_CFUNC)
+#define sepl_val_isref(val) sepl__nb_is(val, SEPL_VAL_REF)
+#define sepl_val_isobj(val) (sepl_val_gettype(val) >= SEPL_VAL_OBJ)
+#endif
+
+extern const SeplValue SEPL_NONE;
 
 SEPL_LIB SeplValue sepl_val_asref(void *v);
 SEPL_LIB SeplValue sepl_val_scope(sepl_size pos);
@@ -250,6 +347,9 @@ SEPL_LIB SeplValue sepl_val_cfunc(sepl_c_func cfunc);
 SEPL_LIB SeplValue sepl_val_object(void *vobj);
 SEPL_LIB SeplValue sepl_val_type(void *vobj, sepl_size custom_id);
 
+/* Value of any type id, numbers are 0, used by the compiler for its own
+ * types past SEPL_VAL_OBJ */
+SEPL_LIB SeplValue sepl__val_make(sepl_size type, void *obj);
 
 
 typedef struct {
@@ -257,25 +357,30 @@ typedef struct {
     SeplValue value;
 } SeplValuePair;
 
-typedef struct {
+typedef struct SeplEnv {
     sepl_free_func free;
 
     SeplValuePair *predef;
     sepl_size predef_len;
-} SeplEnv;
 
+    /* Optional, frees the objects of an unwound scope in one call instead of
+     * one call to free each. They are gathered at the start of the scope */
+    sepl_free_batch_func free_batch;
+} SeplEnv;
 
 
 typedef enum {
-    SEPL_BC_RETURN,
+    SEPL_BC_RETURN, /* values above the scope it leaves */
     SEPL_BC_JUMPIF,
     SEPL_BC_JUMP,
 
     SEPL_BC_CALL,
     SEPL_BC_POP,
+    SEPL_BC_DROP,
 
     SEPL_BC_NONE,
     SEPL_BC_CONST,
+    SEPL_BC_INT,
     SEPL_BC_STR,
     SEPL_BC_SCOPE,
     SEPL_BC_FUNC,
@@ -301,40 +406,323 @@ typedef enum {
     SEPL_BC_GT,
     SEPL_BC_GTE,
     SEPL_BC_EQ,
-    SEPL_BC_NEQ
+    SEPL_BC_NEQ,
+
+    /* Superinstructions emitted by the compiler for common sequences */
+    SEPL_BC_JUMP_LT, /* LT JUMPIF */
+    SEPL_BC_JUMP_LTE,
+    SEPL_BC_JUMP_GT,
+    SEPL_BC_JUMP_GTE,
+    SEPL_BC_JUMP_EQ,
+    SEPL_BC_JUMP_NEQ,
+    SEPL_BC_JUMP_AND, /* JUMPIF to INT 0 */
+    SEPL_BC_JUMP_OR,  /* inverted JUMPIF to INT 1 */
+    SEPL_BC_ADD_INT,  /* GET INT ADD */
+    SEPL_BC_INC,      /* GET INT ADD SET */
+    SEPL_BC_GET_CALL, /* GET CALL */
+
+    /* Variants emitted when the compiler knows both operands are numbers,
+     * they read them without any type checks */
+    SEPL_BC_ADD_NN,
+    SEPL_BC_SUB_NN,
+    SEPL_BC_MUL_NN,
+    SEPL_BC_DIV_NN,
+    SEPL_BC_LT_NN,
+    SEPL_BC_LTE_NN,
+    SEPL_BC_GT_NN,
+    SEPL_BC_GTE_NN,
+    SEPL_BC_EQ_NN,
+    SEPL_BC_NEQ_NN,
+    SEPL_BC_JUMP_LT_NN,
+    SEPL_BC_JUMP_LTE_NN,
+    SEPL_BC_JUMP_GT_NN,
+    SEPL_BC_JUMP_GTE_NN,
+    SEPL_BC_JUMP_EQ_NN,
+    SEPL_BC_JUMP_NEQ_NN,
+    SEPL_BC_ADD_INT_NN,
+    SEPL_BC_INC_NN,
+
+    /* Quickened variants the interpreter writes over a generic instruction
+     * after running it when built with SEPL_QUICKEN. Each one checks the
+     * types it was specialized for and rewrites itself back to the generic
+     * form when they do not match. The code buffer is then written during
+     * execution, so a module must not be run by several threads at once.
+     * The number variants follow the order of the _NN ones */
+    SEPL_BC_ADD_Q,
+    SEPL_BC_SUB_Q,
+    SEPL_BC_MUL_Q,
+    SEPL_BC_DIV_Q,
+    SEPL_BC_LT_Q,
+    SEPL_BC_LTE_Q,
+    SEPL_BC_GT_Q,
+    SEPL_BC_GTE_Q,
+    SEPL_BC_EQ_Q,
+    SEPL_BC_NEQ_Q,
+    SEPL_BC_JUMP_LT_Q,
+    SEPL_BC_JUMP_LTE_Q,
+    SEPL_BC_JUMP_GT_Q,
+    SEPL_BC_JUMP_GTE_Q,
+    SEPL_BC_JUMP_EQ_Q,
+    SEPL_BC_JUMP_NEQ_Q,
+    SEPL_BC_ADD_INT_Q,
+    SEPL_BC_INC_Q,
+    SEPL_BC_CALL_C,     /* CALL of a cfunc */
+    SEPL_BC_CALL_S,     /* CALL of a sepl function */
+    SEPL_BC_GET_CALL_C, /* GET_CALL of a cfunc */
+    SEPL_BC_GET_CALL_S, /* GET_CALL of a sepl function */
+
+    /* Call of a function known at compile time, with the address of its body
+     * and the exact argument count as operands. The value below the arguments
+     * is replaced by the return scope like with CALL */
+    SEPL_BC_CALL_DIRECT,
+
+    /* Call of the returned value of a function, with the stack offset of the
+     * frame of that function and argc as operands. A sepl function replaces
+     * the frame instead of being pushed above it */
+    SEPL_BC_TAILCALL,
+
+    /* First instruction of a function body, with the most values the body
+     * pushes above its parameters. Checks once that they fit */
+    SEPL_BC_FRAME
 } SeplBC;
 
+/*
+ * Operands are written as variable length integers, 7 bits per byte with the
+ * high bit marking a continuation. Code addresses are padded to a fixed width
+ * so they can be patched once known. Number and string literals are stored in
+ * a constant pool which grows down from the end of the bytecode buffer in
+ * slots of sizeof(double) bytes and are referred to by their slot index.
+ *
+ * Pooled numbers are read byte-wise so the buffer may have any alignment.
+ * Defining SEPL_ALIGNED trims the end of the buffer to a slot boundary in
+ * sepl_mod_new so the interpreter can load them directly instead.
+ */
+#define SEPL_KSLOT sizeof(double)
+#define sepl_mod_kaddr(mod, k) \
+    ((mod)->bytes + (mod)->bsize - (k) * SEPL_KSLOT)
+
+/* Bytes of the object bitmap for a value buffer of vsize values */
+#define sepl_mod_mapsize(vsize) (((vsize) + 7) / 8)
+
+/*
+ * Window a module compiles into instead of its buffer while the compile is
+ * only counted. The latest code and constants are kept, which is all the
+ * compiler reads back, older bytes are dropped and patches into them skipped.
+ * need is the most the code and the constant pool ever took together.
+ */
+#define SEPL_SINK_CODE 128
+#define SEPL_SINK_POOL 384
+
 typedef struct {
+    unsigned char bytes[SEPL_SINK_CODE + SEPL_SINK_POOL];
+    /* Code and pool positions that bytes[0] stands for */
+    sepl_size bbase;
+    sepl_size kbase;
+    sepl_size need;
+} SeplSink;
+
+typedef struct SeplModule {
     unsigned char *bytes;
     sepl_size bpos;
     sepl_size bsize;
+    sepl_size kpos;
+    /* Set while compiling into a SeplSink, bytes is not used then */
+    SeplSink *sink;
 
     SeplValue *values;
     sepl_size vpos;
     sepl_size vsize;
+    /* Optional bitmap set by sepl_mod_setobjmap */
+    unsigned char *objmap;
 
     const char **exports;
     sepl_size esize;
+    /* Hash table of export indices set up by sepl_mod_exporttab, each slot
+     * holds index + 1 or 0 when empty. SEPL_NULL to scan exports instead */
+    const sepl_size *etab;
+    sepl_size ecap;
 
     sepl_size pc;
+
+    /* Set by sepl_ver_module to 1 + the most values the code at 0 pushes,
+     * 0 while the module is not verified */
+    sepl_size verified;
+
+    /* Set for contexts of a SeplImage, whose code is never written */
+    char shared;
 } SeplModule;
 
+/*
+ * Code of a finished module, which is only read once taken. Any number of
+ * contexts made with sepl_mod_context can run it at the same time, each with
+ * its own value buffer, pc and exports. Contexts do not quicken the shared
+ * code and must not be compiled into or optimized.
+ */
+typedef struct {
+    const unsigned char *bytes;
+    sepl_size bpos;
+    sepl_size bsize;
+    sepl_size kpos;
+
+    const char **exports;
+    sepl_size esize;
+    const sepl_size *etab;
+    sepl_size ecap;
+
+    sepl_size verified;
+} SeplImage;
+
 SEPL_LIB SeplModule sepl_mod_new(unsigned char bytes[], sepl_size bsize,
                                  SeplValue values[], sepl_size vsize);
+/*
+ * Gives the module a bitmap with one bit per value, set for the slots an
+ * object has been stored in. map must hold sepl_mod_mapsize(vsize) bytes,
+ * else the module goes on without one. Unwinding a scope and
+ * sepl_mod_cleanup then only look at the marked slots instead of every value
+ * of the scope. The bits may outlive their object but every slot holding an
+ * object is marked.
+ */
+SEPL_LIB void sepl_mod_setobjmap(SeplModule *mod, unsigned char map[],
+                                 sepl_size size);
 SEPL_LIB sepl_size sepl_mod_bc(SeplModule *mod, SeplBC bc, SeplError *e);
 SEPL_LIB sepl_size sepl_mod_bcnum(SeplModule *mod, double n, SeplError *e);
+SEPL_LIB sepl_size sepl_mod_bcstr(SeplModule *mod, sepl_size len, SeplError *e);
 SEPL_LIB sepl_size sepl_mod_bcsize(SeplModule *mod, sepl_size s, SeplError *e);
+SEPL_LIB sepl_size sepl_mod_bcaddr(SeplModule *mod, sepl_size a, SeplError *e);
+SEPL_LIB void sepl_mod_setaddr(SeplModule *mod, sepl_size pos, sepl_size a);
 SEPL_LIB sepl_size sepl_mod_val(SeplModule *mod, SeplValue v, SeplError *e);
 
 SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env);
 SEPL_LIB void sepl_mod_cleanup(SeplModule *mod, SeplEnv env);
+/* Runs the instruction at pc with the engine of sepl_mod_exec and stops, pc
+ * and vpos are left for the next call */
 SEPL_LIB SeplValue sepl_mod_step(SeplModule *mod, SeplError *e, SeplEnv env);
 SEPL_LIB SeplValue sepl_mod_exec(SeplModule *mod, SeplError *e, SeplEnv env);
 SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
                                 SeplArgs args);
 SEPL_LIB SeplValue sepl_mod_getexport(SeplModule *mod, SeplEnv env,
                                       const char *key);
+/*
+ * Calls func with args above the values in use and returns what it returns,
+ * leaving pc and vpos as they were. A cfunc can call back into the module
+ * running it with the mod and env of its SeplArgs. Like sepl_mod_initfunc the
+ * call takes over the objects in args. When it fails its values are freed.
+ */
+SEPL_LIB SeplValue sepl_mod_reenter(SeplModule *mod, SeplError *e,
+                                    SeplEnv env, SeplValue func,
+                                    SeplArgs args);
+
+/*
+ * Exports are found by name through a hash table kept in buf, which must be
+ * aligned for sepl_size and is built again when the exports change. Without
+ * it, or when buf is too small for the exports, they are scanned in order.
+ */
+SEPL_LIB void sepl_mod_exporttab(SeplModule *mod, void *buf, sepl_size size);
+/* Index of the export named key, a handle that stays valid for the module
+ * and its contexts. esize if there is none */
+SEPL_LIB sepl_size sepl_mod_export_index(const SeplModule *mod,
+                                         const char *key);
+/* Value of the export at index, SEPL_NONE past the exports */
+SEPL_LIB SeplValue sepl_mod_export(const SeplModule *mod, SeplEnv env,
+                                   sepl_size index);
+
+/* Sepl function resolved once by sepl_mod_prepare for repeated calls */
+typedef struct {
+    /* Position of the body */
+    sepl_size pc;
+    sepl_size params;
+} SeplCall;
+
+SEPL_LIB SeplCall sepl_mod_prepare(SeplModule *mod, SeplError *e,
+                                   SeplValue func);
+/*
+ * Calls a prepared function with exactly call.params values from args and
+ * stores what it returns in result. The value buffer is checked once for the
+ * return scope and arguments, the body checks the rest as it starts. A failed
+ * call frees its values and leaves vpos as it was.
+ */
+SEPL_LIB void sepl_mod_call(SeplModule *mod, SeplError *e, SeplEnv env,
+                            SeplCall call, const SeplValue args[],
+                            SeplValue *result);
+/*
+ * Calls a prepared function once for each of count rows of arguments, the
+ * row i starting at args + i * stride, and stores what each returns in
+ * results. Objects returned are owned by the caller. The value buffer is
+ * checked once for all rows. A failing row gets SEPL_NONE and its error is
+ * kept in e unless an earlier row failed, stop ends the batch there. Returns
+ * the number of rows that ran without error.
+ */
+SEPL_LIB sepl_size sepl_mod_callbatch(SeplModule *mod, SeplError *e,
+                                      SeplEnv env, SeplCall call,
+                                      const SeplValue args[], sepl_size stride,
+                                      SeplValue results[], sepl_size count,
+                                      char stop);
+
+/* Takes the code of mod as an image, quickened instructions are turned back
+ * into their generic forms. mod must not be written to while it is in use */
+SEPL_LIB SeplImage sepl_mod_image(SeplModule *mod);
+/* Execution context running img with the value buffer values, which it sets
+ * up like sepl_mod_new. sepl_mod_init and sepl_mod_exec then run the top
+ * level code to define its exports */
+SEPL_LIB SeplModule sepl_mod_context(const SeplImage *img, SeplValue values[],
+                                     sepl_size vsize);
+
+/* Values a call of func takes on the value stack, its return scope and
+ * parameters included and the calls it makes excluded */
+SEPL_LIB sepl_size sepl_mod_funcsize(SeplModule *mod, SeplValue func);
+
+/* Bytecode encoding helpers, shared with the optimizer */
+SEPL_LIB sepl_size sepl__varlen(sepl_size v);
+SEPL_LIB sepl_size sepl__rdvar(const unsigned char *bytes, sepl_size *pc);
+SEPL_LIB void sepl__wrvar(unsigned char *at, sepl_size v, sepl_size len);
+/* Where the code or constant byte at pos is kept, SEPL_NULL once a sink
+ * dropped it */
+SEPL_LIB unsigned char *sepl__baddr(SeplModule *mod, sepl_size pos);
+SEPL_LIB sepl_size sepl__bcnext(const unsigned char *bytes, sepl_size pc);
+SEPL_LIB long sepl__bcstack(const unsigned char *bytes, sepl_size pc);
+SEPL_LIB SeplBC sepl__bcgeneric(SeplBC bc);
+
+
+typedef struct {
+    sepl_size bytes;
+    sepl_size instrs;
+} SeplOptStats;
+
+/*
+ * Rewrites the bytecode of a compiled module in place, must be called before
+ * the module is executed. Removes jumps to jumps and to the next instruction,
+ * NONE POP pairs, scopes of blocks that only return their last value and the
+ * NONE SET pair of variable declarations. Returns the removed bytes and
+ * instructions.
+ */
+SEPL_LIB SeplOptStats sepl_opt_peephole(SeplModule *mod);
+
 
+/* Bytes of scratch memory sepl_ver_module needs for the code of mod */
+#define sepl_ver_bufsize(mod) (2 * (mod)->bpos * sizeof(sepl_size))
+
+/*
+ * Checks the code of a finished module once, so that it can run without the
+ * checks the interpreter makes on every instruction. Opcodes and operands
+ * must decode within the code, constants must lie in the pool and scopes and
+ * function bodies must nest. Every path is followed with the depth of the
+ * value stack, which must be the same wherever paths join. Pops may not reach
+ * below the innermost scope, jumps may not leave it, RETURN must leave an
+ * enclosing scope and variables may only be written above the scopes. Each
+ * function body must push no more values than its FRAME allows.
+ *
+ * The code at 0 is checked for the values sepl_mod_init pushes for env, each
+ * function body for its return scope and parameters. buf must be aligned for
+ * sepl_size and hold sepl_ver_bufsize(mod) bytes. On success the module is
+ * marked as verified until it is compiled or optimized again. Invalid code
+ * fails with SEPL_ERR_BC and the opcode at fault in info.bc, a buffer that is
+ * too small with SEPL_ERR_BOVERFLOW.
+ *
+ * Building with SEPL_UNCHECKED runs only verified modules and leaves out the
+ * stack bounds checks. The types of values are still checked when used.
+ */
+SEPL_LIB SeplError sepl_ver_module(SeplModule *mod, SeplEnv env, void *buf,
+                                   sepl_size size);
 #ifdef __cplusplus
 }
 #endif
@@ -388,44 +776,215 @@ SEPL_LIB char sepl_to_special(char c) {
     return c;
 }
 
+/*
+ * Runs of whitespace, identifier characters and string contents are skipped
+ * by sepl__lex_run. With SEPL_SIMD defined and GCC or clang targeting AVX2
+ * or SSE2 they are scanned 32 or 16 bytes at a time. Loads are aligned so they
+ * never cross into the page after the terminating null.
+ */
+#define SEPL__RUN_SPACE 0
+#define SEPL__RUN_IDEN 1
+#define SEPL__RUN_STR 2
+/* Bytes scanned one at a time before switching to vectors */
+#define SEPL__SHORT 8
+
+#if defined(SEPL_SIMD) && defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define SEPL__VEC 32
+#define SEPL__VALL 0xffffffffu
+typedef __m256i sepl__vec;
+#define sepl__vload(p) _mm256_load_si256((const __m256i *)(p))
+#define sepl__vset(c) _mm256_set1_epi8(c)
+#define sepl__veq(a, b) _mm256_cmpeq_epi8(a, b)
+#define sepl__vgt(a, b) _mm256_cmpgt_epi8(a, b)
+#define sepl__vor(a, b) _mm256_or_si256(a, b)
+#define sepl__vand(a, b) _mm256_and_si256(a, b)
+#define sepl__vmask(v) ((unsigned)_mm256_movemask_epi8(v))
+#elif defined(SEPL_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SEPL__VEC 16
+#define SEPL__VALL 0xffffu
+typedef __m128i sepl__vec;
+#define sepl__vload(p) _mm_load_si128((const __m128i *)(p))
+#define sepl__vset(c) _mm_set1_epi8(c)
+#define sepl__veq(a, b) _mm_cmpeq_epi8(a, b)
+#define sepl__vgt(a, b) _mm_cmpgt_epi8(a, b)
+#define sepl__vor(a, b) _mm_or_si128(a, b)
+#define sepl__vand(a, b) _mm_and_si128(a, b)
+#define sepl__vmask(v) ((unsigned)_mm_movemask_epi8(v))
+#endif
+
+#ifdef SEPL__VEC
+/* Bytes of v in [lo, hi], signed so bytes above 127 never match */
+#define sepl__vin(v, lo, hi)                  \
+    sepl__vand(sepl__vgt(v, sepl__vset((lo)-1)), \
+               sepl__vgt(sepl__vset((hi) + 1), v))
+
+/*
+ * Sets a bit for each byte of the block that ends a run and for each newline
+ * in nl. The aligned loads may read past the terminating null, which the
+ * address sanitizer would report.
+ */
+__attribute__((no_sanitize_address)) SEPL_API unsigned
+sepl__lex_stops(const char *block, int run, unsigned *nl) {
+    sepl__vec v = sepl__vload(block), m;
+
+    switch (run) {
+        case SEPL__RUN_SPACE:
+            *nl = sepl__vmask(sepl__veq(v, sepl__vset('\n')));
+            m = sepl__vor(sepl__vor(sepl__veq(v, sepl__vset(' ')),
+                                    sepl__veq(v, sepl__vset('\n'))),
+                          sepl__vor(sepl__veq(v, sepl__vset('\r')),
+                                    sepl__veq(v, sepl__vset('\t'))));
+            return ~sepl__vmask(m) & SEPL__VALL;
+        case SEPL__RUN_IDEN:
+            m = sepl__vor(sepl__vin(v, '0', '9'),
+                          sepl__vin(sepl__vor(v, sepl__vset(0x20)), 'a', 'z'));
+            m = sepl__vor(m, sepl__veq(v, sepl__vset('_')));
+            return ~sepl__vmask(m) & SEPL__VALL;
+        default:
+            m = sepl__vor(sepl__veq(v, sepl__vset('"')),
+                          sepl__veq(v, sepl__vset('\\')));
+            m = sepl__vor(m, sepl__veq(v, sepl__vset(0)));
+            return sepl__vmask(m);
+    }
+}
+
+/* Returns the end of the run continuing at p, counting newlines in lines */
+__attribute__((noinline, no_sanitize_address)) SEPL_API const char *
+sepl__lex_vrun(const char *p, int run, sepl_size *lines) {
+    sepl_size off = (sepl_size)p & (SEPL__VEC - 1);
+    const char *block = p - off;
+    unsigned nl = 0, stops = sepl__lex_stops(block, run, &nl) >> off;
+
+    while (1) {
+        nl >>= off;
+        if (stops != 0)
+            nl &= (1u << __builtin_ctz(stops)) - 1;
+        for (; nl != 0; nl &= nl - 1) {
+            ++*lines;
+        }
+        if (stops != 0)
+            return block + off + __builtin_ctz(stops);
+        block += SEPL__VEC;
+        off = 0;
+        stops = sepl__lex_stops(block, run, &nl);
+    }
+}
+
+/* Most runs are a few bytes long, vectors are only used past the first few */
+SEPL_API const char *sepl__lex_run(const char *p, int run, sepl_size *lines) {
+    sepl_size n = SEPL__SHORT;
+
+    switch (run) {
+        case SEPL__RUN_SPACE:
+            for (; sepl_is_delim(*p); p++) {
+                if (*p == '\n')
+                    ++*lines;
+                if (--n == 0)
+                    return sepl__lex_vrun(p + 1, run, lines);
+            }
+            return p;
+        case SEPL__RUN_IDEN:
+            for (; sepl_is_identifier(*p); p++) {
+                if (--n == 0)
+                    return sepl__lex_vrun(p + 1, run, lines);
+            }
+            return p;
+        default:
+            for (; *p != '"' && *p != '\\' && *p != '\0'; p++) {
+                if (--n == 0)
+                    return sepl__lex_vrun(p + 1, run, lines);
+            }
+            return p;
+    }
+}
+
+#else
+SEPL_API const char *sepl__lex_run(const char *p, int run, sepl_size *lines) {
+    switch (run) {
+        case SEPL__RUN_SPACE:
+            for (; sepl_is_delim(*p); p++) {
+                if (*p == '\n')
+                    ++*lines;
+            }
+            return p;
+        case SEPL__RUN_IDEN:
+            while (sepl_is_identifier(*p)) {
+                p++;
+            }
+            return p;
+        default:
+            while (*p != '"' && *p != '\\' && *p != '\0') {
+                p++;
+            }
+            return p;
+    }
+}
+#endif
+
 SEPL_API SeplToken sepl__make_tok(SeplLexer *lex, SeplTokenT type) {
     SeplToken tok;
     tok.type = type;
     tok.start = lex->source - 1;
     tok.end = lex->source;
+    tok.line = lex->line;
     return tok;
 }
 
+/* Value of the digit c in base 10 or 16, -1 if it is none */
+SEPL_API int sepl__lex_digit(char c, int base) {
+    if (sepl_is_digit(c))
+        return sepl_to_digit(c);
+    if (base == 16 && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Skips one or more digits separated by single underscores, returns the end
+ * or SEPL_NULL if there are no digits or a separator is misplaced.
+ */
+SEPL_API const char *sepl__lex_digits(const char *c, int base) {
+    if (sepl__lex_digit(*c, base) < 0)
+        return SEPL_NULL;
+    while (1) {
+        c++;
+        if (*c == '_') {
+            if (sepl__lex_digit(*++c, base) < 0)
+                return SEPL_NULL;
+        } else if (sepl__lex_digit(*c, base) < 0) {
+            return c;
+        }
+    }
+}
+
+/* Numbers are 12, 1.5, 1., 1e-9, 2.5E+3, 0x1F and 1_000 */
 SEPL_API SeplToken sepl__make_number(SeplLexer *lex) {
     SeplToken tok;
-    char dot_found = 0;
+    const char *c = lex->source;
 
     tok.type = SEPL_TOK_NUM;
     tok.line = lex->line;
     tok.start = lex->source - 1;
-    tok.end = lex->source;
-
-    while (1) {
-        char c = *lex->source++;
 
-        if (sepl_is_digit(c)) {
-            ++tok.end;
-            continue;
+    if (*tok.start == '0' && (*c == 'x' || *c == 'X')) {
+        c = sepl__lex_digits(c + 1, 16);
+    } else {
+        c = sepl__lex_digits(tok.start, 10);
+        if (c != SEPL_NULL && *c == '.')
+            c = sepl_is_digit(c[1]) ? sepl__lex_digits(c + 1, 10) : c + 1;
+        if (c != SEPL_NULL && (*c == 'e' || *c == 'E')) {
+            c++;
+            if (*c == '+' || *c == '-')
+                c++;
+            c = sepl__lex_digits(c, 10);
         }
-        if (c == '.') {
-            if (dot_found)
-                goto invalid_num;
-            dot_found = 1;
-            ++tok.end;
-            continue;
-        }
-        if (sepl_is_alpha(c))
-            goto invalid_num;
-
-        --lex->source;
-        break;
     }
+    if (c == SEPL_NULL || sepl_is_identifier(*c) || *c == '.')
+        goto invalid_num;
 
+    tok.end = lex->source = c;
     return tok;
 
 invalid_num:
@@ -438,13 +997,16 @@ invalid_num:
 SEPL_API SeplToken sepl__make_string(SeplLexer *lex) {
     SeplToken tok;
     tok.type = SEPL_TOK_STRING;
+    tok.line = lex->line;
     tok.start = lex->source - 1;
     tok.end = lex->source;
 
-    while (*tok.end != '"' && *tok.end != '\0') {
-        if (*tok.end++ == '\\') {
+    while (1) {
+        tok.end = sepl__lex_run(tok.end, SEPL__RUN_STR, &lex->line);
+        if (*tok.end != '\\')
+            break;
+        if (*++tok.end != '\0')
             tok.end++;
-        }
     }
 
     if (*tok.end == '\0') {
@@ -461,12 +1023,11 @@ SEPL_API SeplToken sepl__make_string(SeplLexer *lex) {
 SEPL_API SeplToken sepl__make_identifier(SeplLexer *lex) {
     SeplToken tok;
     tok.type = SEPL_TOK_IDENTIFIER;
+    tok.line = lex->line;
     tok.start = lex->source - 1;
-    tok.end = lex->source;
-
-    while (sepl_is_identifier(*tok.end++));
+    tok.end = sepl__lex_run(lex->source, SEPL__RUN_IDEN, &lex->line);
 
-    lex->source = --tok.end;
+    lex->source = tok.end;
     return tok;
 }
 
@@ -487,16 +1048,13 @@ SEPL_API SeplToken sepl__make_keyword(SeplLexer *lex, const char *keyword,
 }
 
 SEPL_API SeplToken next_token(SeplLexer *lex) {
-    char c = *lex->source++;
+    char c;
+
+    if (sepl_is_delim(*lex->source))
+        lex->source = sepl__lex_run(lex->source, SEPL__RUN_SPACE, &lex->line);
+    c = *lex->source++;
 
     switch (c) {
-        case '\n':
-            ++lex->line;
-            return next_token(lex);
-        case ' ':
-        case '\r':
-        case '\t':
-            return next_token(lex);
         case ';':
             return sepl__make_tok(lex, SEPL_TOK_SEMICOLON);
         case ',':
@@ -616,34 +1174,366 @@ SEPL_LIB SeplLexer sepl_lex_init(const char *source) {
 }
 
 SEPL_LIB SeplToken sepl_lex_next(SeplLexer *lex) {
-    SeplToken tok = next_token(lex);
-    lex->current = tok;
-    return tok;
+    if (lex->count != 0) {
+        lex->current = lex->ahead[lex->head];
+        lex->head = (lex->head + 1) & (SEPL_LEX_AHEAD - 1);
+        lex->count--;
+        return lex->current;
+    }
+    lex->current = next_token(lex);
+    return lex->current;
 }
 
-SEPL_LIB SeplToken sepl_lex_peek(SeplLexer lex) { return next_token(&lex); }
+SEPL_LIB SeplToken sepl_lex_peek(SeplLexer lex) {
+    return sepl_lex_ahead(&lex, 0);
+}
 
-SEPL_LIB double sepl_lex_num(SeplToken tok) {
-    double result = 0.0;
-    sepl_size factor = 10;
+SEPL_LIB SeplToken sepl_lex_ahead(SeplLexer *lex, sepl_size n) {
+    if (n >= SEPL_LEX_AHEAD)
+        n = SEPL_LEX_AHEAD - 1;
+    while (lex->count <= n) {
+        lex->ahead[(lex->head + lex->count) & (SEPL_LEX_AHEAD - 1)] =
+            next_token(lex);
+        lex->count++;
+    }
+    return lex->ahead[(lex->head + n) & (SEPL_LEX_AHEAD - 1)];
+}
+
+/*
+ * Number literals are converted with correct rounding, given doubles are not
+ * evaluated in extended precision. Literals with at most 15 significant digits
+ * and a small exponent are exact in a double and take a single multiplication
+ * or division. Others go through a decimal of up to SEPL__NUM_DIGITS digits
+ * that is shifted by powers of two until the binary exponent is known, then
+ * rounded to 53 bits.
+ */
+#define SEPL__NUM_EXACT 15
+#define SEPL__NUM_DIGITS 800
+#define SEPL__NUM_SHIFT ((int)sizeof(unsigned long) * 8 - 4)
+#define SEPL__NUM_2P52 4503599627370496.0
+
+static const double sepl__num_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* 0.d[0]d[1]...d[nd - 1] * 10^dp, trunc is set if nonzero digits were cut */
+typedef struct {
+    unsigned char d[SEPL__NUM_DIGITS + 1];
+    int nd;
+    int dp;
+    char trunc;
+} SeplLexDecimal;
+
+/* Exponent of the literal at c if any, clamped far outside the double range */
+SEPL_API int sepl__num_exp(const char *c, const char *end) {
+    int e = 0, sign = 1;
+
+    if (c == end)
+        return 0;
+    if (*++c == '-' || *c == '+')
+        sign = *c++ == '-' ? -1 : 1;
+    for (; c != end; c++) {
+        if (*c != '_' && e < 100000)
+            e = e * 10 + sepl_to_digit(*c);
+    }
+    return sign * e;
+}
 
-    for (; tok.start != tok.end;) {
-        char c = *tok.start++;
-        if (c == '.') {
+SEPL_API void sepl__dec_trim(SeplLexDecimal *a) {
+    while (a->nd > 0 && a->d[a->nd - 1] == 0) {
+        a->nd--;
+    }
+    if (a->nd == 0)
+        a->dp = 0;
+}
+
+/* Divides by 2^k, k <= SEPL__NUM_SHIFT */
+SEPL_API void sepl__dec_rshift(SeplLexDecimal *a, int k) {
+    unsigned long n = 0, dig, mask = ((unsigned long)1 << k) - 1;
+    int r = 0, w = 0;
+
+    for (; (n >> k) == 0; r++) {
+        if (r >= a->nd) {
+            if (n == 0) {
+                a->nd = 0;
+                return;
+            }
+            while ((n >> k) == 0) {
+                n *= 10;
+                r++;
+            }
             break;
         }
-        result = result * 10 + sepl_to_digit(c);
+        n = n * 10 + a->d[r];
+    }
+    a->dp -= r - 1;
+
+    for (; r < a->nd; r++) {
+        dig = n >> k;
+        n &= mask;
+        a->d[w++] = (unsigned char)dig;
+        n = n * 10 + a->d[r];
     }
+    while (n > 0) {
+        dig = n >> k;
+        n &= mask;
+        if (w < SEPL__NUM_DIGITS)
+            a->d[w++] = (unsigned char)dig;
+        else if (dig > 0)
+            a->trunc = 1;
+        n *= 10;
+    }
+    a->nd = w;
+    sepl__dec_trim(a);
+}
 
-    for (; tok.start != tok.end;) {
-        char c = *tok.start++;
-        result = result + ((double)sepl_to_digit(c) / factor);
-        factor *= 10;
+/* Multiplies by 2^k, k <= SEPL__NUM_SHIFT */
+SEPL_API void sepl__dec_lshift(SeplLexDecimal *a, int k) {
+    /* At most floor(k * log10(2)) + 1 new digits */
+    int delta = ((k * 1233) >> 12) + 1, r = a->nd, w = a->nd + delta, i;
+    unsigned long n = 0, quo;
+
+    while (r > 0 || n > 0) {
+        if (r > 0)
+            n += (unsigned long)a->d[--r] << k;
+        quo = n / 10;
+        if (--w <= SEPL__NUM_DIGITS)
+            a->d[w] = (unsigned char)(n - quo * 10);
+        else if (n - quo * 10 != 0)
+            a->trunc = 1;
+        n = quo;
     }
 
-    return result;
+    a->nd += delta;
+    a->dp += delta;
+    if (w == 1) {
+        for (i = 1; i <= SEPL__NUM_DIGITS && i < a->nd; i++) {
+            a->d[i - 1] = a->d[i];
+        }
+        a->nd--;
+        a->dp--;
+    }
+    if (a->nd > SEPL__NUM_DIGITS) {
+        if (w == 0 && a->d[SEPL__NUM_DIGITS] != 0)
+            a->trunc = 1;
+        a->nd = SEPL__NUM_DIGITS;
+    }
+    sepl__dec_trim(a);
+}
+
+SEPL_API void sepl__dec_shift(SeplLexDecimal *a, int k) {
+    for (; k > SEPL__NUM_SHIFT; k -= SEPL__NUM_SHIFT) {
+        sepl__dec_lshift(a, SEPL__NUM_SHIFT);
+    }
+    for (; k < -SEPL__NUM_SHIFT; k += SEPL__NUM_SHIFT) {
+        sepl__dec_rshift(a, SEPL__NUM_SHIFT);
+    }
+    if (k > 0)
+        sepl__dec_lshift(a, k);
+    else if (k < 0)
+        sepl__dec_rshift(a, -k);
+}
+
+/* Integer part rounded half to even, the decimal holds at most 54 bits */
+SEPL_API double sepl__dec_round(SeplLexDecimal *a) {
+    double n = 0;
+    char up;
+    int i;
+
+    for (i = 0; i < a->dp && i < a->nd; i++) {
+        n = n * 10 + a->d[i];
+    }
+    for (; i < a->dp; i++) {
+        n *= 10;
+    }
+    if (a->dp < 0 || a->dp >= a->nd)
+        return n;
+    if (a->d[a->dp] == 5 && a->dp + 1 == a->nd)
+        up = a->trunc || (a->dp > 0 && a->d[a->dp - 1] % 2 == 1);
+    else
+        up = a->d[a->dp] >= 5;
+    return up ? n + 1 : n;
+}
+
+/* x * 2^e, exact unless the result overflows */
+SEPL_API double sepl__num_scale(double x, int e) {
+    double p = 1, b = 2;
+    int k = e < 0 ? -e : e;
+
+    /* 2^k is only built for k <= 1000 so that it is finite */
+    for (; k > 1000; k -= 1000) {
+        p = sepl__num_scale(1, 1000);
+        x = e < 0 ? x / p : x * p;
+        p = 1;
+    }
+    for (; k != 0; k >>= 1, b *= b) {
+        if (k & 1)
+            p *= b;
+    }
+    return e < 0 ? x / p : x * p;
+}
+
+SEPL_API double sepl__dec_value(SeplLexDecimal *a) {
+    /* Binary shifts that keep the decimal point in place for dp = 0..8 */
+    static const int powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+    int exp = 0, n;
+    double mant;
+
+    if (a->nd == 0 || a->dp < -330)
+        return 0;
+    if (a->dp > 310)
+        return sepl__num_scale(1, 2048);
+
+    /* Scale to [0.5, 1) */
+    while (a->dp > 0) {
+        n = a->dp >= 9 ? 27 : powtab[a->dp];
+        sepl__dec_shift(a, -n);
+        exp += n;
+    }
+    while (a->dp < 0 || (a->dp == 0 && a->d[0] < 5)) {
+        n = -a->dp >= 9 ? 27 : powtab[-a->dp];
+        sepl__dec_shift(a, n);
+        exp -= n;
+    }
+
+    /* Now in [1, 2) * 2^exp, subnormals keep fewer bits */
+    exp--;
+    if (exp < -1022) {
+        sepl__dec_shift(a, exp + 1022);
+        exp = -1022;
+    }
+    if (exp > 1023)
+        return sepl__num_scale(1, 2048);
+
+    sepl__dec_shift(a, 53);
+    mant = sepl__dec_round(a);
+    if (mant == 2 * SEPL__NUM_2P52) {
+        mant /= 2;
+        if (++exp > 1023)
+            return sepl__num_scale(1, 2048);
+    }
+    return sepl__num_scale(mant, exp - 52);
+}
+
+/* Reads the digits and exponent of a decimal literal into a */
+SEPL_API double sepl__num_slow(const char *c, const char *end) {
+    SeplLexDecimal a;
+    char frac = 0;
+    int d;
+
+    a.nd = a.dp = 0;
+    a.trunc = 0;
+    for (; c != end && *c != 'e' && *c != 'E'; c++) {
+        if (*c == '_')
+            continue;
+        if (*c == '.') {
+            frac = 1;
+            continue;
+        }
+        d = sepl_to_digit(*c);
+        if (a.nd == 0 && d == 0) {
+            a.dp -= frac;
+            continue;
+        }
+        a.dp += !frac;
+        if (a.nd < SEPL__NUM_DIGITS)
+            a.d[a.nd++] = (unsigned char)d;
+        else if (d != 0)
+            a.trunc = 1;
+    }
+    a.dp += sepl__num_exp(c, end);
+    sepl__dec_trim(&a);
+    return sepl__dec_value(&a);
+}
+
+/* Hexadecimal integers are rounded half to even past 53 bits */
+SEPL_API double sepl__num_hex(const char *c, const char *end) {
+    double m = 0;
+    int shift = 0, bit, b, d;
+    char half = 0, sticky = 0, odd = 0;
+
+    for (; c != end; c++) {
+        if (*c == '_')
+            continue;
+        d = sepl__lex_digit(*c, 16);
+        for (b = 3; b >= 0; b--) {
+            bit = (d >> b) & 1;
+            if (m < SEPL__NUM_2P52) {
+                m = m * 2 + bit;
+                odd = (char)bit;
+            } else if (shift++ == 0) {
+                half = (char)bit;
+            } else {
+                sticky |= (char)bit;
+            }
+        }
+    }
+    if (half && (sticky || odd))
+        m += 1;
+    return sepl__num_scale(m, shift);
+}
+
+SEPL_LIB double sepl_lex_num(SeplToken tok) {
+    const char *c = tok.start;
+    double mant = 0;
+    int nd = 0, e = 0, d;
+    char frac = 0;
+
+    if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X'))
+        return sepl__num_hex(c + 2, tok.end);
+
+    for (; c != tok.end && *c != 'e' && *c != 'E'; c++) {
+        if (*c == '_')
+            continue;
+        if (*c == '.') {
+            frac = 1;
+            continue;
+        }
+        d = sepl_to_digit(*c);
+        e -= frac;
+        if (nd == 0 && d == 0)
+            continue;
+        if (++nd > SEPL__NUM_EXACT)
+            return sepl__num_slow(tok.start, tok.end);
+        mant = mant * 10 + d;
+    }
+    e += sepl__num_exp(c, tok.end);
+
+    /* Both operands are exact so the result is rounded once */
+    if (mant == 0)
+        return 0;
+    if (e >= 0 && e <= 22)
+        return mant * sepl__num_pow10[e];
+    if (e < 0 && e >= -22)
+        return mant / sepl__num_pow10[-e];
+    if (e > 22 && e - 22 <= SEPL__NUM_EXACT - nd)
+        return mant * sepl__num_pow10[e - 22] * 1e22;
+    return sepl__num_slow(tok.start, tok.end);
 }
 
+#undef SEPL__NUM_EXACT
+#undef SEPL__NUM_DIGITS
+#undef SEPL__NUM_SHIFT
+#undef SEPL__NUM_2P52
+
+#undef SEPL__RUN_SPACE
+#undef SEPL__RUN_IDEN
+#undef SEPL__RUN_STR
+#undef SEPL__SHORT
+#ifdef SEPL__VEC
+#undef SEPL__VEC
+#undef SEPL__VALL
+#undef sepl__vload
+#undef sepl__vset
+#undef sepl__veq
+#undef sepl__vgt
+#undef sepl__vor
+#undef sepl__vand
+#undef sepl__vmask
+#undef sepl__vin
+#endif
+
+#ifndef SEPL_NANBOX
 const SeplValue SEPL_NONE = {0};
 
 SEPL_LIB SeplValue sepl_val_asref(void *v) {
@@ -699,59 +1589,544 @@ SEPL_LIB SeplValue sepl_val_type(void *vobj, sepl_size custom_id) {
     return r;
 }
 
-SEPL_LIB SeplModule sepl_mod_new(unsigned char bytes[], sepl_size bsize,
-                                 SeplValue values[], sepl_size vsize) {
-    SeplModule mod = {0};
-    mod.bytes = bytes;
-    mod.bsize = bsize;
-    mod.values = values;
-    mod.vsize = vsize;
-    return mod;
+SEPL_LIB SeplValue sepl__val_make(sepl_size type, void *obj) {
+    SeplValue r;
+    r.type = type;
+    r.as.obj = obj;
+    return r;
+}
+#else
+const SeplValue SEPL_NONE = {sepl__nb_head(SEPL_VAL_NONE)};
+
+/* Reinterprets the bits of a double and back */
+typedef union {
+    sepl_u64 bits;
+    double num;
+} SeplNbPun;
+
+SEPL_LIB sepl_size sepl__nb_type(sepl_u64 bits) {
+    sepl_size tag;
+    if (!sepl__nb_isbox(bits))
+        return SEPL_VAL_NUM;
+    tag = (sepl_size)((bits >> 48 & 0xf) | (bits >> 59 & 0x10));
+    return tag - 1 - tag / 8;
 }
 
-SEPL_LIB sepl_size sepl_mod_bc(SeplModule *mod, SeplBC bc, SeplError *e) {
-    if (mod->bpos + 1 > mod->bsize) {
-        sepl_err_new(e, SEPL_ERR_BOVERFLOW);
-        return 0;
-    }
-    mod->bytes[mod->bpos] = bc;
-    return mod->bpos++;
+SEPL_LIB double sepl__nb_num(sepl_u64 bits) {
+    SeplNbPun p;
+    p.bits = bits;
+    return p.num;
 }
 
-SEPL_LIB sepl_size sepl_mod_bcnum(SeplModule *mod, double n, SeplError *e) {
-    if (mod->bpos + sizeof(n) > mod->bsize) {
-        sepl_err_new(e, SEPL_ERR_BOVERFLOW);
-        return 0;
-    }
-    *(double *)(mod->bytes + mod->bpos) = n;
-    mod->bpos += sizeof(n);
-    return mod->bpos - sizeof(n);
+SEPL_API SeplValue sepl__nb_box(sepl_size type, sepl_u64 payload) {
+    SeplValue r;
+    r.bits = sepl__nb_head(type) | (payload & SEPL__NB_PAYLOAD);
+    return r;
 }
 
-SEPL_LIB sepl_size sepl_mod_bcsize(SeplModule *mod, sepl_size s, SeplError *e) {
-    if (mod->bpos + sizeof(s) > mod->bsize) {
-        sepl_err_new(e, SEPL_ERR_BOVERFLOW);
-        return 0;
-    }
-    *(sepl_size *)(mod->bytes + mod->bpos) = s;
-    mod->bpos += sizeof(s);
-    return mod->bpos - sizeof(s);
+SEPL_LIB SeplValue sepl_val_asref(void *v) {
+    return sepl__nb_box(SEPL_VAL_REF, (sepl_uptr)v);
 }
 
-SEPL_LIB sepl_size sepl_mod_val(SeplModule *mod, SeplValue v, SeplError *e) {
-    if (mod->vpos >= mod->vsize) {
-        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
-        return 0;
-    }
+SEPL_LIB SeplValue sepl_val_scope(sepl_size pos) {
+    return sepl__nb_box(SEPL_VAL_SCOPE, pos);
+}
 
-    mod->values[mod->vpos] = v;
-    return mod->vpos++;
+SEPL_LIB SeplValue sepl_val_number(double vnum) {
+    SeplNbPun p;
+    SeplValue r;
+    p.num = vnum;
+    /* Any other NaN could collide with a boxed value */
+    r.bits = vnum != vnum ? SEPL__NB_EXP | (sepl_u64)1 << 51 : p.bits;
+    return r;
 }
 
-SEPL_API void sepl__free(SeplValue _) { (void)_; }
+SEPL_LIB SeplValue sepl_val_str(char *str) {
+    return sepl__nb_box(SEPL_VAL_STR, (sepl_uptr)str);
+}
 
-SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env) {
-    sepl_size i;
+SEPL_LIB SeplValue sepl_val_func(sepl_size pos) {
+    return sepl__nb_box(SEPL_VAL_FUNC, pos);
+}
+
+SEPL_LIB SeplValue sepl_val_cfunc(sepl_c_func cfunc) {
+    return sepl__nb_box(SEPL_VAL_CFUNC, (sepl_uptr)cfunc);
+}
+
+SEPL_LIB SeplValue sepl_val_object(void *vobj) {
+    return sepl_val_type(vobj, 0);
+}
+
+SEPL_LIB SeplValue sepl_val_type(void *vobj, sepl_size custom_id) {
+    return sepl__nb_box(SEPL_VAL_OBJ + custom_id, (sepl_uptr)vobj);
+}
+
+SEPL_LIB SeplValue sepl__val_make(sepl_size type, void *obj) {
+    if (type == SEPL_VAL_NUM)
+        return sepl_val_number(0);
+    return sepl__nb_box(type, (sepl_uptr)obj);
+}
+#endif
+
+SEPL_LIB SeplModule sepl_mod_new(unsigned char bytes[], sepl_size bsize,
+                                 SeplValue values[], sepl_size vsize) {
+    SeplModule mod = {0};
+#ifdef SEPL_ALIGNED
+    /* Align the end of the buffer so pooled numbers are naturally aligned */
+    sepl_size rem = (sepl_size)((unsigned long)(bytes + bsize) % SEPL_KSLOT);
+    bsize = bsize > rem ? bsize - rem : 0;
+#endif
+    mod.bytes = bytes;
+    mod.bsize = bsize;
+    mod.kpos = bsize;
+    mod.values = values;
+    mod.vsize = vsize;
+    return mod;
+}
+
+SEPL_LIB void sepl_mod_setobjmap(SeplModule *mod, unsigned char map[],
+                                 sepl_size size) {
+    sepl_size i;
+    if (size < sepl_mod_mapsize(mod->vsize)) {
+        mod->objmap = SEPL_NULL;
+        return;
+    }
+    for (i = 0; i < sepl_mod_mapsize(mod->vsize); i++) {
+        map[i] = 0;
+    }
+    mod->objmap = map;
+}
+
+/* Records the most the code and the pool take together in a sink */
+SEPL_API void sepl__sinkneed(SeplModule *mod, sepl_size bpos) {
+    sepl_size need = bpos + (mod->bsize - mod->kpos);
+    if (need > mod->sink->need)
+        mod->sink->need = need;
+}
+
+/* Where the next len bytes of code go, a sink slides its window over the
+ * code to keep the latest half of it */
+SEPL_API unsigned char *sepl__bcat(SeplModule *mod, sepl_size len) {
+    SeplSink *sink = mod->sink;
+    sepl_size base, i;
+
+    if (sink == SEPL_NULL)
+        return mod->bytes + mod->bpos;
+
+    sepl__sinkneed(mod, mod->bpos + len);
+    if (mod->bpos < sink->bbase)
+        sink->bbase = mod->bpos;
+    if (mod->bpos + len - sink->bbase > SEPL_SINK_CODE) {
+        base = mod->bpos - SEPL_SINK_CODE / 2;
+        for (i = 0; i < SEPL_SINK_CODE / 2; i++) {
+            sink->bytes[i] = sink->bytes[base - sink->bbase + i];
+        }
+        sink->bbase = base;
+    }
+    return sink->bytes + (mod->bpos - sink->bbase);
+}
+
+/* Slides the pool window of a sink down to the constant just reserved at
+ * kpos, keeping the latest constants above it */
+SEPL_API void sepl__kslide(SeplModule *mod, sepl_size okpos) {
+    SeplSink *sink = mod->sink;
+    sepl_size base, end, pos;
+
+    sepl__sinkneed(mod, mod->bpos);
+    if (mod->kpos - sink->kbase >= SEPL_SINK_CODE &&
+        mod->kpos - sink->kbase < sizeof(sink->bytes))
+        return;
+
+    base = mod->kpos - SEPL_SINK_CODE - SEPL_SINK_POOL / 4;
+    end = base + sizeof(sink->bytes);
+    /* Constants still in the window move up in it, from the far end */
+    for (pos = end; pos-- > okpos;) {
+        if (pos - sink->kbase >= SEPL_SINK_CODE &&
+            pos - sink->kbase < sizeof(sink->bytes))
+            sink->bytes[pos - base] = sink->bytes[pos - sink->kbase];
+    }
+    sink->kbase = base;
+}
+
+SEPL_LIB unsigned char *sepl__baddr(SeplModule *mod, sepl_size pos) {
+    SeplSink *sink = mod->sink;
+    sepl_size at;
+
+    if (sink == SEPL_NULL)
+        return mod->bytes + pos;
+    if (pos < mod->kpos) {
+        at = pos - sink->bbase;
+        return at < SEPL_SINK_CODE ? sink->bytes + at : SEPL_NULL;
+    }
+    at = pos - sink->kbase;
+    return at >= SEPL_SINK_CODE && at < sizeof(sink->bytes) ? sink->bytes + at
+                                                            : SEPL_NULL;
+}
+
+SEPL_LIB sepl_size sepl_mod_bc(SeplModule *mod, SeplBC bc, SeplError *e) {
+    if (mod->bpos + 1 > mod->kpos) {
+        sepl_err_new(e, SEPL_ERR_BOVERFLOW);
+        return 0;
+    }
+    *sepl__bcat(mod, 1) = bc;
+    return mod->bpos++;
+}
+
+SEPL_LIB sepl_size sepl__varlen(sepl_size v) {
+    sepl_size len = 1;
+    while (v >>= 7) len++;
+    return len;
+}
+
+SEPL_LIB sepl_size sepl__rdvar(const unsigned char *bytes, sepl_size *pc) {
+    sepl_size v = 0, shift = 0;
+    unsigned char b;
+    do {
+        b = bytes[(*pc)++];
+        v |= (sepl_size)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+SEPL_API double sepl__lddbl(const unsigned char *p) {
+    union {
+        double d;
+        unsigned char b[sizeof(double)];
+    } u;
+    sepl_size i;
+    for (i = 0; i < sizeof(double); i++) {
+        u.b[i] = p[i];
+    }
+    return u.d;
+}
+
+SEPL_LIB void sepl__wrvar(unsigned char *at, sepl_size v, sepl_size len) {
+    while (--len) {
+        *at++ = (unsigned char)(v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *at = (unsigned char)v;
+}
+
+SEPL_API sepl_size sepl__bcvar(SeplModule *mod, sepl_size v, sepl_size len,
+                               SeplError *e) {
+    if (mod->bpos + len > mod->kpos) {
+        sepl_err_new(e, SEPL_ERR_BOVERFLOW);
+        return 0;
+    }
+    sepl__wrvar(sepl__bcat(mod, len), v, len);
+    mod->bpos += len;
+    return mod->bpos - len;
+}
+
+/* Reserves n bytes in the constant pool and returns the slot index */
+SEPL_API sepl_size sepl__kalloc(SeplModule *mod, sepl_size n, SeplError *e) {
+    sepl_size slots = (n + SEPL_KSLOT - 1) / SEPL_KSLOT;
+    if (mod->kpos < mod->bpos + slots * SEPL_KSLOT) {
+        sepl_err_new(e, SEPL_ERR_BOVERFLOW);
+        return 0;
+    }
+    mod->kpos -= slots * SEPL_KSLOT;
+    if (mod->sink != SEPL_NULL)
+        sepl__kslide(mod, mod->kpos + slots * SEPL_KSLOT);
+    return (mod->bsize - mod->kpos) / SEPL_KSLOT;
+}
+
+SEPL_LIB sepl_size sepl_mod_bcnum(SeplModule *mod, double n, SeplError *e) {
+    const unsigned char *nb = (const unsigned char *)&n;
+    sepl_size k, i, top = (mod->bsize - mod->kpos) / SEPL_KSLOT;
+
+    /* Reuse one of the recently pooled constants */
+    for (k = top; k > 0 && k + 16 > top; k--) {
+        const unsigned char *kb =
+            sepl__baddr(mod, mod->bsize - k * SEPL_KSLOT);
+        if (kb == SEPL_NULL)
+            break;
+        for (i = 0; i < sizeof(n) && kb[i] == nb[i]; i++);
+        if (i == sizeof(n))
+            return sepl_mod_bcsize(mod, k, e);
+    }
+
+    k = sepl__kalloc(mod, sizeof(n), e);
+    if (k == 0)
+        return 0;
+    for (i = 0; i < sizeof(n); i++) {
+        sepl__baddr(mod, mod->kpos)[i] = nb[i];
+    }
+    return sepl_mod_bcsize(mod, k, e);
+}
+
+SEPL_LIB sepl_size sepl_mod_bcstr(SeplModule *mod, sepl_size len,
+                                  SeplError *e) {
+    sepl_size k = sepl__kalloc(mod, len + 1, e);
+    if (k == 0)
+        return 0;
+    sepl_mod_bcsize(mod, k, e);
+    return mod->kpos;
+}
+
+SEPL_LIB sepl_size sepl_mod_bcsize(SeplModule *mod, sepl_size s,
+                                   SeplError *e) {
+    return sepl__bcvar(mod, s, sepl__varlen(s), e);
+}
+
+SEPL_LIB sepl_size sepl_mod_bcaddr(SeplModule *mod, sepl_size a,
+                                   SeplError *e) {
+    return sepl__bcvar(mod, a, sepl__varlen(mod->bsize), e);
+}
+
+SEPL_LIB void sepl_mod_setaddr(SeplModule *mod, sepl_size pos, sepl_size a) {
+    unsigned char *at = sepl__baddr(mod, pos);
+    /* A sink has dropped the code, the width of the address is all it needs */
+    if (at != SEPL_NULL)
+        sepl__wrvar(at, a, sepl__varlen(mod->bsize));
+}
+
+/* Position of the instruction after the one at pc */
+SEPL_LIB sepl_size sepl__bcnext(const unsigned char *bytes, sepl_size pc) {
+    switch (bytes[pc++]) {
+        case SEPL_BC_INT:
+            return pc + 1;
+        case SEPL_BC_FUNC:
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+        case SEPL_BC_CALL_DIRECT:
+        case SEPL_BC_TAILCALL:
+            sepl__rdvar(bytes, &pc);
+            sepl__rdvar(bytes, &pc);
+            return pc;
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_INC:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_INC_NN:
+        case SEPL_BC_ADD_INT_Q:
+        case SEPL_BC_INC_Q:
+            sepl__rdvar(bytes, &pc);
+            return pc + 1;
+        case SEPL_BC_RETURN:
+        case SEPL_BC_JUMPIF:
+        case SEPL_BC_JUMP:
+        case SEPL_BC_CALL:
+        case SEPL_BC_DROP:
+        case SEPL_BC_CONST:
+        case SEPL_BC_STR:
+        case SEPL_BC_SCOPE:
+        case SEPL_BC_GET:
+        case SEPL_BC_SET:
+        case SEPL_BC_GET_UP:
+        case SEPL_BC_SET_UP:
+        case SEPL_BC_JUMP_LT:
+        case SEPL_BC_JUMP_LTE:
+        case SEPL_BC_JUMP_GT:
+        case SEPL_BC_JUMP_GTE:
+        case SEPL_BC_JUMP_EQ:
+        case SEPL_BC_JUMP_NEQ:
+        case SEPL_BC_JUMP_AND:
+        case SEPL_BC_JUMP_OR:
+        case SEPL_BC_JUMP_LT_NN:
+        case SEPL_BC_JUMP_LTE_NN:
+        case SEPL_BC_JUMP_GT_NN:
+        case SEPL_BC_JUMP_GTE_NN:
+        case SEPL_BC_JUMP_EQ_NN:
+        case SEPL_BC_JUMP_NEQ_NN:
+        case SEPL_BC_JUMP_LT_Q:
+        case SEPL_BC_JUMP_LTE_Q:
+        case SEPL_BC_JUMP_GT_Q:
+        case SEPL_BC_JUMP_GTE_Q:
+        case SEPL_BC_JUMP_EQ_Q:
+        case SEPL_BC_JUMP_NEQ_Q:
+        case SEPL_BC_CALL_C:
+        case SEPL_BC_CALL_S:
+        case SEPL_BC_FRAME:
+            sepl__rdvar(bytes, &pc);
+            return pc;
+        default:
+            return pc;
+    }
+}
+
+/*
+ * Values pushed minus values popped by the instruction at pc when execution
+ * falls through it. RETURN is counted as zero, the compiler only emits code
+ * after it that expects the returned value on the stack.
+ */
+SEPL_LIB long sepl__bcstack(const unsigned char *bytes, sepl_size pc) {
+    switch (bytes[pc++]) {
+        case SEPL_BC_NONE:
+        case SEPL_BC_CONST:
+        case SEPL_BC_INT:
+        case SEPL_BC_STR:
+        case SEPL_BC_SCOPE:
+        case SEPL_BC_FUNC:
+        case SEPL_BC_GET:
+        case SEPL_BC_GET_UP:
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_ADD_INT_Q:
+            return 1;
+        case SEPL_BC_CALL:
+        case SEPL_BC_CALL_C:
+        case SEPL_BC_CALL_S:
+        case SEPL_BC_DROP:
+            return -(long)sepl__rdvar(bytes, &pc);
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+            sepl__rdvar(bytes, &pc);
+            return 1 - (long)sepl__rdvar(bytes, &pc);
+        case SEPL_BC_CALL_DIRECT:
+        case SEPL_BC_TAILCALL:
+            sepl__rdvar(bytes, &pc);
+            return -(long)sepl__rdvar(bytes, &pc);
+        case SEPL_BC_JUMPIF:
+        case SEPL_BC_POP:
+        case SEPL_BC_SET:
+        case SEPL_BC_SET_UP:
+        case SEPL_BC_ADD:
+        case SEPL_BC_SUB:
+        case SEPL_BC_MUL:
+        case SEPL_BC_DIV:
+        case SEPL_BC_AND:
+        case SEPL_BC_OR:
+        case SEPL_BC_LT:
+        case SEPL_BC_LTE:
+        case SEPL_BC_GT:
+        case SEPL_BC_GTE:
+        case SEPL_BC_EQ:
+        case SEPL_BC_NEQ:
+        case SEPL_BC_JUMP_AND:
+        case SEPL_BC_JUMP_OR:
+        case SEPL_BC_ADD_NN:
+        case SEPL_BC_SUB_NN:
+        case SEPL_BC_MUL_NN:
+        case SEPL_BC_DIV_NN:
+        case SEPL_BC_LT_NN:
+        case SEPL_BC_LTE_NN:
+        case SEPL_BC_GT_NN:
+        case SEPL_BC_GTE_NN:
+        case SEPL_BC_EQ_NN:
+        case SEPL_BC_NEQ_NN:
+        case SEPL_BC_ADD_Q:
+        case SEPL_BC_SUB_Q:
+        case SEPL_BC_MUL_Q:
+        case SEPL_BC_DIV_Q:
+        case SEPL_BC_LT_Q:
+        case SEPL_BC_LTE_Q:
+        case SEPL_BC_GT_Q:
+        case SEPL_BC_GTE_Q:
+        case SEPL_BC_EQ_Q:
+        case SEPL_BC_NEQ_Q:
+            return -1;
+        case SEPL_BC_JUMP_LT:
+        case SEPL_BC_JUMP_LTE:
+        case SEPL_BC_JUMP_GT:
+        case SEPL_BC_JUMP_GTE:
+        case SEPL_BC_JUMP_EQ:
+        case SEPL_BC_JUMP_NEQ:
+        case SEPL_BC_JUMP_LT_NN:
+        case SEPL_BC_JUMP_LTE_NN:
+        case SEPL_BC_JUMP_GT_NN:
+        case SEPL_BC_JUMP_GTE_NN:
+        case SEPL_BC_JUMP_EQ_NN:
+        case SEPL_BC_JUMP_NEQ_NN:
+        case SEPL_BC_JUMP_LT_Q:
+        case SEPL_BC_JUMP_LTE_Q:
+        case SEPL_BC_JUMP_GT_Q:
+        case SEPL_BC_JUMP_GTE_Q:
+        case SEPL_BC_JUMP_EQ_Q:
+        case SEPL_BC_JUMP_NEQ_Q:
+            return -2;
+        default:
+            return 0;
+    }
+}
+
+/* Generic form of a number only or quickened instruction, with the same
+ * operands */
+SEPL_LIB SeplBC sepl__bcgeneric(SeplBC bc) {
+    if (bc >= SEPL_BC_ADD_Q && bc <= SEPL_BC_INC_Q)
+        bc = (SeplBC)(bc - SEPL_BC_ADD_Q + SEPL_BC_ADD_NN);
+    else if (bc == SEPL_BC_CALL_C || bc == SEPL_BC_CALL_S)
+        return SEPL_BC_CALL;
+    else if (bc == SEPL_BC_GET_CALL_C || bc == SEPL_BC_GET_CALL_S)
+        return SEPL_BC_GET_CALL;
+
+    if (bc >= SEPL_BC_ADD_NN && bc <= SEPL_BC_DIV_NN)
+        return (SeplBC)(bc - SEPL_BC_ADD_NN + SEPL_BC_ADD);
+    else if (bc >= SEPL_BC_LT_NN && bc <= SEPL_BC_NEQ_NN)
+        return (SeplBC)(bc - SEPL_BC_LT_NN + SEPL_BC_LT);
+    else if (bc >= SEPL_BC_JUMP_LT_NN && bc <= SEPL_BC_JUMP_NEQ_NN)
+        return (SeplBC)(bc - SEPL_BC_JUMP_LT_NN + SEPL_BC_JUMP_LT);
+    else if (bc == SEPL_BC_ADD_INT_NN)
+        return SEPL_BC_ADD_INT;
+    else if (bc == SEPL_BC_INC_NN)
+        return SEPL_BC_INC;
+    return bc;
+}
+
+SEPL_LIB sepl_size sepl_mod_val(SeplModule *mod, SeplValue v, SeplError *e) {
+    if (mod->vpos >= mod->vsize) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        return 0;
+    }
+
+    mod->values[mod->vpos] = v;
+    return mod->vpos++;
+}
+
+SEPL_API void sepl__free(SeplValue _) { (void)_; }
+
+/* Marks slot i as holding an object */
+SEPL_API void sepl__mark(SeplModule *mod, sepl_size i) {
+    if (mod->objmap != SEPL_NULL)
+        mod->objmap[i / 8] |= (unsigned char)(1u << (i % 8));
+}
+
+/* Frees the objects in the marked slots of values[from, to) and unmarks them.
+ * An object keep refers to is returned instead, else keep itself */
+SEPL_API SeplValue sepl__objfree(SeplModule *mod, sepl_size from,
+                                 sepl_size to, SeplValue keep, SeplEnv env) {
+    unsigned char *map = mod->objmap;
+    SeplValue *values = mod->values;
+    sepl_size i = from, n = 0;
+
+    while (i < to) {
+        SeplValue v;
+        /* Without a bitmap every slot is looked at */
+        if (map != SEPL_NULL) {
+            if (!(map[i / 8] >> (i % 8))) {
+                i = (i / 8 + 1) * 8;
+                continue;
+            }
+            if (!(map[i / 8] >> (i % 8) & 1)) {
+                i++;
+                continue;
+            }
+            map[i / 8] &= (unsigned char)~(1u << (i % 8));
+        }
+
+        v = values[i];
+        if (sepl_val_isref(keep) &&
+            sepl_val_getobj(keep) == (void *)(values + i)) {
+            keep = v;
+        } else if (sepl_val_isobj(v)) {
+            /* Slots below i are already visited */
+            if (env.free_batch != SEPL_NULL)
+                values[from + n++] = v;
+            else
+                env.free(v);
+        }
+        i++;
+    }
+    if (n != 0)
+        env.free_batch(values + from, n);
+    return keep;
+}
+
+SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env) {
+    sepl_size i;
     mod->vpos = 0;
     e->code = SEPL_ERR_OK;
 
@@ -768,304 +2143,1119 @@ SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env) {
 }
 
 SEPL_LIB void sepl_mod_cleanup(SeplModule *mod, SeplEnv env) {
-    sepl_size i;
-    for (i = mod->vpos; i-- > env.predef_len;) {
-        SeplValue v = mod->values[i];
-        if (sepl_val_isobj(v))
-            env.free(v);
+    if (env.free == SEPL_NULL) {
+        env.free = sepl__free;
     }
+    if (mod->vpos > env.predef_len)
+        sepl__objfree(mod, env.predef_len, mod->vpos, SEPL_NONE, env);
 }
 
 SEPL_API double sepl__todbl(SeplError *err, SeplValue v) {
     if (sepl_val_isnum(v)) {
-        return v.as.num;
+        return sepl_val_getnum(v);
     } else if (sepl_val_isref(v)) {
-        return sepl__todbl(err, *(SeplValue *)v.as.obj);
+        return sepl__todbl(err, *(SeplValue *)sepl_val_getobj(v));
     }
     sepl_err_new(err, SEPL_ERR_OPER);
     return 0.0;
 }
 
-SEPL_LIB SeplValue sepl_mod_step(SeplModule *mod, SeplError *e, SeplEnv env) {
-#define sepl__rddbl()           \
-    (mod->pc += sizeof(double), \
-     *(double *)(mod->bytes + mod->pc - sizeof(double)))
-#define sepl__rdsz()               \
-    (mod->pc += sizeof(sepl_size), \
-     *(sepl_size *)(mod->bytes + mod->pc - sizeof(sepl_size)))
-
-#define sepl__pushv(val) (sepl_mod_val(mod, val, e))
-#define sepl__popv()                \
-    (mod->vpos > env.predef_len     \
-         ? mod->values[--mod->vpos] \
-         : (sepl_err_new(e, SEPL_ERR_VUNDERFLOW), SEPL_NONE))
-#define sepl__peekv(offset) (mod->values[mod->vpos - offset - 1])
-#define sepl__popd()                                 \
-    (sepl_val_isobj(sepl__peekv(0))                  \
-         ? (env.free(sepl__popv()), sepl__peekv(-1)) \
-         : sepl__popv())
-
-#define sepl__unaryop(op)                   \
+/*
+ * Threaded execution engine
+ *
+ * pc and the value stack top are kept in locals and only written back to the
+ * module when the engine stops. With GNU C the handlers dispatch through a
+ * table of label addresses, otherwise a plain switch is used. The engine stops
+ * once pc reaches end after running at least one instruction.
+ *
+ * Built with SEPL_UNCHECKED it only runs modules checked by sepl_ver_module
+ * and leaves out the bounds checks of the value stack, which the verifier
+ * has done once for every path.
+ */
+
+#if defined(__GNUC__) && !defined(SEPL_NO_THREADED)
+#define SEPL__THREADED
+#endif
+
+#ifdef SEPL__THREADED
+#define sepl__op(bc) sepl__lbl_##bc
+#define sepl__next()                 \
+    do {                             \
+        if (pc >= end)               \
+            goto halt;               \
+        goto *dispatch[bytes[pc++]]; \
+    } while (0)
+#else
+#define sepl__op(bc) case bc
+#define sepl__next() break
+#endif
+
+SEPL_API SeplValue sepl__exec(SeplModule *mod, SeplError *e, SeplEnv env,
+                              sepl_size end) {
+#ifdef SEPL__THREADED
+    static void *dispatch[256] = {
+        /* Must follow the order of SeplBC */
+        &&sepl__op(SEPL_BC_RETURN),
+        &&sepl__op(SEPL_BC_JUMPIF),
+        &&sepl__op(SEPL_BC_JUMP),
+        &&sepl__op(SEPL_BC_CALL),
+        &&sepl__op(SEPL_BC_POP),
+        &&sepl__op(SEPL_BC_DROP),
+        &&sepl__op(SEPL_BC_NONE),
+        &&sepl__op(SEPL_BC_CONST),
+        &&sepl__op(SEPL_BC_INT),
+        &&sepl__op(SEPL_BC_STR),
+        &&sepl__op(SEPL_BC_SCOPE),
+        &&sepl__op(SEPL_BC_FUNC),
+        &&sepl__op(SEPL_BC_GET),
+        &&sepl__op(SEPL_BC_SET),
+        &&sepl__op(SEPL_BC_GET_UP),
+        &&sepl__op(SEPL_BC_SET_UP),
+        &&sepl__op(SEPL_BC_NEG),
+        &&sepl__op(SEPL_BC_ADD),
+        &&sepl__op(SEPL_BC_SUB),
+        &&sepl__op(SEPL_BC_MUL),
+        &&sepl__op(SEPL_BC_DIV),
+        &&sepl__op(SEPL_BC_NOT),
+        &&sepl__op(SEPL_BC_AND),
+        &&sepl__op(SEPL_BC_OR),
+        &&sepl__op(SEPL_BC_LT),
+        &&sepl__op(SEPL_BC_LTE),
+        &&sepl__op(SEPL_BC_GT),
+        &&sepl__op(SEPL_BC_GTE),
+        &&sepl__op(SEPL_BC_EQ),
+        &&sepl__op(SEPL_BC_NEQ),
+        &&sepl__op(SEPL_BC_JUMP_LT),
+        &&sepl__op(SEPL_BC_JUMP_LTE),
+        &&sepl__op(SEPL_BC_JUMP_GT),
+        &&sepl__op(SEPL_BC_JUMP_GTE),
+        &&sepl__op(SEPL_BC_JUMP_EQ),
+        &&sepl__op(SEPL_BC_JUMP_NEQ),
+        &&sepl__op(SEPL_BC_JUMP_AND),
+        &&sepl__op(SEPL_BC_JUMP_OR),
+        &&sepl__op(SEPL_BC_ADD_INT),
+        &&sepl__op(SEPL_BC_INC),
+        &&sepl__op(SEPL_BC_GET_CALL),
+        &&sepl__op(SEPL_BC_ADD_NN),
+        &&sepl__op(SEPL_BC_SUB_NN),
+        &&sepl__op(SEPL_BC_MUL_NN),
+        &&sepl__op(SEPL_BC_DIV_NN),
+        &&sepl__op(SEPL_BC_LT_NN),
+        &&sepl__op(SEPL_BC_LTE_NN),
+        &&sepl__op(SEPL_BC_GT_NN),
+        &&sepl__op(SEPL_BC_GTE_NN),
+        &&sepl__op(SEPL_BC_EQ_NN),
+        &&sepl__op(SEPL_BC_NEQ_NN),
+        &&sepl__op(SEPL_BC_JUMP_LT_NN),
+        &&sepl__op(SEPL_BC_JUMP_LTE_NN),
+        &&sepl__op(SEPL_BC_JUMP_GT_NN),
+        &&sepl__op(SEPL_BC_JUMP_GTE_NN),
+        &&sepl__op(SEPL_BC_JUMP_EQ_NN),
+        &&sepl__op(SEPL_BC_JUMP_NEQ_NN),
+        &&sepl__op(SEPL_BC_ADD_INT_NN),
+        &&sepl__op(SEPL_BC_INC_NN),
+        &&sepl__op(SEPL_BC_ADD_Q),
+        &&sepl__op(SEPL_BC_SUB_Q),
+        &&sepl__op(SEPL_BC_MUL_Q),
+        &&sepl__op(SEPL_BC_DIV_Q),
+        &&sepl__op(SEPL_BC_LT_Q),
+        &&sepl__op(SEPL_BC_LTE_Q),
+        &&sepl__op(SEPL_BC_GT_Q),
+        &&sepl__op(SEPL_BC_GTE_Q),
+        &&sepl__op(SEPL_BC_EQ_Q),
+        &&sepl__op(SEPL_BC_NEQ_Q),
+        &&sepl__op(SEPL_BC_JUMP_LT_Q),
+        &&sepl__op(SEPL_BC_JUMP_LTE_Q),
+        &&sepl__op(SEPL_BC_JUMP_GT_Q),
+        &&sepl__op(SEPL_BC_JUMP_GTE_Q),
+        &&sepl__op(SEPL_BC_JUMP_EQ_Q),
+        &&sepl__op(SEPL_BC_JUMP_NEQ_Q),
+        &&sepl__op(SEPL_BC_ADD_INT_Q),
+        &&sepl__op(SEPL_BC_INC_Q),
+        &&sepl__op(SEPL_BC_CALL_C),
+        &&sepl__op(SEPL_BC_CALL_S),
+        &&sepl__op(SEPL_BC_GET_CALL_C),
+        &&sepl__op(SEPL_BC_GET_CALL_S),
+        &&sepl__op(SEPL_BC_CALL_DIRECT),
+        &&sepl__op(SEPL_BC_TAILCALL),
+        &&sepl__op(SEPL_BC_FRAME),
+        [SEPL_BC_FRAME + 1 ... 255] = &&bad_bc};
+#endif
+    unsigned char *bytes = mod->bytes;
+    unsigned char *pool = mod->bytes + mod->bsize;
+    SeplValue *values = mod->values;
+    sepl_size pc = mod->pc;
+    sepl_size vp = mod->vpos;
+    sepl_size vsize = mod->vsize;
+    sepl_size base = env.predef_len;
+    unsigned char *map = mod->objmap;
+    /* No slot at or above objs was marked since this call started, scopes
+     * above it are left without looking at the bitmap */
+    sepl_size objs = vp;
+    SeplValue retv = SEPL_NONE;
+    sepl_size at, argc;
+    SeplBC bc;
+
+#define sepl__xrdsz(dst)                                     \
+    do {                                                     \
+        dst = bytes[pc++];                                   \
+        if (dst & 0x80) {                                    \
+            sepl_size s_ = 14;                               \
+            unsigned char b_ = bytes[pc++];                  \
+            dst = (dst & 0x7F) | (sepl_size)(b_ & 0x7F) << 7; \
+            while (b_ & 0x80) {                              \
+                b_ = bytes[pc++];                            \
+                dst |= (sepl_size)(b_ & 0x7F) << s_;         \
+                s_ += 7;                                     \
+            }                                                \
+        }                                                    \
+    } while (0)
+#define sepl__xconst(k) (pool - (k) * SEPL_KSLOT)
+#ifdef SEPL_ALIGNED
+#define sepl__xnum(k) (*(double *)sepl__xconst(k))
+#else
+#define sepl__xnum(k) sepl__lddbl(sepl__xconst(k))
+#endif
+
+#ifndef SEPL_UNCHECKED
+#define sepl__xpush(val)                         \
+    do {                                         \
+        if (vp >= vsize) {                       \
+            sepl_err_new(e, SEPL_ERR_VOVERFLOW); \
+            goto fail;                           \
+        }                                        \
+        values[vp++] = (val);                    \
+    } while (0)
+#define sepl__xpop(dst)                           \
+    do {                                          \
+        if (vp <= base) {                         \
+            sepl_err_new(e, SEPL_ERR_VUNDERFLOW); \
+            goto fail;                            \
+        }                                         \
+        dst = values[--vp];                       \
+    } while (0)
+#else
+#define sepl__xpush(val) (values[vp++] = (val))
+#define sepl__xpop(dst) (dst = values[--vp])
+#endif
+#define sepl__xpeek(offset) (values[vp - (offset) - 1])
+#define sepl__xmark(i)                                        \
+    do {                                                      \
+        if (map != SEPL_NULL)                                 \
+            map[(i) / 8] |= (unsigned char)(1u << ((i) % 8)); \
+        if ((i) >= objs)                                      \
+            objs = (i) + 1;                                   \
+    } while (0)
+/* Frees the objects of values[from, to), no slot above from is live after.
+ * retv is set to the object keep refers to among them, else to keep */
+#define sepl__xunwind(from, to, keep)                             \
+    do {                                                          \
+        if ((from) < objs) {                                      \
+            retv = sepl__objfree(mod, (from), (to), (keep), env); \
+            objs = (from);                                        \
+        }                                                         \
+    } while (0)
+#ifndef SEPL_NANBOX
+#define sepl__xtrue(val) (sepl_val_getnum(val) != 0)
+#else
+/* Other values test their payload, as the unboxed union bits would */
+#define sepl__xtrue(val)                                      \
+    (sepl_val_isnum(val) ? sepl_val_getnum(val) != 0          \
+                         : sepl_val_getpos(val) != 0)
+#endif
+#define sepl__xpopd()           \
+    do {                        \
+        SeplValue d_;           \
+        sepl__xpop(d_);         \
+        if (sepl_val_isobj(d_)) \
+            env.free(d_);       \
+    } while (0)
+
+#define sepl__xunary(op)                    \
     do {                                    \
-        SeplValue v = sepl__popv();         \
-        double d = sepl__todbl(e, v);       \
+        SeplValue v;                        \
+        double d;                           \
+        sepl__xpop(v);                      \
+        d = sepl__todbl(e, v);              \
         if (e->code)                        \
-            break;                          \
-        sepl__pushv(sepl_val_number(op d)); \
+            goto fail;                      \
+        sepl__xpush(sepl_val_number(op d)); \
     } while (0)
-#define sepl__binaryop(op)                                       \
-    do {                                                         \
-        SeplValue v2 = sepl__popv(), v1 = sepl__popv();          \
-        double d1 = sepl__todbl(e, v1), d2 = sepl__todbl(e, v2); \
-        if (e->code)                                             \
-            break;                                               \
-        sepl__pushv(sepl_val_number(d1 op d2));                  \
+#ifdef SEPL_QUICKEN
+/* Specializes the instruction at pos to bc when cond holds, code shared by
+ * contexts is left as is */
+#define sepl__xquicken(cond, pos, bc)         \
+    do {                                      \
+        if ((cond) && !mod->shared)           \
+            bytes[pos] = (unsigned char)(bc); \
+    } while (0)
+#else
+#define sepl__xquicken(cond, pos, bc) ((void)0)
+#endif
+/* Rewrites the quickened instruction at pos to its generic form and runs
+ * that instead */
+#define sepl__xdeopt(pos)                                              \
+    do {                                                               \
+        pc = (pos);                                                    \
+        bytes[pc] = (unsigned char)sepl__bcgeneric((SeplBC)bytes[pc]); \
+        goto redo;                                                     \
+    } while (0)
+#define sepl__xnn(v1, v2) (sepl_val_isnum(v1) && sepl_val_isnum(v2))
+
+#define sepl__xbinary(op, q)                          \
+    do {                                              \
+        SeplValue v1, v2;                             \
+        double d1, d2;                                \
+        sepl__xpop(v2);                               \
+        sepl__xpop(v1);                               \
+        d1 = sepl__todbl(e, v1);                      \
+        d2 = sepl__todbl(e, v2);                      \
+        if (e->code)                                  \
+            goto fail;                                \
+        sepl__xquicken(sepl__xnn(v1, v2), pc - 1, q); \
+        sepl__xpush(sepl_val_number(d1 op d2));       \
+    } while (0)
+/* Compare and jump if false, a binary op followed by JUMPIF */
+#define sepl__xcmpjump(op, q)                     \
+    do {                                          \
+        SeplValue v1, v2;                         \
+        double d1, d2;                            \
+        sepl_size jump;                           \
+        at = pc - 1;                              \
+        sepl__xrdsz(jump);                        \
+        sepl__xpop(v2);                           \
+        sepl__xpop(v1);                           \
+        d1 = sepl__todbl(e, v1);                  \
+        d2 = sepl__todbl(e, v2);                  \
+        if (e->code)                              \
+            goto fail;                            \
+        sepl__xquicken(sepl__xnn(v1, v2), at, q); \
+        if (!(d1 op d2))                          \
+            pc = jump;                            \
+    } while (0)
+/* Unchecked forms of the above for operands known to be numbers */
+#ifndef SEPL_UNCHECKED
+#define sepl__xcheck(n)                           \
+    do {                                          \
+        if (vp < base + (n)) {                    \
+            sepl_err_new(e, SEPL_ERR_VUNDERFLOW); \
+            goto fail;                            \
+        }                                         \
+    } while (0)
+#else
+#define sepl__xcheck(n) ((void)0)
+#endif
+#define sepl__xbinarynn(op)                         \
+    do {                                            \
+        double d1, d2;                              \
+        sepl__xcheck(2);                            \
+        d1 = sepl_val_getnum(values[vp - 2]);       \
+        d2 = sepl_val_getnum(values[--vp]);         \
+        values[vp - 1] = sepl_val_number(d1 op d2); \
+    } while (0)
+#define sepl__xcmpjumpnn(op)                  \
+    do {                                      \
+        double d1, d2;                        \
+        sepl_size jump;                       \
+        sepl__xrdsz(jump);                    \
+        sepl__xcheck(2);                      \
+        d1 = sepl_val_getnum(values[vp - 2]); \
+        d2 = sepl_val_getnum(values[vp - 1]); \
+        vp -= 2;                              \
+        if (!(d1 op d2))                      \
+            pc = jump;                        \
+    } while (0)
+/* Quickened forms, checking for numbers without following references */
+#define sepl__xbinaryq(op)                                               \
+    do {                                                                 \
+        SeplValue v1, v2;                                                \
+        sepl__xcheck(2);                                                 \
+        v1 = values[vp - 2];                                             \
+        v2 = values[vp - 1];                                             \
+        if (!sepl__xnn(v1, v2))                                          \
+            sepl__xdeopt(pc - 1);                                        \
+        vp--;                                                            \
+        values[vp - 1] =                                                 \
+            sepl_val_number(sepl_val_getnum(v1) op sepl_val_getnum(v2)); \
+    } while (0)
+#define sepl__xcmpjumpq(op)                                \
+    do {                                                   \
+        SeplValue v1, v2;                                  \
+        sepl_size jump;                                    \
+        at = pc - 1;                                       \
+        sepl__xcheck(2);                                   \
+        v1 = values[vp - 2];                               \
+        v2 = values[vp - 1];                               \
+        if (!sepl__xnn(v1, v2))                            \
+            sepl__xdeopt(at);                              \
+        sepl__xrdsz(jump);                                 \
+        vp -= 2;                                           \
+        if (!(sepl_val_getnum(v1) op sepl_val_getnum(v2))) \
+            pc = jump;                                     \
     } while (0)
 
-    SeplBC bc = (SeplBC)mod->bytes[mod->pc++];
+    if (env.free == SEPL_NULL) {
+        env.free = sepl__free;
+    }
 
-    switch (bc) {
-        case SEPL_BC_RETURN: {
-            SeplValue retv, v;
-            e->code = SEPL_ERR_OK;
-            if (mod->vpos <= env.predef_len)
-                return SEPL_NONE;
+#ifdef SEPL_UNCHECKED
+    /* The top level code was verified for the values sepl_mod_init pushes,
+     * the room it needs is checked once here */
+    if (mod->verified == 0 || (pc == 0 && vp != base + mod->esize)) {
+        sepl_err_new(e, SEPL_ERR_BC);
+        e->info.bc = (char)bytes[pc];
+        goto fail;
+    }
+    if (pc == 0 && mod->verified - 1 > vsize - vp) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        goto fail;
+    }
+#endif
 
-            retv = sepl__popv();
+#ifdef SEPL__THREADED
+    /* The first instruction always runs, sepl_mod_step passes end = 0 */
+redo:
+    goto *dispatch[bytes[pc++]];
+#else
+    for (;;) {
+    redo:
+        bc = (SeplBC)bytes[pc++];
+        switch (bc) {
+#endif
+        sepl__op(SEPL_BC_RETURN): {
+            sepl_size n, scope;
+            e->code = SEPL_ERR_OK;
+            sepl__xrdsz(n);
+            if (vp <= base)
+                sepl__next();
+#ifndef SEPL_UNCHECKED
+            if (vp - base <= n) {
+                sepl_err_new(e, SEPL_ERR_VUNDERFLOW);
+                goto fail;
+            }
+#endif
 
+            retv = values[vp - 1];
             if (sepl_val_isfun(retv)) {
                 sepl_err_new(e, SEPL_ERR_FUNC_RET);
-                return SEPL_NONE;
+                goto fail;
             }
 
-            /* Pop all values until scope block end */
-            while (1) {
-                v = sepl__popv();
-
-                /* Prevent the return ref object from being freed */
-                if (sepl_val_isref(retv) &&
-                    retv.as.obj == (mod->values + mod->vpos)) {
-                    retv = v; /* Deference */
-                    continue;
-                } else if (sepl_val_isobj(v)) {
-                    env.free(v);
-                } else if (sepl_val_isscp(v)) {
-                    break;
-                }
+            /* The scope of the block ends n values below the returned one */
+            scope = vp - n - 1;
+            if (!sepl_val_isscp(values[scope])) {
+                sepl_err_new(e, SEPL_ERR_BC);
+                goto fail;
             }
+            sepl__xunwind(scope + 1, vp - 1, retv);
+            vp = scope;
 
-            if (v.as.pos >= mod->bpos) {
-                mod->pc = mod->bpos;
-                return retv;
+            if (sepl_val_getpos(values[scope]) >= mod->bpos) {
+                pc = mod->bpos;
+                goto done;
             }
 
-            sepl__pushv(retv);
-            mod->pc = v.as.pos;
-            break;
+            pc = sepl_val_getpos(values[scope]);
+            values[vp++] = retv;
+            if (sepl_val_isobj(retv))
+                sepl__xmark(scope);
+            sepl__next();
         }
-        case SEPL_BC_JUMP: {
-            sepl_size jump = sepl__rdsz();
-            mod->pc = jump;
-            break;
+        sepl__op(SEPL_BC_JUMP): {
+            sepl_size jump;
+            sepl__xrdsz(jump);
+            pc = jump;
+            sepl__next();
         }
-        case SEPL_BC_JUMPIF: {
-            sepl_size jump = sepl__rdsz();
-            SeplValue cond = sepl__peekv(0);
-            if (!cond.as.num) {
-                mod->pc = jump;
+        sepl__op(SEPL_BC_JUMPIF): {
+            sepl_size jump;
+            sepl__xrdsz(jump);
+            if (!sepl__xtrue(sepl__xpeek(0))) {
+                pc = jump;
             }
-            sepl__popd();
-            break;
+            sepl__xpopd();
+            sepl__next();
         }
 
-        case SEPL_BC_CALL: {
-            sepl_size offset = sepl__rdsz();
-            SeplValue v = mod->values[mod->vpos - offset - 1];
+        sepl__op(SEPL_BC_CALL): {
+            at = pc - 1;
+            sepl__xrdsz(argc);
+        }
+        /* Calls the value below the argc arguments, the call instruction
+         * starts at at */
+        call: {
+            SeplValue v = values[vp - argc - 1];
 
             if (sepl_val_iscfun(v)) {
-                SeplArgs args;
-                SeplValue result;
-                args.values = mod->values + mod->vpos - offset;
-                args.size = offset;
-                result = v.as.cfunc(args, e);
-
-                /* Pop arguments */
-                while (offset--) sepl__popd();
-                mod->vpos--; /* Pop function variable */
-                sepl__pushv(result);
+                sepl__xquicken(1, at,
+                               bytes[at] == SEPL_BC_CALL ? SEPL_BC_CALL_C
+                                                         : SEPL_BC_GET_CALL_C);
+                goto callc;
             } else if (sepl_val_isfun(v)) {
-                sepl_size param_c;
-                mod->values[mod->vpos - offset - 1] = sepl_val_scope(mod->pc);
-                mod->pc = v.as.pos;
-                param_c = sepl__rdsz();
-
-                if (param_c < offset) {
-                    while (param_c++ != offset) sepl__popd();
-                } else if (param_c > offset) {
-                    while (param_c-- != offset) sepl__pushv(SEPL_NONE);
+                sepl__xquicken(1, at,
+                               bytes[at] == SEPL_BC_CALL ? SEPL_BC_CALL_S
+                                                         : SEPL_BC_GET_CALL_S);
+                goto calls;
+            }
+            sepl_err_new(e, SEPL_ERR_FUNC_CALL);
+            goto fail;
+        }
+        sepl__op(SEPL_BC_CALL_C): {
+            at = pc - 1;
+            sepl__xrdsz(argc);
+            if (!sepl_val_iscfun(values[vp - argc - 1]))
+                sepl__xdeopt(at);
+        }
+        callc: {
+            SeplArgs args;
+            SeplValue result;
+            args.values = values + vp - argc;
+            args.size = argc;
+            args.mod = mod;
+            args.env = &env;
+            /* Calls back into the module start above the arguments */
+            mod->vpos = vp;
+            result = sepl_val_getcfunc(values[vp - argc - 1])(args, e);
+            /* Functions called back into may have stored objects in the
+             * slots below, as SET_UP does */
+            if (objs < vp)
+                objs = vp;
+
+            /* Pop arguments */
+            while (argc--) sepl__xpopd();
+            vp--; /* Pop function variable */
+            sepl__xpush(result);
+            if (sepl_val_isobj(result))
+                sepl__xmark(vp - 1);
+            if (e->code)
+                goto fail;
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_CALL_S): {
+            at = pc - 1;
+            sepl__xrdsz(argc);
+            if (!sepl_val_isfun(values[vp - argc - 1]))
+                sepl__xdeopt(at);
+        }
+        calls: {
+            sepl_size to = sepl_val_getpos(values[vp - argc - 1]);
+            values[vp - argc - 1] = sepl_val_scope(pc);
+            pc = to;
+        }
+        /* Matches the argc arguments to the parameters at pc */
+        enter: {
+            sepl_size param_c;
+            sepl__xrdsz(param_c);
+
+            if (param_c < argc) {
+                while (param_c++ != argc) sepl__xpopd();
+            } else if (param_c > argc) {
+#ifdef SEPL_UNCHECKED
+                /* FRAME only checks the room of the body */
+                if (param_c - argc > vsize - vp) {
+                    sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+                    goto fail;
                 }
-
-            } else {
-                sepl_err_new(e, SEPL_ERR_FUNC_CALL);
-                return SEPL_NONE;
+#endif
+                while (param_c-- != argc) sepl__xpush(SEPL_NONE);
             }
-            break;
+            sepl__next();
         }
-        case SEPL_BC_POP: {
-            sepl__popd();
-            break;
+        sepl__op(SEPL_BC_POP): {
+            sepl__xpopd();
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DROP): {
+            sepl_size n;
+            sepl__xrdsz(n);
+#ifndef SEPL_UNCHECKED
+            if (vp - base < n) {
+                sepl_err_new(e, SEPL_ERR_VUNDERFLOW);
+                goto fail;
+            }
+#endif
+            sepl__xunwind(vp - n, vp, SEPL_NONE);
+            vp -= n;
+            sepl__next();
         }
 
-        case SEPL_BC_SET: {
-            sepl_size i = sepl__rdsz();
-            SeplValue peek = sepl__peekv(0);
-            sepl_size offset = mod->vpos - i;
+        sepl__op(SEPL_BC_SET): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + vp - i;
 
             /* Reference is assign to another variable */
-            if (sepl_val_isref(peek)) {
+            if (sepl_val_isref(sepl__xpeek(0))) {
                 sepl_err_new(e, SEPL_ERR_REFMOVE);
-                break;
+                goto fail;
             }
-            if (sepl_val_isobj(mod->values[offset]))
-                env.free(mod->values[offset]);
-            mod->values[offset] = sepl__popv();
-            break;
+            if (sepl_val_isobj(*slot))
+                env.free(*slot);
+            if (sepl_val_isobj(sepl__xpeek(0)))
+                sepl__xmark((sepl_size)(slot - values));
+            sepl__xpop(*slot);
+            sepl__next();
         }
-        case SEPL_BC_GET: {
-            sepl_size i = sepl__rdsz();
-            sepl_size offset = mod->vpos - i;
-            SeplValue v = mod->values[offset];
-
-            if (sepl_val_isobj(v)) {
-                sepl__pushv(sepl_val_asref(&mod->values[offset]));
-                break;
+        sepl__op(SEPL_BC_GET): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + vp - i;
+
+            if (sepl_val_isobj(*slot)) {
+                sepl__xpush(sepl_val_asref(slot));
+                sepl__next();
             }
-            sepl__pushv(v);
-            break;
+            sepl__xpush(*slot);
+            sepl__next();
         }
 
-        case SEPL_BC_SET_UP: {
-            sepl_size offset = sepl__rdsz();
-            SeplValue peek = sepl__peekv(0);
+        sepl__op(SEPL_BC_SET_UP): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + i;
 
             /* Reference is assign to another variable */
-            if (sepl_val_isref(peek)) {
+            if (sepl_val_isref(sepl__xpeek(0))) {
                 sepl_err_new(e, SEPL_ERR_REFMOVE);
-                break;
+                goto fail;
             }
-            if (sepl_val_isobj(mod->values[offset]))
-                env.free(mod->values[offset]);
-            mod->values[offset] = sepl__popv();
-            break;
+#ifdef SEPL_UNCHECKED
+            /* A function kept past its scope may find a scope at i, which
+             * the verifier cannot see. Copying one there would make a
+             * RETURN jump with another depth */
+            if (sepl_val_isscp(sepl__xpeek(0))) {
+                sepl_err_new(e, SEPL_ERR_BC);
+                e->info.bc = SEPL_BC_SET_UP;
+                goto fail;
+            }
+#endif
+            if (sepl_val_isobj(*slot))
+                env.free(*slot);
+            if (sepl_val_isobj(sepl__xpeek(0)))
+                sepl__xmark((sepl_size)(slot - values));
+            sepl__xpop(*slot);
+            sepl__next();
         }
-        case SEPL_BC_GET_UP: {
-            sepl_size offset = sepl__rdsz();
-            SeplValue v = mod->values[offset];
-
-            if (sepl_val_isobj(v)) {
-                sepl__pushv(sepl_val_asref(&mod->values[offset]));
-                break;
+        sepl__op(SEPL_BC_GET_UP): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + i;
+
+            if (sepl_val_isobj(*slot)) {
+                sepl__xpush(sepl_val_asref(slot));
+                sepl__next();
             }
-            sepl__pushv(v);
-            break;
+            sepl__xpush(*slot);
+            sepl__next();
         }
 
-        case SEPL_BC_NONE: {
-            sepl__pushv(SEPL_NONE);
-            break;
+        sepl__op(SEPL_BC_NONE): {
+            sepl__xpush(SEPL_NONE);
+            sepl__next();
         }
-        case SEPL_BC_CONST: {
-            double v = sepl__rddbl();
-            sepl__pushv(sepl_val_number(v));
-            break;
+        sepl__op(SEPL_BC_CONST): {
+            sepl_size k;
+            sepl__xrdsz(k);
+            sepl__xpush(sepl_val_number(sepl__xnum(k)));
+            sepl__next();
         }
-        case SEPL_BC_STR: {
-            sepl_size len = sepl__rdsz();
-            sepl__pushv(sepl_val_str((char *)(mod->bytes + mod->pc)));
-            mod->pc += len + 1;
-            break;
+        sepl__op(SEPL_BC_INT): {
+            int i = bytes[pc++];
+            sepl__xpush(sepl_val_number(i - ((i & 0x80) << 1)));
+            sepl__next();
         }
-        case SEPL_BC_SCOPE: {
-            sepl_size end_pos = sepl__rdsz();
-            sepl__pushv(sepl_val_scope(end_pos));
-            break;
+        sepl__op(SEPL_BC_STR): {
+            sepl_size k;
+            sepl__xrdsz(k);
+            sepl__xpush(sepl_val_str((char *)sepl__xconst(k)));
+            sepl__next();
         }
-        case SEPL_BC_FUNC: {
-            sepl_size skip_pos = sepl__rdsz();
-            sepl__pushv(sepl_val_func(mod->pc));
-            mod->pc = skip_pos;
-            break;
+        sepl__op(SEPL_BC_SCOPE): {
+            sepl_size end_pos;
+            sepl__xrdsz(end_pos);
+            sepl__xpush(sepl_val_scope(end_pos));
+            sepl__next();
         }
-
-        case SEPL_BC_NEG: {
-            sepl__unaryop(-);
-            break;
+        sepl__op(SEPL_BC_FUNC): {
+            sepl_size skip_pos;
+            sepl__xrdsz(skip_pos);
+            sepl__xpush(sepl_val_func(pc));
+            pc = skip_pos;
+            sepl__next();
         }
 
-        case SEPL_BC_ADD: {
-            sepl__binaryop(+);
-            break;
+        sepl__op(SEPL_BC_NEG): {
+            sepl__xunary(-);
+            sepl__next();
         }
-        case SEPL_BC_SUB: {
-            sepl__binaryop(-);
-            break;
+        sepl__op(SEPL_BC_ADD): {
+            sepl__xbinary(+, SEPL_BC_ADD_Q);
+            sepl__next();
         }
-        case SEPL_BC_MUL: {
-            sepl__binaryop(*);
-            break;
+        sepl__op(SEPL_BC_SUB): {
+            sepl__xbinary(-, SEPL_BC_SUB_Q);
+            sepl__next();
         }
-        case SEPL_BC_DIV: {
-            sepl__binaryop(/);
-            break;
+        sepl__op(SEPL_BC_MUL): {
+            sepl__xbinary(*, SEPL_BC_MUL_Q);
+            sepl__next();
         }
-        case SEPL_BC_NOT: {
-            sepl__unaryop(!);
-            break;
+        sepl__op(SEPL_BC_DIV): {
+            sepl__xbinary(/, SEPL_BC_DIV_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NOT): {
+            sepl__xunary(!);
+            sepl__next();
         }
 
-        case SEPL_BC_LT: {
-            sepl__binaryop(<);
-            break;
+        sepl__op(SEPL_BC_LT): {
+            sepl__xbinary(<, SEPL_BC_LT_Q);
+            sepl__next();
         }
-        case SEPL_BC_LTE: {
-            sepl__binaryop(<=);
-            break;
+        sepl__op(SEPL_BC_LTE): {
+            sepl__xbinary(<=, SEPL_BC_LTE_Q);
+            sepl__next();
         }
-        case SEPL_BC_GT: {
-            sepl__binaryop(>);
-            break;
+        sepl__op(SEPL_BC_GT): {
+            sepl__xbinary(>, SEPL_BC_GT_Q);
+            sepl__next();
         }
-        case SEPL_BC_GTE: {
-            sepl__binaryop(>=);
-            break;
+        sepl__op(SEPL_BC_GTE): {
+            sepl__xbinary(>=, SEPL_BC_GTE_Q);
+            sepl__next();
         }
-        case SEPL_BC_EQ: {
-            sepl__binaryop(==);
-            break;
+        sepl__op(SEPL_BC_EQ): {
+            sepl__xbinary(==, SEPL_BC_EQ_Q);
+            sepl__next();
         }
-        case SEPL_BC_NEQ: {
-            sepl__binaryop(!=);
-            break;
+        sepl__op(SEPL_BC_NEQ): {
+            sepl__xbinary(!=, SEPL_BC_NEQ_Q);
+            sepl__next();
         }
 
-        default: {
-            sepl_err_new(e, SEPL_ERR_BC);
-            e->info.bc = bc;
-            return SEPL_NONE;
+        sepl__op(SEPL_BC_JUMP_LT): {
+            sepl__xcmpjump(<, SEPL_BC_JUMP_LT_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_LTE): {
+            sepl__xcmpjump(<=, SEPL_BC_JUMP_LTE_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GT): {
+            sepl__xcmpjump(>, SEPL_BC_JUMP_GT_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GTE): {
+            sepl__xcmpjump(>=, SEPL_BC_JUMP_GTE_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_EQ): {
+            sepl__xcmpjump(==, SEPL_BC_JUMP_EQ_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_NEQ): {
+            sepl__xcmpjump(!=, SEPL_BC_JUMP_NEQ_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_AND): {
+            /* Short circuit with 0 when the operand is false */
+            sepl_size jump;
+            int d;
+            sepl__xrdsz(jump);
+            d = sepl__xtrue(sepl__xpeek(0));
+            sepl__xpopd();
+            if (!d) {
+                sepl__xpush(sepl_val_number(0));
+                pc = jump;
+            }
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_OR): {
+            /* Short circuit with 1 when the operand is true */
+            sepl_size jump;
+            int d;
+            sepl__xrdsz(jump);
+            d = sepl__xtrue(sepl__xpeek(0));
+            sepl__xpopd();
+            if (d) {
+                sepl__xpush(sepl_val_number(1));
+                pc = jump;
+            }
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD_INT): {
+            sepl_size i;
+            int k;
+            double d;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            d = sepl__todbl(e, values[vp - i]);
+            if (e->code)
+                goto fail;
+            sepl__xquicken(sepl_val_isnum(values[vp - i]), at,
+                           SEPL_BC_ADD_INT_Q);
+            sepl__xpush(sepl_val_number(d + (k - ((k & 0x80) << 1))));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_INC): {
+            SeplValue *slot;
+            sepl_size i;
+            int k;
+            double d;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            slot = values + vp - i;
+            d = sepl__todbl(e, *slot);
+            if (e->code)
+                goto fail;
+            sepl__xquicken(sepl_val_isnum(*slot), at, SEPL_BC_INC_Q);
+            *slot = sepl_val_number(d + (k - ((k & 0x80) << 1)));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GET_CALL): {
+            SeplValue *slot;
+            sepl_size i;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            sepl__xrdsz(argc);
+            slot = values + vp - i;
+
+            if (sepl_val_isobj(*slot)) {
+                sepl__xpush(sepl_val_asref(slot));
+            } else {
+                sepl__xpush(*slot);
+            }
+            goto call;
         }
-    }
-    return SEPL_NONE;
-}
 
-SEPL_LIB SeplValue sepl_mod_exec(SeplModule *mod, SeplError *e, SeplEnv env) {
-    SeplValue retv = SEPL_NONE;
+        sepl__op(SEPL_BC_ADD_NN): {
+            sepl__xbinarynn(+);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_SUB_NN): {
+            sepl__xbinarynn(-);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_MUL_NN): {
+            sepl__xbinarynn(*);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DIV_NN): {
+            sepl__xbinarynn(/);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LT_NN): {
+            sepl__xbinarynn(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LTE_NN): {
+            sepl__xbinarynn(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GT_NN): {
+            sepl__xbinarynn(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GTE_NN): {
+            sepl__xbinarynn(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_EQ_NN): {
+            sepl__xbinarynn(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NEQ_NN): {
+            sepl__xbinarynn(!=);
+            sepl__next();
+        }
+
+        sepl__op(SEPL_BC_JUMP_LT_NN): {
+            sepl__xcmpjumpnn(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_LTE_NN): {
+            sepl__xcmpjumpnn(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GT_NN): {
+            sepl__xcmpjumpnn(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GTE_NN): {
+            sepl__xcmpjumpnn(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_EQ_NN): {
+            sepl__xcmpjumpnn(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_NEQ_NN): {
+            sepl__xcmpjumpnn(!=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD_INT_NN): {
+            sepl_size i;
+            int k;
+            double d;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            d = sepl_val_getnum(values[vp - i]);
+            sepl__xpush(sepl_val_number(d + (k - ((k & 0x80) << 1))));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_INC_NN): {
+            SeplValue *slot;
+            sepl_size i;
+            int k;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            slot = values + vp - i;
+            *slot = sepl_val_number(sepl_val_getnum(*slot) +
+                                    (k - ((k & 0x80) << 1)));
+            sepl__next();
+        }
+
+        sepl__op(SEPL_BC_ADD_Q): {
+            sepl__xbinaryq(+);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_SUB_Q): {
+            sepl__xbinaryq(-);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_MUL_Q): {
+            sepl__xbinaryq(*);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DIV_Q): {
+            sepl__xbinaryq(/);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LT_Q): {
+            sepl__xbinaryq(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LTE_Q): {
+            sepl__xbinaryq(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GT_Q): {
+            sepl__xbinaryq(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GTE_Q): {
+            sepl__xbinaryq(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_EQ_Q): {
+            sepl__xbinaryq(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NEQ_Q): {
+            sepl__xbinaryq(!=);
+            sepl__next();
+        }
+
+        sepl__op(SEPL_BC_JUMP_LT_Q): {
+            sepl__xcmpjumpq(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_LTE_Q): {
+            sepl__xcmpjumpq(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GT_Q): {
+            sepl__xcmpjumpq(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GTE_Q): {
+            sepl__xcmpjumpq(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_EQ_Q): {
+            sepl__xcmpjumpq(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_NEQ_Q): {
+            sepl__xcmpjumpq(!=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD_INT_Q): {
+            SeplValue v;
+            sepl_size i;
+            int k;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            v = values[vp - i];
+            if (!sepl_val_isnum(v))
+                sepl__xdeopt(at);
+            sepl__xpush(
+                sepl_val_number(sepl_val_getnum(v) + (k - ((k & 0x80) << 1))));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_INC_Q): {
+            SeplValue *slot;
+            sepl_size i;
+            int k;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            slot = values + vp - i;
+            if (!sepl_val_isnum(*slot))
+                sepl__xdeopt(at);
+            *slot = sepl_val_number(sepl_val_getnum(*slot) +
+                                    (k - ((k & 0x80) << 1)));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GET_CALL_C): {
+            SeplValue v;
+            sepl_size i;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            sepl__xrdsz(argc);
+            v = values[vp - i];
+            if (!sepl_val_iscfun(v))
+                sepl__xdeopt(at);
+            sepl__xpush(v);
+            goto callc;
+        }
+        sepl__op(SEPL_BC_GET_CALL_S): {
+            SeplValue v;
+            sepl_size i;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            sepl__xrdsz(argc);
+            v = values[vp - i];
+            if (!sepl_val_isfun(v))
+                sepl__xdeopt(at);
+            sepl__xpush(v);
+            goto calls;
+        }
+        sepl__op(SEPL_BC_CALL_DIRECT): {
+            sepl_size to;
+            sepl__xrdsz(to);
+            sepl__xrdsz(argc);
+            values[vp - argc - 1] = sepl_val_scope(pc);
+            pc = to;
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_TAILCALL): {
+            sepl_size depth, frame, i;
+            SeplValue v;
+            sepl__xrdsz(depth);
+            sepl__xrdsz(argc);
+            frame = vp - depth;
+            v = values[vp - argc - 1];
+
+            if (sepl_val_iscfun(v))
+                goto callc;
+            if (!sepl_val_isfun(v)) {
+                sepl_err_new(e, SEPL_ERR_FUNC_CALL);
+                goto fail;
+            }
+            /* References into the frame must outlive it */
+            for (i = vp - argc; i < vp; i++) {
+                if (sepl_val_isref(values[i]) &&
+                    (SeplValue *)sepl_val_getobj(values[i]) >= values + frame)
+                    goto calls;
+            }
 
-    while (mod->pc < mod->bpos) {
-        retv = sepl_mod_step(mod, e, env);
-        if (e->code != SEPL_ERR_OK)
-            return SEPL_NONE;
+            /* Free the frame like RETURN, keeping its return scope */
+            sepl__xunwind(frame + 1, vp - argc - 1, SEPL_NONE);
+            for (i = 0; i < argc; i++) {
+                values[frame + 1 + i] = values[vp - argc + i];
+                if (sepl_val_isobj(values[frame + 1 + i]))
+                    sepl__xmark(frame + 1 + i);
+            }
+            vp = frame + 1 + argc;
+            pc = sepl_val_getpos(v);
+            goto enter;
+        }
+        sepl__op(SEPL_BC_FRAME): {
+            sepl_size n;
+            sepl__xrdsz(n);
+            if (n > vsize - vp) {
+                sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+                goto fail;
+            }
+            sepl__next();
+        }
+
+#ifdef SEPL__THREADED
+        sepl__op(SEPL_BC_AND):
+        sepl__op(SEPL_BC_OR):
+        bad_bc:
+#else
+        default:
+#endif
+        {
+#ifdef SEPL__THREADED
+            bc = (SeplBC)bytes[pc - 1];
+#endif
+            sepl_err_new(e, SEPL_ERR_BC);
+            e->info.bc = bc;
+            goto fail;
+        }
+#ifndef SEPL__THREADED
+        }
+        if (pc >= end)
+            goto halt;
     }
+#endif
+
+halt:
+    retv = SEPL_NONE;
+done:
+    mod->pc = pc;
+    mod->vpos = vp;
     return retv;
+
+fail:
+    mod->pc = pc;
+    mod->vpos = vp;
+    return SEPL_NONE;
+
+#undef sepl__xrdsz
+#undef sepl__xconst
+#undef sepl__xnum
+#undef sepl__xpush
+#undef sepl__xpop
+#undef sepl__xpeek
+#undef sepl__xmark
+#undef sepl__xunwind
+#undef sepl__xtrue
+#undef sepl__xpopd
+#undef sepl__xunary
+#undef sepl__xbinary
+#undef sepl__xcmpjump
+#undef sepl__xcheck
+#undef sepl__xbinarynn
+#undef sepl__xcmpjumpnn
+#undef sepl__xquicken
+#undef sepl__xdeopt
+#undef sepl__xnn
+#undef sepl__xbinaryq
+#undef sepl__xcmpjumpq
+#undef sepl__op
+#undef sepl__next
+}
+
+SEPL_LIB SeplValue sepl_mod_step(SeplModule *mod, SeplError *e, SeplEnv env) {
+    return sepl__exec(mod, e, env, 0);
+}
+
+SEPL_LIB SeplValue sepl_mod_exec(SeplModule *mod, SeplError *e, SeplEnv env) {
+    if (mod->pc >= mod->bpos)
+        return SEPL_NONE;
+    return sepl__exec(mod, e, env, mod->bpos);
 }
 
 SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
@@ -1076,12 +3266,14 @@ SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
         return;
     }
 
-    mod->pc = func.as.pos;
-    args_count = sepl__rdsz();
+    mod->pc = sepl_val_getpos(func);
+    args_count = sepl__rdvar(mod->bytes, &mod->pc);
 
     sepl_mod_val(mod, sepl_val_scope(mod->bpos), e);
     for (i = 0; i < args.size; i++) {
-        sepl_mod_val(mod, args.values[i], e);
+        sepl_size at = sepl_mod_val(mod, args.values[i], e);
+        if (e->code == SEPL_ERR_OK && sepl_val_isobj(args.values[i]))
+            sepl__mark(mod, at);
     }
     if (e->code != SEPL_ERR_OK)
         return;
@@ -1097,25 +3289,1156 @@ SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
         return;
 }
 
-SEPL_LIB SeplValue sepl_mod_getexport(SeplModule *mod, SeplEnv env,
-                                      const char *key) {
+/* Frees the values a failed call left above vpos and drops them */
+SEPL_API void sepl__unwindto(SeplModule *mod, SeplEnv env, sepl_size vpos) {
+    if (env.free == SEPL_NULL) {
+        env.free = sepl__free;
+    }
+    if (mod->vpos > vpos)
+        sepl__objfree(mod, vpos, mod->vpos, SEPL_NONE, env);
+    mod->vpos = vpos;
+}
+
+SEPL_LIB SeplValue sepl_mod_reenter(SeplModule *mod, SeplError *e,
+                                    SeplEnv env, SeplValue func,
+                                    SeplArgs args) {
+    sepl_size pc = mod->pc, vpos = mod->vpos;
+    SeplValue result = SEPL_NONE;
+
+    e->code = SEPL_ERR_OK;
+    sepl_mod_initfunc(mod, e, func, args);
+    if (e->code == SEPL_ERR_OK)
+        result = sepl__exec(mod, e, env, mod->bpos);
+    if (e->code != SEPL_ERR_OK) {
+        sepl__unwindto(mod, env, vpos);
+        result = SEPL_NONE;
+    }
+
+    mod->pc = pc;
+    mod->vpos = vpos;
+    return result;
+}
+
+SEPL_LIB SeplCall sepl_mod_prepare(SeplModule *mod, SeplError *e,
+                                   SeplValue func) {
+    SeplCall call = {0};
+    if (!sepl_val_isfun(func)) {
+        sepl_err_new(e, SEPL_ERR_FUNC_CALL);
+        return call;
+    }
+
+    call.pc = sepl_val_getpos(func);
+    call.params = sepl__rdvar(mod->bytes, &call.pc);
+    return call;
+}
+
+/* Runs a prepared call above vpos, whose room is already checked */
+SEPL_API SeplValue sepl__callat(SeplModule *mod, SeplError *e, SeplEnv env,
+                                SeplCall call, const SeplValue args[],
+                                sepl_size vp) {
+    SeplValue *values = mod->values;
     sepl_size i;
+
+    values[vp++] = sepl_val_scope(mod->bpos);
+    for (i = 0; i < call.params; i++, vp++) {
+        values[vp] = args[i];
+        if (sepl_val_isobj(args[i]))
+            sepl__mark(mod, vp);
+    }
+    mod->vpos = vp;
+    mod->pc = call.pc;
+    return sepl__exec(mod, e, env, mod->bpos);
+}
+
+SEPL_LIB void sepl_mod_call(SeplModule *mod, SeplError *e, SeplEnv env,
+                            SeplCall call, const SeplValue args[],
+                            SeplValue *result) {
+    sepl_size vpos = mod->vpos;
+
+    e->code = SEPL_ERR_OK;
+    if (call.params >= mod->vsize - vpos) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        *result = SEPL_NONE;
+        return;
+    }
+    *result = sepl__callat(mod, e, env, call, args, vpos);
+    if (e->code == SEPL_ERR_OK)
+        return;
+
+    sepl__unwindto(mod, env, vpos);
+    *result = SEPL_NONE;
+}
+
+SEPL_LIB sepl_size sepl_mod_callbatch(SeplModule *mod, SeplError *e,
+                                      SeplEnv env, SeplCall call,
+                                      const SeplValue args[], sepl_size stride,
+                                      SeplValue results[], sepl_size count,
+                                      char stop) {
+    sepl_size pc = mod->pc, vpos = mod->vpos, ok = 0, row;
+    SeplError err;
+
+    e->code = SEPL_ERR_OK;
+    if (call.params >= mod->vsize - vpos) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        return 0;
+    }
+
+    err.code = SEPL_ERR_OK;
+    for (row = 0; row < count; row++, args += stride) {
+        results[row] = sepl__callat(mod, &err, env, call, args, vpos);
+        if (err.code == SEPL_ERR_OK) {
+            ok++;
+            continue;
+        }
+
+        sepl__unwindto(mod, env, vpos);
+        results[row] = SEPL_NONE;
+        if (e->code == SEPL_ERR_OK)
+            *e = err;
+        err.code = SEPL_ERR_OK;
+        if (stop)
+            break;
+    }
+
+    mod->pc = pc;
+    return ok;
+}
+
+SEPL_LIB SeplImage sepl_mod_image(SeplModule *mod) {
+    SeplImage img;
+    sepl_size pc;
+
+    for (pc = 0; pc < mod->bpos; pc = sepl__bcnext(mod->bytes, pc)) {
+        SeplBC bc = (SeplBC)mod->bytes[pc];
+        if ((bc >= SEPL_BC_ADD_Q && bc <= SEPL_BC_INC_Q) ||
+            (bc >= SEPL_BC_CALL_C && bc <= SEPL_BC_GET_CALL_S))
+            mod->bytes[pc] = (unsigned char)sepl__bcgeneric(bc);
+    }
+
+    img.bytes = mod->bytes;
+    img.bpos = mod->bpos;
+    img.bsize = mod->bsize;
+    img.kpos = mod->kpos;
+    img.exports = mod->exports;
+    img.esize = mod->esize;
+    img.etab = mod->etab;
+    img.ecap = mod->ecap;
+    img.verified = mod->verified;
+    return img;
+}
+
+SEPL_LIB SeplModule sepl_mod_context(const SeplImage *img, SeplValue values[],
+                                     sepl_size vsize) {
+    /* The code is only written by contexts that are not shared */
+    SeplModule mod =
+        sepl_mod_new((unsigned char *)img->bytes, img->bsize, values, vsize);
+    mod.bpos = img->bpos;
+    mod.kpos = img->kpos;
+    mod.exports = img->exports;
+    mod.esize = img->esize;
+    mod.etab = img->etab;
+    mod.ecap = img->ecap;
+    mod.verified = img->verified;
+    mod.shared = 1;
+    return mod;
+}
+
+SEPL_LIB sepl_size sepl_mod_funcsize(SeplModule *mod, SeplValue func) {
+    sepl_size pc, params;
+    if (!sepl_val_isfun(func))
+        return 0;
+
+    pc = sepl_val_getpos(func);
+    params = sepl__rdvar(mod->bytes, &pc);
+    if (mod->bytes[pc++] != SEPL_BC_FRAME)
+        return 1 + params;
+    return 1 + params + sepl__rdvar(mod->bytes, &pc);
+}
+
+/* 1 if the export names a and b are the same */
+SEPL_API char sepl__ekeyeq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+SEPL_API sepl_size sepl__ehash(const char *key) {
+    sepl_size hash = 2166136261u;
+    while (*key) {
+        hash = (hash ^ (unsigned char)*key++) * 16777619u;
+    }
+    return hash;
+}
+
+SEPL_LIB void sepl_mod_exporttab(SeplModule *mod, void *buf, sepl_size size) {
+    sepl_size *tab = (sepl_size *)buf;
+    sepl_size cap = 1, mask, i, at;
+
+    mod->etab = SEPL_NULL;
+    mod->ecap = 0;
+    /* Largest power of two that fits, at most three quarters full */
+    while (cap * 2 * sizeof(sepl_size) <= size) {
+        cap *= 2;
+    }
+    if (cap * sizeof(sepl_size) > size || mod->esize * 4 > cap * 3)
+        return;
+
+    mask = cap - 1;
+    for (i = 0; i < cap; i++) {
+        tab[i] = 0;
+    }
     for (i = 0; i < mod->esize; i++) {
-        const char *e_key = mod->exports[i];
-        const char *k_key = key;
-        char match = 1;
+        at = sepl__ehash(mod->exports[i]) & mask;
+        /* The first of repeated names is kept, as a scan would find it */
+        while (tab[at] != 0 &&
+               !sepl__ekeyeq(mod->exports[tab[at] - 1], mod->exports[i])) {
+            at = (at + 1) & mask;
+        }
+        if (tab[at] == 0)
+            tab[at] = i + 1;
+    }
+    mod->etab = tab;
+    mod->ecap = cap;
+}
+
+SEPL_LIB sepl_size sepl_mod_export_index(const SeplModule *mod,
+                                         const char *key) {
+    sepl_size i, mask;
+    if (mod->etab == SEPL_NULL) {
+        for (i = 0; i < mod->esize; i++) {
+            if (sepl__ekeyeq(mod->exports[i], key))
+                return i;
+        }
+        return mod->esize;
+    }
+
+    mask = mod->ecap - 1;
+    for (i = sepl__ehash(key) & mask; mod->etab[i] != 0; i = (i + 1) & mask) {
+        if (sepl__ekeyeq(mod->exports[mod->etab[i] - 1], key))
+            return mod->etab[i] - 1;
+    }
+    return mod->esize;
+}
+
+SEPL_LIB SeplValue sepl_mod_export(const SeplModule *mod, SeplEnv env,
+                                   sepl_size index) {
+    if (index >= mod->esize)
+        return SEPL_NONE;
+    return mod->values[env.predef_len + index];
+}
+
+SEPL_LIB SeplValue sepl_mod_getexport(SeplModule *mod, SeplEnv env,
+                                      const char *key) {
+    return sepl_mod_export(mod, env, sepl_mod_export_index(mod, key));
+}
+
+/* Deepest block nesting followed when moving stack offsets */
+#define SEPL__OPT_NEST 32
+/* Longest jump chain followed */
+#define SEPL__OPT_HOPS 16
+/* Most edits made by one pass */
+#define SEPL__OPT_EDITS 64
+
+#define sepl__opt_hasaddr(bc)                                       \
+    ((bc) == SEPL_BC_JUMPIF || (bc) == SEPL_BC_JUMP ||              \
+     (bc) == SEPL_BC_SCOPE || (bc) == SEPL_BC_FUNC ||               \
+     ((bc) >= SEPL_BC_JUMP_LT && (bc) <= SEPL_BC_JUMP_OR) ||        \
+     ((bc) >= SEPL_BC_JUMP_LT_NN && (bc) <= SEPL_BC_JUMP_NEQ_NN) || \
+     ((bc) >= SEPL_BC_JUMP_LT_Q && (bc) <= SEPL_BC_JUMP_NEQ_Q) ||   \
+     (bc) == SEPL_BC_CALL_DIRECT)
+#define sepl__opt_isjump(bc)                           \
+    (sepl__opt_hasaddr(bc) && (bc) != SEPL_BC_SCOPE && \
+     (bc) != SEPL_BC_FUNC && (bc) != SEPL_BC_CALL_DIRECT)
+/* Instructions whose result is never a function or a reference */
+#define sepl__opt_isplain(bc)                                 \
+    (((bc) >= SEPL_BC_NONE && (bc) <= SEPL_BC_STR) ||         \
+     ((bc) >= SEPL_BC_NEG && (bc) <= SEPL_BC_NEQ) ||          \
+     ((bc) >= SEPL_BC_ADD_NN && (bc) <= SEPL_BC_NEQ_NN) ||    \
+     ((bc) >= SEPL_BC_ADD_Q && (bc) <= SEPL_BC_NEQ_Q) ||      \
+     (bc) == SEPL_BC_ADD_INT || (bc) == SEPL_BC_ADD_INT_NN || \
+     (bc) == SEPL_BC_ADD_INT_Q)
+
+/* Overwrites the operand at pos keeping its encoded width */
+SEPL_API void sepl__opt_wrvar(unsigned char *bytes, sepl_size pos,
+                              sepl_size v) {
+    sepl_size end = pos;
+    sepl__rdvar(bytes, &end);
+    sepl__wrvar(bytes + pos, v, end - pos);
+}
+
+SEPL_API sepl_size sepl__opt_opwidth(const unsigned char *bytes,
+                                     sepl_size pos) {
+    sepl_size end = pos;
+    sepl__rdvar(bytes, &end);
+    return end - pos;
+}
+
+/*
+ * Change found by a pass: instructions removed at pos[i] for len[i] bytes,
+ * the second range may be empty, and the stack offsets in [from, to) moved
+ * as by sepl__opt_walk. keep must not be a jump target, 0 if any may be.
+ */
+typedef struct {
+    sepl_size pos[2], len[2];
+    sepl_size from, to, keep;
+    char decl;
+} SeplOptEdit;
+
+/* End of the code an edit spans */
+#define sepl__opt_span(edit) \
+    ((edit)->len[1] != 0 ? (edit)->pos[1] + (edit)->len[1] \
+                         : (edit)->pos[0] + (edit)->len[0])
+
+/*
+ * Drops the edits that would remove a jump target, reading every address
+ * once, and those inside the code of an edit that is kept. Returns the number
+ * of edits left.
+ */
+SEPL_API sepl_size sepl__opt_targets(SeplModule *mod, SeplOptEdit *edits,
+                                     sepl_size n) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size order[SEPL__OPT_EDITS], keeps = 0, pc, at, a, i, j, lo, hi;
+    sepl_size kept = 0, busy = 0;
+
+    /* Edits with a position to keep, ordered by it */
+    for (i = 0; i < n; i++) {
+        if (edits[i].keep == 0)
+            continue;
+        for (j = keeps++; j > 0 && edits[order[j - 1]].keep > edits[i].keep;
+             j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    for (pc = 0; keeps != 0 && pc < mod->bpos; pc = sepl__bcnext(bytes, pc)) {
+        if (!sepl__opt_hasaddr(bytes[pc]))
+            continue;
+        at = pc + 1;
+        a = sepl__rdvar(bytes, &at);
+        for (lo = 0, hi = keeps; lo < hi;) {
+            sepl_size mid = lo + (hi - lo) / 2;
+            if (edits[order[mid]].keep < a)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo != keeps && edits[order[lo]].keep == a)
+            edits[order[lo]].keep = mod->bpos;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (edits[i].keep == mod->bpos || edits[i].pos[0] < busy)
+            continue;
+        busy = sepl__opt_span(&edits[i]);
+        edits[kept++] = edits[i];
+    }
+    return kept;
+}
+
+/* Position a moves to once the ranges at pos, each len long, are removed.
+ * Positions in a range move to its start */
+SEPL_API sepl_size sepl__opt_map(const sepl_size *pos, const sepl_size *len,
+                                 const sepl_size *sum, sepl_size n,
+                                 sepl_size a) {
+    sepl_size lo = 0, hi = n;
+    while (lo < hi) {
+        sepl_size mid = lo + (hi - lo) / 2;
+        if (pos[mid] >= a)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0)
+        return a;
+    lo--;
+    return a - sum[lo] - (a - pos[lo] < len[lo] ? a - pos[lo] : len[lo]);
+}
+
+/* Removes the instructions of the edits and moves the addresses, all in one
+ * sweep over the code */
+SEPL_API void sepl__opt_compact(SeplModule *mod, const SeplOptEdit *edits,
+                                sepl_size n, SeplOptStats *stats) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size pos[SEPL__OPT_EDITS * 2], len[SEPL__OPT_EDITS * 2];
+    sepl_size sum[SEPL__OPT_EDITS * 2];
+    sepl_size cuts = 0, i, j, c = 0, pc = 0, w = 0, next, at, a;
+
+    /* sum holds the bytes removed before each range */
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 2; j++) {
+            if (edits[i].len[j] == 0)
+                continue;
+            pos[cuts] = edits[i].pos[j];
+            len[cuts] = edits[i].len[j];
+            sum[cuts] = cuts != 0 ? sum[cuts - 1] + len[cuts - 1] : 0;
+            stats->bytes += len[cuts];
+            stats->instrs++;
+            cuts++;
+        }
+    }
+
+    while (pc < mod->bpos) {
+        if (c < cuts && pc == pos[c]) {
+            pc += len[c++];
+            continue;
+        }
+        next = sepl__bcnext(bytes, pc);
+        for (i = pc; i < next; i++) {
+            bytes[w + i - pc] = bytes[i];
+        }
+        if (sepl__opt_hasaddr(bytes[w])) {
+            at = w + 1;
+            a = sepl__rdvar(bytes, &at);
+            sepl__opt_wrvar(bytes, w + 1,
+                            sepl__opt_map(pos, len, sum, cuts, a));
+        }
+        w += next - pc;
+        pc = next;
+    }
+    mod->bpos = w;
+    mod->pc = sepl__opt_map(pos, len, sum, cuts, mod->pc);
+}
 
-        while (*e_key && *k_key) {
-            match = *e_key++ == *k_key++;
-            if (!match)
+/*
+ * Follows the code in [pc, end) with a stack slot below it that is about to
+ * be removed, either a scope marker or a declared variable. depth counts the
+ * values above the slot and last is set to the last instruction outside of
+ * nested blocks. Stops early at a SET outside of nested blocks that assigns
+ * the slot. Returns the position it stopped at or 0 if the code relies on the
+ * slot, in which case nothing is changed. With apply set the stack offsets
+ * that reach below the slot are moved by one.
+ */
+SEPL_API sepl_size sepl__opt_walk(SeplModule *mod, sepl_size pc,
+                                  sepl_size end, long *depth, sepl_size *last,
+                                  char decl, char apply) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size ends[SEPL__OPT_NEST], nest = 0, at, i;
+    long saved[SEPL__OPT_NEST], d = 0;
+
+    while (pc < end) {
+        unsigned char bc = bytes[pc];
+        at = pc + 1;
+
+        /* Loops close their scope with a JUMP rather than a RETURN */
+        if (nest != 0 && pc == ends[nest - 1]) {
+            d = saved[--nest] + 1;
+            continue;
+        }
+
+        switch (bc) {
+            case SEPL_BC_RETURN:
+                if (nest == 0)
+                    return 0;
+                break;
+            case SEPL_BC_SCOPE:
+                if (nest == SEPL__OPT_NEST)
+                    return 0;
+                ends[nest] = sepl__rdvar(bytes, &at);
+                saved[nest++] = d;
+                break;
+            case SEPL_BC_FUNC:
+                /* Function bodies address outer values by absolute index */
+                if (!decl || nest != 0 || d != 0)
+                    return 0;
+                *last = pc;
+                pc = sepl__rdvar(bytes, &at);
+                d++;
+                continue;
+            case SEPL_BC_GET:
+            case SEPL_BC_SET:
+            case SEPL_BC_ADD_INT:
+            case SEPL_BC_INC:
+            case SEPL_BC_GET_CALL:
+            case SEPL_BC_ADD_INT_NN:
+            case SEPL_BC_INC_NN:
+            case SEPL_BC_ADD_INT_Q:
+            case SEPL_BC_INC_Q:
+            case SEPL_BC_GET_CALL_C:
+            case SEPL_BC_GET_CALL_S:
+            case SEPL_BC_TAILCALL:
+                i = sepl__rdvar(bytes, &at);
+                if (i == (sepl_size)d + 1) {
+                    if (decl && nest == 0 && bc == SEPL_BC_SET) {
+                        *depth = d;
+                        return pc;
+                    }
+                    return 0;
+                }
+                if (apply && i > (sepl_size)d)
+                    sepl__opt_wrvar(bytes, pc + 1, i - 1);
+                break;
+            default:
                 break;
         }
-        if (match && *e_key == *k_key) {
-            return mod->values[env.predef_len + i];
+
+        d += sepl__bcstack(bytes, pc);
+        if (d < 0)
+            return 0;
+        if (nest == 0 || (bc == SEPL_BC_SCOPE && nest == 1))
+            *last = pc;
+        pc = sepl__bcnext(bytes, pc);
+    }
+
+    *depth = d;
+    return pc;
+}
+
+/* Points jumps past chains of unconditional jumps */
+SEPL_API char sepl__opt_thread(SeplModule *mod, sepl_size pc) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size at = pc + 1, a = sepl__rdvar(bytes, &at), t = a, hops = 0;
+
+    while (t < mod->bpos && bytes[t] == SEPL_BC_JUMP &&
+           hops++ < SEPL__OPT_HOPS) {
+        at = t + 1;
+        t = sepl__rdvar(bytes, &at);
+    }
+    if (t == a || (t < mod->bpos && bytes[t] == SEPL_BC_JUMP) ||
+        sepl__varlen(t) > sepl__opt_opwidth(bytes, pc + 1))
+        return 0;
+
+    sepl__opt_wrvar(bytes, pc + 1, t);
+    return 1;
+}
+
+/* Removes the scope of a block that only returns its last value */
+SEPL_API char sepl__opt_flatten(SeplModule *mod, sepl_size pc,
+                                SeplOptEdit *edit) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size at = pc + 1, end = sepl__rdvar(bytes, &at), last = 0, ret;
+    long d;
+
+    if (end >= mod->bpos || end <= at)
+        return 0;
+    /* The RETURN closing the block */
+    for (ret = at; sepl__bcnext(bytes, ret) < end;)
+        ret = sepl__bcnext(bytes, ret);
+    if (bytes[ret] != SEPL_BC_RETURN || sepl__bcnext(bytes, ret) != end)
+        return 0;
+    if (sepl__opt_walk(mod, at, ret, &d, &last, 0, 0) != ret || d != 1)
+        return 0;
+    /* RETURN rejects functions unless the block is returned again */
+    if (!sepl__opt_isplain(bytes[last]) && bytes[end] != SEPL_BC_RETURN)
+        return 0;
+
+    edit->pos[0] = pc;
+    edit->len[0] = at - pc;
+    edit->pos[1] = ret;
+    edit->len[1] = end - ret;
+    edit->from = at;
+    edit->to = ret;
+    edit->keep = ret;
+    edit->decl = 0;
+    return 1;
+}
+
+/* Evaluates the initializer of a declared variable directly into its slot */
+SEPL_API char sepl__opt_decl(SeplModule *mod, sepl_size pc,
+                             SeplOptEdit *edit) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size set, last = pc;
+    long d;
+
+    set = sepl__opt_walk(mod, pc + 1, mod->bpos, &d, &last, 1, 0);
+    if (set == 0 || set == mod->bpos || d != 1)
+        return 0;
+    /* SET copies references which a fresh slot cannot hold */
+    if (!sepl__opt_isplain(bytes[last]) && bytes[last] != SEPL_BC_FUNC)
+        return 0;
+
+    edit->pos[0] = pc;
+    edit->len[0] = 1;
+    edit->pos[1] = set;
+    edit->len[1] = sepl__bcnext(bytes, set) - set;
+    edit->from = pc + 1;
+    edit->to = set;
+    edit->keep = 0;
+    edit->decl = 1;
+    return 1;
+}
+
+/*
+ * Scans the code once for edits, then drops the ones that remove a jump
+ * target and removes the rest in one sweep. Edits inside the code of another
+ * edit are left to the next pass.
+ */
+SEPL_API char sepl__opt_pass(SeplModule *mod, SeplOptStats *stats) {
+    unsigned char *bytes = mod->bytes;
+    SeplOptEdit edits[SEPL__OPT_EDITS];
+    sepl_size pc = 0, next, at, n = 0, i, last;
+    char changed = 0;
+    long d;
+
+    while (pc < mod->bpos && n < SEPL__OPT_EDITS) {
+        unsigned char bc = bytes[pc];
+        SeplOptEdit *edit = &edits[n];
+        next = sepl__bcnext(bytes, pc);
+        edit->from = edit->to = edit->keep = 0;
+        edit->len[1] = 0;
+
+        if (sepl__opt_isjump(bc)) {
+            changed |= sepl__opt_thread(mod, pc);
+            at = pc + 1;
+            if (bc == SEPL_BC_JUMP && sepl__rdvar(bytes, &at) == next) {
+                edit->pos[0] = pc;
+                edit->len[0] = next - pc;
+                n++;
+            }
+        } else if (bc == SEPL_BC_SCOPE) {
+            n += sepl__opt_flatten(mod, pc, edit);
+        } else if (bc == SEPL_BC_NONE) {
+            if (next < mod->bpos && bytes[next] == SEPL_BC_POP) {
+                edit->pos[0] = pc;
+                edit->len[0] = 1;
+                edit->pos[1] = next;
+                edit->len[1] = 1;
+                edit->keep = next;
+                n++;
+            } else {
+                n += sepl__opt_decl(mod, pc, edit);
+            }
         }
+        pc = next;
     }
 
-    return SEPL_NONE;
+    n = sepl__opt_targets(mod, edits, n);
+    if (n == 0)
+        return changed;
+    for (i = 0; i < n; i++) {
+        if (edits[i].from != edits[i].to)
+            sepl__opt_walk(mod, edits[i].from, edits[i].to, &d, &last,
+                           edits[i].decl, 1);
+    }
+    sepl__opt_compact(mod, edits, n, stats);
+    return 1;
+}
+
+SEPL_LIB SeplOptStats sepl_opt_peephole(SeplModule *mod) {
+    SeplOptStats stats = {0};
+    mod->verified = 0;
+    while (sepl__opt_pass(mod, &stats));
+    return stats;
+}
+
+#undef sepl__opt_span
+#undef sepl__opt_hasaddr
+#undef sepl__opt_isjump
+#undef sepl__opt_isplain
+
+/* Owner of the code outside of any scope or function body */
+#define SEPL__VER_TOP ((sepl_size)-1)
+
+typedef struct {
+    SeplBC bc;
+    sepl_size a, b;
+    sepl_size next;
+} SeplVerOp;
+
+typedef struct {
+    const unsigned char *bytes;
+    sepl_size bpos;
+    /* 0 inside an instruction, 1 at the start of one no path has reached yet
+     * and the depth of the value stack + 2 at one that a path has */
+    sepl_size *state;
+    /* Position of the SCOPE or FUNC opening the innermost region around each
+     * instruction, SEPL__VER_TOP outside of them */
+    sepl_size *owner;
+    char changed;
+
+    /* Depth at 0 and the deepest the top level code gets */
+    sepl_size start, peak;
+    /* Function body being swept, with the depth at its FUNC and the deepest
+     * it gets above its frame */
+    sepl_size func, fend, fparams, fframe, fdepth, fpeak;
+    /* Instruction whose check only holds once a sweep changes nothing */
+    sepl_size late;
+} SeplVer;
+
+/* Reads the operand at *pc, 0 if it runs past end or does not fit */
+SEPL_API char sepl__ver_rdvar(const unsigned char *bytes, sepl_size *pc,
+                              sepl_size end, sepl_size *v) {
+    sepl_size at = *pc, len = 0;
+    do {
+        if (at >= end || ++len > (sizeof(sepl_size) * 8 + 6) / 7)
+            return 0;
+    } while (bytes[at++] & 0x80);
+    *v = sepl__rdvar(bytes, pc);
+    return 1;
+}
+
+/* Decodes the instruction at pc, 0 if it is not one the interpreter runs or
+ * its operands run past the code */
+SEPL_API char sepl__ver_decode(const SeplVer *v, sepl_size pc,
+                               SeplVerOp *op) {
+    const unsigned char *bytes = v->bytes;
+    int operands = 1, raw = 0;
+
+    op->bc = (SeplBC)bytes[pc++];
+    op->a = op->b = 0;
+    switch (op->bc) {
+        case SEPL_BC_AND:
+        case SEPL_BC_OR:
+            return 0;
+        case SEPL_BC_INT:
+            operands = 0;
+            raw = 1;
+            break;
+        case SEPL_BC_FUNC:
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+        case SEPL_BC_CALL_DIRECT:
+        case SEPL_BC_TAILCALL:
+            operands = 2;
+            break;
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_INC:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_INC_NN:
+        case SEPL_BC_ADD_INT_Q:
+        case SEPL_BC_INC_Q:
+            raw = 1;
+            break;
+        default:
+            if (op->bc > SEPL_BC_FRAME)
+                return 0;
+            if (op->bc == SEPL_BC_POP || op->bc == SEPL_BC_NONE ||
+                (op->bc >= SEPL_BC_NEG && op->bc <= SEPL_BC_NEQ) ||
+                (op->bc >= SEPL_BC_ADD_NN && op->bc <= SEPL_BC_NEQ_NN) ||
+                (op->bc >= SEPL_BC_ADD_Q && op->bc <= SEPL_BC_NEQ_Q))
+                operands = 0;
+            break;
+    }
+
+    if (operands > 0 && !sepl__ver_rdvar(bytes, &pc, v->bpos, &op->a))
+        return 0;
+    if (operands > 1 && !sepl__ver_rdvar(bytes, &pc, v->bpos, &op->b))
+        return 0;
+    if (raw) {
+        if (pc >= v->bpos)
+            return 0;
+        op->b = bytes[pc++];
+    }
+    op->next = pc;
+    return 1;
+}
+
+/* End address of the region opened at r */
+SEPL_API sepl_size sepl__ver_end(const SeplVer *v, sepl_size r) {
+    if (r == SEPL__VER_TOP)
+        return v->bpos;
+    r++;
+    return sepl__rdvar(v->bytes, &r);
+}
+
+/*
+ * Decodes every instruction, checks the constants they refer to and that
+ * scopes and function bodies nest, and records the owner of each. *at is left
+ * at the instruction at fault.
+ */
+SEPL_API char sepl__ver_scan(const SeplModule *mod, SeplVer *v,
+                             sepl_size *at) {
+    sepl_size pool = (mod->bsize - mod->kpos) / SEPL_KSLOT;
+    sepl_size cur = SEPL__VER_TOP, end = v->bpos, pc, i;
+    sepl_size func = SEPL__VER_TOP, body = SEPL__VER_TOP;
+    SeplVerOp op;
+
+    for (pc = 0; pc < v->bpos; pc++) {
+        v->state[pc] = 0;
+    }
+
+    for (pc = 0; pc < v->bpos; pc = op.next) {
+        *at = pc;
+        while (cur != SEPL__VER_TOP && pc == end) {
+            if (cur == func)
+                func = SEPL__VER_TOP;
+            cur = v->owner[cur];
+            end = sepl__ver_end(v, cur);
+        }
+        if (!sepl__ver_decode(v, pc, &op) || op.next > end)
+            return 0;
+        /* FRAME starts each function body and nothing else */
+        if ((pc == body) != (op.bc == SEPL_BC_FRAME))
+            return 0;
+        v->state[pc] = 1;
+        v->owner[pc] = cur;
+
+        switch (op.bc) {
+            case SEPL_BC_FUNC:
+                /* Functions do not nest */
+                if (func != SEPL__VER_TOP)
+                    return 0;
+                func = pc;
+                body = op.next;
+                if (op.a <= op.next || op.a > end)
+                    return 0;
+                cur = pc;
+                end = op.a;
+                break;
+            case SEPL_BC_SCOPE:
+                if (op.a <= op.next || op.a > end)
+                    return 0;
+                cur = pc;
+                end = op.a;
+                break;
+            case SEPL_BC_CONST:
+                if (op.a == 0 || op.a > pool)
+                    return 0;
+                break;
+            case SEPL_BC_STR:
+                if (op.a == 0 || op.a > pool)
+                    return 0;
+                for (i = mod->bsize - op.a * SEPL_KSLOT;
+                     i < mod->bsize && mod->bytes[i]; i++);
+                if (i == mod->bsize)
+                    return 0;
+                break;
+            default:
+                break;
+        }
+    }
+    return 1;
+}
+
+/* 1 if slot holds the scope opened at r or at one around it, up to the
+ * return scope of the function */
+SEPL_API char sepl__ver_ismark(const SeplVer *v, sepl_size r, sepl_size slot) {
+    for (; r != SEPL__VER_TOP; r = v->owner[r]) {
+        sepl_size mark = v->bytes[r] == SEPL_BC_FUNC ? 0 : v->state[r] - 2;
+        if (mark == slot)
+            return 1;
+        if (mark < slot || v->bytes[r] == SEPL_BC_FUNC)
+            return 0;
+    }
+    return 0;
+}
+
+/* Joins the path reaching t with the stack at depth d, t must start an
+ * instruction of region r. Leaving the code is only allowed at the top */
+SEPL_API char sepl__ver_flow(SeplVer *v, sepl_size r, sepl_size t,
+                             sepl_size d) {
+    if (t == v->bpos)
+        return r == SEPL__VER_TOP;
+    if (t > v->bpos || v->state[t] == 0 || v->owner[t] != r)
+        return 0;
+    if (v->state[t] == 1) {
+        v->state[t] = d + 2;
+        v->changed = 1;
+        return 1;
+    }
+    return v->state[t] == d + 2;
+}
+
+/* Follows the instruction at pc if a path reaches it */
+SEPL_API char sepl__ver_step(SeplVer *v, sepl_size pc, const SeplVerOp *op) {
+    sepl_size cur = v->owner[pc], r = cur, own = cur;
+    sepl_size d, nd, low, hi, slot;
+
+    if (v->state[pc] < 2)
+        return 1;
+    d = v->state[pc] - 2;
+
+    /* Scopes whose value this path popped may only be left with POP and
+     * JUMP, r is the innermost one it did not */
+    while (r != SEPL__VER_TOP && v->bytes[r] == SEPL_BC_SCOPE &&
+           v->state[r] - 2 >= d) {
+        r = v->owner[r];
+    }
+    if (r != cur && op->bc != SEPL_BC_POP && op->bc != SEPL_BC_JUMP)
+        return 0;
+    if (r == SEPL__VER_TOP)
+        low = v->start;
+    else if (v->bytes[r] == SEPL_BC_SCOPE)
+        low = v->state[r] - 1;
+    else
+        low = 1;
+
+#define sepl__ver_pop(n)      \
+    do {                      \
+        if ((n) > d - low)    \
+            return 0;         \
+    } while (0)
+#define sepl__ver_read(i)          \
+    do {                           \
+        if ((i) == 0 || (i) > d)   \
+            return 0;              \
+    } while (0)
+/* Writes may not replace a scope */
+#define sepl__ver_write(i)                                                \
+    do {                                                                  \
+        if ((i) == 0 || (i) > d || sepl__ver_ismark(v, cur, d - (i)))     \
+            return 0;                                                     \
+    } while (0)
+
+    switch (op->bc) {
+        case SEPL_BC_RETURN:
+            if (op->a >= d || !sepl__ver_ismark(v, cur, d - op->a - 1))
+                return 0;
+            nd = d;
+            break;
+        case SEPL_BC_JUMP:
+            if (!sepl__ver_flow(v, r, op->a, d))
+                return 0;
+            nd = d;
+            break;
+        case SEPL_BC_JUMPIF:
+            sepl__ver_pop(1);
+            nd = d - 1;
+            if (!sepl__ver_flow(v, cur, op->a, nd))
+                return 0;
+            break;
+
+        case SEPL_BC_CALL:
+        case SEPL_BC_CALL_C:
+        case SEPL_BC_CALL_S:
+            /* The callee and its arguments */
+            if (op->a >= d - low)
+                return 0;
+            nd = d - op->a;
+            break;
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+            sepl__ver_read(op->a);
+            sepl__ver_pop(op->b);
+            nd = d - op->b + 1;
+            break;
+        case SEPL_BC_CALL_DIRECT: {
+            sepl_size func, at;
+            if (op->b >= d - low)
+                return 0;
+            if (op->a >= v->bpos || v->state[op->a] == 0 ||
+                v->bytes[op->a] != SEPL_BC_FRAME)
+                return 0;
+            func = v->owner[op->a];
+            at = func + 1;
+            sepl__rdvar(v->bytes, &at);
+            if (sepl__rdvar(v->bytes, &at) != op->b)
+                return 0;
+            /* The body is only checked where its FUNC is reached */
+            if (v->state[func] < 2)
+                v->late = pc;
+            nd = d - op->b;
+            break;
+        }
+        case SEPL_BC_TAILCALL:
+            /* Replaces the frame of the function it is in */
+            if (v->func == SEPL__VER_TOP || op->a != d || op->b >= d - low)
+                return 0;
+            nd = d - op->b;
+            break;
+
+        case SEPL_BC_POP:
+            /* May pop the scope of r too, which leaves it */
+            if (r != SEPL__VER_TOP && v->bytes[r] == SEPL_BC_SCOPE)
+                low--;
+            sepl__ver_pop(1);
+            nd = d - 1;
+            break;
+        case SEPL_BC_DROP:
+            sepl__ver_pop(op->a);
+            nd = d - op->a;
+            break;
+
+        case SEPL_BC_NONE:
+        case SEPL_BC_CONST:
+        case SEPL_BC_INT:
+        case SEPL_BC_STR:
+            nd = d + 1;
+            break;
+        case SEPL_BC_SCOPE:
+            if (!sepl__ver_flow(v, cur, op->a, d + 1))
+                return 0;
+            own = pc;
+            nd = d + 1;
+            break;
+        case SEPL_BC_FUNC:
+            if (!sepl__ver_flow(v, cur, op->a, d + 1) ||
+                !sepl__ver_flow(v, pc, op->next, 1 + op->b))
+                return 0;
+            v->fdepth = d;
+            if (d + 1 > v->peak)
+                v->peak = d + 1;
+            return 1;
+
+        case SEPL_BC_GET:
+            sepl__ver_read(op->a);
+            nd = d + 1;
+            break;
+        case SEPL_BC_SET:
+            sepl__ver_write(op->a);
+            sepl__ver_pop(1);
+            nd = d - 1;
+            break;
+        case SEPL_BC_GET_UP:
+            /* A function reaches its own slot and the values below */
+            if (op->a >= (v->func != SEPL__VER_TOP ? v->fdepth + 1 : d))
+                return 0;
+            nd = d + 1;
+            break;
+        case SEPL_BC_SET_UP:
+            slot = op->a;
+            if (v->func != SEPL__VER_TOP
+                    ? slot > v->fdepth ||
+                          sepl__ver_ismark(v, v->owner[v->func], slot)
+                    : slot >= d || sepl__ver_ismark(v, cur, slot))
+                return 0;
+            sepl__ver_pop(1);
+            nd = d - 1;
+            break;
+
+        case SEPL_BC_NEG:
+        case SEPL_BC_NOT:
+            sepl__ver_pop(1);
+            nd = d;
+            break;
+
+        case SEPL_BC_JUMP_LT:
+        case SEPL_BC_JUMP_LTE:
+        case SEPL_BC_JUMP_GT:
+        case SEPL_BC_JUMP_GTE:
+        case SEPL_BC_JUMP_EQ:
+        case SEPL_BC_JUMP_NEQ:
+        case SEPL_BC_JUMP_LT_NN:
+        case SEPL_BC_JUMP_LTE_NN:
+        case SEPL_BC_JUMP_GT_NN:
+        case SEPL_BC_JUMP_GTE_NN:
+        case SEPL_BC_JUMP_EQ_NN:
+        case SEPL_BC_JUMP_NEQ_NN:
+        case SEPL_BC_JUMP_LT_Q:
+        case SEPL_BC_JUMP_LTE_Q:
+        case SEPL_BC_JUMP_GT_Q:
+        case SEPL_BC_JUMP_GTE_Q:
+        case SEPL_BC_JUMP_EQ_Q:
+        case SEPL_BC_JUMP_NEQ_Q:
+            sepl__ver_pop(2);
+            nd = d - 2;
+            if (!sepl__ver_flow(v, cur, op->a, nd))
+                return 0;
+            break;
+        case SEPL_BC_JUMP_AND:
+        case SEPL_BC_JUMP_OR:
+            /* The short circuit value takes the place of the operand */
+            sepl__ver_pop(1);
+            nd = d - 1;
+            if (!sepl__ver_flow(v, cur, op->a, d))
+                return 0;
+            break;
+
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_ADD_INT_Q:
+            sepl__ver_read(op->a);
+            nd = d + 1;
+            break;
+        case SEPL_BC_INC:
+        case SEPL_BC_INC_NN:
+        case SEPL_BC_INC_Q:
+            sepl__ver_write(op->a);
+            nd = d;
+            break;
+        case SEPL_BC_FRAME:
+            v->fframe = op->a;
+            nd = d;
+            break;
+
+        default:
+            /* The binary operators */
+            sepl__ver_pop(2);
+            nd = d - 1;
+            break;
+    }
+
+#undef sepl__ver_pop
+#undef sepl__ver_read
+#undef sepl__ver_write
+
+    /* GET_CALL pushes the last argument before the call pops them */
+    hi = nd > d ? nd : d;
+    if (op->bc == SEPL_BC_GET_CALL || op->bc == SEPL_BC_GET_CALL_C ||
+        op->bc == SEPL_BC_GET_CALL_S)
+        hi = d + 1;
+    if (v->func != SEPL__VER_TOP) {
+        if (hi > v->fpeak)
+            v->fpeak = hi;
+    } else if (hi > v->peak) {
+        v->peak = hi;
+    }
+
+    if (op->bc == SEPL_BC_RETURN || op->bc == SEPL_BC_JUMP)
+        return 1;
+    return sepl__ver_flow(v, own, op->next, nd);
+}
+
+/* Checks that the function body left at its end fits its FRAME */
+SEPL_API void sepl__ver_leave(SeplVer *v) {
+    sepl_size params = 1 + v->fparams;
+    if (v->fpeak > params && v->fpeak - params > v->fframe)
+        v->late = v->func;
+    v->func = SEPL__VER_TOP;
+}
+
+SEPL_LIB SeplError sepl_ver_module(SeplModule *mod, SeplEnv env, void *buf,
+                                   sepl_size size) {
+    SeplError err = {0};
+    SeplVer v;
+    SeplVerOp op;
+    sepl_size pc = 0;
+
+    mod->verified = 0;
+    if (size < sepl_ver_bufsize(mod)) {
+        sepl_err_new(&err, SEPL_ERR_BOVERFLOW);
+        return err;
+    }
+
+    v.bytes = mod->bytes;
+    v.bpos = mod->bpos;
+    v.state = (sepl_size *)buf;
+    v.owner = v.state + mod->bpos;
+    v.start = env.predef_len + mod->esize;
+    v.fend = v.fparams = v.fframe = v.fdepth = v.fpeak = 0;
+    if (mod->kpos < mod->bpos || mod->kpos > mod->bsize ||
+        !sepl__ver_scan(mod, &v, &pc))
+        goto bad;
+
+    /* Sweep the code until no path reaches an instruction it did not */
+    if (v.bpos != 0)
+        v.state[0] = v.start + 2;
+    do {
+        v.changed = 0;
+        v.peak = v.start;
+        v.func = v.late = SEPL__VER_TOP;
+        for (pc = 0; pc < v.bpos; pc = op.next) {
+            if (v.func != SEPL__VER_TOP && pc == v.fend)
+                sepl__ver_leave(&v);
+            sepl__ver_decode(&v, pc, &op);
+            if (!sepl__ver_step(&v, pc, &op))
+                goto bad;
+            if (op.bc == SEPL_BC_FUNC) {
+                v.func = pc;
+                v.fend = op.a;
+                v.fparams = op.b;
+                v.fframe = v.fpeak = 0;
+            }
+        }
+        if (v.func != SEPL__VER_TOP)
+            sepl__ver_leave(&v);
+    } while (v.changed);
+
+    if (v.late != SEPL__VER_TOP) {
+        pc = v.late;
+        goto bad;
+    }
+    mod->verified = 1 + v.peak - v.start;
+    return err;
+
+bad:
+    sepl_err_new(&err, SEPL_ERR_BC);
+    err.info.bc = pc < mod->bpos ? (char)mod->bytes[pc] : 0;
+    return err;
 }
 
 #endif
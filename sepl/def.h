@@ -12,6 +12,23 @@ typedef SEPL_DEF_SIZE sepl_size;
 sepl__static_assert(sepl__is_unsigned(sepl_size), is_unsigned);
 #endif
 
+#ifdef SEPL_NANBOX
+/* NaN-boxed values need a 64 bit word and an integer wide enough to hold a
+ * pointer, override these where the defaults do not fit */
+#ifndef SEPL_DEF_U64
+typedef unsigned long long sepl_u64;
+#else
+typedef SEPL_DEF_U64 sepl_u64;
+#endif
+#ifndef SEPL_DEF_UPTR
+typedef unsigned long sepl_uptr;
+#else
+typedef SEPL_DEF_UPTR sepl_uptr;
+#endif
+sepl__static_assert(sizeof(sepl_u64) == 8, u64_is_8_bytes);
+sepl__static_assert(sizeof(sepl_uptr) >= sizeof(void *), uptr_holds_pointer);
+#endif
+
 #ifndef SEPL_NULL
 #ifdef __cplusplus
 #define SEPL_NULL nullptr
@@ -8,11 +8,15 @@ typedef struct {
     SeplValue value;
 } SeplValuePair;
 
-typedef struct {
+typedef struct SeplEnv {
     sepl_free_func free;
 
     SeplValuePair *predef;
     sepl_size predef_len;
+
+    /* Optional, frees the objects of an unwound scope in one call instead of
+     * one call to free each. They are gathered at the start of the scope */
+    sepl_free_batch_func free_batch;
 } SeplEnv;
 
 #endif
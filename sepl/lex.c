@@ -47,44 +47,215 @@ SEPL_LIB char sepl_to_special(char c) {
     return c;
 }
 
+/*
+ * Runs of whitespace, identifier characters and string contents are skipped
+ * by sepl__lex_run. With SEPL_SIMD defined and GCC or clang targeting AVX2
+ * or SSE2 they are scanned 32 or 16 bytes at a time. Loads are aligned so they
+ * never cross into the page after the terminating null.
+ */
+#define SEPL__RUN_SPACE 0
+#define SEPL__RUN_IDEN 1
+#define SEPL__RUN_STR 2
+/* Bytes scanned one at a time before switching to vectors */
+#define SEPL__SHORT 8
+
+#if defined(SEPL_SIMD) && defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define SEPL__VEC 32
+#define SEPL__VALL 0xffffffffu
+typedef __m256i sepl__vec;
+#define sepl__vload(p) _mm256_load_si256((const __m256i *)(p))
+#define sepl__vset(c) _mm256_set1_epi8(c)
+#define sepl__veq(a, b) _mm256_cmpeq_epi8(a, b)
+#define sepl__vgt(a, b) _mm256_cmpgt_epi8(a, b)
+#define sepl__vor(a, b) _mm256_or_si256(a, b)
+#define sepl__vand(a, b) _mm256_and_si256(a, b)
+#define sepl__vmask(v) ((unsigned)_mm256_movemask_epi8(v))
+#elif defined(SEPL_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SEPL__VEC 16
+#define SEPL__VALL 0xffffu
+typedef __m128i sepl__vec;
+#define sepl__vload(p) _mm_load_si128((const __m128i *)(p))
+#define sepl__vset(c) _mm_set1_epi8(c)
+#define sepl__veq(a, b) _mm_cmpeq_epi8(a, b)
+#define sepl__vgt(a, b) _mm_cmpgt_epi8(a, b)
+#define sepl__vor(a, b) _mm_or_si128(a, b)
+#define sepl__vand(a, b) _mm_and_si128(a, b)
+#define sepl__vmask(v) ((unsigned)_mm_movemask_epi8(v))
+#endif
+
+#ifdef SEPL__VEC
+/* Bytes of v in [lo, hi], signed so bytes above 127 never match */
+#define sepl__vin(v, lo, hi)                  \
+    sepl__vand(sepl__vgt(v, sepl__vset((lo)-1)), \
+               sepl__vgt(sepl__vset((hi) + 1), v))
+
+/*
+ * Sets a bit for each byte of the block that ends a run and for each newline
+ * in nl. The aligned loads may read past the terminating null, which the
+ * address sanitizer would report.
+ */
+__attribute__((no_sanitize_address)) SEPL_API unsigned
+sepl__lex_stops(const char *block, int run, unsigned *nl) {
+    sepl__vec v = sepl__vload(block), m;
+
+    switch (run) {
+        case SEPL__RUN_SPACE:
+            *nl = sepl__vmask(sepl__veq(v, sepl__vset('\n')));
+            m = sepl__vor(sepl__vor(sepl__veq(v, sepl__vset(' ')),
+                                    sepl__veq(v, sepl__vset('\n'))),
+                          sepl__vor(sepl__veq(v, sepl__vset('\r')),
+                                    sepl__veq(v, sepl__vset('\t'))));
+            return ~sepl__vmask(m) & SEPL__VALL;
+        case SEPL__RUN_IDEN:
+            m = sepl__vor(sepl__vin(v, '0', '9'),
+                          sepl__vin(sepl__vor(v, sepl__vset(0x20)), 'a', 'z'));
+            m = sepl__vor(m, sepl__veq(v, sepl__vset('_')));
+            return ~sepl__vmask(m) & SEPL__VALL;
+        default:
+            m = sepl__vor(sepl__veq(v, sepl__vset('"')),
+                          sepl__veq(v, sepl__vset('\\')));
+            m = sepl__vor(m, sepl__veq(v, sepl__vset(0)));
+            return sepl__vmask(m);
+    }
+}
+
+/* Returns the end of the run continuing at p, counting newlines in lines */
+__attribute__((noinline, no_sanitize_address)) SEPL_API const char *
+sepl__lex_vrun(const char *p, int run, sepl_size *lines) {
+    sepl_size off = (sepl_size)p & (SEPL__VEC - 1);
+    const char *block = p - off;
+    unsigned nl = 0, stops = sepl__lex_stops(block, run, &nl) >> off;
+
+    while (1) {
+        nl >>= off;
+        if (stops != 0)
+            nl &= (1u << __builtin_ctz(stops)) - 1;
+        for (; nl != 0; nl &= nl - 1) {
+            ++*lines;
+        }
+        if (stops != 0)
+            return block + off + __builtin_ctz(stops);
+        block += SEPL__VEC;
+        off = 0;
+        stops = sepl__lex_stops(block, run, &nl);
+    }
+}
+
+/* Most runs are a few bytes long, vectors are only used past the first few */
+SEPL_API const char *sepl__lex_run(const char *p, int run, sepl_size *lines) {
+    sepl_size n = SEPL__SHORT;
+
+    switch (run) {
+        case SEPL__RUN_SPACE:
+            for (; sepl_is_delim(*p); p++) {
+                if (*p == '\n')
+                    ++*lines;
+                if (--n == 0)
+                    return sepl__lex_vrun(p + 1, run, lines);
+            }
+            return p;
+        case SEPL__RUN_IDEN:
+            for (; sepl_is_identifier(*p); p++) {
+                if (--n == 0)
+                    return sepl__lex_vrun(p + 1, run, lines);
+            }
+            return p;
+        default:
+            for (; *p != '"' && *p != '\\' && *p != '\0'; p++) {
+                if (--n == 0)
+                    return sepl__lex_vrun(p + 1, run, lines);
+            }
+            return p;
+    }
+}
+
+#else
+SEPL_API const char *sepl__lex_run(const char *p, int run, sepl_size *lines) {
+    switch (run) {
+        case SEPL__RUN_SPACE:
+            for (; sepl_is_delim(*p); p++) {
+                if (*p == '\n')
+                    ++*lines;
+            }
+            return p;
+        case SEPL__RUN_IDEN:
+            while (sepl_is_identifier(*p)) {
+                p++;
+            }
+            return p;
+        default:
+            while (*p != '"' && *p != '\\' && *p != '\0') {
+                p++;
+            }
+            return p;
+    }
+}
+#endif
+
 SEPL_API SeplToken sepl__make_tok(SeplLexer *lex, SeplTokenT type) {
     SeplToken tok;
     tok.type = type;
     tok.start = lex->source - 1;
     tok.end = lex->source;
+    tok.line = lex->line;
     return tok;
 }
 
+/* Value of the digit c in base 10 or 16, -1 if it is none */
+SEPL_API int sepl__lex_digit(char c, int base) {
+    if (sepl_is_digit(c))
+        return sepl_to_digit(c);
+    if (base == 16 && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Skips one or more digits separated by single underscores, returns the end
+ * or SEPL_NULL if there are no digits or a separator is misplaced.
+ */
+SEPL_API const char *sepl__lex_digits(const char *c, int base) {
+    if (sepl__lex_digit(*c, base) < 0)
+        return SEPL_NULL;
+    while (1) {
+        c++;
+        if (*c == '_') {
+            if (sepl__lex_digit(*++c, base) < 0)
+                return SEPL_NULL;
+        } else if (sepl__lex_digit(*c, base) < 0) {
+            return c;
+        }
+    }
+}
+
+/* Numbers are 12, 1.5, 1., 1e-9, 2.5E+3, 0x1F and 1_000 */
 SEPL_API SeplToken sepl__make_number(SeplLexer *lex) {
     SeplToken tok;
-    char dot_found = 0;
+    const char *c = lex->source;
 
     tok.type = SEPL_TOK_NUM;
     tok.line = lex->line;
     tok.start = lex->source - 1;
-    tok.end = lex->source;
-
-    while (1) {
-        char c = *lex->source++;
 
-        if (sepl_is_digit(c)) {
-            ++tok.end;
-            continue;
-        }
-        if (c == '.') {
-            if (dot_found)
-                goto invalid_num;
-            dot_found = 1;
-            ++tok.end;
-            continue;
+    if (*tok.start == '0' && (*c == 'x' || *c == 'X')) {
+        c = sepl__lex_digits(c + 1, 16);
+    } else {
+        c = sepl__lex_digits(tok.start, 10);
+        if (c != SEPL_NULL && *c == '.')
+            c = sepl_is_digit(c[1]) ? sepl__lex_digits(c + 1, 10) : c + 1;
+        if (c != SEPL_NULL && (*c == 'e' || *c == 'E')) {
+            c++;
+            if (*c == '+' || *c == '-')
+                c++;
+            c = sepl__lex_digits(c, 10);
         }
-        if (sepl_is_alpha(c))
-            goto invalid_num;
-
-        --lex->source;
-        break;
     }
+    if (c == SEPL_NULL || sepl_is_identifier(*c) || *c == '.')
+        goto invalid_num;
 
+    tok.end = lex->source = c;
     return tok;
 
 invalid_num:
@@ -97,13 +268,16 @@ invalid_num:
 SEPL_API SeplToken sepl__make_string(SeplLexer *lex) {
     SeplToken tok;
     tok.type = SEPL_TOK_STRING;
+    tok.line = lex->line;
     tok.start = lex->source - 1;
     tok.end = lex->source;
 
-    while (*tok.end != '"' && *tok.end != '\0') {
-        if (*tok.end++ == '\\') {
+    while (1) {
+        tok.end = sepl__lex_run(tok.end, SEPL__RUN_STR, &lex->line);
+        if (*tok.end != '\\')
+            break;
+        if (*++tok.end != '\0')
             tok.end++;
-        }
     }
 
     if (*tok.end == '\0') {
@@ -120,12 +294,11 @@ SEPL_API SeplToken sepl__make_string(SeplLexer *lex) {
 SEPL_API SeplToken sepl__make_identifier(SeplLexer *lex) {
     SeplToken tok;
     tok.type = SEPL_TOK_IDENTIFIER;
+    tok.line = lex->line;
     tok.start = lex->source - 1;
-    tok.end = lex->source;
+    tok.end = sepl__lex_run(lex->source, SEPL__RUN_IDEN, &lex->line);
 
-    while (sepl_is_identifier(*tok.end++));
-
-    lex->source = --tok.end;
+    lex->source = tok.end;
     return tok;
 }
 
@@ -146,16 +319,13 @@ SEPL_API SeplToken sepl__make_keyword(SeplLexer *lex, const char *keyword,
 }
 
 SEPL_API SeplToken next_token(SeplLexer *lex) {
-    char c = *lex->source++;
+    char c;
+
+    if (sepl_is_delim(*lex->source))
+        lex->source = sepl__lex_run(lex->source, SEPL__RUN_SPACE, &lex->line);
+    c = *lex->source++;
 
     switch (c) {
-        case '\n':
-            ++lex->line;
-            return next_token(lex);
-        case ' ':
-        case '\r':
-        case '\t':
-            return next_token(lex);
         case ';':
             return sepl__make_tok(lex, SEPL_TOK_SEMICOLON);
         case ',':
@@ -275,30 +445,361 @@ SEPL_LIB SeplLexer sepl_lex_init(const char *source) {
 }
 
 SEPL_LIB SeplToken sepl_lex_next(SeplLexer *lex) {
-    SeplToken tok = next_token(lex);
-    lex->current = tok;
-    return tok;
+    if (lex->count != 0) {
+        lex->current = lex->ahead[lex->head];
+        lex->head = (lex->head + 1) & (SEPL_LEX_AHEAD - 1);
+        lex->count--;
+        return lex->current;
+    }
+    lex->current = next_token(lex);
+    return lex->current;
 }
 
-SEPL_LIB SeplToken sepl_lex_peek(SeplLexer lex) { return next_token(&lex); }
+SEPL_LIB SeplToken sepl_lex_peek(SeplLexer lex) {
+    return sepl_lex_ahead(&lex, 0);
+}
 
-SEPL_LIB double sepl_lex_num(SeplToken tok) {
-    double result = 0.0;
-    sepl_size factor = 10;
+SEPL_LIB SeplToken sepl_lex_ahead(SeplLexer *lex, sepl_size n) {
+    if (n >= SEPL_LEX_AHEAD)
+        n = SEPL_LEX_AHEAD - 1;
+    while (lex->count <= n) {
+        lex->ahead[(lex->head + lex->count) & (SEPL_LEX_AHEAD - 1)] =
+            next_token(lex);
+        lex->count++;
+    }
+    return lex->ahead[(lex->head + n) & (SEPL_LEX_AHEAD - 1)];
+}
+
+/*
+ * Number literals are converted with correct rounding, given doubles are not
+ * evaluated in extended precision. Literals with at most 15 significant digits
+ * and a small exponent are exact in a double and take a single multiplication
+ * or division. Others go through a decimal of up to SEPL__NUM_DIGITS digits
+ * that is shifted by powers of two until the binary exponent is known, then
+ * rounded to 53 bits.
+ */
+#define SEPL__NUM_EXACT 15
+#define SEPL__NUM_DIGITS 800
+#define SEPL__NUM_SHIFT ((int)sizeof(unsigned long) * 8 - 4)
+#define SEPL__NUM_2P52 4503599627370496.0
+
+static const double sepl__num_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* 0.d[0]d[1]...d[nd - 1] * 10^dp, trunc is set if nonzero digits were cut */
+typedef struct {
+    unsigned char d[SEPL__NUM_DIGITS + 1];
+    int nd;
+    int dp;
+    char trunc;
+} SeplLexDecimal;
+
+/* Exponent of the literal at c if any, clamped far outside the double range */
+SEPL_API int sepl__num_exp(const char *c, const char *end) {
+    int e = 0, sign = 1;
+
+    if (c == end)
+        return 0;
+    if (*++c == '-' || *c == '+')
+        sign = *c++ == '-' ? -1 : 1;
+    for (; c != end; c++) {
+        if (*c != '_' && e < 100000)
+            e = e * 10 + sepl_to_digit(*c);
+    }
+    return sign * e;
+}
+
+SEPL_API void sepl__dec_trim(SeplLexDecimal *a) {
+    while (a->nd > 0 && a->d[a->nd - 1] == 0) {
+        a->nd--;
+    }
+    if (a->nd == 0)
+        a->dp = 0;
+}
 
-    for (; tok.start != tok.end;) {
-        char c = *tok.start++;
-        if (c == '.') {
+/* Divides by 2^k, k <= SEPL__NUM_SHIFT */
+SEPL_API void sepl__dec_rshift(SeplLexDecimal *a, int k) {
+    unsigned long n = 0, dig, mask = ((unsigned long)1 << k) - 1;
+    int r = 0, w = 0;
+
+    for (; (n >> k) == 0; r++) {
+        if (r >= a->nd) {
+            if (n == 0) {
+                a->nd = 0;
+                return;
+            }
+            while ((n >> k) == 0) {
+                n *= 10;
+                r++;
+            }
             break;
         }
-        result = result * 10 + sepl_to_digit(c);
+        n = n * 10 + a->d[r];
+    }
+    a->dp -= r - 1;
+
+    for (; r < a->nd; r++) {
+        dig = n >> k;
+        n &= mask;
+        a->d[w++] = (unsigned char)dig;
+        n = n * 10 + a->d[r];
+    }
+    while (n > 0) {
+        dig = n >> k;
+        n &= mask;
+        if (w < SEPL__NUM_DIGITS)
+            a->d[w++] = (unsigned char)dig;
+        else if (dig > 0)
+            a->trunc = 1;
+        n *= 10;
+    }
+    a->nd = w;
+    sepl__dec_trim(a);
+}
+
+/* Multiplies by 2^k, k <= SEPL__NUM_SHIFT */
+SEPL_API void sepl__dec_lshift(SeplLexDecimal *a, int k) {
+    /* At most floor(k * log10(2)) + 1 new digits */
+    int delta = ((k * 1233) >> 12) + 1, r = a->nd, w = a->nd + delta, i;
+    unsigned long n = 0, quo;
+
+    while (r > 0 || n > 0) {
+        if (r > 0)
+            n += (unsigned long)a->d[--r] << k;
+        quo = n / 10;
+        if (--w <= SEPL__NUM_DIGITS)
+            a->d[w] = (unsigned char)(n - quo * 10);
+        else if (n - quo * 10 != 0)
+            a->trunc = 1;
+        n = quo;
+    }
+
+    a->nd += delta;
+    a->dp += delta;
+    if (w == 1) {
+        for (i = 1; i <= SEPL__NUM_DIGITS && i < a->nd; i++) {
+            a->d[i - 1] = a->d[i];
+        }
+        a->nd--;
+        a->dp--;
+    }
+    if (a->nd > SEPL__NUM_DIGITS) {
+        if (w == 0 && a->d[SEPL__NUM_DIGITS] != 0)
+            a->trunc = 1;
+        a->nd = SEPL__NUM_DIGITS;
+    }
+    sepl__dec_trim(a);
+}
+
+SEPL_API void sepl__dec_shift(SeplLexDecimal *a, int k) {
+    for (; k > SEPL__NUM_SHIFT; k -= SEPL__NUM_SHIFT) {
+        sepl__dec_lshift(a, SEPL__NUM_SHIFT);
+    }
+    for (; k < -SEPL__NUM_SHIFT; k += SEPL__NUM_SHIFT) {
+        sepl__dec_rshift(a, SEPL__NUM_SHIFT);
+    }
+    if (k > 0)
+        sepl__dec_lshift(a, k);
+    else if (k < 0)
+        sepl__dec_rshift(a, -k);
+}
+
+/* Integer part rounded half to even, the decimal holds at most 54 bits */
+SEPL_API double sepl__dec_round(SeplLexDecimal *a) {
+    double n = 0;
+    char up;
+    int i;
+
+    for (i = 0; i < a->dp && i < a->nd; i++) {
+        n = n * 10 + a->d[i];
+    }
+    for (; i < a->dp; i++) {
+        n *= 10;
+    }
+    if (a->dp < 0 || a->dp >= a->nd)
+        return n;
+    if (a->d[a->dp] == 5 && a->dp + 1 == a->nd)
+        up = a->trunc || (a->dp > 0 && a->d[a->dp - 1] % 2 == 1);
+    else
+        up = a->d[a->dp] >= 5;
+    return up ? n + 1 : n;
+}
+
+/* x * 2^e, exact unless the result overflows */
+SEPL_API double sepl__num_scale(double x, int e) {
+    double p = 1, b = 2;
+    int k = e < 0 ? -e : e;
+
+    /* 2^k is only built for k <= 1000 so that it is finite */
+    for (; k > 1000; k -= 1000) {
+        p = sepl__num_scale(1, 1000);
+        x = e < 0 ? x / p : x * p;
+        p = 1;
+    }
+    for (; k != 0; k >>= 1, b *= b) {
+        if (k & 1)
+            p *= b;
+    }
+    return e < 0 ? x / p : x * p;
+}
+
+SEPL_API double sepl__dec_value(SeplLexDecimal *a) {
+    /* Binary shifts that keep the decimal point in place for dp = 0..8 */
+    static const int powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+    int exp = 0, n;
+    double mant;
+
+    if (a->nd == 0 || a->dp < -330)
+        return 0;
+    if (a->dp > 310)
+        return sepl__num_scale(1, 2048);
+
+    /* Scale to [0.5, 1) */
+    while (a->dp > 0) {
+        n = a->dp >= 9 ? 27 : powtab[a->dp];
+        sepl__dec_shift(a, -n);
+        exp += n;
+    }
+    while (a->dp < 0 || (a->dp == 0 && a->d[0] < 5)) {
+        n = -a->dp >= 9 ? 27 : powtab[-a->dp];
+        sepl__dec_shift(a, n);
+        exp -= n;
+    }
+
+    /* Now in [1, 2) * 2^exp, subnormals keep fewer bits */
+    exp--;
+    if (exp < -1022) {
+        sepl__dec_shift(a, exp + 1022);
+        exp = -1022;
+    }
+    if (exp > 1023)
+        return sepl__num_scale(1, 2048);
+
+    sepl__dec_shift(a, 53);
+    mant = sepl__dec_round(a);
+    if (mant == 2 * SEPL__NUM_2P52) {
+        mant /= 2;
+        if (++exp > 1023)
+            return sepl__num_scale(1, 2048);
+    }
+    return sepl__num_scale(mant, exp - 52);
+}
+
+/* Reads the digits and exponent of a decimal literal into a */
+SEPL_API double sepl__num_slow(const char *c, const char *end) {
+    SeplLexDecimal a;
+    char frac = 0;
+    int d;
+
+    a.nd = a.dp = 0;
+    a.trunc = 0;
+    for (; c != end && *c != 'e' && *c != 'E'; c++) {
+        if (*c == '_')
+            continue;
+        if (*c == '.') {
+            frac = 1;
+            continue;
+        }
+        d = sepl_to_digit(*c);
+        if (a.nd == 0 && d == 0) {
+            a.dp -= frac;
+            continue;
+        }
+        a.dp += !frac;
+        if (a.nd < SEPL__NUM_DIGITS)
+            a.d[a.nd++] = (unsigned char)d;
+        else if (d != 0)
+            a.trunc = 1;
     }
+    a.dp += sepl__num_exp(c, end);
+    sepl__dec_trim(&a);
+    return sepl__dec_value(&a);
+}
 
-    for (; tok.start != tok.end;) {
-        char c = *tok.start++;
-        result = result + ((double)sepl_to_digit(c) / factor);
-        factor *= 10;
+/* Hexadecimal integers are rounded half to even past 53 bits */
+SEPL_API double sepl__num_hex(const char *c, const char *end) {
+    double m = 0;
+    int shift = 0, bit, b, d;
+    char half = 0, sticky = 0, odd = 0;
+
+    for (; c != end; c++) {
+        if (*c == '_')
+            continue;
+        d = sepl__lex_digit(*c, 16);
+        for (b = 3; b >= 0; b--) {
+            bit = (d >> b) & 1;
+            if (m < SEPL__NUM_2P52) {
+                m = m * 2 + bit;
+                odd = (char)bit;
+            } else if (shift++ == 0) {
+                half = (char)bit;
+            } else {
+                sticky |= (char)bit;
+            }
+        }
     }
+    if (half && (sticky || odd))
+        m += 1;
+    return sepl__num_scale(m, shift);
+}
+
+SEPL_LIB double sepl_lex_num(SeplToken tok) {
+    const char *c = tok.start;
+    double mant = 0;
+    int nd = 0, e = 0, d;
+    char frac = 0;
 
-    return result;
+    if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X'))
+        return sepl__num_hex(c + 2, tok.end);
+
+    for (; c != tok.end && *c != 'e' && *c != 'E'; c++) {
+        if (*c == '_')
+            continue;
+        if (*c == '.') {
+            frac = 1;
+            continue;
+        }
+        d = sepl_to_digit(*c);
+        e -= frac;
+        if (nd == 0 && d == 0)
+            continue;
+        if (++nd > SEPL__NUM_EXACT)
+            return sepl__num_slow(tok.start, tok.end);
+        mant = mant * 10 + d;
+    }
+    e += sepl__num_exp(c, tok.end);
+
+    /* Both operands are exact so the result is rounded once */
+    if (mant == 0)
+        return 0;
+    if (e >= 0 && e <= 22)
+        return mant * sepl__num_pow10[e];
+    if (e < 0 && e >= -22)
+        return mant / sepl__num_pow10[-e];
+    if (e > 22 && e - 22 <= SEPL__NUM_EXACT - nd)
+        return mant * sepl__num_pow10[e - 22] * 1e22;
+    return sepl__num_slow(tok.start, tok.end);
 }
+
+#undef SEPL__NUM_EXACT
+#undef SEPL__NUM_DIGITS
+#undef SEPL__NUM_SHIFT
+#undef SEPL__NUM_2P52
+
+#undef SEPL__RUN_SPACE
+#undef SEPL__RUN_IDEN
+#undef SEPL__RUN_STR
+#undef SEPL__SHORT
+#ifdef SEPL__VEC
+#undef SEPL__VEC
+#undef SEPL__VALL
+#undef sepl__vload
+#undef sepl__vset
+#undef sepl__veq
+#undef sepl__vgt
+#undef sepl__vor
+#undef sepl__vand
+#undef sepl__vmask
+#undef sepl__vin
+#endif
@@ -54,10 +54,21 @@ typedef struct {
     sepl_size line;
 } SeplToken;
 
+/* Tokens kept ahead of the current one, must be a power of two */
+#define SEPL_LEX_AHEAD 4
+
+/*
+ * Peeked tokens are kept in a ring buffer so every token is scanned once.
+ * source and line are the position of the scanner, which can be ahead of
+ * the current token, the line of a token is stored in the token itself.
+ */
 typedef struct {
     const char *source;
     sepl_size line;
     SeplToken current;
+    SeplToken ahead[SEPL_LEX_AHEAD];
+    unsigned char head;
+    unsigned char count;
 } SeplLexer;
 
 SEPL_LIB char sepl_is_digit(char c);
@@ -70,6 +81,8 @@ SEPL_LIB char sepl_to_special(char c);
 SEPL_LIB SeplLexer sepl_lex_init(const char *source);
 SEPL_LIB SeplToken sepl_lex_next(SeplLexer *lex);
 SEPL_LIB SeplToken sepl_lex_peek(SeplLexer lex);
+/* Returns the token n places after the current one, n < SEPL_LEX_AHEAD */
+SEPL_LIB SeplToken sepl_lex_ahead(SeplLexer *lex, sepl_size n);
 SEPL_LIB double sepl_lex_num(SeplToken tok);
 
 #endif
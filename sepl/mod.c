@@ -6,40 +6,399 @@
 SEPL_LIB SeplModule sepl_mod_new(unsigned char bytes[], sepl_size bsize,
                                  SeplValue values[], sepl_size vsize) {
     SeplModule mod = {0};
+#ifdef SEPL_ALIGNED
+    /* Align the end of the buffer so pooled numbers are naturally aligned */
+    sepl_size rem = (sepl_size)((unsigned long)(bytes + bsize) % SEPL_KSLOT);
+    bsize = bsize > rem ? bsize - rem : 0;
+#endif
     mod.bytes = bytes;
     mod.bsize = bsize;
+    mod.kpos = bsize;
     mod.values = values;
     mod.vsize = vsize;
     return mod;
 }
 
+SEPL_LIB void sepl_mod_setobjmap(SeplModule *mod, unsigned char map[],
+                                 sepl_size size) {
+    sepl_size i;
+    if (size < sepl_mod_mapsize(mod->vsize)) {
+        mod->objmap = SEPL_NULL;
+        return;
+    }
+    for (i = 0; i < sepl_mod_mapsize(mod->vsize); i++) {
+        map[i] = 0;
+    }
+    mod->objmap = map;
+}
+
+/* Records the most the code and the pool take together in a sink */
+SEPL_API void sepl__sinkneed(SeplModule *mod, sepl_size bpos) {
+    sepl_size need = bpos + (mod->bsize - mod->kpos);
+    if (need > mod->sink->need)
+        mod->sink->need = need;
+}
+
+/* Where the next len bytes of code go, a sink slides its window over the
+ * code to keep the latest half of it */
+SEPL_API unsigned char *sepl__bcat(SeplModule *mod, sepl_size len) {
+    SeplSink *sink = mod->sink;
+    sepl_size base, i;
+
+    if (sink == SEPL_NULL)
+        return mod->bytes + mod->bpos;
+
+    sepl__sinkneed(mod, mod->bpos + len);
+    if (mod->bpos < sink->bbase)
+        sink->bbase = mod->bpos;
+    if (mod->bpos + len - sink->bbase > SEPL_SINK_CODE) {
+        base = mod->bpos - SEPL_SINK_CODE / 2;
+        for (i = 0; i < SEPL_SINK_CODE / 2; i++) {
+            sink->bytes[i] = sink->bytes[base - sink->bbase + i];
+        }
+        sink->bbase = base;
+    }
+    return sink->bytes + (mod->bpos - sink->bbase);
+}
+
+/* Slides the pool window of a sink down to the constant just reserved at
+ * kpos, keeping the latest constants above it */
+SEPL_API void sepl__kslide(SeplModule *mod, sepl_size okpos) {
+    SeplSink *sink = mod->sink;
+    sepl_size base, end, pos;
+
+    sepl__sinkneed(mod, mod->bpos);
+    if (mod->kpos - sink->kbase >= SEPL_SINK_CODE &&
+        mod->kpos - sink->kbase < sizeof(sink->bytes))
+        return;
+
+    base = mod->kpos - SEPL_SINK_CODE - SEPL_SINK_POOL / 4;
+    end = base + sizeof(sink->bytes);
+    /* Constants still in the window move up in it, from the far end */
+    for (pos = end; pos-- > okpos;) {
+        if (pos - sink->kbase >= SEPL_SINK_CODE &&
+            pos - sink->kbase < sizeof(sink->bytes))
+            sink->bytes[pos - base] = sink->bytes[pos - sink->kbase];
+    }
+    sink->kbase = base;
+}
+
+SEPL_LIB unsigned char *sepl__baddr(SeplModule *mod, sepl_size pos) {
+    SeplSink *sink = mod->sink;
+    sepl_size at;
+
+    if (sink == SEPL_NULL)
+        return mod->bytes + pos;
+    if (pos < mod->kpos) {
+        at = pos - sink->bbase;
+        return at < SEPL_SINK_CODE ? sink->bytes + at : SEPL_NULL;
+    }
+    at = pos - sink->kbase;
+    return at >= SEPL_SINK_CODE && at < sizeof(sink->bytes) ? sink->bytes + at
+                                                            : SEPL_NULL;
+}
+
 SEPL_LIB sepl_size sepl_mod_bc(SeplModule *mod, SeplBC bc, SeplError *e) {
-    if (mod->bpos + 1 > mod->bsize) {
+    if (mod->bpos + 1 > mod->kpos) {
         sepl_err_new(e, SEPL_ERR_BOVERFLOW);
         return 0;
     }
-    mod->bytes[mod->bpos] = bc;
+    *sepl__bcat(mod, 1) = bc;
     return mod->bpos++;
 }
 
-SEPL_LIB sepl_size sepl_mod_bcnum(SeplModule *mod, double n, SeplError *e) {
-    if (mod->bpos + sizeof(n) > mod->bsize) {
+SEPL_LIB sepl_size sepl__varlen(sepl_size v) {
+    sepl_size len = 1;
+    while (v >>= 7) len++;
+    return len;
+}
+
+SEPL_LIB sepl_size sepl__rdvar(const unsigned char *bytes, sepl_size *pc) {
+    sepl_size v = 0, shift = 0;
+    unsigned char b;
+    do {
+        b = bytes[(*pc)++];
+        v |= (sepl_size)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+SEPL_API double sepl__lddbl(const unsigned char *p) {
+    union {
+        double d;
+        unsigned char b[sizeof(double)];
+    } u;
+    sepl_size i;
+    for (i = 0; i < sizeof(double); i++) {
+        u.b[i] = p[i];
+    }
+    return u.d;
+}
+
+SEPL_LIB void sepl__wrvar(unsigned char *at, sepl_size v, sepl_size len) {
+    while (--len) {
+        *at++ = (unsigned char)(v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *at = (unsigned char)v;
+}
+
+SEPL_API sepl_size sepl__bcvar(SeplModule *mod, sepl_size v, sepl_size len,
+                               SeplError *e) {
+    if (mod->bpos + len > mod->kpos) {
         sepl_err_new(e, SEPL_ERR_BOVERFLOW);
         return 0;
     }
-    *(double *)(mod->bytes + mod->bpos) = n;
-    mod->bpos += sizeof(n);
-    return mod->bpos - sizeof(n);
+    sepl__wrvar(sepl__bcat(mod, len), v, len);
+    mod->bpos += len;
+    return mod->bpos - len;
 }
 
-SEPL_LIB sepl_size sepl_mod_bcsize(SeplModule *mod, sepl_size s, SeplError *e) {
-    if (mod->bpos + sizeof(s) > mod->bsize) {
+/* Reserves n bytes in the constant pool and returns the slot index */
+SEPL_API sepl_size sepl__kalloc(SeplModule *mod, sepl_size n, SeplError *e) {
+    sepl_size slots = (n + SEPL_KSLOT - 1) / SEPL_KSLOT;
+    if (mod->kpos < mod->bpos + slots * SEPL_KSLOT) {
         sepl_err_new(e, SEPL_ERR_BOVERFLOW);
         return 0;
     }
-    *(sepl_size *)(mod->bytes + mod->bpos) = s;
-    mod->bpos += sizeof(s);
-    return mod->bpos - sizeof(s);
+    mod->kpos -= slots * SEPL_KSLOT;
+    if (mod->sink != SEPL_NULL)
+        sepl__kslide(mod, mod->kpos + slots * SEPL_KSLOT);
+    return (mod->bsize - mod->kpos) / SEPL_KSLOT;
+}
+
+SEPL_LIB sepl_size sepl_mod_bcnum(SeplModule *mod, double n, SeplError *e) {
+    const unsigned char *nb = (const unsigned char *)&n;
+    sepl_size k, i, top = (mod->bsize - mod->kpos) / SEPL_KSLOT;
+
+    /* Reuse one of the recently pooled constants */
+    for (k = top; k > 0 && k + 16 > top; k--) {
+        const unsigned char *kb =
+            sepl__baddr(mod, mod->bsize - k * SEPL_KSLOT);
+        if (kb == SEPL_NULL)
+            break;
+        for (i = 0; i < sizeof(n) && kb[i] == nb[i]; i++);
+        if (i == sizeof(n))
+            return sepl_mod_bcsize(mod, k, e);
+    }
+
+    k = sepl__kalloc(mod, sizeof(n), e);
+    if (k == 0)
+        return 0;
+    for (i = 0; i < sizeof(n); i++) {
+        sepl__baddr(mod, mod->kpos)[i] = nb[i];
+    }
+    return sepl_mod_bcsize(mod, k, e);
+}
+
+SEPL_LIB sepl_size sepl_mod_bcstr(SeplModule *mod, sepl_size len,
+                                  SeplError *e) {
+    sepl_size k = sepl__kalloc(mod, len + 1, e);
+    if (k == 0)
+        return 0;
+    sepl_mod_bcsize(mod, k, e);
+    return mod->kpos;
+}
+
+SEPL_LIB sepl_size sepl_mod_bcsize(SeplModule *mod, sepl_size s,
+                                   SeplError *e) {
+    return sepl__bcvar(mod, s, sepl__varlen(s), e);
+}
+
+SEPL_LIB sepl_size sepl_mod_bcaddr(SeplModule *mod, sepl_size a,
+                                   SeplError *e) {
+    return sepl__bcvar(mod, a, sepl__varlen(mod->bsize), e);
+}
+
+SEPL_LIB void sepl_mod_setaddr(SeplModule *mod, sepl_size pos, sepl_size a) {
+    unsigned char *at = sepl__baddr(mod, pos);
+    /* A sink has dropped the code, the width of the address is all it needs */
+    if (at != SEPL_NULL)
+        sepl__wrvar(at, a, sepl__varlen(mod->bsize));
+}
+
+/* Position of the instruction after the one at pc */
+SEPL_LIB sepl_size sepl__bcnext(const unsigned char *bytes, sepl_size pc) {
+    switch (bytes[pc++]) {
+        case SEPL_BC_INT:
+            return pc + 1;
+        case SEPL_BC_FUNC:
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+        case SEPL_BC_CALL_DIRECT:
+        case SEPL_BC_TAILCALL:
+            sepl__rdvar(bytes, &pc);
+            sepl__rdvar(bytes, &pc);
+            return pc;
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_INC:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_INC_NN:
+        case SEPL_BC_ADD_INT_Q:
+        case SEPL_BC_INC_Q:
+            sepl__rdvar(bytes, &pc);
+            return pc + 1;
+        case SEPL_BC_RETURN:
+        case SEPL_BC_JUMPIF:
+        case SEPL_BC_JUMP:
+        case SEPL_BC_CALL:
+        case SEPL_BC_DROP:
+        case SEPL_BC_CONST:
+        case SEPL_BC_STR:
+        case SEPL_BC_SCOPE:
+        case SEPL_BC_GET:
+        case SEPL_BC_SET:
+        case SEPL_BC_GET_UP:
+        case SEPL_BC_SET_UP:
+        case SEPL_BC_JUMP_LT:
+        case SEPL_BC_JUMP_LTE:
+        case SEPL_BC_JUMP_GT:
+        case SEPL_BC_JUMP_GTE:
+        case SEPL_BC_JUMP_EQ:
+        case SEPL_BC_JUMP_NEQ:
+        case SEPL_BC_JUMP_AND:
+        case SEPL_BC_JUMP_OR:
+        case SEPL_BC_JUMP_LT_NN:
+        case SEPL_BC_JUMP_LTE_NN:
+        case SEPL_BC_JUMP_GT_NN:
+        case SEPL_BC_JUMP_GTE_NN:
+        case SEPL_BC_JUMP_EQ_NN:
+        case SEPL_BC_JUMP_NEQ_NN:
+        case SEPL_BC_JUMP_LT_Q:
+        case SEPL_BC_JUMP_LTE_Q:
+        case SEPL_BC_JUMP_GT_Q:
+        case SEPL_BC_JUMP_GTE_Q:
+        case SEPL_BC_JUMP_EQ_Q:
+        case SEPL_BC_JUMP_NEQ_Q:
+        case SEPL_BC_CALL_C:
+        case SEPL_BC_CALL_S:
+        case SEPL_BC_FRAME:
+            sepl__rdvar(bytes, &pc);
+            return pc;
+        default:
+            return pc;
+    }
+}
+
+/*
+ * Values pushed minus values popped by the instruction at pc when execution
+ * falls through it. RETURN is counted as zero, the compiler only emits code
+ * after it that expects the returned value on the stack.
+ */
+SEPL_LIB long sepl__bcstack(const unsigned char *bytes, sepl_size pc) {
+    switch (bytes[pc++]) {
+        case SEPL_BC_NONE:
+        case SEPL_BC_CONST:
+        case SEPL_BC_INT:
+        case SEPL_BC_STR:
+        case SEPL_BC_SCOPE:
+        case SEPL_BC_FUNC:
+        case SEPL_BC_GET:
+        case SEPL_BC_GET_UP:
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_ADD_INT_Q:
+            return 1;
+        case SEPL_BC_CALL:
+        case SEPL_BC_CALL_C:
+        case SEPL_BC_CALL_S:
+        case SEPL_BC_DROP:
+            return -(long)sepl__rdvar(bytes, &pc);
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+            sepl__rdvar(bytes, &pc);
+            return 1 - (long)sepl__rdvar(bytes, &pc);
+        case SEPL_BC_CALL_DIRECT:
+        case SEPL_BC_TAILCALL:
+            sepl__rdvar(bytes, &pc);
+            return -(long)sepl__rdvar(bytes, &pc);
+        case SEPL_BC_JUMPIF:
+        case SEPL_BC_POP:
+        case SEPL_BC_SET:
+        case SEPL_BC_SET_UP:
+        case SEPL_BC_ADD:
+        case SEPL_BC_SUB:
+        case SEPL_BC_MUL:
+        case SEPL_BC_DIV:
+        case SEPL_BC_AND:
+        case SEPL_BC_OR:
+        case SEPL_BC_LT:
+        case SEPL_BC_LTE:
+        case SEPL_BC_GT:
+        case SEPL_BC_GTE:
+        case SEPL_BC_EQ:
+        case SEPL_BC_NEQ:
+        case SEPL_BC_JUMP_AND:
+        case SEPL_BC_JUMP_OR:
+        case SEPL_BC_ADD_NN:
+        case SEPL_BC_SUB_NN:
+        case SEPL_BC_MUL_NN:
+        case SEPL_BC_DIV_NN:
+        case SEPL_BC_LT_NN:
+        case SEPL_BC_LTE_NN:
+        case SEPL_BC_GT_NN:
+        case SEPL_BC_GTE_NN:
+        case SEPL_BC_EQ_NN:
+        case SEPL_BC_NEQ_NN:
+        case SEPL_BC_ADD_Q:
+        case SEPL_BC_SUB_Q:
+        case SEPL_BC_MUL_Q:
+        case SEPL_BC_DIV_Q:
+        case SEPL_BC_LT_Q:
+        case SEPL_BC_LTE_Q:
+        case SEPL_BC_GT_Q:
+        case SEPL_BC_GTE_Q:
+        case SEPL_BC_EQ_Q:
+        case SEPL_BC_NEQ_Q:
+            return -1;
+        case SEPL_BC_JUMP_LT:
+        case SEPL_BC_JUMP_LTE:
+        case SEPL_BC_JUMP_GT:
+        case SEPL_BC_JUMP_GTE:
+        case SEPL_BC_JUMP_EQ:
+        case SEPL_BC_JUMP_NEQ:
+        case SEPL_BC_JUMP_LT_NN:
+        case SEPL_BC_JUMP_LTE_NN:
+        case SEPL_BC_JUMP_GT_NN:
+        case SEPL_BC_JUMP_GTE_NN:
+        case SEPL_BC_JUMP_EQ_NN:
+        case SEPL_BC_JUMP_NEQ_NN:
+        case SEPL_BC_JUMP_LT_Q:
+        case SEPL_BC_JUMP_LTE_Q:
+        case SEPL_BC_JUMP_GT_Q:
+        case SEPL_BC_JUMP_GTE_Q:
+        case SEPL_BC_JUMP_EQ_Q:
+        case SEPL_BC_JUMP_NEQ_Q:
+            return -2;
+        default:
+            return 0;
+    }
+}
+
+/* Generic form of a number only or quickened instruction, with the same
+ * operands */
+SEPL_LIB SeplBC sepl__bcgeneric(SeplBC bc) {
+    if (bc >= SEPL_BC_ADD_Q && bc <= SEPL_BC_INC_Q)
+        bc = (SeplBC)(bc - SEPL_BC_ADD_Q + SEPL_BC_ADD_NN);
+    else if (bc == SEPL_BC_CALL_C || bc == SEPL_BC_CALL_S)
+        return SEPL_BC_CALL;
+    else if (bc == SEPL_BC_GET_CALL_C || bc == SEPL_BC_GET_CALL_S)
+        return SEPL_BC_GET_CALL;
+
+    if (bc >= SEPL_BC_ADD_NN && bc <= SEPL_BC_DIV_NN)
+        return (SeplBC)(bc - SEPL_BC_ADD_NN + SEPL_BC_ADD);
+    else if (bc >= SEPL_BC_LT_NN && bc <= SEPL_BC_NEQ_NN)
+        return (SeplBC)(bc - SEPL_BC_LT_NN + SEPL_BC_LT);
+    else if (bc >= SEPL_BC_JUMP_LT_NN && bc <= SEPL_BC_JUMP_NEQ_NN)
+        return (SeplBC)(bc - SEPL_BC_JUMP_LT_NN + SEPL_BC_JUMP_LT);
+    else if (bc == SEPL_BC_ADD_INT_NN)
+        return SEPL_BC_ADD_INT;
+    else if (bc == SEPL_BC_INC_NN)
+        return SEPL_BC_INC;
+    return bc;
 }
 
 SEPL_LIB sepl_size sepl_mod_val(SeplModule *mod, SeplValue v, SeplError *e) {
@@ -54,6 +413,53 @@ SEPL_LIB sepl_size sepl_mod_val(SeplModule *mod, SeplValue v, SeplError *e) {
 
 SEPL_API void sepl__free(SeplValue _) { (void)_; }
 
+/* Marks slot i as holding an object */
+SEPL_API void sepl__mark(SeplModule *mod, sepl_size i) {
+    if (mod->objmap != SEPL_NULL)
+        mod->objmap[i / 8] |= (unsigned char)(1u << (i % 8));
+}
+
+/* Frees the objects in the marked slots of values[from, to) and unmarks them.
+ * An object keep refers to is returned instead, else keep itself */
+SEPL_API SeplValue sepl__objfree(SeplModule *mod, sepl_size from,
+                                 sepl_size to, SeplValue keep, SeplEnv env) {
+    unsigned char *map = mod->objmap;
+    SeplValue *values = mod->values;
+    sepl_size i = from, n = 0;
+
+    while (i < to) {
+        SeplValue v;
+        /* Without a bitmap every slot is looked at */
+        if (map != SEPL_NULL) {
+            if (!(map[i / 8] >> (i % 8))) {
+                i = (i / 8 + 1) * 8;
+                continue;
+            }
+            if (!(map[i / 8] >> (i % 8) & 1)) {
+                i++;
+                continue;
+            }
+            map[i / 8] &= (unsigned char)~(1u << (i % 8));
+        }
+
+        v = values[i];
+        if (sepl_val_isref(keep) &&
+            sepl_val_getobj(keep) == (void *)(values + i)) {
+            keep = v;
+        } else if (sepl_val_isobj(v)) {
+            /* Slots below i are already visited */
+            if (env.free_batch != SEPL_NULL)
+                values[from + n++] = v;
+            else
+                env.free(v);
+        }
+        i++;
+    }
+    if (n != 0)
+        env.free_batch(values + from, n);
+    return keep;
+}
+
 SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env) {
     sepl_size i;
     mod->vpos = 0;
@@ -72,304 +478,1119 @@ SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env) {
 }
 
 SEPL_LIB void sepl_mod_cleanup(SeplModule *mod, SeplEnv env) {
-    sepl_size i;
-    for (i = mod->vpos; i-- > env.predef_len;) {
-        SeplValue v = mod->values[i];
-        if (sepl_val_isobj(v))
-            env.free(v);
+    if (env.free == SEPL_NULL) {
+        env.free = sepl__free;
     }
+    if (mod->vpos > env.predef_len)
+        sepl__objfree(mod, env.predef_len, mod->vpos, SEPL_NONE, env);
 }
 
 SEPL_API double sepl__todbl(SeplError *err, SeplValue v) {
     if (sepl_val_isnum(v)) {
-        return v.as.num;
+        return sepl_val_getnum(v);
     } else if (sepl_val_isref(v)) {
-        return sepl__todbl(err, *(SeplValue *)v.as.obj);
+        return sepl__todbl(err, *(SeplValue *)sepl_val_getobj(v));
     }
     sepl_err_new(err, SEPL_ERR_OPER);
     return 0.0;
 }
 
-SEPL_LIB SeplValue sepl_mod_step(SeplModule *mod, SeplError *e, SeplEnv env) {
-#define sepl__rddbl()           \
-    (mod->pc += sizeof(double), \
-     *(double *)(mod->bytes + mod->pc - sizeof(double)))
-#define sepl__rdsz()               \
-    (mod->pc += sizeof(sepl_size), \
-     *(sepl_size *)(mod->bytes + mod->pc - sizeof(sepl_size)))
-
-#define sepl__pushv(val) (sepl_mod_val(mod, val, e))
-#define sepl__popv()                \
-    (mod->vpos > env.predef_len     \
-         ? mod->values[--mod->vpos] \
-         : (sepl_err_new(e, SEPL_ERR_VUNDERFLOW), SEPL_NONE))
-#define sepl__peekv(offset) (mod->values[mod->vpos - offset - 1])
-#define sepl__popd()                                 \
-    (sepl_val_isobj(sepl__peekv(0))                  \
-         ? (env.free(sepl__popv()), sepl__peekv(-1)) \
-         : sepl__popv())
-
-#define sepl__unaryop(op)                   \
+/*
+ * Threaded execution engine
+ *
+ * pc and the value stack top are kept in locals and only written back to the
+ * module when the engine stops. With GNU C the handlers dispatch through a
+ * table of label addresses, otherwise a plain switch is used. The engine stops
+ * once pc reaches end after running at least one instruction.
+ *
+ * Built with SEPL_UNCHECKED it only runs modules checked by sepl_ver_module
+ * and leaves out the bounds checks of the value stack, which the verifier
+ * has done once for every path.
+ */
+
+#if defined(__GNUC__) && !defined(SEPL_NO_THREADED)
+#define SEPL__THREADED
+#endif
+
+#ifdef SEPL__THREADED
+#define sepl__op(bc) sepl__lbl_##bc
+#define sepl__next()                 \
+    do {                             \
+        if (pc >= end)               \
+            goto halt;               \
+        goto *dispatch[bytes[pc++]]; \
+    } while (0)
+#else
+#define sepl__op(bc) case bc
+#define sepl__next() break
+#endif
+
+SEPL_API SeplValue sepl__exec(SeplModule *mod, SeplError *e, SeplEnv env,
+                              sepl_size end) {
+#ifdef SEPL__THREADED
+    static void *dispatch[256] = {
+        /* Must follow the order of SeplBC */
+        &&sepl__op(SEPL_BC_RETURN),
+        &&sepl__op(SEPL_BC_JUMPIF),
+        &&sepl__op(SEPL_BC_JUMP),
+        &&sepl__op(SEPL_BC_CALL),
+        &&sepl__op(SEPL_BC_POP),
+        &&sepl__op(SEPL_BC_DROP),
+        &&sepl__op(SEPL_BC_NONE),
+        &&sepl__op(SEPL_BC_CONST),
+        &&sepl__op(SEPL_BC_INT),
+        &&sepl__op(SEPL_BC_STR),
+        &&sepl__op(SEPL_BC_SCOPE),
+        &&sepl__op(SEPL_BC_FUNC),
+        &&sepl__op(SEPL_BC_GET),
+        &&sepl__op(SEPL_BC_SET),
+        &&sepl__op(SEPL_BC_GET_UP),
+        &&sepl__op(SEPL_BC_SET_UP),
+        &&sepl__op(SEPL_BC_NEG),
+        &&sepl__op(SEPL_BC_ADD),
+        &&sepl__op(SEPL_BC_SUB),
+        &&sepl__op(SEPL_BC_MUL),
+        &&sepl__op(SEPL_BC_DIV),
+        &&sepl__op(SEPL_BC_NOT),
+        &&sepl__op(SEPL_BC_AND),
+        &&sepl__op(SEPL_BC_OR),
+        &&sepl__op(SEPL_BC_LT),
+        &&sepl__op(SEPL_BC_LTE),
+        &&sepl__op(SEPL_BC_GT),
+        &&sepl__op(SEPL_BC_GTE),
+        &&sepl__op(SEPL_BC_EQ),
+        &&sepl__op(SEPL_BC_NEQ),
+        &&sepl__op(SEPL_BC_JUMP_LT),
+        &&sepl__op(SEPL_BC_JUMP_LTE),
+        &&sepl__op(SEPL_BC_JUMP_GT),
+        &&sepl__op(SEPL_BC_JUMP_GTE),
+        &&sepl__op(SEPL_BC_JUMP_EQ),
+        &&sepl__op(SEPL_BC_JUMP_NEQ),
+        &&sepl__op(SEPL_BC_JUMP_AND),
+        &&sepl__op(SEPL_BC_JUMP_OR),
+        &&sepl__op(SEPL_BC_ADD_INT),
+        &&sepl__op(SEPL_BC_INC),
+        &&sepl__op(SEPL_BC_GET_CALL),
+        &&sepl__op(SEPL_BC_ADD_NN),
+        &&sepl__op(SEPL_BC_SUB_NN),
+        &&sepl__op(SEPL_BC_MUL_NN),
+        &&sepl__op(SEPL_BC_DIV_NN),
+        &&sepl__op(SEPL_BC_LT_NN),
+        &&sepl__op(SEPL_BC_LTE_NN),
+        &&sepl__op(SEPL_BC_GT_NN),
+        &&sepl__op(SEPL_BC_GTE_NN),
+        &&sepl__op(SEPL_BC_EQ_NN),
+        &&sepl__op(SEPL_BC_NEQ_NN),
+        &&sepl__op(SEPL_BC_JUMP_LT_NN),
+        &&sepl__op(SEPL_BC_JUMP_LTE_NN),
+        &&sepl__op(SEPL_BC_JUMP_GT_NN),
+        &&sepl__op(SEPL_BC_JUMP_GTE_NN),
+        &&sepl__op(SEPL_BC_JUMP_EQ_NN),
+        &&sepl__op(SEPL_BC_JUMP_NEQ_NN),
+        &&sepl__op(SEPL_BC_ADD_INT_NN),
+        &&sepl__op(SEPL_BC_INC_NN),
+        &&sepl__op(SEPL_BC_ADD_Q),
+        &&sepl__op(SEPL_BC_SUB_Q),
+        &&sepl__op(SEPL_BC_MUL_Q),
+        &&sepl__op(SEPL_BC_DIV_Q),
+        &&sepl__op(SEPL_BC_LT_Q),
+        &&sepl__op(SEPL_BC_LTE_Q),
+        &&sepl__op(SEPL_BC_GT_Q),
+        &&sepl__op(SEPL_BC_GTE_Q),
+        &&sepl__op(SEPL_BC_EQ_Q),
+        &&sepl__op(SEPL_BC_NEQ_Q),
+        &&sepl__op(SEPL_BC_JUMP_LT_Q),
+        &&sepl__op(SEPL_BC_JUMP_LTE_Q),
+        &&sepl__op(SEPL_BC_JUMP_GT_Q),
+        &&sepl__op(SEPL_BC_JUMP_GTE_Q),
+        &&sepl__op(SEPL_BC_JUMP_EQ_Q),
+        &&sepl__op(SEPL_BC_JUMP_NEQ_Q),
+        &&sepl__op(SEPL_BC_ADD_INT_Q),
+        &&sepl__op(SEPL_BC_INC_Q),
+        &&sepl__op(SEPL_BC_CALL_C),
+        &&sepl__op(SEPL_BC_CALL_S),
+        &&sepl__op(SEPL_BC_GET_CALL_C),
+        &&sepl__op(SEPL_BC_GET_CALL_S),
+        &&sepl__op(SEPL_BC_CALL_DIRECT),
+        &&sepl__op(SEPL_BC_TAILCALL),
+        &&sepl__op(SEPL_BC_FRAME),
+        [SEPL_BC_FRAME + 1 ... 255] = &&bad_bc};
+#endif
+    unsigned char *bytes = mod->bytes;
+    unsigned char *pool = mod->bytes + mod->bsize;
+    SeplValue *values = mod->values;
+    sepl_size pc = mod->pc;
+    sepl_size vp = mod->vpos;
+    sepl_size vsize = mod->vsize;
+    sepl_size base = env.predef_len;
+    unsigned char *map = mod->objmap;
+    /* No slot at or above objs was marked since this call started, scopes
+     * above it are left without looking at the bitmap */
+    sepl_size objs = vp;
+    SeplValue retv = SEPL_NONE;
+    sepl_size at, argc;
+    SeplBC bc;
+
+#define sepl__xrdsz(dst)                                     \
+    do {                                                     \
+        dst = bytes[pc++];                                   \
+        if (dst & 0x80) {                                    \
+            sepl_size s_ = 14;                               \
+            unsigned char b_ = bytes[pc++];                  \
+            dst = (dst & 0x7F) | (sepl_size)(b_ & 0x7F) << 7; \
+            while (b_ & 0x80) {                              \
+                b_ = bytes[pc++];                            \
+                dst |= (sepl_size)(b_ & 0x7F) << s_;         \
+                s_ += 7;                                     \
+            }                                                \
+        }                                                    \
+    } while (0)
+#define sepl__xconst(k) (pool - (k) * SEPL_KSLOT)
+#ifdef SEPL_ALIGNED
+#define sepl__xnum(k) (*(double *)sepl__xconst(k))
+#else
+#define sepl__xnum(k) sepl__lddbl(sepl__xconst(k))
+#endif
+
+#ifndef SEPL_UNCHECKED
+#define sepl__xpush(val)                         \
+    do {                                         \
+        if (vp >= vsize) {                       \
+            sepl_err_new(e, SEPL_ERR_VOVERFLOW); \
+            goto fail;                           \
+        }                                        \
+        values[vp++] = (val);                    \
+    } while (0)
+#define sepl__xpop(dst)                           \
+    do {                                          \
+        if (vp <= base) {                         \
+            sepl_err_new(e, SEPL_ERR_VUNDERFLOW); \
+            goto fail;                            \
+        }                                         \
+        dst = values[--vp];                       \
+    } while (0)
+#else
+#define sepl__xpush(val) (values[vp++] = (val))
+#define sepl__xpop(dst) (dst = values[--vp])
+#endif
+#define sepl__xpeek(offset) (values[vp - (offset) - 1])
+#define sepl__xmark(i)                                        \
+    do {                                                      \
+        if (map != SEPL_NULL)                                 \
+            map[(i) / 8] |= (unsigned char)(1u << ((i) % 8)); \
+        if ((i) >= objs)                                      \
+            objs = (i) + 1;                                   \
+    } while (0)
+/* Frees the objects of values[from, to), no slot above from is live after.
+ * retv is set to the object keep refers to among them, else to keep */
+#define sepl__xunwind(from, to, keep)                             \
+    do {                                                          \
+        if ((from) < objs) {                                      \
+            retv = sepl__objfree(mod, (from), (to), (keep), env); \
+            objs = (from);                                        \
+        }                                                         \
+    } while (0)
+#ifndef SEPL_NANBOX
+#define sepl__xtrue(val) (sepl_val_getnum(val) != 0)
+#else
+/* Other values test their payload, as the unboxed union bits would */
+#define sepl__xtrue(val)                                      \
+    (sepl_val_isnum(val) ? sepl_val_getnum(val) != 0          \
+                         : sepl_val_getpos(val) != 0)
+#endif
+#define sepl__xpopd()           \
+    do {                        \
+        SeplValue d_;           \
+        sepl__xpop(d_);         \
+        if (sepl_val_isobj(d_)) \
+            env.free(d_);       \
+    } while (0)
+
+#define sepl__xunary(op)                    \
     do {                                    \
-        SeplValue v = sepl__popv();         \
-        double d = sepl__todbl(e, v);       \
+        SeplValue v;                        \
+        double d;                           \
+        sepl__xpop(v);                      \
+        d = sepl__todbl(e, v);              \
         if (e->code)                        \
-            break;                          \
-        sepl__pushv(sepl_val_number(op d)); \
+            goto fail;                      \
+        sepl__xpush(sepl_val_number(op d)); \
     } while (0)
-#define sepl__binaryop(op)                                       \
-    do {                                                         \
-        SeplValue v2 = sepl__popv(), v1 = sepl__popv();          \
-        double d1 = sepl__todbl(e, v1), d2 = sepl__todbl(e, v2); \
-        if (e->code)                                             \
-            break;                                               \
-        sepl__pushv(sepl_val_number(d1 op d2));                  \
+#ifdef SEPL_QUICKEN
+/* Specializes the instruction at pos to bc when cond holds, code shared by
+ * contexts is left as is */
+#define sepl__xquicken(cond, pos, bc)         \
+    do {                                      \
+        if ((cond) && !mod->shared)           \
+            bytes[pos] = (unsigned char)(bc); \
     } while (0)
+#else
+#define sepl__xquicken(cond, pos, bc) ((void)0)
+#endif
+/* Rewrites the quickened instruction at pos to its generic form and runs
+ * that instead */
+#define sepl__xdeopt(pos)                                              \
+    do {                                                               \
+        pc = (pos);                                                    \
+        bytes[pc] = (unsigned char)sepl__bcgeneric((SeplBC)bytes[pc]); \
+        goto redo;                                                     \
+    } while (0)
+#define sepl__xnn(v1, v2) (sepl_val_isnum(v1) && sepl_val_isnum(v2))
 
-    SeplBC bc = (SeplBC)mod->bytes[mod->pc++];
+#define sepl__xbinary(op, q)                          \
+    do {                                              \
+        SeplValue v1, v2;                             \
+        double d1, d2;                                \
+        sepl__xpop(v2);                               \
+        sepl__xpop(v1);                               \
+        d1 = sepl__todbl(e, v1);                      \
+        d2 = sepl__todbl(e, v2);                      \
+        if (e->code)                                  \
+            goto fail;                                \
+        sepl__xquicken(sepl__xnn(v1, v2), pc - 1, q); \
+        sepl__xpush(sepl_val_number(d1 op d2));       \
+    } while (0)
+/* Compare and jump if false, a binary op followed by JUMPIF */
+#define sepl__xcmpjump(op, q)                     \
+    do {                                          \
+        SeplValue v1, v2;                         \
+        double d1, d2;                            \
+        sepl_size jump;                           \
+        at = pc - 1;                              \
+        sepl__xrdsz(jump);                        \
+        sepl__xpop(v2);                           \
+        sepl__xpop(v1);                           \
+        d1 = sepl__todbl(e, v1);                  \
+        d2 = sepl__todbl(e, v2);                  \
+        if (e->code)                              \
+            goto fail;                            \
+        sepl__xquicken(sepl__xnn(v1, v2), at, q); \
+        if (!(d1 op d2))                          \
+            pc = jump;                            \
+    } while (0)
+/* Unchecked forms of the above for operands known to be numbers */
+#ifndef SEPL_UNCHECKED
+#define sepl__xcheck(n)                           \
+    do {                                          \
+        if (vp < base + (n)) {                    \
+            sepl_err_new(e, SEPL_ERR_VUNDERFLOW); \
+            goto fail;                            \
+        }                                         \
+    } while (0)
+#else
+#define sepl__xcheck(n) ((void)0)
+#endif
+#define sepl__xbinarynn(op)                         \
+    do {                                            \
+        double d1, d2;                              \
+        sepl__xcheck(2);                            \
+        d1 = sepl_val_getnum(values[vp - 2]);       \
+        d2 = sepl_val_getnum(values[--vp]);         \
+        values[vp - 1] = sepl_val_number(d1 op d2); \
+    } while (0)
+#define sepl__xcmpjumpnn(op)                  \
+    do {                                      \
+        double d1, d2;                        \
+        sepl_size jump;                       \
+        sepl__xrdsz(jump);                    \
+        sepl__xcheck(2);                      \
+        d1 = sepl_val_getnum(values[vp - 2]); \
+        d2 = sepl_val_getnum(values[vp - 1]); \
+        vp -= 2;                              \
+        if (!(d1 op d2))                      \
+            pc = jump;                        \
+    } while (0)
+/* Quickened forms, checking for numbers without following references */
+#define sepl__xbinaryq(op)                                               \
+    do {                                                                 \
+        SeplValue v1, v2;                                                \
+        sepl__xcheck(2);                                                 \
+        v1 = values[vp - 2];                                             \
+        v2 = values[vp - 1];                                             \
+        if (!sepl__xnn(v1, v2))                                          \
+            sepl__xdeopt(pc - 1);                                        \
+        vp--;                                                            \
+        values[vp - 1] =                                                 \
+            sepl_val_number(sepl_val_getnum(v1) op sepl_val_getnum(v2)); \
+    } while (0)
+#define sepl__xcmpjumpq(op)                                \
+    do {                                                   \
+        SeplValue v1, v2;                                  \
+        sepl_size jump;                                    \
+        at = pc - 1;                                       \
+        sepl__xcheck(2);                                   \
+        v1 = values[vp - 2];                               \
+        v2 = values[vp - 1];                               \
+        if (!sepl__xnn(v1, v2))                            \
+            sepl__xdeopt(at);                              \
+        sepl__xrdsz(jump);                                 \
+        vp -= 2;                                           \
+        if (!(sepl_val_getnum(v1) op sepl_val_getnum(v2))) \
+            pc = jump;                                     \
+    } while (0)
 
-    switch (bc) {
-        case SEPL_BC_RETURN: {
-            SeplValue retv, v;
-            e->code = SEPL_ERR_OK;
-            if (mod->vpos <= env.predef_len)
-                return SEPL_NONE;
+    if (env.free == SEPL_NULL) {
+        env.free = sepl__free;
+    }
 
-            retv = sepl__popv();
+#ifdef SEPL_UNCHECKED
+    /* The top level code was verified for the values sepl_mod_init pushes,
+     * the room it needs is checked once here */
+    if (mod->verified == 0 || (pc == 0 && vp != base + mod->esize)) {
+        sepl_err_new(e, SEPL_ERR_BC);
+        e->info.bc = (char)bytes[pc];
+        goto fail;
+    }
+    if (pc == 0 && mod->verified - 1 > vsize - vp) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        goto fail;
+    }
+#endif
 
+#ifdef SEPL__THREADED
+    /* The first instruction always runs, sepl_mod_step passes end = 0 */
+redo:
+    goto *dispatch[bytes[pc++]];
+#else
+    for (;;) {
+    redo:
+        bc = (SeplBC)bytes[pc++];
+        switch (bc) {
+#endif
+        sepl__op(SEPL_BC_RETURN): {
+            sepl_size n, scope;
+            e->code = SEPL_ERR_OK;
+            sepl__xrdsz(n);
+            if (vp <= base)
+                sepl__next();
+#ifndef SEPL_UNCHECKED
+            if (vp - base <= n) {
+                sepl_err_new(e, SEPL_ERR_VUNDERFLOW);
+                goto fail;
+            }
+#endif
+
+            retv = values[vp - 1];
             if (sepl_val_isfun(retv)) {
                 sepl_err_new(e, SEPL_ERR_FUNC_RET);
-                return SEPL_NONE;
+                goto fail;
             }
 
-            /* Pop all values until scope block end */
-            while (1) {
-                v = sepl__popv();
-
-                /* Prevent the return ref object from being freed */
-                if (sepl_val_isref(retv) &&
-                    retv.as.obj == (mod->values + mod->vpos)) {
-                    retv = v; /* Deference */
-                    continue;
-                } else if (sepl_val_isobj(v)) {
-                    env.free(v);
-                } else if (sepl_val_isscp(v)) {
-                    break;
-                }
+            /* The scope of the block ends n values below the returned one */
+            scope = vp - n - 1;
+            if (!sepl_val_isscp(values[scope])) {
+                sepl_err_new(e, SEPL_ERR_BC);
+                goto fail;
             }
+            sepl__xunwind(scope + 1, vp - 1, retv);
+            vp = scope;
 
-            if (v.as.pos >= mod->bpos) {
-                mod->pc = mod->bpos;
-                return retv;
+            if (sepl_val_getpos(values[scope]) >= mod->bpos) {
+                pc = mod->bpos;
+                goto done;
             }
 
-            sepl__pushv(retv);
-            mod->pc = v.as.pos;
-            break;
+            pc = sepl_val_getpos(values[scope]);
+            values[vp++] = retv;
+            if (sepl_val_isobj(retv))
+                sepl__xmark(scope);
+            sepl__next();
         }
-        case SEPL_BC_JUMP: {
-            sepl_size jump = sepl__rdsz();
-            mod->pc = jump;
-            break;
+        sepl__op(SEPL_BC_JUMP): {
+            sepl_size jump;
+            sepl__xrdsz(jump);
+            pc = jump;
+            sepl__next();
         }
-        case SEPL_BC_JUMPIF: {
-            sepl_size jump = sepl__rdsz();
-            SeplValue cond = sepl__peekv(0);
-            if (!cond.as.num) {
-                mod->pc = jump;
+        sepl__op(SEPL_BC_JUMPIF): {
+            sepl_size jump;
+            sepl__xrdsz(jump);
+            if (!sepl__xtrue(sepl__xpeek(0))) {
+                pc = jump;
             }
-            sepl__popd();
-            break;
+            sepl__xpopd();
+            sepl__next();
         }
 
-        case SEPL_BC_CALL: {
-            sepl_size offset = sepl__rdsz();
-            SeplValue v = mod->values[mod->vpos - offset - 1];
+        sepl__op(SEPL_BC_CALL): {
+            at = pc - 1;
+            sepl__xrdsz(argc);
+        }
+        /* Calls the value below the argc arguments, the call instruction
+         * starts at at */
+        call: {
+            SeplValue v = values[vp - argc - 1];
 
             if (sepl_val_iscfun(v)) {
-                SeplArgs args;
-                SeplValue result;
-                args.values = mod->values + mod->vpos - offset;
-                args.size = offset;
-                result = v.as.cfunc(args, e);
-
-                /* Pop arguments */
-                while (offset--) sepl__popd();
-                mod->vpos--; /* Pop function variable */
-                sepl__pushv(result);
+                sepl__xquicken(1, at,
+                               bytes[at] == SEPL_BC_CALL ? SEPL_BC_CALL_C
+                                                         : SEPL_BC_GET_CALL_C);
+                goto callc;
             } else if (sepl_val_isfun(v)) {
-                sepl_size param_c;
-                mod->values[mod->vpos - offset - 1] = sepl_val_scope(mod->pc);
-                mod->pc = v.as.pos;
-                param_c = sepl__rdsz();
-
-                if (param_c < offset) {
-                    while (param_c++ != offset) sepl__popd();
-                } else if (param_c > offset) {
-                    while (param_c-- != offset) sepl__pushv(SEPL_NONE);
-                }
+                sepl__xquicken(1, at,
+                               bytes[at] == SEPL_BC_CALL ? SEPL_BC_CALL_S
+                                                         : SEPL_BC_GET_CALL_S);
+                goto calls;
+            }
+            sepl_err_new(e, SEPL_ERR_FUNC_CALL);
+            goto fail;
+        }
+        sepl__op(SEPL_BC_CALL_C): {
+            at = pc - 1;
+            sepl__xrdsz(argc);
+            if (!sepl_val_iscfun(values[vp - argc - 1]))
+                sepl__xdeopt(at);
+        }
+        callc: {
+            SeplArgs args;
+            SeplValue result;
+            args.values = values + vp - argc;
+            args.size = argc;
+            args.mod = mod;
+            args.env = &env;
+            /* Calls back into the module start above the arguments */
+            mod->vpos = vp;
+            result = sepl_val_getcfunc(values[vp - argc - 1])(args, e);
+            /* Functions called back into may have stored objects in the
+             * slots below, as SET_UP does */
+            if (objs < vp)
+                objs = vp;
 
-            } else {
-                sepl_err_new(e, SEPL_ERR_FUNC_CALL);
-                return SEPL_NONE;
+            /* Pop arguments */
+            while (argc--) sepl__xpopd();
+            vp--; /* Pop function variable */
+            sepl__xpush(result);
+            if (sepl_val_isobj(result))
+                sepl__xmark(vp - 1);
+            if (e->code)
+                goto fail;
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_CALL_S): {
+            at = pc - 1;
+            sepl__xrdsz(argc);
+            if (!sepl_val_isfun(values[vp - argc - 1]))
+                sepl__xdeopt(at);
+        }
+        calls: {
+            sepl_size to = sepl_val_getpos(values[vp - argc - 1]);
+            values[vp - argc - 1] = sepl_val_scope(pc);
+            pc = to;
+        }
+        /* Matches the argc arguments to the parameters at pc */
+        enter: {
+            sepl_size param_c;
+            sepl__xrdsz(param_c);
+
+            if (param_c < argc) {
+                while (param_c++ != argc) sepl__xpopd();
+            } else if (param_c > argc) {
+#ifdef SEPL_UNCHECKED
+                /* FRAME only checks the room of the body */
+                if (param_c - argc > vsize - vp) {
+                    sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+                    goto fail;
+                }
+#endif
+                while (param_c-- != argc) sepl__xpush(SEPL_NONE);
             }
-            break;
+            sepl__next();
         }
-        case SEPL_BC_POP: {
-            sepl__popd();
-            break;
+        sepl__op(SEPL_BC_POP): {
+            sepl__xpopd();
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DROP): {
+            sepl_size n;
+            sepl__xrdsz(n);
+#ifndef SEPL_UNCHECKED
+            if (vp - base < n) {
+                sepl_err_new(e, SEPL_ERR_VUNDERFLOW);
+                goto fail;
+            }
+#endif
+            sepl__xunwind(vp - n, vp, SEPL_NONE);
+            vp -= n;
+            sepl__next();
         }
 
-        case SEPL_BC_SET: {
-            sepl_size i = sepl__rdsz();
-            SeplValue peek = sepl__peekv(0);
-            sepl_size offset = mod->vpos - i;
+        sepl__op(SEPL_BC_SET): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + vp - i;
 
             /* Reference is assign to another variable */
-            if (sepl_val_isref(peek)) {
+            if (sepl_val_isref(sepl__xpeek(0))) {
                 sepl_err_new(e, SEPL_ERR_REFMOVE);
-                break;
+                goto fail;
             }
-            if (sepl_val_isobj(mod->values[offset]))
-                env.free(mod->values[offset]);
-            mod->values[offset] = sepl__popv();
-            break;
+            if (sepl_val_isobj(*slot))
+                env.free(*slot);
+            if (sepl_val_isobj(sepl__xpeek(0)))
+                sepl__xmark((sepl_size)(slot - values));
+            sepl__xpop(*slot);
+            sepl__next();
         }
-        case SEPL_BC_GET: {
-            sepl_size i = sepl__rdsz();
-            sepl_size offset = mod->vpos - i;
-            SeplValue v = mod->values[offset];
+        sepl__op(SEPL_BC_GET): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + vp - i;
 
-            if (sepl_val_isobj(v)) {
-                sepl__pushv(sepl_val_asref(&mod->values[offset]));
-                break;
+            if (sepl_val_isobj(*slot)) {
+                sepl__xpush(sepl_val_asref(slot));
+                sepl__next();
             }
-            sepl__pushv(v);
-            break;
+            sepl__xpush(*slot);
+            sepl__next();
         }
 
-        case SEPL_BC_SET_UP: {
-            sepl_size offset = sepl__rdsz();
-            SeplValue peek = sepl__peekv(0);
+        sepl__op(SEPL_BC_SET_UP): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + i;
 
             /* Reference is assign to another variable */
-            if (sepl_val_isref(peek)) {
+            if (sepl_val_isref(sepl__xpeek(0))) {
                 sepl_err_new(e, SEPL_ERR_REFMOVE);
-                break;
+                goto fail;
             }
-            if (sepl_val_isobj(mod->values[offset]))
-                env.free(mod->values[offset]);
-            mod->values[offset] = sepl__popv();
-            break;
+#ifdef SEPL_UNCHECKED
+            /* A function kept past its scope may find a scope at i, which
+             * the verifier cannot see. Copying one there would make a
+             * RETURN jump with another depth */
+            if (sepl_val_isscp(sepl__xpeek(0))) {
+                sepl_err_new(e, SEPL_ERR_BC);
+                e->info.bc = SEPL_BC_SET_UP;
+                goto fail;
+            }
+#endif
+            if (sepl_val_isobj(*slot))
+                env.free(*slot);
+            if (sepl_val_isobj(sepl__xpeek(0)))
+                sepl__xmark((sepl_size)(slot - values));
+            sepl__xpop(*slot);
+            sepl__next();
         }
-        case SEPL_BC_GET_UP: {
-            sepl_size offset = sepl__rdsz();
-            SeplValue v = mod->values[offset];
+        sepl__op(SEPL_BC_GET_UP): {
+            SeplValue *slot;
+            sepl_size i;
+            sepl__xrdsz(i);
+            slot = values + i;
 
-            if (sepl_val_isobj(v)) {
-                sepl__pushv(sepl_val_asref(&mod->values[offset]));
-                break;
+            if (sepl_val_isobj(*slot)) {
+                sepl__xpush(sepl_val_asref(slot));
+                sepl__next();
             }
-            sepl__pushv(v);
-            break;
+            sepl__xpush(*slot);
+            sepl__next();
         }
 
-        case SEPL_BC_NONE: {
-            sepl__pushv(SEPL_NONE);
-            break;
+        sepl__op(SEPL_BC_NONE): {
+            sepl__xpush(SEPL_NONE);
+            sepl__next();
         }
-        case SEPL_BC_CONST: {
-            double v = sepl__rddbl();
-            sepl__pushv(sepl_val_number(v));
-            break;
+        sepl__op(SEPL_BC_CONST): {
+            sepl_size k;
+            sepl__xrdsz(k);
+            sepl__xpush(sepl_val_number(sepl__xnum(k)));
+            sepl__next();
         }
-        case SEPL_BC_STR: {
-            sepl_size len = sepl__rdsz();
-            sepl__pushv(sepl_val_str((char *)(mod->bytes + mod->pc)));
-            mod->pc += len + 1;
-            break;
+        sepl__op(SEPL_BC_INT): {
+            int i = bytes[pc++];
+            sepl__xpush(sepl_val_number(i - ((i & 0x80) << 1)));
+            sepl__next();
         }
-        case SEPL_BC_SCOPE: {
-            sepl_size end_pos = sepl__rdsz();
-            sepl__pushv(sepl_val_scope(end_pos));
-            break;
+        sepl__op(SEPL_BC_STR): {
+            sepl_size k;
+            sepl__xrdsz(k);
+            sepl__xpush(sepl_val_str((char *)sepl__xconst(k)));
+            sepl__next();
         }
-        case SEPL_BC_FUNC: {
-            sepl_size skip_pos = sepl__rdsz();
-            sepl__pushv(sepl_val_func(mod->pc));
-            mod->pc = skip_pos;
-            break;
+        sepl__op(SEPL_BC_SCOPE): {
+            sepl_size end_pos;
+            sepl__xrdsz(end_pos);
+            sepl__xpush(sepl_val_scope(end_pos));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_FUNC): {
+            sepl_size skip_pos;
+            sepl__xrdsz(skip_pos);
+            sepl__xpush(sepl_val_func(pc));
+            pc = skip_pos;
+            sepl__next();
         }
 
-        case SEPL_BC_NEG: {
-            sepl__unaryop(-);
-            break;
+        sepl__op(SEPL_BC_NEG): {
+            sepl__xunary(-);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD): {
+            sepl__xbinary(+, SEPL_BC_ADD_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_SUB): {
+            sepl__xbinary(-, SEPL_BC_SUB_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_MUL): {
+            sepl__xbinary(*, SEPL_BC_MUL_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DIV): {
+            sepl__xbinary(/, SEPL_BC_DIV_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NOT): {
+            sepl__xunary(!);
+            sepl__next();
         }
 
-        case SEPL_BC_ADD: {
-            sepl__binaryop(+);
-            break;
+        sepl__op(SEPL_BC_LT): {
+            sepl__xbinary(<, SEPL_BC_LT_Q);
+            sepl__next();
         }
-        case SEPL_BC_SUB: {
-            sepl__binaryop(-);
-            break;
+        sepl__op(SEPL_BC_LTE): {
+            sepl__xbinary(<=, SEPL_BC_LTE_Q);
+            sepl__next();
         }
-        case SEPL_BC_MUL: {
-            sepl__binaryop(*);
-            break;
+        sepl__op(SEPL_BC_GT): {
+            sepl__xbinary(>, SEPL_BC_GT_Q);
+            sepl__next();
         }
-        case SEPL_BC_DIV: {
-            sepl__binaryop(/);
-            break;
+        sepl__op(SEPL_BC_GTE): {
+            sepl__xbinary(>=, SEPL_BC_GTE_Q);
+            sepl__next();
         }
-        case SEPL_BC_NOT: {
-            sepl__unaryop(!);
-            break;
+        sepl__op(SEPL_BC_EQ): {
+            sepl__xbinary(==, SEPL_BC_EQ_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NEQ): {
+            sepl__xbinary(!=, SEPL_BC_NEQ_Q);
+            sepl__next();
         }
 
-        case SEPL_BC_LT: {
-            sepl__binaryop(<);
-            break;
+        sepl__op(SEPL_BC_JUMP_LT): {
+            sepl__xcmpjump(<, SEPL_BC_JUMP_LT_Q);
+            sepl__next();
         }
-        case SEPL_BC_LTE: {
-            sepl__binaryop(<=);
-            break;
+        sepl__op(SEPL_BC_JUMP_LTE): {
+            sepl__xcmpjump(<=, SEPL_BC_JUMP_LTE_Q);
+            sepl__next();
         }
-        case SEPL_BC_GT: {
-            sepl__binaryop(>);
-            break;
+        sepl__op(SEPL_BC_JUMP_GT): {
+            sepl__xcmpjump(>, SEPL_BC_JUMP_GT_Q);
+            sepl__next();
         }
-        case SEPL_BC_GTE: {
-            sepl__binaryop(>=);
-            break;
+        sepl__op(SEPL_BC_JUMP_GTE): {
+            sepl__xcmpjump(>=, SEPL_BC_JUMP_GTE_Q);
+            sepl__next();
         }
-        case SEPL_BC_EQ: {
-            sepl__binaryop(==);
-            break;
+        sepl__op(SEPL_BC_JUMP_EQ): {
+            sepl__xcmpjump(==, SEPL_BC_JUMP_EQ_Q);
+            sepl__next();
         }
-        case SEPL_BC_NEQ: {
-            sepl__binaryop(!=);
-            break;
+        sepl__op(SEPL_BC_JUMP_NEQ): {
+            sepl__xcmpjump(!=, SEPL_BC_JUMP_NEQ_Q);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_AND): {
+            /* Short circuit with 0 when the operand is false */
+            sepl_size jump;
+            int d;
+            sepl__xrdsz(jump);
+            d = sepl__xtrue(sepl__xpeek(0));
+            sepl__xpopd();
+            if (!d) {
+                sepl__xpush(sepl_val_number(0));
+                pc = jump;
+            }
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_OR): {
+            /* Short circuit with 1 when the operand is true */
+            sepl_size jump;
+            int d;
+            sepl__xrdsz(jump);
+            d = sepl__xtrue(sepl__xpeek(0));
+            sepl__xpopd();
+            if (d) {
+                sepl__xpush(sepl_val_number(1));
+                pc = jump;
+            }
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD_INT): {
+            sepl_size i;
+            int k;
+            double d;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            d = sepl__todbl(e, values[vp - i]);
+            if (e->code)
+                goto fail;
+            sepl__xquicken(sepl_val_isnum(values[vp - i]), at,
+                           SEPL_BC_ADD_INT_Q);
+            sepl__xpush(sepl_val_number(d + (k - ((k & 0x80) << 1))));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_INC): {
+            SeplValue *slot;
+            sepl_size i;
+            int k;
+            double d;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            slot = values + vp - i;
+            d = sepl__todbl(e, *slot);
+            if (e->code)
+                goto fail;
+            sepl__xquicken(sepl_val_isnum(*slot), at, SEPL_BC_INC_Q);
+            *slot = sepl_val_number(d + (k - ((k & 0x80) << 1)));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GET_CALL): {
+            SeplValue *slot;
+            sepl_size i;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            sepl__xrdsz(argc);
+            slot = values + vp - i;
+
+            if (sepl_val_isobj(*slot)) {
+                sepl__xpush(sepl_val_asref(slot));
+            } else {
+                sepl__xpush(*slot);
+            }
+            goto call;
+        }
+
+        sepl__op(SEPL_BC_ADD_NN): {
+            sepl__xbinarynn(+);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_SUB_NN): {
+            sepl__xbinarynn(-);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_MUL_NN): {
+            sepl__xbinarynn(*);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DIV_NN): {
+            sepl__xbinarynn(/);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LT_NN): {
+            sepl__xbinarynn(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LTE_NN): {
+            sepl__xbinarynn(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GT_NN): {
+            sepl__xbinarynn(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GTE_NN): {
+            sepl__xbinarynn(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_EQ_NN): {
+            sepl__xbinarynn(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NEQ_NN): {
+            sepl__xbinarynn(!=);
+            sepl__next();
+        }
+
+        sepl__op(SEPL_BC_JUMP_LT_NN): {
+            sepl__xcmpjumpnn(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_LTE_NN): {
+            sepl__xcmpjumpnn(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GT_NN): {
+            sepl__xcmpjumpnn(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GTE_NN): {
+            sepl__xcmpjumpnn(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_EQ_NN): {
+            sepl__xcmpjumpnn(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_NEQ_NN): {
+            sepl__xcmpjumpnn(!=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD_INT_NN): {
+            sepl_size i;
+            int k;
+            double d;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            d = sepl_val_getnum(values[vp - i]);
+            sepl__xpush(sepl_val_number(d + (k - ((k & 0x80) << 1))));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_INC_NN): {
+            SeplValue *slot;
+            sepl_size i;
+            int k;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            slot = values + vp - i;
+            *slot = sepl_val_number(sepl_val_getnum(*slot) +
+                                    (k - ((k & 0x80) << 1)));
+            sepl__next();
+        }
+
+        sepl__op(SEPL_BC_ADD_Q): {
+            sepl__xbinaryq(+);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_SUB_Q): {
+            sepl__xbinaryq(-);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_MUL_Q): {
+            sepl__xbinaryq(*);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_DIV_Q): {
+            sepl__xbinaryq(/);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LT_Q): {
+            sepl__xbinaryq(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_LTE_Q): {
+            sepl__xbinaryq(<=);
+            sepl__next();
         }
+        sepl__op(SEPL_BC_GT_Q): {
+            sepl__xbinaryq(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GTE_Q): {
+            sepl__xbinaryq(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_EQ_Q): {
+            sepl__xbinaryq(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_NEQ_Q): {
+            sepl__xbinaryq(!=);
+            sepl__next();
+        }
+
+        sepl__op(SEPL_BC_JUMP_LT_Q): {
+            sepl__xcmpjumpq(<);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_LTE_Q): {
+            sepl__xcmpjumpq(<=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GT_Q): {
+            sepl__xcmpjumpq(>);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_GTE_Q): {
+            sepl__xcmpjumpq(>=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_EQ_Q): {
+            sepl__xcmpjumpq(==);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_JUMP_NEQ_Q): {
+            sepl__xcmpjumpq(!=);
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_ADD_INT_Q): {
+            SeplValue v;
+            sepl_size i;
+            int k;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            v = values[vp - i];
+            if (!sepl_val_isnum(v))
+                sepl__xdeopt(at);
+            sepl__xpush(
+                sepl_val_number(sepl_val_getnum(v) + (k - ((k & 0x80) << 1))));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_INC_Q): {
+            SeplValue *slot;
+            sepl_size i;
+            int k;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            k = bytes[pc++];
+            slot = values + vp - i;
+            if (!sepl_val_isnum(*slot))
+                sepl__xdeopt(at);
+            *slot = sepl_val_number(sepl_val_getnum(*slot) +
+                                    (k - ((k & 0x80) << 1)));
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_GET_CALL_C): {
+            SeplValue v;
+            sepl_size i;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            sepl__xrdsz(argc);
+            v = values[vp - i];
+            if (!sepl_val_iscfun(v))
+                sepl__xdeopt(at);
+            sepl__xpush(v);
+            goto callc;
+        }
+        sepl__op(SEPL_BC_GET_CALL_S): {
+            SeplValue v;
+            sepl_size i;
+            at = pc - 1;
+            sepl__xrdsz(i);
+            sepl__xrdsz(argc);
+            v = values[vp - i];
+            if (!sepl_val_isfun(v))
+                sepl__xdeopt(at);
+            sepl__xpush(v);
+            goto calls;
+        }
+        sepl__op(SEPL_BC_CALL_DIRECT): {
+            sepl_size to;
+            sepl__xrdsz(to);
+            sepl__xrdsz(argc);
+            values[vp - argc - 1] = sepl_val_scope(pc);
+            pc = to;
+            sepl__next();
+        }
+        sepl__op(SEPL_BC_TAILCALL): {
+            sepl_size depth, frame, i;
+            SeplValue v;
+            sepl__xrdsz(depth);
+            sepl__xrdsz(argc);
+            frame = vp - depth;
+            v = values[vp - argc - 1];
+
+            if (sepl_val_iscfun(v))
+                goto callc;
+            if (!sepl_val_isfun(v)) {
+                sepl_err_new(e, SEPL_ERR_FUNC_CALL);
+                goto fail;
+            }
+            /* References into the frame must outlive it */
+            for (i = vp - argc; i < vp; i++) {
+                if (sepl_val_isref(values[i]) &&
+                    (SeplValue *)sepl_val_getobj(values[i]) >= values + frame)
+                    goto calls;
+            }
 
-        default: {
+            /* Free the frame like RETURN, keeping its return scope */
+            sepl__xunwind(frame + 1, vp - argc - 1, SEPL_NONE);
+            for (i = 0; i < argc; i++) {
+                values[frame + 1 + i] = values[vp - argc + i];
+                if (sepl_val_isobj(values[frame + 1 + i]))
+                    sepl__xmark(frame + 1 + i);
+            }
+            vp = frame + 1 + argc;
+            pc = sepl_val_getpos(v);
+            goto enter;
+        }
+        sepl__op(SEPL_BC_FRAME): {
+            sepl_size n;
+            sepl__xrdsz(n);
+            if (n > vsize - vp) {
+                sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+                goto fail;
+            }
+            sepl__next();
+        }
+
+#ifdef SEPL__THREADED
+        sepl__op(SEPL_BC_AND):
+        sepl__op(SEPL_BC_OR):
+        bad_bc:
+#else
+        default:
+#endif
+        {
+#ifdef SEPL__THREADED
+            bc = (SeplBC)bytes[pc - 1];
+#endif
             sepl_err_new(e, SEPL_ERR_BC);
             e->info.bc = bc;
-            return SEPL_NONE;
+            goto fail;
         }
+#ifndef SEPL__THREADED
+        }
+        if (pc >= end)
+            goto halt;
     }
+#endif
+
+halt:
+    retv = SEPL_NONE;
+done:
+    mod->pc = pc;
+    mod->vpos = vp;
+    return retv;
+
+fail:
+    mod->pc = pc;
+    mod->vpos = vp;
     return SEPL_NONE;
+
+#undef sepl__xrdsz
+#undef sepl__xconst
+#undef sepl__xnum
+#undef sepl__xpush
+#undef sepl__xpop
+#undef sepl__xpeek
+#undef sepl__xmark
+#undef sepl__xunwind
+#undef sepl__xtrue
+#undef sepl__xpopd
+#undef sepl__xunary
+#undef sepl__xbinary
+#undef sepl__xcmpjump
+#undef sepl__xcheck
+#undef sepl__xbinarynn
+#undef sepl__xcmpjumpnn
+#undef sepl__xquicken
+#undef sepl__xdeopt
+#undef sepl__xnn
+#undef sepl__xbinaryq
+#undef sepl__xcmpjumpq
+#undef sepl__op
+#undef sepl__next
 }
 
-SEPL_LIB SeplValue sepl_mod_exec(SeplModule *mod, SeplError *e, SeplEnv env) {
-    SeplValue retv = SEPL_NONE;
+SEPL_LIB SeplValue sepl_mod_step(SeplModule *mod, SeplError *e, SeplEnv env) {
+    return sepl__exec(mod, e, env, 0);
+}
 
-    while (mod->pc < mod->bpos) {
-        retv = sepl_mod_step(mod, e, env);
-        if (e->code != SEPL_ERR_OK)
-            return SEPL_NONE;
-    }
-    return retv;
+SEPL_LIB SeplValue sepl_mod_exec(SeplModule *mod, SeplError *e, SeplEnv env) {
+    if (mod->pc >= mod->bpos)
+        return SEPL_NONE;
+    return sepl__exec(mod, e, env, mod->bpos);
 }
 
 SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
@@ -380,12 +1601,14 @@ SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
         return;
     }
 
-    mod->pc = func.as.pos;
-    args_count = sepl__rdsz();
+    mod->pc = sepl_val_getpos(func);
+    args_count = sepl__rdvar(mod->bytes, &mod->pc);
 
     sepl_mod_val(mod, sepl_val_scope(mod->bpos), e);
     for (i = 0; i < args.size; i++) {
-        sepl_mod_val(mod, args.values[i], e);
+        sepl_size at = sepl_mod_val(mod, args.values[i], e);
+        if (e->code == SEPL_ERR_OK && sepl_val_isobj(args.values[i]))
+            sepl__mark(mod, at);
     }
     if (e->code != SEPL_ERR_OK)
         return;
@@ -401,23 +1624,247 @@ SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
         return;
 }
 
-SEPL_LIB SeplValue sepl_mod_getexport(SeplModule *mod, SeplEnv env,
-                                      const char *key) {
+/* Frees the values a failed call left above vpos and drops them */
+SEPL_API void sepl__unwindto(SeplModule *mod, SeplEnv env, sepl_size vpos) {
+    if (env.free == SEPL_NULL) {
+        env.free = sepl__free;
+    }
+    if (mod->vpos > vpos)
+        sepl__objfree(mod, vpos, mod->vpos, SEPL_NONE, env);
+    mod->vpos = vpos;
+}
+
+SEPL_LIB SeplValue sepl_mod_reenter(SeplModule *mod, SeplError *e,
+                                    SeplEnv env, SeplValue func,
+                                    SeplArgs args) {
+    sepl_size pc = mod->pc, vpos = mod->vpos;
+    SeplValue result = SEPL_NONE;
+
+    e->code = SEPL_ERR_OK;
+    sepl_mod_initfunc(mod, e, func, args);
+    if (e->code == SEPL_ERR_OK)
+        result = sepl__exec(mod, e, env, mod->bpos);
+    if (e->code != SEPL_ERR_OK) {
+        sepl__unwindto(mod, env, vpos);
+        result = SEPL_NONE;
+    }
+
+    mod->pc = pc;
+    mod->vpos = vpos;
+    return result;
+}
+
+SEPL_LIB SeplCall sepl_mod_prepare(SeplModule *mod, SeplError *e,
+                                   SeplValue func) {
+    SeplCall call = {0};
+    if (!sepl_val_isfun(func)) {
+        sepl_err_new(e, SEPL_ERR_FUNC_CALL);
+        return call;
+    }
+
+    call.pc = sepl_val_getpos(func);
+    call.params = sepl__rdvar(mod->bytes, &call.pc);
+    return call;
+}
+
+/* Runs a prepared call above vpos, whose room is already checked */
+SEPL_API SeplValue sepl__callat(SeplModule *mod, SeplError *e, SeplEnv env,
+                                SeplCall call, const SeplValue args[],
+                                sepl_size vp) {
+    SeplValue *values = mod->values;
     sepl_size i;
-    for (i = 0; i < mod->esize; i++) {
-        const char *e_key = mod->exports[i];
-        const char *k_key = key;
-        char match = 1;
 
-        while (*e_key && *k_key) {
-            match = *e_key++ == *k_key++;
-            if (!match)
-                break;
+    values[vp++] = sepl_val_scope(mod->bpos);
+    for (i = 0; i < call.params; i++, vp++) {
+        values[vp] = args[i];
+        if (sepl_val_isobj(args[i]))
+            sepl__mark(mod, vp);
+    }
+    mod->vpos = vp;
+    mod->pc = call.pc;
+    return sepl__exec(mod, e, env, mod->bpos);
+}
+
+SEPL_LIB void sepl_mod_call(SeplModule *mod, SeplError *e, SeplEnv env,
+                            SeplCall call, const SeplValue args[],
+                            SeplValue *result) {
+    sepl_size vpos = mod->vpos;
+
+    e->code = SEPL_ERR_OK;
+    if (call.params >= mod->vsize - vpos) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        *result = SEPL_NONE;
+        return;
+    }
+    *result = sepl__callat(mod, e, env, call, args, vpos);
+    if (e->code == SEPL_ERR_OK)
+        return;
+
+    sepl__unwindto(mod, env, vpos);
+    *result = SEPL_NONE;
+}
+
+SEPL_LIB sepl_size sepl_mod_callbatch(SeplModule *mod, SeplError *e,
+                                      SeplEnv env, SeplCall call,
+                                      const SeplValue args[], sepl_size stride,
+                                      SeplValue results[], sepl_size count,
+                                      char stop) {
+    sepl_size pc = mod->pc, vpos = mod->vpos, ok = 0, row;
+    SeplError err;
+
+    e->code = SEPL_ERR_OK;
+    if (call.params >= mod->vsize - vpos) {
+        sepl_err_new(e, SEPL_ERR_VOVERFLOW);
+        return 0;
+    }
+
+    err.code = SEPL_ERR_OK;
+    for (row = 0; row < count; row++, args += stride) {
+        results[row] = sepl__callat(mod, &err, env, call, args, vpos);
+        if (err.code == SEPL_ERR_OK) {
+            ok++;
+            continue;
+        }
+
+        sepl__unwindto(mod, env, vpos);
+        results[row] = SEPL_NONE;
+        if (e->code == SEPL_ERR_OK)
+            *e = err;
+        err.code = SEPL_ERR_OK;
+        if (stop)
+            break;
+    }
+
+    mod->pc = pc;
+    return ok;
+}
+
+SEPL_LIB SeplImage sepl_mod_image(SeplModule *mod) {
+    SeplImage img;
+    sepl_size pc;
+
+    for (pc = 0; pc < mod->bpos; pc = sepl__bcnext(mod->bytes, pc)) {
+        SeplBC bc = (SeplBC)mod->bytes[pc];
+        if ((bc >= SEPL_BC_ADD_Q && bc <= SEPL_BC_INC_Q) ||
+            (bc >= SEPL_BC_CALL_C && bc <= SEPL_BC_GET_CALL_S))
+            mod->bytes[pc] = (unsigned char)sepl__bcgeneric(bc);
+    }
+
+    img.bytes = mod->bytes;
+    img.bpos = mod->bpos;
+    img.bsize = mod->bsize;
+    img.kpos = mod->kpos;
+    img.exports = mod->exports;
+    img.esize = mod->esize;
+    img.etab = mod->etab;
+    img.ecap = mod->ecap;
+    img.verified = mod->verified;
+    return img;
+}
+
+SEPL_LIB SeplModule sepl_mod_context(const SeplImage *img, SeplValue values[],
+                                     sepl_size vsize) {
+    /* The code is only written by contexts that are not shared */
+    SeplModule mod =
+        sepl_mod_new((unsigned char *)img->bytes, img->bsize, values, vsize);
+    mod.bpos = img->bpos;
+    mod.kpos = img->kpos;
+    mod.exports = img->exports;
+    mod.esize = img->esize;
+    mod.etab = img->etab;
+    mod.ecap = img->ecap;
+    mod.verified = img->verified;
+    mod.shared = 1;
+    return mod;
+}
+
+SEPL_LIB sepl_size sepl_mod_funcsize(SeplModule *mod, SeplValue func) {
+    sepl_size pc, params;
+    if (!sepl_val_isfun(func))
+        return 0;
+
+    pc = sepl_val_getpos(func);
+    params = sepl__rdvar(mod->bytes, &pc);
+    if (mod->bytes[pc++] != SEPL_BC_FRAME)
+        return 1 + params;
+    return 1 + params + sepl__rdvar(mod->bytes, &pc);
+}
+
+/* 1 if the export names a and b are the same */
+SEPL_API char sepl__ekeyeq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+SEPL_API sepl_size sepl__ehash(const char *key) {
+    sepl_size hash = 2166136261u;
+    while (*key) {
+        hash = (hash ^ (unsigned char)*key++) * 16777619u;
+    }
+    return hash;
+}
+
+SEPL_LIB void sepl_mod_exporttab(SeplModule *mod, void *buf, sepl_size size) {
+    sepl_size *tab = (sepl_size *)buf;
+    sepl_size cap = 1, mask, i, at;
+
+    mod->etab = SEPL_NULL;
+    mod->ecap = 0;
+    /* Largest power of two that fits, at most three quarters full */
+    while (cap * 2 * sizeof(sepl_size) <= size) {
+        cap *= 2;
+    }
+    if (cap * sizeof(sepl_size) > size || mod->esize * 4 > cap * 3)
+        return;
+
+    mask = cap - 1;
+    for (i = 0; i < cap; i++) {
+        tab[i] = 0;
+    }
+    for (i = 0; i < mod->esize; i++) {
+        at = sepl__ehash(mod->exports[i]) & mask;
+        /* The first of repeated names is kept, as a scan would find it */
+        while (tab[at] != 0 &&
+               !sepl__ekeyeq(mod->exports[tab[at] - 1], mod->exports[i])) {
+            at = (at + 1) & mask;
         }
-        if (match && *e_key == *k_key) {
-            return mod->values[env.predef_len + i];
+        if (tab[at] == 0)
+            tab[at] = i + 1;
+    }
+    mod->etab = tab;
+    mod->ecap = cap;
+}
+
+SEPL_LIB sepl_size sepl_mod_export_index(const SeplModule *mod,
+                                         const char *key) {
+    sepl_size i, mask;
+    if (mod->etab == SEPL_NULL) {
+        for (i = 0; i < mod->esize; i++) {
+            if (sepl__ekeyeq(mod->exports[i], key))
+                return i;
         }
+        return mod->esize;
     }
 
-    return SEPL_NONE;
+    mask = mod->ecap - 1;
+    for (i = sepl__ehash(key) & mask; mod->etab[i] != 0; i = (i + 1) & mask) {
+        if (sepl__ekeyeq(mod->exports[mod->etab[i] - 1], key))
+            return mod->etab[i] - 1;
+    }
+    return mod->esize;
+}
+
+SEPL_LIB SeplValue sepl_mod_export(const SeplModule *mod, SeplEnv env,
+                                   sepl_size index) {
+    if (index >= mod->esize)
+        return SEPL_NONE;
+    return mod->values[env.predef_len + index];
+}
+
+SEPL_LIB SeplValue sepl_mod_getexport(SeplModule *mod, SeplEnv env,
+                                      const char *key) {
+    return sepl_mod_export(mod, env, sepl_mod_export_index(mod, key));
 }
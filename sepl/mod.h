@@ -7,15 +7,17 @@
 #include "val.h"
 
 typedef enum {
-    SEPL_BC_RETURN,
+    SEPL_BC_RETURN, /* values above the scope it leaves */
     SEPL_BC_JUMPIF,
     SEPL_BC_JUMP,
 
     SEPL_BC_CALL,
     SEPL_BC_POP,
+    SEPL_BC_DROP,
 
     SEPL_BC_NONE,
     SEPL_BC_CONST,
+    SEPL_BC_INT,
     SEPL_BC_STR,
     SEPL_BC_SCOPE,
     SEPL_BC_FUNC,
@@ -41,38 +43,280 @@ typedef enum {
     SEPL_BC_GT,
     SEPL_BC_GTE,
     SEPL_BC_EQ,
-    SEPL_BC_NEQ
+    SEPL_BC_NEQ,
+
+    /* Superinstructions emitted by the compiler for common sequences */
+    SEPL_BC_JUMP_LT, /* LT JUMPIF */
+    SEPL_BC_JUMP_LTE,
+    SEPL_BC_JUMP_GT,
+    SEPL_BC_JUMP_GTE,
+    SEPL_BC_JUMP_EQ,
+    SEPL_BC_JUMP_NEQ,
+    SEPL_BC_JUMP_AND, /* JUMPIF to INT 0 */
+    SEPL_BC_JUMP_OR,  /* inverted JUMPIF to INT 1 */
+    SEPL_BC_ADD_INT,  /* GET INT ADD */
+    SEPL_BC_INC,      /* GET INT ADD SET */
+    SEPL_BC_GET_CALL, /* GET CALL */
+
+    /* Variants emitted when the compiler knows both operands are numbers,
+     * they read them without any type checks */
+    SEPL_BC_ADD_NN,
+    SEPL_BC_SUB_NN,
+    SEPL_BC_MUL_NN,
+    SEPL_BC_DIV_NN,
+    SEPL_BC_LT_NN,
+    SEPL_BC_LTE_NN,
+    SEPL_BC_GT_NN,
+    SEPL_BC_GTE_NN,
+    SEPL_BC_EQ_NN,
+    SEPL_BC_NEQ_NN,
+    SEPL_BC_JUMP_LT_NN,
+    SEPL_BC_JUMP_LTE_NN,
+    SEPL_BC_JUMP_GT_NN,
+    SEPL_BC_JUMP_GTE_NN,
+    SEPL_BC_JUMP_EQ_NN,
+    SEPL_BC_JUMP_NEQ_NN,
+    SEPL_BC_ADD_INT_NN,
+    SEPL_BC_INC_NN,
+
+    /* Quickened variants the interpreter writes over a generic instruction
+     * after running it when built with SEPL_QUICKEN. Each one checks the
+     * types it was specialized for and rewrites itself back to the generic
+     * form when they do not match. The code buffer is then written during
+     * execution, so a module must not be run by several threads at once.
+     * The number variants follow the order of the _NN ones */
+    SEPL_BC_ADD_Q,
+    SEPL_BC_SUB_Q,
+    SEPL_BC_MUL_Q,
+    SEPL_BC_DIV_Q,
+    SEPL_BC_LT_Q,
+    SEPL_BC_LTE_Q,
+    SEPL_BC_GT_Q,
+    SEPL_BC_GTE_Q,
+    SEPL_BC_EQ_Q,
+    SEPL_BC_NEQ_Q,
+    SEPL_BC_JUMP_LT_Q,
+    SEPL_BC_JUMP_LTE_Q,
+    SEPL_BC_JUMP_GT_Q,
+    SEPL_BC_JUMP_GTE_Q,
+    SEPL_BC_JUMP_EQ_Q,
+    SEPL_BC_JUMP_NEQ_Q,
+    SEPL_BC_ADD_INT_Q,
+    SEPL_BC_INC_Q,
+    SEPL_BC_CALL_C,     /* CALL of a cfunc */
+    SEPL_BC_CALL_S,     /* CALL of a sepl function */
+    SEPL_BC_GET_CALL_C, /* GET_CALL of a cfunc */
+    SEPL_BC_GET_CALL_S, /* GET_CALL of a sepl function */
+
+    /* Call of a function known at compile time, with the address of its body
+     * and the exact argument count as operands. The value below the arguments
+     * is replaced by the return scope like with CALL */
+    SEPL_BC_CALL_DIRECT,
+
+    /* Call of the returned value of a function, with the stack offset of the
+     * frame of that function and argc as operands. A sepl function replaces
+     * the frame instead of being pushed above it */
+    SEPL_BC_TAILCALL,
+
+    /* First instruction of a function body, with the most values the body
+     * pushes above its parameters. Checks once that they fit */
+    SEPL_BC_FRAME
 } SeplBC;
 
+/*
+ * Operands are written as variable length integers, 7 bits per byte with the
+ * high bit marking a continuation. Code addresses are padded to a fixed width
+ * so they can be patched once known. Number and string literals are stored in
+ * a constant pool which grows down from the end of the bytecode buffer in
+ * slots of sizeof(double) bytes and are referred to by their slot index.
+ *
+ * Pooled numbers are read byte-wise so the buffer may have any alignment.
+ * Defining SEPL_ALIGNED trims the end of the buffer to a slot boundary in
+ * sepl_mod_new so the interpreter can load them directly instead.
+ */
+#define SEPL_KSLOT sizeof(double)
+#define sepl_mod_kaddr(mod, k) \
+    ((mod)->bytes + (mod)->bsize - (k) * SEPL_KSLOT)
+
+/* Bytes of the object bitmap for a value buffer of vsize values */
+#define sepl_mod_mapsize(vsize) (((vsize) + 7) / 8)
+
+/*
+ * Window a module compiles into instead of its buffer while the compile is
+ * only counted. The latest code and constants are kept, which is all the
+ * compiler reads back, older bytes are dropped and patches into them skipped.
+ * need is the most the code and the constant pool ever took together.
+ */
+#define SEPL_SINK_CODE 128
+#define SEPL_SINK_POOL 384
+
 typedef struct {
+    unsigned char bytes[SEPL_SINK_CODE + SEPL_SINK_POOL];
+    /* Code and pool positions that bytes[0] stands for */
+    sepl_size bbase;
+    sepl_size kbase;
+    sepl_size need;
+} SeplSink;
+
+typedef struct SeplModule {
     unsigned char *bytes;
     sepl_size bpos;
     sepl_size bsize;
+    sepl_size kpos;
+    /* Set while compiling into a SeplSink, bytes is not used then */
+    SeplSink *sink;
 
     SeplValue *values;
     sepl_size vpos;
     sepl_size vsize;
+    /* Optional bitmap set by sepl_mod_setobjmap */
+    unsigned char *objmap;
 
     const char **exports;
     sepl_size esize;
+    /* Hash table of export indices set up by sepl_mod_exporttab, each slot
+     * holds index + 1 or 0 when empty. SEPL_NULL to scan exports instead */
+    const sepl_size *etab;
+    sepl_size ecap;
 
     sepl_size pc;
+
+    /* Set by sepl_ver_module to 1 + the most values the code at 0 pushes,
+     * 0 while the module is not verified */
+    sepl_size verified;
+
+    /* Set for contexts of a SeplImage, whose code is never written */
+    char shared;
 } SeplModule;
 
+/*
+ * Code of a finished module, which is only read once taken. Any number of
+ * contexts made with sepl_mod_context can run it at the same time, each with
+ * its own value buffer, pc and exports. Contexts do not quicken the shared
+ * code and must not be compiled into or optimized.
+ */
+typedef struct {
+    const unsigned char *bytes;
+    sepl_size bpos;
+    sepl_size bsize;
+    sepl_size kpos;
+
+    const char **exports;
+    sepl_size esize;
+    const sepl_size *etab;
+    sepl_size ecap;
+
+    sepl_size verified;
+} SeplImage;
+
 SEPL_LIB SeplModule sepl_mod_new(unsigned char bytes[], sepl_size bsize,
                                  SeplValue values[], sepl_size vsize);
+/*
+ * Gives the module a bitmap with one bit per value, set for the slots an
+ * object has been stored in. map must hold sepl_mod_mapsize(vsize) bytes,
+ * else the module goes on without one. Unwinding a scope and
+ * sepl_mod_cleanup then only look at the marked slots instead of every value
+ * of the scope. The bits may outlive their object but every slot holding an
+ * object is marked.
+ */
+SEPL_LIB void sepl_mod_setobjmap(SeplModule *mod, unsigned char map[],
+                                 sepl_size size);
 SEPL_LIB sepl_size sepl_mod_bc(SeplModule *mod, SeplBC bc, SeplError *e);
 SEPL_LIB sepl_size sepl_mod_bcnum(SeplModule *mod, double n, SeplError *e);
+SEPL_LIB sepl_size sepl_mod_bcstr(SeplModule *mod, sepl_size len, SeplError *e);
 SEPL_LIB sepl_size sepl_mod_bcsize(SeplModule *mod, sepl_size s, SeplError *e);
+SEPL_LIB sepl_size sepl_mod_bcaddr(SeplModule *mod, sepl_size a, SeplError *e);
+SEPL_LIB void sepl_mod_setaddr(SeplModule *mod, sepl_size pos, sepl_size a);
 SEPL_LIB sepl_size sepl_mod_val(SeplModule *mod, SeplValue v, SeplError *e);
 
 SEPL_LIB void sepl_mod_init(SeplModule *mod, SeplError *e, SeplEnv env);
 SEPL_LIB void sepl_mod_cleanup(SeplModule *mod, SeplEnv env);
+/* Runs the instruction at pc with the engine of sepl_mod_exec and stops, pc
+ * and vpos are left for the next call */
 SEPL_LIB SeplValue sepl_mod_step(SeplModule *mod, SeplError *e, SeplEnv env);
 SEPL_LIB SeplValue sepl_mod_exec(SeplModule *mod, SeplError *e, SeplEnv env);
 SEPL_LIB void sepl_mod_initfunc(SeplModule *mod, SeplError *e, SeplValue func,
                                 SeplArgs args);
 SEPL_LIB SeplValue sepl_mod_getexport(SeplModule *mod, SeplEnv env,
                                       const char *key);
+/*
+ * Calls func with args above the values in use and returns what it returns,
+ * leaving pc and vpos as they were. A cfunc can call back into the module
+ * running it with the mod and env of its SeplArgs. Like sepl_mod_initfunc the
+ * call takes over the objects in args. When it fails its values are freed.
+ */
+SEPL_LIB SeplValue sepl_mod_reenter(SeplModule *mod, SeplError *e,
+                                    SeplEnv env, SeplValue func,
+                                    SeplArgs args);
+
+/*
+ * Exports are found by name through a hash table kept in buf, which must be
+ * aligned for sepl_size and is built again when the exports change. Without
+ * it, or when buf is too small for the exports, they are scanned in order.
+ */
+SEPL_LIB void sepl_mod_exporttab(SeplModule *mod, void *buf, sepl_size size);
+/* Index of the export named key, a handle that stays valid for the module
+ * and its contexts. esize if there is none */
+SEPL_LIB sepl_size sepl_mod_export_index(const SeplModule *mod,
+                                         const char *key);
+/* Value of the export at index, SEPL_NONE past the exports */
+SEPL_LIB SeplValue sepl_mod_export(const SeplModule *mod, SeplEnv env,
+                                   sepl_size index);
+
+/* Sepl function resolved once by sepl_mod_prepare for repeated calls */
+typedef struct {
+    /* Position of the body */
+    sepl_size pc;
+    sepl_size params;
+} SeplCall;
+
+SEPL_LIB SeplCall sepl_mod_prepare(SeplModule *mod, SeplError *e,
+                                   SeplValue func);
+/*
+ * Calls a prepared function with exactly call.params values from args and
+ * stores what it returns in result. The value buffer is checked once for the
+ * return scope and arguments, the body checks the rest as it starts. A failed
+ * call frees its values and leaves vpos as it was.
+ */
+SEPL_LIB void sepl_mod_call(SeplModule *mod, SeplError *e, SeplEnv env,
+                            SeplCall call, const SeplValue args[],
+                            SeplValue *result);
+/*
+ * Calls a prepared function once for each of count rows of arguments, the
+ * row i starting at args + i * stride, and stores what each returns in
+ * results. Objects returned are owned by the caller. The value buffer is
+ * checked once for all rows. A failing row gets SEPL_NONE and its error is
+ * kept in e unless an earlier row failed, stop ends the batch there. Returns
+ * the number of rows that ran without error.
+ */
+SEPL_LIB sepl_size sepl_mod_callbatch(SeplModule *mod, SeplError *e,
+                                      SeplEnv env, SeplCall call,
+                                      const SeplValue args[], sepl_size stride,
+                                      SeplValue results[], sepl_size count,
+                                      char stop);
+
+/* Takes the code of mod as an image, quickened instructions are turned back
+ * into their generic forms. mod must not be written to while it is in use */
+SEPL_LIB SeplImage sepl_mod_image(SeplModule *mod);
+/* Execution context running img with the value buffer values, which it sets
+ * up like sepl_mod_new. sepl_mod_init and sepl_mod_exec then run the top
+ * level code to define its exports */
+SEPL_LIB SeplModule sepl_mod_context(const SeplImage *img, SeplValue values[],
+                                     sepl_size vsize);
+
+/* Values a call of func takes on the value stack, its return scope and
+ * parameters included and the calls it makes excluded */
+SEPL_LIB sepl_size sepl_mod_funcsize(SeplModule *mod, SeplValue func);
+
+/* Bytecode encoding helpers, shared with the optimizer */
+SEPL_LIB sepl_size sepl__varlen(sepl_size v);
+SEPL_LIB sepl_size sepl__rdvar(const unsigned char *bytes, sepl_size *pc);
+SEPL_LIB void sepl__wrvar(unsigned char *at, sepl_size v, sepl_size len);
+/* Where the code or constant byte at pos is kept, SEPL_NULL once a sink
+ * dropped it */
+SEPL_LIB unsigned char *sepl__baddr(SeplModule *mod, sepl_size pos);
+SEPL_LIB sepl_size sepl__bcnext(const unsigned char *bytes, sepl_size pc);
+SEPL_LIB long sepl__bcstack(const unsigned char *bytes, sepl_size pc);
+SEPL_LIB SeplBC sepl__bcgeneric(SeplBC bc);
 
 #endif
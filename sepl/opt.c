@@ -0,0 +1,395 @@
+#include "opt.h"
+
+/* Deepest block nesting followed when moving stack offsets */
+#define SEPL__OPT_NEST 32
+/* Longest jump chain followed */
+#define SEPL__OPT_HOPS 16
+/* Most edits made by one pass */
+#define SEPL__OPT_EDITS 64
+
+#define sepl__opt_hasaddr(bc)                                       \
+    ((bc) == SEPL_BC_JUMPIF || (bc) == SEPL_BC_JUMP ||              \
+     (bc) == SEPL_BC_SCOPE || (bc) == SEPL_BC_FUNC ||               \
+     ((bc) >= SEPL_BC_JUMP_LT && (bc) <= SEPL_BC_JUMP_OR) ||        \
+     ((bc) >= SEPL_BC_JUMP_LT_NN && (bc) <= SEPL_BC_JUMP_NEQ_NN) || \
+     ((bc) >= SEPL_BC_JUMP_LT_Q && (bc) <= SEPL_BC_JUMP_NEQ_Q) ||   \
+     (bc) == SEPL_BC_CALL_DIRECT)
+#define sepl__opt_isjump(bc)                           \
+    (sepl__opt_hasaddr(bc) && (bc) != SEPL_BC_SCOPE && \
+     (bc) != SEPL_BC_FUNC && (bc) != SEPL_BC_CALL_DIRECT)
+/* Instructions whose result is never a function or a reference */
+#define sepl__opt_isplain(bc)                                 \
+    (((bc) >= SEPL_BC_NONE && (bc) <= SEPL_BC_STR) ||         \
+     ((bc) >= SEPL_BC_NEG && (bc) <= SEPL_BC_NEQ) ||          \
+     ((bc) >= SEPL_BC_ADD_NN && (bc) <= SEPL_BC_NEQ_NN) ||    \
+     ((bc) >= SEPL_BC_ADD_Q && (bc) <= SEPL_BC_NEQ_Q) ||      \
+     (bc) == SEPL_BC_ADD_INT || (bc) == SEPL_BC_ADD_INT_NN || \
+     (bc) == SEPL_BC_ADD_INT_Q)
+
+/* Overwrites the operand at pos keeping its encoded width */
+SEPL_API void sepl__opt_wrvar(unsigned char *bytes, sepl_size pos,
+                              sepl_size v) {
+    sepl_size end = pos;
+    sepl__rdvar(bytes, &end);
+    sepl__wrvar(bytes + pos, v, end - pos);
+}
+
+SEPL_API sepl_size sepl__opt_opwidth(const unsigned char *bytes,
+                                     sepl_size pos) {
+    sepl_size end = pos;
+    sepl__rdvar(bytes, &end);
+    return end - pos;
+}
+
+/*
+ * Change found by a pass: instructions removed at pos[i] for len[i] bytes,
+ * the second range may be empty, and the stack offsets in [from, to) moved
+ * as by sepl__opt_walk. keep must not be a jump target, 0 if any may be.
+ */
+typedef struct {
+    sepl_size pos[2], len[2];
+    sepl_size from, to, keep;
+    char decl;
+} SeplOptEdit;
+
+/* End of the code an edit spans */
+#define sepl__opt_span(edit) \
+    ((edit)->len[1] != 0 ? (edit)->pos[1] + (edit)->len[1] \
+                         : (edit)->pos[0] + (edit)->len[0])
+
+/*
+ * Drops the edits that would remove a jump target, reading every address
+ * once, and those inside the code of an edit that is kept. Returns the number
+ * of edits left.
+ */
+SEPL_API sepl_size sepl__opt_targets(SeplModule *mod, SeplOptEdit *edits,
+                                     sepl_size n) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size order[SEPL__OPT_EDITS], keeps = 0, pc, at, a, i, j, lo, hi;
+    sepl_size kept = 0, busy = 0;
+
+    /* Edits with a position to keep, ordered by it */
+    for (i = 0; i < n; i++) {
+        if (edits[i].keep == 0)
+            continue;
+        for (j = keeps++; j > 0 && edits[order[j - 1]].keep > edits[i].keep;
+             j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    for (pc = 0; keeps != 0 && pc < mod->bpos; pc = sepl__bcnext(bytes, pc)) {
+        if (!sepl__opt_hasaddr(bytes[pc]))
+            continue;
+        at = pc + 1;
+        a = sepl__rdvar(bytes, &at);
+        for (lo = 0, hi = keeps; lo < hi;) {
+            sepl_size mid = lo + (hi - lo) / 2;
+            if (edits[order[mid]].keep < a)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo != keeps && edits[order[lo]].keep == a)
+            edits[order[lo]].keep = mod->bpos;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (edits[i].keep == mod->bpos || edits[i].pos[0] < busy)
+            continue;
+        busy = sepl__opt_span(&edits[i]);
+        edits[kept++] = edits[i];
+    }
+    return kept;
+}
+
+/* Position a moves to once the ranges at pos, each len long, are removed.
+ * Positions in a range move to its start */
+SEPL_API sepl_size sepl__opt_map(const sepl_size *pos, const sepl_size *len,
+                                 const sepl_size *sum, sepl_size n,
+                                 sepl_size a) {
+    sepl_size lo = 0, hi = n;
+    while (lo < hi) {
+        sepl_size mid = lo + (hi - lo) / 2;
+        if (pos[mid] >= a)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0)
+        return a;
+    lo--;
+    return a - sum[lo] - (a - pos[lo] < len[lo] ? a - pos[lo] : len[lo]);
+}
+
+/* Removes the instructions of the edits and moves the addresses, all in one
+ * sweep over the code */
+SEPL_API void sepl__opt_compact(SeplModule *mod, const SeplOptEdit *edits,
+                                sepl_size n, SeplOptStats *stats) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size pos[SEPL__OPT_EDITS * 2], len[SEPL__OPT_EDITS * 2];
+    sepl_size sum[SEPL__OPT_EDITS * 2];
+    sepl_size cuts = 0, i, j, c = 0, pc = 0, w = 0, next, at, a;
+
+    /* sum holds the bytes removed before each range */
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 2; j++) {
+            if (edits[i].len[j] == 0)
+                continue;
+            pos[cuts] = edits[i].pos[j];
+            len[cuts] = edits[i].len[j];
+            sum[cuts] = cuts != 0 ? sum[cuts - 1] + len[cuts - 1] : 0;
+            stats->bytes += len[cuts];
+            stats->instrs++;
+            cuts++;
+        }
+    }
+
+    while (pc < mod->bpos) {
+        if (c < cuts && pc == pos[c]) {
+            pc += len[c++];
+            continue;
+        }
+        next = sepl__bcnext(bytes, pc);
+        for (i = pc; i < next; i++) {
+            bytes[w + i - pc] = bytes[i];
+        }
+        if (sepl__opt_hasaddr(bytes[w])) {
+            at = w + 1;
+            a = sepl__rdvar(bytes, &at);
+            sepl__opt_wrvar(bytes, w + 1,
+                            sepl__opt_map(pos, len, sum, cuts, a));
+        }
+        w += next - pc;
+        pc = next;
+    }
+    mod->bpos = w;
+    mod->pc = sepl__opt_map(pos, len, sum, cuts, mod->pc);
+}
+
+/*
+ * Follows the code in [pc, end) with a stack slot below it that is about to
+ * be removed, either a scope marker or a declared variable. depth counts the
+ * values above the slot and last is set to the last instruction outside of
+ * nested blocks. Stops early at a SET outside of nested blocks that assigns
+ * the slot. Returns the position it stopped at or 0 if the code relies on the
+ * slot, in which case nothing is changed. With apply set the stack offsets
+ * that reach below the slot are moved by one.
+ */
+SEPL_API sepl_size sepl__opt_walk(SeplModule *mod, sepl_size pc,
+                                  sepl_size end, long *depth, sepl_size *last,
+                                  char decl, char apply) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size ends[SEPL__OPT_NEST], nest = 0, at, i;
+    long saved[SEPL__OPT_NEST], d = 0;
+
+    while (pc < end) {
+        unsigned char bc = bytes[pc];
+        at = pc + 1;
+
+        /* Loops close their scope with a JUMP rather than a RETURN */
+        if (nest != 0 && pc == ends[nest - 1]) {
+            d = saved[--nest] + 1;
+            continue;
+        }
+
+        switch (bc) {
+            case SEPL_BC_RETURN:
+                if (nest == 0)
+                    return 0;
+                break;
+            case SEPL_BC_SCOPE:
+                if (nest == SEPL__OPT_NEST)
+                    return 0;
+                ends[nest] = sepl__rdvar(bytes, &at);
+                saved[nest++] = d;
+                break;
+            case SEPL_BC_FUNC:
+                /* Function bodies address outer values by absolute index */
+                if (!decl || nest != 0 || d != 0)
+                    return 0;
+                *last = pc;
+                pc = sepl__rdvar(bytes, &at);
+                d++;
+                continue;
+            case SEPL_BC_GET:
+            case SEPL_BC_SET:
+            case SEPL_BC_ADD_INT:
+            case SEPL_BC_INC:
+            case SEPL_BC_GET_CALL:
+            case SEPL_BC_ADD_INT_NN:
+            case SEPL_BC_INC_NN:
+            case SEPL_BC_ADD_INT_Q:
+            case SEPL_BC_INC_Q:
+            case SEPL_BC_GET_CALL_C:
+            case SEPL_BC_GET_CALL_S:
+            case SEPL_BC_TAILCALL:
+                i = sepl__rdvar(bytes, &at);
+                if (i == (sepl_size)d + 1) {
+                    if (decl && nest == 0 && bc == SEPL_BC_SET) {
+                        *depth = d;
+                        return pc;
+                    }
+                    return 0;
+                }
+                if (apply && i > (sepl_size)d)
+                    sepl__opt_wrvar(bytes, pc + 1, i - 1);
+                break;
+            default:
+                break;
+        }
+
+        d += sepl__bcstack(bytes, pc);
+        if (d < 0)
+            return 0;
+        if (nest == 0 || (bc == SEPL_BC_SCOPE && nest == 1))
+            *last = pc;
+        pc = sepl__bcnext(bytes, pc);
+    }
+
+    *depth = d;
+    return pc;
+}
+
+/* Points jumps past chains of unconditional jumps */
+SEPL_API char sepl__opt_thread(SeplModule *mod, sepl_size pc) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size at = pc + 1, a = sepl__rdvar(bytes, &at), t = a, hops = 0;
+
+    while (t < mod->bpos && bytes[t] == SEPL_BC_JUMP &&
+           hops++ < SEPL__OPT_HOPS) {
+        at = t + 1;
+        t = sepl__rdvar(bytes, &at);
+    }
+    if (t == a || (t < mod->bpos && bytes[t] == SEPL_BC_JUMP) ||
+        sepl__varlen(t) > sepl__opt_opwidth(bytes, pc + 1))
+        return 0;
+
+    sepl__opt_wrvar(bytes, pc + 1, t);
+    return 1;
+}
+
+/* Removes the scope of a block that only returns its last value */
+SEPL_API char sepl__opt_flatten(SeplModule *mod, sepl_size pc,
+                                SeplOptEdit *edit) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size at = pc + 1, end = sepl__rdvar(bytes, &at), last = 0, ret;
+    long d;
+
+    if (end >= mod->bpos || end <= at)
+        return 0;
+    /* The RETURN closing the block */
+    for (ret = at; sepl__bcnext(bytes, ret) < end;)
+        ret = sepl__bcnext(bytes, ret);
+    if (bytes[ret] != SEPL_BC_RETURN || sepl__bcnext(bytes, ret) != end)
+        return 0;
+    if (sepl__opt_walk(mod, at, ret, &d, &last, 0, 0) != ret || d != 1)
+        return 0;
+    /* RETURN rejects functions unless the block is returned again */
+    if (!sepl__opt_isplain(bytes[last]) && bytes[end] != SEPL_BC_RETURN)
+        return 0;
+
+    edit->pos[0] = pc;
+    edit->len[0] = at - pc;
+    edit->pos[1] = ret;
+    edit->len[1] = end - ret;
+    edit->from = at;
+    edit->to = ret;
+    edit->keep = ret;
+    edit->decl = 0;
+    return 1;
+}
+
+/* Evaluates the initializer of a declared variable directly into its slot */
+SEPL_API char sepl__opt_decl(SeplModule *mod, sepl_size pc,
+                             SeplOptEdit *edit) {
+    unsigned char *bytes = mod->bytes;
+    sepl_size set, last = pc;
+    long d;
+
+    set = sepl__opt_walk(mod, pc + 1, mod->bpos, &d, &last, 1, 0);
+    if (set == 0 || set == mod->bpos || d != 1)
+        return 0;
+    /* SET copies references which a fresh slot cannot hold */
+    if (!sepl__opt_isplain(bytes[last]) && bytes[last] != SEPL_BC_FUNC)
+        return 0;
+
+    edit->pos[0] = pc;
+    edit->len[0] = 1;
+    edit->pos[1] = set;
+    edit->len[1] = sepl__bcnext(bytes, set) - set;
+    edit->from = pc + 1;
+    edit->to = set;
+    edit->keep = 0;
+    edit->decl = 1;
+    return 1;
+}
+
+/*
+ * Scans the code once for edits, then drops the ones that remove a jump
+ * target and removes the rest in one sweep. Edits inside the code of another
+ * edit are left to the next pass.
+ */
+SEPL_API char sepl__opt_pass(SeplModule *mod, SeplOptStats *stats) {
+    unsigned char *bytes = mod->bytes;
+    SeplOptEdit edits[SEPL__OPT_EDITS];
+    sepl_size pc = 0, next, at, n = 0, i, last;
+    char changed = 0;
+    long d;
+
+    while (pc < mod->bpos && n < SEPL__OPT_EDITS) {
+        unsigned char bc = bytes[pc];
+        SeplOptEdit *edit = &edits[n];
+        next = sepl__bcnext(bytes, pc);
+        edit->from = edit->to = edit->keep = 0;
+        edit->len[1] = 0;
+
+        if (sepl__opt_isjump(bc)) {
+            changed |= sepl__opt_thread(mod, pc);
+            at = pc + 1;
+            if (bc == SEPL_BC_JUMP && sepl__rdvar(bytes, &at) == next) {
+                edit->pos[0] = pc;
+                edit->len[0] = next - pc;
+                n++;
+            }
+        } else if (bc == SEPL_BC_SCOPE) {
+            n += sepl__opt_flatten(mod, pc, edit);
+        } else if (bc == SEPL_BC_NONE) {
+            if (next < mod->bpos && bytes[next] == SEPL_BC_POP) {
+                edit->pos[0] = pc;
+                edit->len[0] = 1;
+                edit->pos[1] = next;
+                edit->len[1] = 1;
+                edit->keep = next;
+                n++;
+            } else {
+                n += sepl__opt_decl(mod, pc, edit);
+            }
+        }
+        pc = next;
+    }
+
+    n = sepl__opt_targets(mod, edits, n);
+    if (n == 0)
+        return changed;
+    for (i = 0; i < n; i++) {
+        if (edits[i].from != edits[i].to)
+            sepl__opt_walk(mod, edits[i].from, edits[i].to, &d, &last,
+                           edits[i].decl, 1);
+    }
+    sepl__opt_compact(mod, edits, n, stats);
+    return 1;
+}
+
+SEPL_LIB SeplOptStats sepl_opt_peephole(SeplModule *mod) {
+    SeplOptStats stats = {0};
+    mod->verified = 0;
+    while (sepl__opt_pass(mod, &stats));
+    return stats;
+}
+
+#undef sepl__opt_span
+#undef sepl__opt_hasaddr
+#undef sepl__opt_isjump
+#undef sepl__opt_isplain
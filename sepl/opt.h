@@ -0,0 +1,21 @@
+#ifndef SEPL_OPTIMIZER
+#define SEPL_OPTIMIZER
+
+#include "def.h"
+#include "mod.h"
+
+typedef struct {
+    sepl_size bytes;
+    sepl_size instrs;
+} SeplOptStats;
+
+/*
+ * Rewrites the bytecode of a compiled module in place, must be called before
+ * the module is executed. Removes jumps to jumps and to the next instruction,
+ * NONE POP pairs, scopes of blocks that only return their last value and the
+ * NONE SET pair of variable declarations. Returns the removed bytes and
+ * instructions.
+ */
+SEPL_LIB SeplOptStats sepl_opt_peephole(SeplModule *mod);
+
+#endif
@@ -1,5 +1,6 @@
 #include "val.h"
 
+#ifndef SEPL_NANBOX
 const SeplValue SEPL_NONE = {0};
 
 SEPL_LIB SeplValue sepl_val_asref(void *v) {
@@ -54,3 +55,82 @@ SEPL_LIB SeplValue sepl_val_type(void *vobj, sepl_size custom_id) {
     r.as.obj = vobj;
     return r;
 }
+
+SEPL_LIB SeplValue sepl__val_make(sepl_size type, void *obj) {
+    SeplValue r;
+    r.type = type;
+    r.as.obj = obj;
+    return r;
+}
+#else
+const SeplValue SEPL_NONE = {sepl__nb_head(SEPL_VAL_NONE)};
+
+/* Reinterprets the bits of a double and back */
+typedef union {
+    sepl_u64 bits;
+    double num;
+} SeplNbPun;
+
+SEPL_LIB sepl_size sepl__nb_type(sepl_u64 bits) {
+    sepl_size tag;
+    if (!sepl__nb_isbox(bits))
+        return SEPL_VAL_NUM;
+    tag = (sepl_size)((bits >> 48 & 0xf) | (bits >> 59 & 0x10));
+    return tag - 1 - tag / 8;
+}
+
+SEPL_LIB double sepl__nb_num(sepl_u64 bits) {
+    SeplNbPun p;
+    p.bits = bits;
+    return p.num;
+}
+
+SEPL_API SeplValue sepl__nb_box(sepl_size type, sepl_u64 payload) {
+    SeplValue r;
+    r.bits = sepl__nb_head(type) | (payload & SEPL__NB_PAYLOAD);
+    return r;
+}
+
+SEPL_LIB SeplValue sepl_val_asref(void *v) {
+    return sepl__nb_box(SEPL_VAL_REF, (sepl_uptr)v);
+}
+
+SEPL_LIB SeplValue sepl_val_scope(sepl_size pos) {
+    return sepl__nb_box(SEPL_VAL_SCOPE, pos);
+}
+
+SEPL_LIB SeplValue sepl_val_number(double vnum) {
+    SeplNbPun p;
+    SeplValue r;
+    p.num = vnum;
+    /* Any other NaN could collide with a boxed value */
+    r.bits = vnum != vnum ? SEPL__NB_EXP | (sepl_u64)1 << 51 : p.bits;
+    return r;
+}
+
+SEPL_LIB SeplValue sepl_val_str(char *str) {
+    return sepl__nb_box(SEPL_VAL_STR, (sepl_uptr)str);
+}
+
+SEPL_LIB SeplValue sepl_val_func(sepl_size pos) {
+    return sepl__nb_box(SEPL_VAL_FUNC, pos);
+}
+
+SEPL_LIB SeplValue sepl_val_cfunc(sepl_c_func cfunc) {
+    return sepl__nb_box(SEPL_VAL_CFUNC, (sepl_uptr)cfunc);
+}
+
+SEPL_LIB SeplValue sepl_val_object(void *vobj) {
+    return sepl_val_type(vobj, 0);
+}
+
+SEPL_LIB SeplValue sepl_val_type(void *vobj, sepl_size custom_id) {
+    return sepl__nb_box(SEPL_VAL_OBJ + custom_id, (sepl_uptr)vobj);
+}
+
+SEPL_LIB SeplValue sepl__val_make(sepl_size type, void *obj) {
+    if (type == SEPL_VAL_NUM)
+        return sepl_val_number(0);
+    return sepl__nb_box(type, (sepl_uptr)obj);
+}
+#endif
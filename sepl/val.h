@@ -17,14 +17,24 @@ typedef enum {
     SEPL_VAL_OBJ
 } SeplValueType;
 
+struct SeplModule;
+struct SeplEnv;
+
 typedef struct {
     SeplValue *values;
     sepl_size size;
+
+    /* Module and environment running a cfunc, which it may pass to
+     * sepl_mod_reenter. SEPL_NULL when the host calls it */
+    struct SeplModule *mod;
+    const struct SeplEnv *env;
 } SeplArgs;
 
 typedef SeplValue (*sepl_c_func)(SeplArgs, SeplError *);
 typedef void (*sepl_free_func)(SeplValue);
+typedef void (*sepl_free_batch_func)(SeplValue *, sepl_size);
 
+#ifndef SEPL_NANBOX
 struct SeplValue {
     sepl_size type;
     union {
@@ -39,16 +49,76 @@ struct SeplValue {
     } as;
 };
 
-extern const SeplValue SEPL_NONE;
+#define sepl_val_gettype(val) ((val).type)
+#define sepl_val_getnum(val) ((val).as.num)
+#define sepl_val_getpos(val) ((val).as.pos)
+#define sepl_val_getcfunc(val) ((val).as.cfunc)
+#define sepl_val_getobj(val) ((val).as.obj)
+
+#define sepl_val_isnone(val) ((val).type == SEPL_VAL_NONE)
+#define sepl_val_isscp(val) ((val).type == SEPL_VAL_SCOPE)
+#define sepl_val_isnum(val) ((val).type == SEPL_VAL_NUM)
+#define sepl_val_isstr(val) ((val).type == SEPL_VAL_STR)
+#define sepl_val_isfun(val) ((val).type == SEPL_VAL_FUNC)
+#define sepl_val_iscfun(val) ((val).type == SEPL_VAL_CFUNC)
+#define sepl_val_isref(val) ((val).type == SEPL_VAL_REF)
+#define sepl_val_isobj(val) ((val).type >= SEPL_VAL_OBJ)
+#else
+/*
+ * Defining SEPL_NANBOX packs values into the 8 bytes of a double. Numbers are
+ * stored as they are, everything else is a NaN: all exponent bits set, the
+ * sign bit and the top 4 mantissa bits holding a tag and the low 48 bits
+ * holding the position or pointer. Tags with their low 3 bits clear are left
+ * to numbers, so infinities and the NaNs arithmetic produces still read as
+ * numbers, and sepl_val_number replaces any other NaN with a canonical one.
+ *
+ * That leaves room for type ids below SEPL_NANBOX_TYPES, so custom ids
+ * passed to sepl_val_type must stay below SEPL_NANBOX_TYPES - SEPL_VAL_OBJ,
+ * and pointers must fit in 48 bits as they do in user space on x86-64 and
+ * AArch64.
+ */
+struct SeplValue {
+    sepl_u64 bits;
+};
+
+#define SEPL_NANBOX_TYPES 28
+
+#define SEPL__NB_EXP ((sepl_u64)0x7ff << 52)
+#define SEPL__NB_LOW ((sepl_u64)7 << 48)
+#define SEPL__NB_HEAD ((sepl_u64)0xffff << 48)
+#define SEPL__NB_PAYLOAD (((sepl_u64)1 << 48) - 1)
 
-#define sepl_val_isnone(val) (val.type == SEPL_VAL_NONE)
-#define sepl_val_isscp(val) (val.type == SEPL_VAL_SCOPE)
-#define sepl_val_isnum(val) (val.type == SEPL_VAL_NUM)
-#define sepl_val_isstr(val) (val.type == SEPL_VAL_STR)
-#define sepl_val_isfun(val) (val.type == SEPL_VAL_FUNC)
-#define sepl_val_iscfun(val) (val.type == SEPL_VAL_CFUNC)
-#define sepl_val_isref(val) (val.type == SEPL_VAL_REF)
-#define sepl_val_isobj(val) (val.type >= SEPL_VAL_OBJ)
+/* Type id t is stored as tag t + 1 + t / 7, skipping the number tags */
+#define sepl__nb_tag(t) ((sepl_u64)(t) + 1 + (sepl_u64)(t) / 7)
+#define sepl__nb_head(t)                                   \
+    (SEPL__NB_EXP | (sepl__nb_tag(t) & 0x10) << 59 |       \
+     (sepl__nb_tag(t) & 0xf) << 48)
+#define sepl__nb_isbox(bits) \
+    (((bits) & SEPL__NB_EXP) == SEPL__NB_EXP && ((bits) & SEPL__NB_LOW) != 0)
+#define sepl__nb_is(val, t) (((val).bits & SEPL__NB_HEAD) == sepl__nb_head(t))
+
+SEPL_LIB sepl_size sepl__nb_type(sepl_u64 bits);
+SEPL_LIB double sepl__nb_num(sepl_u64 bits);
+
+#define sepl_val_gettype(val) sepl__nb_type((val).bits)
+#define sepl_val_getnum(val) sepl__nb_num((val).bits)
+#define sepl_val_getpos(val) ((sepl_size)((val).bits & SEPL__NB_PAYLOAD))
+#define sepl_val_getcfunc(val) \
+    ((sepl_c_func)(sepl_uptr)((val).bits & SEPL__NB_PAYLOAD))
+#define sepl_val_getobj(val) \
+    ((void *)(sepl_uptr)((val).bits & SEPL__NB_PAYLOAD))
+
+#define sepl_val_isnone(val) sepl__nb_is(val, SEPL_VAL_NONE)
+#define sepl_val_isscp(val) sepl__nb_is(val, SEPL_VAL_SCOPE)
+#define sepl_val_isnum(val) (!sepl__nb_isbox((val).bits))
+#define sepl_val_isstr(val) sepl__nb_is(val, SEPL_VAL_STR)
+#define sepl_val_isfun(val) sepl__nb_is(val, SEPL_VAL_FUNC)
+#define sepl_val_iscfun(val) sepl__nb_is(val, SEPL_VAL_CFUNC)
+#define sepl_val_isref(val) sepl__nb_is(val, SEPL_VAL_REF)
+#define sepl_val_isobj(val) (sepl_val_gettype(val) >= SEPL_VAL_OBJ)
+#endif
+
+extern const SeplValue SEPL_NONE;
 
 SEPL_LIB SeplValue sepl_val_asref(void *v);
 SEPL_LIB SeplValue sepl_val_scope(sepl_size pos);
@@ -60,4 +130,8 @@ SEPL_LIB SeplValue sepl_val_cfunc(sepl_c_func cfunc);
 SEPL_LIB SeplValue sepl_val_object(void *vobj);
 SEPL_LIB SeplValue sepl_val_type(void *vobj, sepl_size custom_id);
 
+/* Value of any type id, numbers are 0, used by the compiler for its own
+ * types past SEPL_VAL_OBJ */
+SEPL_LIB SeplValue sepl__val_make(sepl_size type, void *obj);
+
 #endif
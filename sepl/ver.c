@@ -0,0 +1,514 @@
+#include "ver.h"
+
+/* Owner of the code outside of any scope or function body */
+#define SEPL__VER_TOP ((sepl_size)-1)
+
+typedef struct {
+    SeplBC bc;
+    sepl_size a, b;
+    sepl_size next;
+} SeplVerOp;
+
+typedef struct {
+    const unsigned char *bytes;
+    sepl_size bpos;
+    /* 0 inside an instruction, 1 at the start of one no path has reached yet
+     * and the depth of the value stack + 2 at one that a path has */
+    sepl_size *state;
+    /* Position of the SCOPE or FUNC opening the innermost region around each
+     * instruction, SEPL__VER_TOP outside of them */
+    sepl_size *owner;
+    char changed;
+
+    /* Depth at 0 and the deepest the top level code gets */
+    sepl_size start, peak;
+    /* Function body being swept, with the depth at its FUNC and the deepest
+     * it gets above its frame */
+    sepl_size func, fend, fparams, fframe, fdepth, fpeak;
+    /* Instruction whose check only holds once a sweep changes nothing */
+    sepl_size late;
+} SeplVer;
+
+/* Reads the operand at *pc, 0 if it runs past end or does not fit */
+SEPL_API char sepl__ver_rdvar(const unsigned char *bytes, sepl_size *pc,
+                              sepl_size end, sepl_size *v) {
+    sepl_size at = *pc, len = 0;
+    do {
+        if (at >= end || ++len > (sizeof(sepl_size) * 8 + 6) / 7)
+            return 0;
+    } while (bytes[at++] & 0x80);
+    *v = sepl__rdvar(bytes, pc);
+    return 1;
+}
+
+/* Decodes the instruction at pc, 0 if it is not one the interpreter runs or
+ * its operands run past the code */
+SEPL_API char sepl__ver_decode(const SeplVer *v, sepl_size pc,
+                               SeplVerOp *op) {
+    const unsigned char *bytes = v->bytes;
+    int operands = 1, raw = 0;
+
+    op->bc = (SeplBC)bytes[pc++];
+    op->a = op->b = 0;
+    switch (op->bc) {
+        case SEPL_BC_AND:
+        case SEPL_BC_OR:
+            return 0;
+        case SEPL_BC_INT:
+            operands = 0;
+            raw = 1;
+            break;
+        case SEPL_BC_FUNC:
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+        case SEPL_BC_CALL_DIRECT:
+        case SEPL_BC_TAILCALL:
+            operands = 2;
+            break;
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_INC:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_INC_NN:
+        case SEPL_BC_ADD_INT_Q:
+        case SEPL_BC_INC_Q:
+            raw = 1;
+            break;
+        default:
+            if (op->bc > SEPL_BC_FRAME)
+                return 0;
+            if (op->bc == SEPL_BC_POP || op->bc == SEPL_BC_NONE ||
+                (op->bc >= SEPL_BC_NEG && op->bc <= SEPL_BC_NEQ) ||
+                (op->bc >= SEPL_BC_ADD_NN && op->bc <= SEPL_BC_NEQ_NN) ||
+                (op->bc >= SEPL_BC_ADD_Q && op->bc <= SEPL_BC_NEQ_Q))
+                operands = 0;
+            break;
+    }
+
+    if (operands > 0 && !sepl__ver_rdvar(bytes, &pc, v->bpos, &op->a))
+        return 0;
+    if (operands > 1 && !sepl__ver_rdvar(bytes, &pc, v->bpos, &op->b))
+        return 0;
+    if (raw) {
+        if (pc >= v->bpos)
+            return 0;
+        op->b = bytes[pc++];
+    }
+    op->next = pc;
+    return 1;
+}
+
+/* End address of the region opened at r */
+SEPL_API sepl_size sepl__ver_end(const SeplVer *v, sepl_size r) {
+    if (r == SEPL__VER_TOP)
+        return v->bpos;
+    r++;
+    return sepl__rdvar(v->bytes, &r);
+}
+
+/*
+ * Decodes every instruction, checks the constants they refer to and that
+ * scopes and function bodies nest, and records the owner of each. *at is left
+ * at the instruction at fault.
+ */
+SEPL_API char sepl__ver_scan(const SeplModule *mod, SeplVer *v,
+                             sepl_size *at) {
+    sepl_size pool = (mod->bsize - mod->kpos) / SEPL_KSLOT;
+    sepl_size cur = SEPL__VER_TOP, end = v->bpos, pc, i;
+    sepl_size func = SEPL__VER_TOP, body = SEPL__VER_TOP;
+    SeplVerOp op;
+
+    for (pc = 0; pc < v->bpos; pc++) {
+        v->state[pc] = 0;
+    }
+
+    for (pc = 0; pc < v->bpos; pc = op.next) {
+        *at = pc;
+        while (cur != SEPL__VER_TOP && pc == end) {
+            if (cur == func)
+                func = SEPL__VER_TOP;
+            cur = v->owner[cur];
+            end = sepl__ver_end(v, cur);
+        }
+        if (!sepl__ver_decode(v, pc, &op) || op.next > end)
+            return 0;
+        /* FRAME starts each function body and nothing else */
+        if ((pc == body) != (op.bc == SEPL_BC_FRAME))
+            return 0;
+        v->state[pc] = 1;
+        v->owner[pc] = cur;
+
+        switch (op.bc) {
+            case SEPL_BC_FUNC:
+                /* Functions do not nest */
+                if (func != SEPL__VER_TOP)
+                    return 0;
+                func = pc;
+                body = op.next;
+                if (op.a <= op.next || op.a > end)
+                    return 0;
+                cur = pc;
+                end = op.a;
+                break;
+            case SEPL_BC_SCOPE:
+                if (op.a <= op.next || op.a > end)
+                    return 0;
+                cur = pc;
+                end = op.a;
+                break;
+            case SEPL_BC_CONST:
+                if (op.a == 0 || op.a > pool)
+                    return 0;
+                break;
+            case SEPL_BC_STR:
+                if (op.a == 0 || op.a > pool)
+                    return 0;
+                for (i = mod->bsize - op.a * SEPL_KSLOT;
+                     i < mod->bsize && mod->bytes[i]; i++);
+                if (i == mod->bsize)
+                    return 0;
+                break;
+            default:
+                break;
+        }
+    }
+    return 1;
+}
+
+/* 1 if slot holds the scope opened at r or at one around it, up to the
+ * return scope of the function */
+SEPL_API char sepl__ver_ismark(const SeplVer *v, sepl_size r, sepl_size slot) {
+    for (; r != SEPL__VER_TOP; r = v->owner[r]) {
+        sepl_size mark = v->bytes[r] == SEPL_BC_FUNC ? 0 : v->state[r] - 2;
+        if (mark == slot)
+            return 1;
+        if (mark < slot || v->bytes[r] == SEPL_BC_FUNC)
+            return 0;
+    }
+    return 0;
+}
+
+/* Joins the path reaching t with the stack at depth d, t must start an
+ * instruction of region r. Leaving the code is only allowed at the top */
+SEPL_API char sepl__ver_flow(SeplVer *v, sepl_size r, sepl_size t,
+                             sepl_size d) {
+    if (t == v->bpos)
+        return r == SEPL__VER_TOP;
+    if (t > v->bpos || v->state[t] == 0 || v->owner[t] != r)
+        return 0;
+    if (v->state[t] == 1) {
+        v->state[t] = d + 2;
+        v->changed = 1;
+        return 1;
+    }
+    return v->state[t] == d + 2;
+}
+
+/* Follows the instruction at pc if a path reaches it */
+SEPL_API char sepl__ver_step(SeplVer *v, sepl_size pc, const SeplVerOp *op) {
+    sepl_size cur = v->owner[pc], r = cur, own = cur;
+    sepl_size d, nd, low, hi, slot;
+
+    if (v->state[pc] < 2)
+        return 1;
+    d = v->state[pc] - 2;
+
+    /* Scopes whose value this path popped may only be left with POP and
+     * JUMP, r is the innermost one it did not */
+    while (r != SEPL__VER_TOP && v->bytes[r] == SEPL_BC_SCOPE &&
+           v->state[r] - 2 >= d) {
+        r = v->owner[r];
+    }
+    if (r != cur && op->bc != SEPL_BC_POP && op->bc != SEPL_BC_JUMP)
+        return 0;
+    if (r == SEPL__VER_TOP)
+        low = v->start;
+    else if (v->bytes[r] == SEPL_BC_SCOPE)
+        low = v->state[r] - 1;
+    else
+        low = 1;
+
+#define sepl__ver_pop(n)      \
+    do {                      \
+        if ((n) > d - low)    \
+            return 0;         \
+    } while (0)
+#define sepl__ver_read(i)          \
+    do {                           \
+        if ((i) == 0 || (i) > d)   \
+            return 0;              \
+    } while (0)
+/* Writes may not replace a scope */
+#define sepl__ver_write(i)                                                \
+    do {                                                                  \
+        if ((i) == 0 || (i) > d || sepl__ver_ismark(v, cur, d - (i)))     \
+            return 0;                                                     \
+    } while (0)
+
+    switch (op->bc) {
+        case SEPL_BC_RETURN:
+            if (op->a >= d || !sepl__ver_ismark(v, cur, d - op->a - 1))
+                return 0;
+            nd = d;
+            break;
+        case SEPL_BC_JUMP:
+            if (!sepl__ver_flow(v, r, op->a, d))
+                return 0;
+            nd = d;
+            break;
+        case SEPL_BC_JUMPIF:
+            sepl__ver_pop(1);
+            nd = d - 1;
+            if (!sepl__ver_flow(v, cur, op->a, nd))
+                return 0;
+            break;
+
+        case SEPL_BC_CALL:
+        case SEPL_BC_CALL_C:
+        case SEPL_BC_CALL_S:
+            /* The callee and its arguments */
+            if (op->a >= d - low)
+                return 0;
+            nd = d - op->a;
+            break;
+        case SEPL_BC_GET_CALL:
+        case SEPL_BC_GET_CALL_C:
+        case SEPL_BC_GET_CALL_S:
+            sepl__ver_read(op->a);
+            sepl__ver_pop(op->b);
+            nd = d - op->b + 1;
+            break;
+        case SEPL_BC_CALL_DIRECT: {
+            sepl_size func, at;
+            if (op->b >= d - low)
+                return 0;
+            if (op->a >= v->bpos || v->state[op->a] == 0 ||
+                v->bytes[op->a] != SEPL_BC_FRAME)
+                return 0;
+            func = v->owner[op->a];
+            at = func + 1;
+            sepl__rdvar(v->bytes, &at);
+            if (sepl__rdvar(v->bytes, &at) != op->b)
+                return 0;
+            /* The body is only checked where its FUNC is reached */
+            if (v->state[func] < 2)
+                v->late = pc;
+            nd = d - op->b;
+            break;
+        }
+        case SEPL_BC_TAILCALL:
+            /* Replaces the frame of the function it is in */
+            if (v->func == SEPL__VER_TOP || op->a != d || op->b >= d - low)
+                return 0;
+            nd = d - op->b;
+            break;
+
+        case SEPL_BC_POP:
+            /* May pop the scope of r too, which leaves it */
+            if (r != SEPL__VER_TOP && v->bytes[r] == SEPL_BC_SCOPE)
+                low--;
+            sepl__ver_pop(1);
+            nd = d - 1;
+            break;
+        case SEPL_BC_DROP:
+            sepl__ver_pop(op->a);
+            nd = d - op->a;
+            break;
+
+        case SEPL_BC_NONE:
+        case SEPL_BC_CONST:
+        case SEPL_BC_INT:
+        case SEPL_BC_STR:
+            nd = d + 1;
+            break;
+        case SEPL_BC_SCOPE:
+            if (!sepl__ver_flow(v, cur, op->a, d + 1))
+                return 0;
+            own = pc;
+            nd = d + 1;
+            break;
+        case SEPL_BC_FUNC:
+            if (!sepl__ver_flow(v, cur, op->a, d + 1) ||
+                !sepl__ver_flow(v, pc, op->next, 1 + op->b))
+                return 0;
+            v->fdepth = d;
+            if (d + 1 > v->peak)
+                v->peak = d + 1;
+            return 1;
+
+        case SEPL_BC_GET:
+            sepl__ver_read(op->a);
+            nd = d + 1;
+            break;
+        case SEPL_BC_SET:
+            sepl__ver_write(op->a);
+            sepl__ver_pop(1);
+            nd = d - 1;
+            break;
+        case SEPL_BC_GET_UP:
+            /* A function reaches its own slot and the values below */
+            if (op->a >= (v->func != SEPL__VER_TOP ? v->fdepth + 1 : d))
+                return 0;
+            nd = d + 1;
+            break;
+        case SEPL_BC_SET_UP:
+            slot = op->a;
+            if (v->func != SEPL__VER_TOP
+                    ? slot > v->fdepth ||
+                          sepl__ver_ismark(v, v->owner[v->func], slot)
+                    : slot >= d || sepl__ver_ismark(v, cur, slot))
+                return 0;
+            sepl__ver_pop(1);
+            nd = d - 1;
+            break;
+
+        case SEPL_BC_NEG:
+        case SEPL_BC_NOT:
+            sepl__ver_pop(1);
+            nd = d;
+            break;
+
+        case SEPL_BC_JUMP_LT:
+        case SEPL_BC_JUMP_LTE:
+        case SEPL_BC_JUMP_GT:
+        case SEPL_BC_JUMP_GTE:
+        case SEPL_BC_JUMP_EQ:
+        case SEPL_BC_JUMP_NEQ:
+        case SEPL_BC_JUMP_LT_NN:
+        case SEPL_BC_JUMP_LTE_NN:
+        case SEPL_BC_JUMP_GT_NN:
+        case SEPL_BC_JUMP_GTE_NN:
+        case SEPL_BC_JUMP_EQ_NN:
+        case SEPL_BC_JUMP_NEQ_NN:
+        case SEPL_BC_JUMP_LT_Q:
+        case SEPL_BC_JUMP_LTE_Q:
+        case SEPL_BC_JUMP_GT_Q:
+        case SEPL_BC_JUMP_GTE_Q:
+        case SEPL_BC_JUMP_EQ_Q:
+        case SEPL_BC_JUMP_NEQ_Q:
+            sepl__ver_pop(2);
+            nd = d - 2;
+            if (!sepl__ver_flow(v, cur, op->a, nd))
+                return 0;
+            break;
+        case SEPL_BC_JUMP_AND:
+        case SEPL_BC_JUMP_OR:
+            /* The short circuit value takes the place of the operand */
+            sepl__ver_pop(1);
+            nd = d - 1;
+            if (!sepl__ver_flow(v, cur, op->a, d))
+                return 0;
+            break;
+
+        case SEPL_BC_ADD_INT:
+        case SEPL_BC_ADD_INT_NN:
+        case SEPL_BC_ADD_INT_Q:
+            sepl__ver_read(op->a);
+            nd = d + 1;
+            break;
+        case SEPL_BC_INC:
+        case SEPL_BC_INC_NN:
+        case SEPL_BC_INC_Q:
+            sepl__ver_write(op->a);
+            nd = d;
+            break;
+        case SEPL_BC_FRAME:
+            v->fframe = op->a;
+            nd = d;
+            break;
+
+        default:
+            /* The binary operators */
+            sepl__ver_pop(2);
+            nd = d - 1;
+            break;
+    }
+
+#undef sepl__ver_pop
+#undef sepl__ver_read
+#undef sepl__ver_write
+
+    /* GET_CALL pushes the last argument before the call pops them */
+    hi = nd > d ? nd : d;
+    if (op->bc == SEPL_BC_GET_CALL || op->bc == SEPL_BC_GET_CALL_C ||
+        op->bc == SEPL_BC_GET_CALL_S)
+        hi = d + 1;
+    if (v->func != SEPL__VER_TOP) {
+        if (hi > v->fpeak)
+            v->fpeak = hi;
+    } else if (hi > v->peak) {
+        v->peak = hi;
+    }
+
+    if (op->bc == SEPL_BC_RETURN || op->bc == SEPL_BC_JUMP)
+        return 1;
+    return sepl__ver_flow(v, own, op->next, nd);
+}
+
+/* Checks that the function body left at its end fits its FRAME */
+SEPL_API void sepl__ver_leave(SeplVer *v) {
+    sepl_size params = 1 + v->fparams;
+    if (v->fpeak > params && v->fpeak - params > v->fframe)
+        v->late = v->func;
+    v->func = SEPL__VER_TOP;
+}
+
+SEPL_LIB SeplError sepl_ver_module(SeplModule *mod, SeplEnv env, void *buf,
+                                   sepl_size size) {
+    SeplError err = {0};
+    SeplVer v;
+    SeplVerOp op;
+    sepl_size pc = 0;
+
+    mod->verified = 0;
+    if (size < sepl_ver_bufsize(mod)) {
+        sepl_err_new(&err, SEPL_ERR_BOVERFLOW);
+        return err;
+    }
+
+    v.bytes = mod->bytes;
+    v.bpos = mod->bpos;
+    v.state = (sepl_size *)buf;
+    v.owner = v.state + mod->bpos;
+    v.start = env.predef_len + mod->esize;
+    v.fend = v.fparams = v.fframe = v.fdepth = v.fpeak = 0;
+    if (mod->kpos < mod->bpos || mod->kpos > mod->bsize ||
+        !sepl__ver_scan(mod, &v, &pc))
+        goto bad;
+
+    /* Sweep the code until no path reaches an instruction it did not */
+    if (v.bpos != 0)
+        v.state[0] = v.start + 2;
+    do {
+        v.changed = 0;
+        v.peak = v.start;
+        v.func = v.late = SEPL__VER_TOP;
+        for (pc = 0; pc < v.bpos; pc = op.next) {
+            if (v.func != SEPL__VER_TOP && pc == v.fend)
+                sepl__ver_leave(&v);
+            sepl__ver_decode(&v, pc, &op);
+            if (!sepl__ver_step(&v, pc, &op))
+                goto bad;
+            if (op.bc == SEPL_BC_FUNC) {
+                v.func = pc;
+                v.fend = op.a;
+                v.fparams = op.b;
+                v.fframe = v.fpeak = 0;
+            }
+        }
+        if (v.func != SEPL__VER_TOP)
+            sepl__ver_leave(&v);
+    } while (v.changed);
+
+    if (v.late != SEPL__VER_TOP) {
+        pc = v.late;
+        goto bad;
+    }
+    mod->verified = 1 + v.peak - v.start;
+    return err;
+
+bad:
+    sepl_err_new(&err, SEPL_ERR_BC);
+    err.info.bc = pc < mod->bpos ? (char)mod->bytes[pc] : 0;
+    return err;
+}
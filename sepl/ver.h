@@ -0,0 +1,35 @@
+#ifndef SEPL_VERIFIER
+#define SEPL_VERIFIER
+
+#include "def.h"
+#include "env.h"
+#include "err.h"
+#include "mod.h"
+
+/* Bytes of scratch memory sepl_ver_module needs for the code of mod */
+#define sepl_ver_bufsize(mod) (2 * (mod)->bpos * sizeof(sepl_size))
+
+/*
+ * Checks the code of a finished module once, so that it can run without the
+ * checks the interpreter makes on every instruction. Opcodes and operands
+ * must decode within the code, constants must lie in the pool and scopes and
+ * function bodies must nest. Every path is followed with the depth of the
+ * value stack, which must be the same wherever paths join. Pops may not reach
+ * below the innermost scope, jumps may not leave it, RETURN must leave an
+ * enclosing scope and variables may only be written above the scopes. Each
+ * function body must push no more values than its FRAME allows.
+ *
+ * The code at 0 is checked for the values sepl_mod_init pushes for env, each
+ * function body for its return scope and parameters. buf must be aligned for
+ * sepl_size and hold sepl_ver_bufsize(mod) bytes. On success the module is
+ * marked as verified until it is compiled or optimized again. Invalid code
+ * fails with SEPL_ERR_BC and the opcode at fault in info.bc, a buffer that is
+ * too small with SEPL_ERR_BOVERFLOW.
+ *
+ * Building with SEPL_UNCHECKED runs only verified modules and leaves out the
+ * stack bounds checks. The types of values are still checked when used.
+ */
+SEPL_LIB SeplError sepl_ver_module(SeplModule *mod, SeplEnv env, void *buf,
+                                   sepl_size size);
+
+#endif
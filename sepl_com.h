@@ -25,6 +25,27 @@
 
 #include "sepl.h"
 
+/* Number of recent instructions remembered for fusing and folding */
+#define SEPL__COM_OPS 8
+/* Nesting depth of bodies compiled without a scope */
+#define SEPL__COM_FLAT 16
+/* Number of declared functions remembered for direct calls */
+#define SEPL__COM_DIRECT 32
+
+/* Interned identifier of the symbol table */
+typedef struct {
+    const char *name;
+    sepl_size hash;
+    sepl_size head; /* Latest binding + 1, 0 if there is none */
+} SeplComSym;
+
+/* Variable declared with an identifier */
+typedef struct {
+    const char *start;
+    sepl_size index;
+    sepl_size prev; /* Binding shadowed by this one + 1 */
+} SeplComBind;
+
 typedef struct {
     SeplLexer lex;
     SeplModule *mod;
@@ -36,9 +57,57 @@ typedef struct {
     char block_ret;
     char inner_ret;
     char func_block;
+    /* 2 in the statements of a function body and 1 in the bodies of its if,
+     * else and while statements, where returning a call is a tail call. 0
+     * anywhere else, expressions included */
+    char tail;
+    /* Value position of the function whose body is being compiled */
+    sepl_size frame;
+    /* Value position of the scope a RETURN written now leaves */
+    sepl_size scope;
+    /* Deepest the value stack got, over the whole source and in the function
+     * body being compiled */
+    sepl_size vmax, fmax;
 
     /* 0 - no assign, 1 - local, 2 - upvalue (scope), 3 - upvalue (function) */
     char assign_type;
+
+    /* Start and constant pool position of the latest instructions and the
+     * latest jump target. Instructions are only fused or folded when no jump
+     * target lies between them */
+    struct {
+        sepl_size pos, kpos;
+    } ops[SEPL__COM_OPS];
+    sepl_size nops, label;
+
+    /* Value positions where bodies compiled without a scope begin */
+    sepl_size flat[SEPL__COM_FLAT];
+    sepl_size nflat;
+    /* End of the latest body found to hold no return statement */
+    const char *noret;
+    /* Start of the outermost loop being compiled + 1, 0 outside of loops,
+     * and the position below which no number only instruction is left */
+    sepl_size loop, typed;
+
+    /* Functions bound by the declaration of a variable that has not been
+     * assigned since. Calls through the variable jump straight to the body,
+     * an entry is free when start is null. end is the position after the
+     * function once it is compiled, 0 before */
+    struct {
+        const char *start;
+        sepl_size index, func, body, end, params;
+    } direct[SEPL__COM_DIRECT];
+
+    /* Symbol table set up by sepl_com_symtab. binds and marks hold the
+     * variables and the scope and function values on the value stack in
+     * ascending positions, names are interned while a variable is bound */
+    SeplComSym *syms;
+    SeplComBind *binds;
+    sepl_size *marks;
+    sepl_size sym_cap, sym_len, bind_cap, bind_len, mark_cap, mark_len;
+    /* Set once the symbol table ran out of space, variables are found by
+     * scanning the value stack from then on */
+    char sym_full;
 } SeplCompiler;
 
 SEPL_LIB void sepl_com_number(SeplCompiler *com);
@@ -62,8 +131,8 @@ SEPL_LIB void sepl_com_expr(SeplCompiler *com);
 SEPL_LIB void sepl_com_return(SeplCompiler *com);
 
 SEPL_LIB void sepl_com_if(SeplCompiler *com);
-SEPL_LIB void sepl_com_else(SeplCompiler *com, unsigned char *if_jump,
-                            unsigned char **end_jump);
+SEPL_LIB void sepl_com_else(SeplCompiler *com, sepl_size if_jump,
+                            sepl_size *end_jump);
 SEPL_LIB void sepl_com_while(SeplCompiler *com);
 
 SEPL_LIB void sepl_com_statement(SeplCompiler *com);
@@ -72,8 +141,29 @@ SEPL_LIB void sepl_com_module(SeplCompiler *com);
 
 SEPL_LIB SeplCompiler sepl_com_init(const char *source, SeplModule *mod,
                                     SeplEnv env);
+SEPL_LIB char sepl_com_symtab(SeplCompiler *com, void *buf, sepl_size size);
 SEPL_LIB SeplError sepl_com_finish(SeplCompiler *com);
 
+typedef struct {
+    sepl_size bsize;
+    sepl_size vsize;
+} SeplComSizes;
+
+/*
+ * Dry run of compiling source with entry, sepl_com_block or sepl_com_module,
+ * for mod. The code is only counted in a SeplSink, mod->bytes is never
+ * written and may be of any size. The compiler resolves names in the value
+ * buffer, which serves as scratch space for the compile time value stack.
+ * Sets sizes to the smallest buffers sepl_mod_new takes for the same compile:
+ * bsize is exact and vsize holds the deepest the compile time value stack
+ * gets. Running the module needs sepl_mod_funcsize more values for each call
+ * in progress.
+ */
+SEPL_LIB SeplError sepl_com_measure(const char *source, SeplModule *mod,
+                                    SeplEnv env,
+                                    void (*entry)(SeplCompiler *),
+                                    SeplComSizes *sizes);
+
 #ifdef SEPL_IMPLEMENTATION
 
 #define SEPL__ASSIGN_NONE 0
@@ -81,8 +171,15 @@ SEPL_LIB SeplError sepl_com_finish(SeplCompiler *com);
 #define SEPL__ASSIGN_UPS 2
 #define SEPL__ASSIGN_UPV 3
 
+/*
+ * Compile time types of the value stack. A number is only known to be one at
+ * runtime when it comes from a constant, an operator or a local variable that
+ * has held nothing but numbers since its declaration (SEPL_VAR_NUM). Numbers
+ * read from other variables are SEPL_VAL_NUMX and are checked at runtime.
+ */
 typedef enum {
     SEPL_VAL_UNKNOWN = SEPL_VAL_OBJ + 1,
+    SEPL_VAL_NUMX,
     SEPL_VAR_NONE,
     SEPL_VAR_SCOPE,
     SEPL_VAR_NUM,
@@ -91,7 +188,9 @@ typedef enum {
     SEPL_VAR_CFUNC,
     SEPL_VAR_REF,
     SEPL_VAR_OBJ,
-    SEPL_VAR_UNKNOWN
+    SEPL_VAR_UNKNOWN,
+    SEPL_VAR_NUMX,
+    SEPL_VAR_DECL /* Declared, before its initializer is assigned */
 } SeplComVar;
 
 typedef void (*sepl_parse_func)(SeplCompiler *);
@@ -163,29 +262,89 @@ SeplParseRule rules[SEPL_TOK_EOF + 1] = {
 #define seplc__getrule(tok) (&rules[tok.type])
 #define seplc__currtok(com) ((com)->lex.current)
 #define seplc__nexttok(com) (sepl_lex_next(&(com)->lex))
-#define seplc__peektok(com) (sepl_lex_peek((com)->lex))
+#define seplc__peektok(com) (sepl_lex_ahead(&(com)->lex, 0))
 
 #define seplc__isnum(v) (v == SEPL_VAL_NUM || v == SEPL_VAL_UNKNOWN)
 
+/* Writes an opcode, operands are written with the sepl_mod_bc* functions */
 #define seplc__writebyte(com, code) \
-    (sepl_mod_bc((com)->mod, code, &(com)->error))
-#define seplc__writenum(com, value) \
-    (sepl_mod_bcnum((com)->mod, value, &(com)->error))
+    (seplc__pushop(com), sepl_mod_bc((com)->mod, code, &(com)->error))
 #define seplc__writesize(com, value) \
     (sepl_mod_bcsize((com)->mod, value, &(com)->error))
 #define seplc__writepop(com) \
     (seplc__writebyte((com), SEPL_BC_POP), (com)->mod->vpos--)
-
-#define seplc__writeconst(com, type, value)                        \
-    (seplc__writebyte((com), type), seplc__writenum((com), value), \
-     seplc__markval(com, SEPL_VAL_NUM))
+/* RETURN of the value on top, which lies n values above its scope */
+#define seplc__writereturn(com)                \
+    seplc__writesized((com), SEPL_BC_RETURN, \
+                      (com)->mod->vpos - (com)->scope - 1)
+
+#define seplc__rawval(com, index) \
+    ((int)sepl_val_gettype((com)->mod->values[index]))
+/* Both operands on top of the value stack are known to be numbers */
+#define seplc__typednn(com)                                      \
+    (seplc__rawval(com, (com)->mod->vpos - 1) == SEPL_VAL_NUM && \
+     seplc__rawval(com, (com)->mod->vpos - 2) == SEPL_VAL_NUM)
+
+#define seplc__writeconst(com, value) \
+    (seplc__writenum((com), value), seplc__markval(com, SEPL_VAL_NUM))
 #define seplc__writesized(com, type, value) \
     (seplc__writebyte((com), type), seplc__writesize((com), value))
 
 #define seplc__writeplaceholder(com) \
-    (seplc__writesize((com), 0),     \
-     (com)->mod->bytes + (com)->mod->bpos - sizeof(sepl_size))
-#define seplc__setpholder(com, ph) (*(sepl_size *)ph = (com)->mod->bpos)
+    sepl_mod_bcaddr((com)->mod, 0, &(com)->error)
+#define seplc__setpholderto(com, ph, pos) \
+    (seplc__label(com, pos), sepl_mod_setaddr((com)->mod, ph, pos))
+#define seplc__setpholder(com, ph) \
+    seplc__setpholderto(com, ph, (com)->mod->bpos)
+
+/* Start of the i-th latest instruction, i < nops */
+#define seplc__op(com, i) ((com)->ops[(com)->nops - 1 - (i)].pos)
+
+/* Byte of the code at pos, 0xFF which is no instruction once a sink dropped
+ * it. Code is only read back up to bpos, so the operands after an opcode
+ * that is kept are as well */
+SEPL_API unsigned char seplc__byte(SeplCompiler *com, sepl_size pos) {
+    unsigned char *at = sepl__baddr(com->mod, pos);
+    return at != SEPL_NULL ? *at : 0xFF;
+}
+
+/* Writes b at pos unless a sink dropped it. A sink keeps the start of a long
+ * string, which is all that is read back of it */
+SEPL_API void seplc__setbyte(SeplCompiler *com, sepl_size pos,
+                             unsigned char b) {
+    unsigned char *at = sepl__baddr(com->mod, pos);
+    if (at != SEPL_NULL)
+        *at = b;
+}
+
+/* Reads the operand at *pos and moves past it */
+SEPL_API sepl_size seplc__rdvar(SeplCompiler *com, sepl_size *pos) {
+    sepl_size at = 0, v = sepl__rdvar(sepl__baddr(com->mod, *pos), &at);
+    *pos += at;
+    return v;
+}
+
+/* Position after the instruction at pc */
+SEPL_API sepl_size seplc__next(SeplCompiler *com, sepl_size pc) {
+    unsigned char *at = sepl__baddr(com->mod, pc);
+    return at != SEPL_NULL ? pc + sepl__bcnext(at, 0) : pc;
+}
+
+/* Marks pos as a jump target so nothing is fused across it */
+#define seplc__label(com, pos) \
+    ((com)->label = (pos) > (com)->label ? (pos) : (com)->label)
+
+/* Size of an instruction with a placeholder operand */
+#define seplc__jumpsize(com) (1 + sepl__varlen((com)->mod->bsize))
+
+/* Notes that the value stack reaches n values */
+#define seplc__reach(com, n)                                     \
+    do {                                                         \
+        if ((n) > (com)->fmax)                                   \
+            (com)->fmax = (n);                                   \
+        if ((n) > (com)->vmax)                                   \
+            (com)->vmax = (n);                                   \
+    } while (0)
 
 #define seplc__check(com)                     \
     do {                                      \
@@ -201,6 +360,46 @@ SeplParseRule rules[SEPL_TOK_EOF + 1] = {
         }                                                              \
     } while (0);
 
+SEPL_API void seplc__pushop(SeplCompiler *com) {
+    if (com->nops == SEPL__COM_OPS) {
+        sepl_size i;
+        for (i = 1; i < SEPL__COM_OPS; i++) {
+            com->ops[i - 1] = com->ops[i];
+        }
+        com->nops--;
+    }
+    com->ops[com->nops].pos = com->mod->bpos;
+    com->ops[com->nops].kpos = com->mod->kpos;
+    com->nops++;
+}
+
+/* Drops the code from pos onwards along with its constants */
+SEPL_API void seplc__rewind(SeplCompiler *com, sepl_size pos) {
+    while (com->nops != 0 && seplc__op(com, 0) >= pos) {
+        com->mod->kpos = com->ops[--com->nops].kpos;
+    }
+    com->mod->bpos = pos;
+    if (com->typed > pos)
+        com->typed = pos;
+}
+
+/* Turns the number only instructions of the loops being compiled back into
+ * their checked forms, once a variable they may read stops being a number */
+SEPL_API void seplc__untype(SeplCompiler *com) {
+    unsigned char *bytes = com->mod->bytes;
+    sepl_size pc = com->loop - 1;
+
+    /* Only opcodes change, not the size of the code a sink counts */
+    if (com->loop == 0 || com->mod->sink != SEPL_NULL)
+        return;
+    if (pc < com->typed)
+        pc = com->typed;
+    for (; pc < com->mod->bpos; pc = sepl__bcnext(bytes, pc)) {
+        bytes[pc] = (unsigned char)sepl__bcgeneric((SeplBC)bytes[pc]);
+    }
+    com->typed = com->mod->bpos;
+}
+
 SEPL_API void seplc__parse(SeplCompiler *com, SeplComPrec pre) {
     SeplToken tok = seplc__currtok(com);
 
@@ -238,34 +437,248 @@ SEPL_API void seplc__parse(SeplCompiler *com, SeplComPrec pre) {
     }
 }
 
-SEPL_API void seplc__markvar(SeplCompiler *com, const char *start) {
-    SeplValue v = sepl_val_object((void *)start);
-    v.type = SEPL_VAR_NONE;
+SEPL_API sepl_size seplc__hash(const char *name) {
+    sepl_size hash = 2166136261u;
+    while (sepl_is_identifier(*name)) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+SEPL_API char seplc__varcmp(const char *v, const char *i) {
+    char match = *v == *i;
+    if (!match)
+        return match;
+
+    for (;; v++, i++) {
+        if (!sepl_is_identifier(*v)) {
+            if (sepl_is_identifier(*i))
+                match = 0;
+            break;
+        } else {
+            if (*v == *i)
+                continue;
+            match = 0;
+            break;
+        }
+    }
+    return match;
+}
+
+/* Finds the interned identifier, interning it if insert is set */
+SEPL_API SeplComSym *seplc__intern(SeplCompiler *com, const char *name,
+                                   char insert) {
+    sepl_size hash = seplc__hash(name), mask = com->sym_cap - 1;
+    sepl_size i = hash & mask;
+
+    for (; com->syms[i].name != SEPL_NULL; i = (i + 1) & mask) {
+        if (com->syms[i].hash == hash && seplc__varcmp(com->syms[i].name, name))
+            return &com->syms[i];
+    }
+    if (!insert || (com->sym_len + 1) * 4 > com->sym_cap * 3)
+        return SEPL_NULL;
+
+    com->sym_len++;
+    com->syms[i].name = name;
+    com->syms[i].hash = hash;
+    com->syms[i].head = 0;
+    return &com->syms[i];
+}
+
+/* Removes an identifier no variable is bound to, moving back the ones
+ * probed past it */
+SEPL_API void seplc__unintern(SeplCompiler *com, SeplComSym *sym) {
+    sepl_size mask = com->sym_cap - 1, i = (sepl_size)(sym - com->syms);
+    sepl_size j = i, home;
+
+    for (;;) {
+        j = (j + 1) & mask;
+        if (com->syms[j].name == SEPL_NULL)
+            break;
+        home = com->syms[j].hash & mask;
+        /* Stays when its home lies cyclically in (i, j] */
+        if (i <= j ? i < home && home <= j : i < home || home <= j)
+            continue;
+        com->syms[i] = com->syms[j];
+        i = j;
+    }
+    com->syms[i].name = SEPL_NULL;
+    com->sym_len--;
+}
+
+/* Drops the variables and marks at vpos and above off the symbol table */
+SEPL_API void seplc__unbind(SeplCompiler *com, sepl_size vpos) {
+    SeplComBind *bind;
+    SeplComSym *sym;
+
+    if (com->syms == SEPL_NULL)
+        return;
+    while (com->mark_len != 0 && com->marks[com->mark_len - 1] >= vpos) {
+        com->mark_len--;
+    }
+    while (com->bind_len != 0 && com->binds[com->bind_len - 1].index >= vpos) {
+        bind = &com->binds[--com->bind_len];
+        sym = seplc__intern(com, bind->start, 0);
+        sym->head = bind->prev;
+        if (sym->head == 0)
+            seplc__unintern(com, sym);
+    }
+}
+
+/* Switches to scanning the value stack once the symbol table is full */
+#define seplc__symfull(com) ((com)->syms = SEPL_NULL, (com)->sym_full = 1)
+
+/* Adds the variable or scope value at pos to the symbol table */
+SEPL_API void seplc__bindval(SeplCompiler *com, SeplValue v, sepl_size pos) {
+    SeplComSym *sym;
+
+    if (sepl_val_isscp(v) || sepl_val_isfun(v)) {
+        if (com->mark_len == com->mark_cap)
+            seplc__symfull(com);
+        else
+            com->marks[com->mark_len++] = pos;
+        return;
+    } else if (sepl_val_gettype(v) < SEPL_VAR_NONE) {
+        return;
+    }
+
+    sym = seplc__intern(com, (const char *)sepl_val_getobj(v), 1);
+    if (sym == SEPL_NULL || com->bind_len == com->bind_cap) {
+        seplc__symfull(com);
+        return;
+    }
+    com->binds[com->bind_len].start = (const char *)sepl_val_getobj(v);
+    com->binds[com->bind_len].index = pos;
+    com->binds[com->bind_len].prev = sym->head;
+    sym->head = ++com->bind_len;
+}
+
+/* Pushes a compile time value, the symbol table falls back to scanning the
+ * value stack once it runs out of space */
+SEPL_API void seplc__pushval(SeplCompiler *com, SeplValue v) {
+    sepl_size pos = com->mod->vpos;
+
+    if (com->syms != SEPL_NULL) {
+        /* Values popped since are no longer bound */
+        seplc__unbind(com, pos);
+        seplc__bindval(com, v, pos);
+    }
     sepl_mod_val(com->mod, v, &com->error);
+    seplc__reach(com, com->mod->vpos);
+}
+
+SEPL_API void seplc__markvar(SeplCompiler *com, const char *start) {
+    seplc__pushval(com, sepl__val_make(SEPL_VAR_NONE, (void *)start));
+}
+
+/* Variable with its initializer still to be assigned */
+SEPL_API void seplc__markdecl(SeplCompiler *com, const char *start) {
+    seplc__pushval(com, sepl__val_make(SEPL_VAR_DECL, (void *)start));
+}
+
+/* Latest variable declared with the identifier still on the value stack */
+SEPL_API char seplc__lookup(SeplCompiler *com, const char *name,
+                            sepl_size *index) {
+    SeplComSym *sym = seplc__intern(com, name, 0);
+    sepl_size head = sym != SEPL_NULL ? sym->head : 0;
+
+    /* Variables popped without a value pushed since are still bound */
+    for (; head != 0; head = com->binds[head - 1].prev) {
+        SeplComBind *bind = &com->binds[head - 1];
+        SeplValue v = com->mod->values[bind->index];
+
+        if (bind->index < com->mod->vpos &&
+            sepl_val_gettype(v) >= SEPL_VAR_NONE &&
+            sepl_val_getobj(v) == (void *)bind->start) {
+            *index = bind->index;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Top of the scope and function value positions */
+SEPL_API sepl_size seplc__marks(SeplCompiler *com) {
+    while (com->mark_len != 0 &&
+           com->marks[com->mark_len - 1] >= com->mod->vpos) {
+        com->mark_len--;
+    }
+    return com->mark_len;
+}
+
+/* Kind of the deepest scope or function the variable at index is below */
+SEPL_API sepl_size seplc__upvof(SeplCompiler *com, sepl_size index) {
+    sepl_size lo = 0, hi = seplc__marks(com), end = hi, flat = 0, mark;
+
+    /* A function body reaches the values outside it by absolute index, its
+     * frame moves with the call depth */
+    if (com->func_block && index < com->frame)
+        return SEPL__ASSIGN_UPV;
+    while (lo < hi) {
+        sepl_size mid = lo + (hi - lo) / 2;
+        if (com->marks[mid] > index)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    while (flat < com->nflat && com->flat[flat] <= index) {
+        flat++;
+    }
+
+    if (lo == end)
+        return flat == com->nflat ? SEPL__ASSIGN_LOC : SEPL__ASSIGN_UPS;
+    mark = com->marks[lo];
+    if ((flat != com->nflat && com->flat[flat] <= mark) ||
+        sepl_val_isscp(com->mod->values[mark]))
+        return SEPL__ASSIGN_UPS;
+    return SEPL__ASSIGN_UPV;
 }
 
 SEPL_API void seplc__updtvar(SeplCompiler *com, sepl_size index, int type) {
-    if ((int)type < (int)SEPL_VAR_NONE) {
+    int old = seplc__rawval(com, index);
+
+    if (type == SEPL_VAL_NUM && old != SEPL_VAR_NUM && old != SEPL_VAR_DECL) {
+        /* It may still hold the previous value when read after a branch */
+        type = SEPL_VAR_NUMX;
+    } else if ((int)type < (int)SEPL_VAR_NONE) {
         type += SEPL_VAR_NONE;
     }
-    com->mod->values[index].type = type;
+    if (old == SEPL_VAR_NUM && type != SEPL_VAR_NUM)
+        seplc__untype(com);
+
+    com->mod->values[index] =
+        sepl__val_make(type, sepl_val_getobj(com->mod->values[index]));
 }
 
 SEPL_API void seplc__markval(SeplCompiler *com, sepl_size type) {
-    SeplValue v = {0};
-    v.type = type;
-    sepl_mod_val(com->mod, v, &com->error);
+    seplc__pushval(com, sepl__val_make(type, SEPL_NULL));
 }
 
 SEPL_API int seplc__peekval(SeplCompiler *com, sepl_size index) {
-    int t = com->mod->values[index].type;
+    int t = seplc__rawval(com, index);
     if (t == SEPL_VAR_OBJ)
         return SEPL_VAL_REF;
+    else if (t == SEPL_VAR_DECL)
+        return SEPL_VAL_NONE;
+    else if (t == SEPL_VAR_NUMX || t == SEPL_VAL_NUMX)
+        return SEPL_VAL_NUM;
     else if (t >= SEPL_VAR_NONE)
         return t - SEPL_VAR_NONE;
     return t;
 }
 
+/* Type of the value read from the variable at index */
+SEPL_API int seplc__readval(SeplCompiler *com, sepl_size index,
+                            sepl_size upvalue) {
+    int t = seplc__peekval(com, index);
+
+    /* Functions may run after any later assignment of an upvalue */
+    if (t == SEPL_VAL_NUM && (seplc__rawval(com, index) != SEPL_VAR_NUM ||
+                              upvalue == SEPL__ASSIGN_UPV))
+        return SEPL_VAL_NUMX;
+    return t;
+}
+
 SEPL_API int seplc__popval(SeplCompiler *com) {
     if (com->mod->vpos == 0) {
         sepl_err_new(&com->error, SEPL_ERR_VUNDERFLOW);
@@ -274,49 +687,491 @@ SEPL_API int seplc__popval(SeplCompiler *com) {
     return seplc__peekval(com, --com->mod->vpos);
 }
 
-SEPL_API char seplc__varcmp(const char *v, const char *i) {
-    char match = *v == *i;
-    if (!match)
-        return match;
+SEPL_API void seplc__writenum(SeplCompiler *com, double num) {
+    /* Small integers are encoded inline, everything else is pooled */
+    if (num >= -128 && num <= 127 && num == (int)num &&
+        !(num == 0 && 1 / num < 0)) {
+        seplc__writebyte(com, SEPL_BC_INT);
+        sepl_mod_bc(com->mod, (SeplBC)((int)num & 0xFF), &com->error);
+        return;
+    }
+    seplc__writebyte(com, SEPL_BC_CONST);
+    sepl_mod_bcnum(com->mod, num, &com->error);
+}
 
-    for (;; v++, i++) {
-        if (!sepl_is_identifier(*v)) {
-            if (sepl_is_identifier(*i))
-                match = 0;
-            break;
-        } else {
-            if (*v == *i)
-                continue;
-            match = 0;
+/* Reads the INT immediate at pos */
+#define seplc__rdint(com, pos) \
+    ((int)seplc__byte(com, pos) - ((seplc__byte(com, pos) & 0x80) << 1))
+
+/* Replaces GET i, INT k with ADD_INT i, k when followed by ADD or SUB */
+SEPL_API char seplc__fuseaddint(SeplCompiler *com, int sign, char typed) {
+    sepl_size get, num, pos, index;
+    int k;
+
+    if (com->nops < 2)
+        return 0;
+    get = seplc__op(com, 1);
+    num = seplc__op(com, 0);
+    if (com->label > get || num + 2 != com->mod->bpos ||
+        seplc__byte(com, get) != SEPL_BC_GET ||
+        seplc__byte(com, num) != SEPL_BC_INT) {
+        return 0;
+    }
+    pos = get + 1;
+    index = seplc__rdvar(com, &pos);
+    k = sign * seplc__rdint(com, num + 1);
+    if (pos != num || k > 127) {
+        return 0;
+    }
+
+    seplc__rewind(com, get);
+    seplc__writesized(com, typed ? SEPL_BC_ADD_INT_NN : SEPL_BC_ADD_INT, index);
+    sepl_mod_bc(com->mod, (SeplBC)(k & 0xFF), &com->error);
+    return 1;
+}
+
+/* Replaces ADD_INT i, k with INC i, k when stored back into the same slot */
+SEPL_API char seplc__fuseinc(SeplCompiler *com, sepl_size offset) {
+    sepl_size add, pos, index;
+    char typed;
+    int k;
+
+    if (com->nops < 1)
+        return 0;
+    add = seplc__op(com, 0);
+    typed = seplc__byte(com, add) == SEPL_BC_ADD_INT_NN;
+    if (com->label > add ||
+        (seplc__byte(com, add) != SEPL_BC_ADD_INT && !typed)) {
+        return 0;
+    }
+    pos = add + 1;
+    index = seplc__rdvar(com, &pos);
+    if (pos + 1 != com->mod->bpos || index + 1 != offset) {
+        return 0;
+    }
+
+    k = seplc__rdint(com, pos);
+    seplc__rewind(com, add);
+    seplc__writesized(com, typed ? SEPL_BC_INC_NN : SEPL_BC_INC, index);
+    sepl_mod_bc(com->mod, (SeplBC)(k & 0xFF), &com->error);
+    return 1;
+}
+
+/* Replaces GET i with GET_CALL i when it is followed by CALL */
+SEPL_API char seplc__fusecall(SeplCompiler *com, sepl_size args) {
+    sepl_size get, pos, index;
+
+    if (com->nops < 1)
+        return 0;
+    get = seplc__op(com, 0);
+    if (com->label > get || seplc__byte(com, get) != SEPL_BC_GET) {
+        return 0;
+    }
+    pos = get + 1;
+    index = seplc__rdvar(com, &pos);
+    if (pos != com->mod->bpos) {
+        return 0;
+    }
+
+    seplc__rewind(com, get);
+    seplc__writesized(com, SEPL_BC_GET_CALL, index);
+    seplc__writesize(com, args);
+    return 1;
+}
+
+/* Entry + 1 of the direct calls through the variable at index, 0 if it does
+ * not hold the function of its declaration */
+SEPL_API sepl_size seplc__direct(SeplCompiler *com, sepl_size index) {
+    sepl_size i;
+    int raw;
+
+    if (index >= com->mod->vpos)
+        return 0;
+    raw = seplc__rawval(com, index);
+    if (raw != SEPL_VAR_DECL && raw != SEPL_VAR_FUNC)
+        return 0;
+    for (i = 0; i < SEPL__COM_DIRECT; i++) {
+        if (com->direct[i].start != SEPL_NULL &&
+            com->direct[i].index == index &&
+            com->direct[i].start ==
+                (const char *)sepl_val_getobj(com->mod->values[index]))
+            return i + 1;
+    }
+    return 0;
+}
+
+/* Remembers the function at func being declared into the variable at index */
+SEPL_API void seplc__adddirect(SeplCompiler *com, sepl_size index,
+                               sepl_size func, sepl_size params) {
+    sepl_size i, used;
+
+    for (i = 0; i < SEPL__COM_DIRECT; i++) {
+        used = com->direct[i].start != SEPL_NULL &&
+               seplc__direct(com, com->direct[i].index) == i + 1;
+        if (!used)
             break;
+    }
+    if (i == SEPL__COM_DIRECT)
+        return;
+
+    com->direct[i].start =
+        (const char *)sepl_val_getobj(com->mod->values[index]);
+    com->direct[i].index = index;
+    com->direct[i].func = func;
+    com->direct[i].body = com->mod->bpos;
+    com->direct[i].end = 0;
+    com->direct[i].params = params;
+}
+
+/* Turns the direct calls of entry i back into CALL once its variable is
+ * assigned again. The count is padded to the width of both operands so no
+ * code moves */
+SEPL_API void seplc__undirect(SeplCompiler *com, sepl_size i) {
+    unsigned char *bytes = com->mod->bytes;
+    sepl_size pc = com->direct[i].func, at, to, args;
+
+    /* Like seplc__untype this only changes opcodes */
+    if (com->mod->sink != SEPL_NULL)
+        pc = com->mod->bpos;
+    for (; pc < com->mod->bpos; pc = sepl__bcnext(bytes, pc)) {
+        if (bytes[pc] != SEPL_BC_CALL_DIRECT)
+            continue;
+        at = pc + 1;
+        to = sepl__rdvar(bytes, &at);
+        args = sepl__rdvar(bytes, &at);
+        if (to == com->direct[i].body) {
+            bytes[pc] = SEPL_BC_CALL;
+            sepl__wrvar(bytes + pc + 1, args, at - pc - 1);
         }
     }
-    return match;
+    com->direct[i].start = SEPL_NULL;
+}
+
+/* Index of the variable read by the last instruction when it is the callee
+ * pushed at pos */
+SEPL_API char seplc__callee(SeplCompiler *com, sepl_size pos,
+                            sepl_size *index) {
+    sepl_size get, at;
+
+    if (com->nops < 1)
+        return 0;
+    get = seplc__op(com, 0);
+    if (com->label > get || seplc__next(com, get) != com->mod->bpos)
+        return 0;
+
+    at = get + 1;
+    if (seplc__byte(com, get) == SEPL_BC_GET) {
+        *index = pos - seplc__rdvar(com, &at);
+        return 1;
+    } else if (seplc__byte(com, get) == SEPL_BC_GET_UP) {
+        *index = seplc__rdvar(com, &at);
+        return 1;
+    }
+    return 0;
+}
+
+/* Replaces the call returned by the last instruction with TAILCALL, the
+ * RETURN after it is kept for cfuncs */
+SEPL_API void seplc__tailcall(SeplCompiler *com) {
+    sepl_size call, at, index = 0, args;
+    SeplBC bc;
+
+    if (com->nops < 1)
+        return;
+    call = seplc__op(com, 0);
+    bc = (SeplBC)seplc__byte(com, call);
+    /* Calls label their own end as the return target */
+    if (seplc__next(com, call) != com->mod->bpos ||
+        (com->label > call && com->label != com->mod->bpos))
+        return;
+
+    at = call + 1;
+    if (bc == SEPL_BC_GET_CALL)
+        index = seplc__rdvar(com, &at);
+    else if (bc == SEPL_BC_CALL_DIRECT)
+        seplc__rdvar(com, &at);
+    else if (bc != SEPL_BC_CALL)
+        return;
+    args = seplc__rdvar(com, &at);
+
+    seplc__rewind(com, call);
+    if (bc == SEPL_BC_GET_CALL)
+        seplc__writesized(com, SEPL_BC_GET, index);
+    /* The result of the call is on top, the callee was below the arguments */
+    seplc__writesized(com, SEPL_BC_TAILCALL,
+                      com->mod->vpos + args - com->frame);
+    seplc__writesize(com, args);
+}
+
+/* Reads the number pushed by a constant instruction spanning pos to end */
+SEPL_API char seplc__rdnum(SeplCompiler *com, sepl_size pos, sepl_size end,
+                           double *num) {
+    sepl_size k;
+
+    if (pos >= end) {
+        return 0;
+    } else if (seplc__byte(com, pos) == SEPL_BC_INT && pos + 2 == end) {
+        *num = seplc__rdint(com, pos + 1);
+        return 1;
+    } else if (seplc__byte(com, pos) == SEPL_BC_CONST) {
+        pos++;
+        k = seplc__rdvar(com, &pos);
+        if (pos == end) {
+            *num = sepl__lddbl(sepl__baddr(
+                com->mod, com->mod->bsize - k * SEPL_KSLOT));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Removes the last instruction if it pushes a known number */
+SEPL_API char seplc__foldnum(SeplCompiler *com, double *num) {
+    if (com->nops < 1 || com->label > seplc__op(com, 0) ||
+        !seplc__rdnum(com, seplc__op(com, 0), com->mod->bpos, num)) {
+        return 0;
+    }
+    seplc__rewind(com, seplc__op(com, 0));
+    return 1;
+}
+
+/* Evaluates a binary operator when both operands are known numbers */
+SEPL_API char seplc__foldbinary(SeplCompiler *com, SeplTokenT op) {
+    sepl_size l, r;
+    double d1, d2;
+
+    if (com->nops < 2)
+        return 0;
+    l = seplc__op(com, 1);
+    r = seplc__op(com, 0);
+    if (com->label > l || !seplc__rdnum(com, l, r, &d1) ||
+        !seplc__rdnum(com, r, com->mod->bpos, &d2)) {
+        return 0;
+    }
+
+    switch (op) {
+        case SEPL_TOK_ADD: d1 = d1 + d2; break;
+        case SEPL_TOK_SUB: d1 = d1 - d2; break;
+        case SEPL_TOK_MUL: d1 = d1 * d2; break;
+        case SEPL_TOK_DIV: d1 = d1 / d2; break;
+        case SEPL_TOK_LT: d1 = d1 < d2; break;
+        case SEPL_TOK_LTE: d1 = d1 <= d2; break;
+        case SEPL_TOK_GT: d1 = d1 > d2; break;
+        case SEPL_TOK_GTE: d1 = d1 >= d2; break;
+        case SEPL_TOK_EQ: d1 = d1 == d2; break;
+        case SEPL_TOK_NEQ: d1 = d1 != d2; break;
+        default: return 0;
+    }
+
+    seplc__rewind(com, l);
+    seplc__writenum(com, d1);
+    return 1;
+}
+
+/* Compiles code that can never run for errors and throws the output away */
+SEPL_API void seplc__deadcode(SeplCompiler *com, sepl_parse_func parse) {
+    sepl_size bpos = com->mod->bpos, kpos = com->mod->kpos;
+    sepl_size vpos = com->mod->vpos, label = com->label;
+    char block_ret = com->block_ret, inner_ret = com->inner_ret;
+
+    parse(com);
+
+    seplc__rewind(com, bpos);
+    com->mod->kpos = kpos;
+    com->mod->vpos = vpos;
+    seplc__unbind(com, vpos);
+    com->label = label;
+    com->block_ret = block_ret;
+    com->inner_ret = inner_ret;
+}
+
+/* The dead code may slide the windows of a sink past the code it is thrown
+ * away to, they are put back as they were */
+SEPL_API void seplc__sinkdead(SeplCompiler *com, sepl_parse_func parse) {
+    SeplSink *sink = com->mod->sink, save = *sink;
+
+    seplc__deadcode(com, parse);
+    save.need = sink->need;
+    *sink = save;
+}
+
+SEPL_API void seplc__dead(SeplCompiler *com, sepl_parse_func parse) {
+    if (com->mod->sink != SEPL_NULL)
+        seplc__sinkdead(com, parse);
+    else
+        seplc__deadcode(com, parse);
+}
+
+/*
+ * Looks ahead for a return statement in the block at the current token. The
+ * source is scanned for braces and the return keyword only, so the tokens of
+ * the block are still lexed once. Unterminated blocks count as returning.
+ */
+SEPL_API char seplc__hasreturn(SeplCompiler *com) {
+    const char *c = seplc__currtok(com).end;
+    sepl_size depth = 1;
+
+    /* Bodies nested in one already scanned hold no return either */
+    if (com->noret != SEPL_NULL && c <= com->noret)
+        return 0;
+
+    while (depth != 0) {
+        switch (*c++) {
+            case '\0':
+                return 1;
+            case '{':
+                depth++;
+                break;
+            case '}':
+                depth--;
+                break;
+            case '"':
+                while (*c != '"') {
+                    if (*c == '\0')
+                        return 1;
+                    if (*c++ == '\\' && *c != '\0')
+                        c++;
+                }
+                c++;
+                break;
+            case 'r':
+                /* c[-2] is at worst the opening brace */
+                if (!sepl_is_identifier(c[-2]) && c[0] == 'e' &&
+                    c[1] == 't' && c[2] == 'u' && c[3] == 'r' && c[4] == 'n' &&
+                    !sepl_is_identifier(c[5]))
+                    return 1;
+                break;
+            default:
+                break;
+        }
+    }
+    com->noret = c;
+    return 0;
+}
+
+/*
+ * Compiles the body of if, else and while. A body without return statements
+ * pushes no scope, its variables are dropped at the end with a single DROP.
+ * Returns 1 if the body was compiled as a block and left its value.
+ */
+SEPL_API char seplc__body(SeplCompiler *com) {
+    sepl_size ovp = com->mod->vpos;
+    SeplToken tok;
+
+    if (seplc__currtok(com).type != SEPL_TOK_LCURLY ||
+        com->nflat == SEPL__COM_FLAT || seplc__hasreturn(com)) {
+        char tail = com->tail;
+        com->tail = tail == 2;
+        sepl_com_block(com);
+        com->tail = tail;
+        return 1;
+    }
+
+    com->flat[com->nflat++] = ovp;
+    tok = seplc__nexttok(com);
+    while (tok.type != SEPL_TOK_RCURLY) {
+        sepl_com_statement(com);
+        if (com->error.code != SEPL_ERR_OK)
+            return 0;
+        tok = seplc__nexttok(com);
+    }
+    com->nflat--;
+
+    if (com->mod->vpos != ovp)
+        seplc__writesized(com, SEPL_BC_DROP, com->mod->vpos - ovp);
+    com->mod->vpos = ovp;
+    seplc__unbind(com, ovp);
+    com->block_ret = 0;
+    com->inner_ret = 0;
+    return 0;
+}
+
+/* Compiles the branch following else */
+SEPL_API void seplc__elsebranch(SeplCompiler *com) {
+    if (seplc__currtok(com).type == SEPL_TOK_IF) {
+        sepl_com_if(com);
+        return;
+    }
+
+    if (!seplc__body(com)) {
+        return;
+    } else if (com->block_ret) {
+        /* Propagate return value, it is never left on the stack */
+        seplc__writereturn(com);
+        com->mod->vpos--;
+    } else {
+        seplc__writepop(com);
+    }
+}
+
+SEPL_API void seplc__parseand(SeplCompiler *com) {
+    seplc__parse(com, SEPL_PRE_AND);
+}
+
+SEPL_API void seplc__parseor(SeplCompiler *com) {
+    seplc__parse(com, SEPL_PRE_OR);
+}
+
+/* Writes JUMPIF, fused with a directly preceding comparison */
+SEPL_API sepl_size seplc__writejumpif(SeplCompiler *com) {
+    sepl_size cmp = com->nops ? seplc__op(com, 0) : com->mod->bpos;
+    unsigned char bc = seplc__byte(com, cmp);
+
+    if (com->label <= cmp && cmp + 1 == com->mod->bpos && bc >= SEPL_BC_LT &&
+        bc <= SEPL_BC_NEQ) {
+        seplc__rewind(com, cmp);
+        seplc__writebyte(com, (SeplBC)(bc - SEPL_BC_LT + SEPL_BC_JUMP_LT));
+    } else if (com->label <= cmp && cmp + 1 == com->mod->bpos &&
+               bc >= SEPL_BC_LT_NN && bc <= SEPL_BC_NEQ_NN) {
+        seplc__rewind(com, cmp);
+        seplc__writebyte(com,
+                         (SeplBC)(bc - SEPL_BC_LT_NN + SEPL_BC_JUMP_LT_NN));
+    } else {
+        seplc__writebyte(com, SEPL_BC_JUMPIF);
+    }
+    return seplc__writeplaceholder(com);
 }
 
 SEPL_API sepl_size seplc__findvar(SeplCompiler *com, SeplToken iden,
                                   sepl_size *upv) {
-    sepl_size pos;
+    sepl_size pos, flat = com->nflat;
     *upv = SEPL__ASSIGN_LOC;
 
+    if (com->syms != SEPL_NULL) {
+        if (seplc__lookup(com, iden.start, &pos)) {
+            *upv = seplc__upvof(com, pos);
+            return pos;
+        }
+        sepl_err_iden(&com->error, SEPL_ERR_IDEN_NDEF, iden);
+        return 0;
+    }
+
     for (pos = com->mod->vpos; pos-- != 0;) {
         char *v_start, *i_start;
         SeplValue v = com->mod->values[pos];
 
+        /* Leaving a body without scope counts as leaving a scope */
+        while (flat != 0 && pos < com->flat[flat - 1]) {
+            *upv = SEPL__ASSIGN_UPS;
+            flat--;
+        }
+
         if (sepl_val_isscp(v)) {
             *upv = SEPL__ASSIGN_UPS;
             continue;
         } else if (sepl_val_isfun(v)) {
             *upv = SEPL__ASSIGN_UPV;
             continue;
-        } else if (v.type < SEPL_VAR_NONE) {
+        } else if (sepl_val_gettype(v) < SEPL_VAR_NONE) {
             continue;
         }
 
-        v_start = (char *)v.as.obj;
+        v_start = (char *)sepl_val_getobj(v);
         i_start = (char *)iden.start;
 
         if (seplc__varcmp(v_start, i_start)) {
+            if (com->func_block && pos < com->frame)
+                *upv = SEPL__ASSIGN_UPV;
             return pos;
         }
     }
@@ -326,21 +1181,32 @@ SEPL_API sepl_size seplc__findvar(SeplCompiler *com, SeplToken iden,
 }
 
 SEPL_API char seplc__existsvar(SeplCompiler *com, SeplToken iden) {
-    sepl_size pos;
+    sepl_size pos, marks;
+
+    if (com->syms != SEPL_NULL) {
+        if (!seplc__lookup(com, iden.start, &pos))
+            return 0;
+        marks = seplc__marks(com);
+        if (marks != 0 && pos < com->marks[marks - 1])
+            return 0;
+        return com->nflat == 0 || pos >= com->flat[com->nflat - 1];
+    }
 
     for (pos = com->mod->vpos; pos-- != 0;) {
         char *v_start, *i_start;
         SeplValue v = com->mod->values[pos];
 
-        if (sepl_val_isscp(v)) {
+        if (com->nflat != 0 && pos < com->flat[com->nflat - 1]) {
+            break;
+        } else if (sepl_val_isscp(v)) {
             break;
         } else if (sepl_val_isfun(v)) {
             break;
-        } else if (v.type < SEPL_VAR_NONE) {
+        } else if (sepl_val_gettype(v) < SEPL_VAR_NONE) {
             continue;
         }
 
-        v_start = (char *)v.as.obj;
+        v_start = (char *)sepl_val_getobj(v);
         i_start = (char *)iden.start;
 
         if (seplc__varcmp(v_start, i_start)) {
@@ -358,25 +1224,29 @@ SEPL_API char seplc__existsvar(SeplCompiler *com, SeplToken iden) {
 
 SEPL_LIB void sepl_com_number(SeplCompiler *com) {
     double num = sepl_lex_num(seplc__currtok(com));
-    seplc__writeconst(com, SEPL_BC_CONST, num);
+    seplc__writeconst(com, num);
 }
 
 SEPL_LIB void sepl_com_string(SeplCompiler *com) {
     SeplToken cur = seplc__currtok(com);
-    sepl_size i, slen = cur.end - cur.start - 2;
-    unsigned char *wlen;
+    sepl_size i, len = 0, slen = cur.end - cur.start - 2, str;
+
+    for (i = 0; i < slen; i++, len++) {
+        if (cur.start[i + 1] == '\\')
+            i++;
+    }
 
     seplc__writebyte(com, SEPL_BC_STR);
-    wlen = seplc__writeplaceholder(com);
+    str = sepl_mod_bcstr(com->mod, len, &com->error);
+    seplc__check(com);
+
     for (i = 0; i < slen; i++) {
         char c = cur.start[i + 1];
         if (c == '\\')
             c = sepl_to_special(cur.start[++i + 1]);
-        seplc__writebyte(com, (SeplBC)c);
+        seplc__setbyte(com, str++, (unsigned char)c);
     }
-    seplc__writebyte(com, (SeplBC)'\0');
-    *(sepl_size *)wlen =
-        (com->mod->bytes + com->mod->bpos) - wlen - sizeof(sepl_size) - 1;
+    seplc__setbyte(com, str, '\0');
 
     seplc__markval(com, SEPL_VAL_STR);
 }
@@ -388,6 +1258,7 @@ SEPL_LIB void sepl_com_none(SeplCompiler *com) {
 
 SEPL_LIB void sepl_com_unary(SeplCompiler *com) {
     SeplToken op = seplc__currtok(com);
+    double num;
 
     seplc__nexttok(com);
     seplc__parse(com, SEPL_PRE_UNARY);
@@ -400,6 +1271,11 @@ SEPL_LIB void sepl_com_unary(SeplCompiler *com) {
         return;
     }
 
+    if (op.type != SEPL_TOK_ADD && seplc__foldnum(com, &num)) {
+        seplc__writenum(com, op.type == SEPL_TOK_SUB ? -num : !num);
+        return;
+    }
+
     switch (op.type) {
         case SEPL_TOK_SUB:
             seplc__writebyte(com, SEPL_BC_NEG);
@@ -408,19 +1284,26 @@ SEPL_LIB void sepl_com_unary(SeplCompiler *com) {
             seplc__writebyte(com, SEPL_BC_NOT);
             break;
         default:
-            break;
+            return;
     }
+    com->mod->vpos--;
+    seplc__markval(com, SEPL_VAL_NUM);
 }
 
 SEPL_LIB void sepl_com_binary(SeplCompiler *com) {
     SeplToken op = seplc__currtok(com);
     SeplParseRule *rule = seplc__getrule(op);
+    char typed;
+    int nn, cn;
 
     seplc__nexttok(com);
     seplc__parse(com, (SeplComPrec)(rule->pre + 1));
     seplc__check(com);
 
     /* Check right operand */
+    typed = com->mod->vpos >= 2 && seplc__typednn(com);
+    nn = typed ? SEPL_BC_ADD_NN - SEPL_BC_ADD : 0;
+    cn = typed ? SEPL_BC_LT_NN - SEPL_BC_LT : 0;
     int vtyp = seplc__popval(com);
     seplc__check(com);
     if (vtyp != SEPL_VAL_NUM && vtyp != SEPL_VAL_UNKNOWN) {
@@ -435,37 +1318,47 @@ SEPL_LIB void sepl_com_binary(SeplCompiler *com) {
         return;
     }
 
+    /* The result is always a number */
+    com->mod->vpos--;
+    seplc__markval(com, SEPL_VAL_NUM);
+
+    if (seplc__foldbinary(com, op.type)) {
+        return;
+    }
+
     switch (op.type) {
         case SEPL_TOK_ADD:
-            seplc__writebyte(com, SEPL_BC_ADD);
+            if (!seplc__fuseaddint(com, 1, typed))
+                seplc__writebyte(com, (SeplBC)(SEPL_BC_ADD + nn));
             break;
         case SEPL_TOK_SUB:
-            seplc__writebyte(com, SEPL_BC_SUB);
+            if (!seplc__fuseaddint(com, -1, typed))
+                seplc__writebyte(com, (SeplBC)(SEPL_BC_SUB + nn));
             break;
         case SEPL_TOK_MUL:
-            seplc__writebyte(com, SEPL_BC_MUL);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_MUL + nn));
             break;
         case SEPL_TOK_DIV:
-            seplc__writebyte(com, SEPL_BC_DIV);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_DIV + nn));
             break;
 
         case SEPL_TOK_LT:
-            seplc__writebyte(com, SEPL_BC_LT);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_LT + cn));
             break;
         case SEPL_TOK_LTE:
-            seplc__writebyte(com, SEPL_BC_LTE);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_LTE + cn));
             break;
         case SEPL_TOK_GT:
-            seplc__writebyte(com, SEPL_BC_GT);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_GT + cn));
             break;
         case SEPL_TOK_GTE:
-            seplc__writebyte(com, SEPL_BC_GTE);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_GTE + cn));
             break;
         case SEPL_TOK_EQ:
-            seplc__writebyte(com, SEPL_BC_EQ);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_EQ + cn));
             break;
         case SEPL_TOK_NEQ:
-            seplc__writebyte(com, SEPL_BC_NEQ);
+            seplc__writebyte(com, (SeplBC)(SEPL_BC_NEQ + cn));
             break;
 
         default:
@@ -474,7 +1367,8 @@ SEPL_LIB void sepl_com_binary(SeplCompiler *com) {
 }
 
 SEPL_LIB void sepl_com_and(SeplCompiler *com) {
-    unsigned char *jump;
+    sepl_size jump = 0;
+    double num;
     int vtyp;
 
     vtyp = seplc__popval(com);
@@ -483,15 +1377,23 @@ SEPL_LIB void sepl_com_and(SeplCompiler *com) {
         sepl_err_new(&com->error, SEPL_ERR_OPER);
         return;
     }
-    seplc__writebyte(com, SEPL_BC_JUMPIF);
-    jump = seplc__writeplaceholder(com);
+    if (!seplc__foldnum(com, &num)) {
+        seplc__writebyte(com, SEPL_BC_JUMP_AND);
+        jump = seplc__writeplaceholder(com);
+    } else if (!num) {
+        /* The rest of the chain is never evaluated */
+        seplc__nexttok(com);
+        seplc__dead(com, seplc__parseand);
+        seplc__writeconst(com, 0.0);
+        return;
+    }
 
     seplc__nexttok(com);
     seplc__parse(com, (SeplComPrec)(SEPL_PRE_AND + 1));
     seplc__check(com);
 
     if (seplc__peektok(com).type != SEPL_TOK_AND) {
-        unsigned char *jfalse, *jtrue;
+        sepl_size jfalse;
 
         vtyp = seplc__popval(com);
         seplc__check(com);
@@ -499,29 +1401,29 @@ SEPL_LIB void sepl_com_and(SeplCompiler *com) {
             sepl_err_new(&com->error, SEPL_ERR_OPER);
             return;
         }
-        seplc__writebyte(com, SEPL_BC_JUMPIF);
-        jfalse = seplc__writeplaceholder(com);
-
-        seplc__writeconst(com, SEPL_BC_CONST, 1.0);
-        seplc__writebyte(com, SEPL_BC_JUMP);
-        jtrue = seplc__writeplaceholder(com);
-
-        seplc__setpholder(com, jump);
-        seplc__setpholder(com, jfalse);
-        seplc__writeconst(com, SEPL_BC_CONST, 0.0);
-        seplc__setpholder(com, jtrue);
+        if (seplc__foldnum(com, &num)) {
+            seplc__writeconst(com, num != 0);
+        } else {
+            seplc__writebyte(com, SEPL_BC_JUMP_AND);
+            jfalse = seplc__writeplaceholder(com);
 
-        com->mod->vpos--;
+            seplc__writeconst(com, 1.0);
+            seplc__setpholder(com, jfalse);
+        }
     } else {
         seplc__nexttok(com);
         sepl_com_and(com);
         seplc__check(com);
-        *(sepl_size *)jump = com->mod->bpos - 1 - sizeof(sepl_size);
     }
+
+    /* JUMP_AND leaves 0 when jumping to the end of the chain */
+    if (jump != 0)
+        seplc__setpholder(com, jump);
 }
 
 SEPL_LIB void sepl_com_or(SeplCompiler *com) {
-    unsigned char *end, *next;
+    sepl_size jump = 0;
+    double num;
     int vtyp;
 
     vtyp = seplc__popval(com);
@@ -530,19 +1432,23 @@ SEPL_LIB void sepl_com_or(SeplCompiler *com) {
         sepl_err_new(&com->error, SEPL_ERR_OPER);
         return;
     }
-    seplc__writebyte(com, SEPL_BC_JUMPIF);
-    next = seplc__writeplaceholder(com);
-
-    seplc__writebyte(com, SEPL_BC_JUMP);
-    end = seplc__writeplaceholder(com);
-    seplc__setpholder(com, next);
+    if (!seplc__foldnum(com, &num)) {
+        seplc__writebyte(com, SEPL_BC_JUMP_OR);
+        jump = seplc__writeplaceholder(com);
+    } else if (num) {
+        /* The rest of the chain is never evaluated */
+        seplc__nexttok(com);
+        seplc__dead(com, seplc__parseor);
+        seplc__writeconst(com, 1.0);
+        return;
+    }
 
     seplc__nexttok(com);
     seplc__parse(com, (SeplComPrec)(SEPL_PRE_OR + 1));
     seplc__check(com);
 
     if (seplc__peektok(com).type != SEPL_TOK_OR) {
-        unsigned char *jfalse, *jtrue;
+        sepl_size jtrue;
 
         vtyp = seplc__popval(com);
         seplc__check(com);
@@ -550,30 +1456,29 @@ SEPL_LIB void sepl_com_or(SeplCompiler *com) {
             sepl_err_new(&com->error, SEPL_ERR_OPER);
             return;
         }
-        seplc__writebyte(com, SEPL_BC_JUMPIF);
-        jfalse = seplc__writeplaceholder(com);
-
-        seplc__setpholder(com, end);
-        seplc__writeconst(com, SEPL_BC_CONST, 1.0);
-        seplc__writebyte(com, SEPL_BC_JUMP);
-        jtrue = seplc__writeplaceholder(com);
-
-        seplc__setpholder(com, jfalse);
-        seplc__writeconst(com, SEPL_BC_CONST, 0.0);
-        seplc__setpholder(com, jtrue);
+        if (seplc__foldnum(com, &num)) {
+            seplc__writeconst(com, num != 0);
+        } else {
+            seplc__writebyte(com, SEPL_BC_JUMP_OR);
+            jtrue = seplc__writeplaceholder(com);
 
-        com->mod->vpos--;
+            seplc__writeconst(com, 0.0);
+            seplc__setpholder(com, jtrue);
+        }
     } else {
         seplc__nexttok(com);
         sepl_com_or(com);
         seplc__check(com);
-        *(sepl_size *)end = com->mod->bpos - (1 * 3 + sizeof(sepl_size) * 3);
     }
+
+    /* JUMP_OR leaves 1 when jumping to the end of the chain */
+    if (jump != 0)
+        seplc__setpholder(com, jump);
 }
 
 SEPL_LIB void sepl_com_assign(SeplCompiler *com, sepl_size index,
                               sepl_size upvalue) {
-    sepl_size ovp = com->mod->vpos;
+    sepl_size ovp = com->mod->vpos, direct;
 
     seplc__nexttok(com);
 
@@ -582,19 +1487,30 @@ SEPL_LIB void sepl_com_assign(SeplCompiler *com, sepl_size index,
     seplc__check(com);
     com->assign_type = 0;
 
-    if (upvalue <= SEPL__ASSIGN_UPS)
-        seplc__writesized(com, SEPL_BC_SET, (com->mod->vpos - index));
-    else
+    /* Only the declaration may assign a function called directly */
+    direct = seplc__direct(com, index);
+    if (direct != 0) {
+        if (seplc__rawval(com, index) != SEPL_VAR_DECL ||
+            index + 2 != com->mod->vpos ||
+            com->direct[direct - 1].end != com->mod->bpos)
+            seplc__undirect(com, direct - 1);
+    }
+
+    if (upvalue <= SEPL__ASSIGN_UPS) {
+        if (!seplc__fuseinc(com, com->mod->vpos - index))
+            seplc__writesized(com, SEPL_BC_SET, (com->mod->vpos - index));
+    } else
         seplc__writesized(com, SEPL_BC_SET_UP, index);
 
     if (com->mod->vpos != ovp) {
+        int raw = seplc__rawval(com, com->mod->vpos - 1);
         int vtyp = seplc__popval(com);
         seplc__check(com);
         if (vtyp == SEPL_VAL_REF) {
             sepl_err_new(&com->error, SEPL_ERR_REFMOVE);
             return;
         }
-        seplc__updtvar(com, index, vtyp);
+        seplc__updtvar(com, index, raw == SEPL_VAL_NUMX ? raw : vtyp);
     }
     com->mod->vpos = ovp;
 }
@@ -625,13 +1541,13 @@ SEPL_LIB void sepl_com_identifier(SeplCompiler *com) {
             seplc__writesized(com, SEPL_BC_GET_UP, index);
         }
 
-        seplc__markval(com, seplc__peekval(com, index));
+        seplc__markval(com, seplc__readval(com, index, upvalue));
     }
 }
 
 SEPL_LIB void sepl_com_variable(SeplCompiler *com) {
     SeplToken iden = seplc__nexttok(com);
-    sepl_size ovp = com->mod->vpos;
+    sepl_size ovp = com->mod->vpos, get_pos;
     seplc__check_tok(com, SEPL_TOK_IDENTIFIER);
 
     /* If the identifier already exists within the current scope */
@@ -640,21 +1556,23 @@ SEPL_LIB void sepl_com_variable(SeplCompiler *com) {
         return;
     }
 
-    seplc__markvar(com, iden.start);
+    seplc__markdecl(com, iden.start);
     seplc__check(com);
 
     seplc__writebyte(com, SEPL_BC_NONE);
+    get_pos = com->mod->bpos;
     sepl_com_identifier(com);
 
     /* Empty declearation */
     if (com->mod->vpos - ovp == 2) {
         /* Remove Get instruction added by else case */
-        com->mod->bpos -= 1 + sizeof(sepl_size);
+        seplc__rewind(com, get_pos);
         com->mod->vpos--;
+        seplc__updtvar(com, ovp, SEPL_VAL_NONE);
     }
 }
 
-SEPL_LIB void sepl_com_params(SeplCompiler *com, unsigned char *pcount) {
+SEPL_LIB void sepl_com_params(SeplCompiler *com, sepl_size *pcount) {
     sepl_size offset = 0;
     seplc__check_tok(com, SEPL_TOK_LPAREN);
 
@@ -672,13 +1590,17 @@ SEPL_LIB void sepl_com_params(SeplCompiler *com, unsigned char *pcount) {
         seplc__check_tok(com, SEPL_TOK_COMMA);
     }
 
-    *(sepl_size *)pcount = offset;
+    *pcount = offset;
     seplc__check_tok(com, SEPL_TOK_RPAREN);
 }
 
 SEPL_LIB void sepl_com_func(SeplCompiler *com) {
-    unsigned char *skip, *params;
-    sepl_size ovp = com->mod->vpos;
+    sepl_size skip, frame, i;
+    sepl_size ovp = com->mod->vpos, params, func = com->mod->bpos;
+    sepl_size oscope = com->scope, ofmax = com->fmax;
+    /* Initializer of a declaration, the variable is just below */
+    char decl = com->assign_type == SEPL__ASSIGN_LOC && ovp != 0 &&
+                seplc__rawval(com, ovp - 1) == SEPL_VAR_DECL;
 
     if (com->func_block) {
         sepl_err_new(&com->error, SEPL_ERR_CLOSURE);
@@ -691,26 +1613,46 @@ SEPL_LIB void sepl_com_func(SeplCompiler *com) {
 
     seplc__writebyte(com, SEPL_BC_FUNC);
     skip = seplc__writeplaceholder(com);
-    params = seplc__writeplaceholder(com);
     seplc__markval(com, SEPL_VAL_FUNC);
 
     seplc__nexttok(com);
-    sepl_com_params(com, params);
+    sepl_com_params(com, &params);
+    seplc__check(com);
+    seplc__writesize(com, params);
+    seplc__label(com, com->mod->bpos);
     seplc__nexttok(com);
+    if (decl)
+        seplc__adddirect(com, ovp - 1, func, params);
+    seplc__writebyte(com, SEPL_BC_FRAME);
+    frame = seplc__writeplaceholder(com);
+    com->fmax = com->mod->vpos;
 
     com->func_block = 1;
+    com->tail = 2;
+    com->frame = ovp;
+    com->scope = ovp;
     sepl_com_block(com);
     com->func_block = 0;
+    com->tail = 0;
 
-    seplc__writebyte(com, SEPL_BC_RETURN);
+    seplc__writereturn(com);
+    com->scope = oscope;
+    sepl_mod_setaddr(com->mod, frame, com->fmax - (ovp + 1 + params));
+    com->fmax = ofmax;
     seplc__setpholder(com, skip);
+    for (i = 0; decl && i < SEPL__COM_DIRECT; i++) {
+        if (com->direct[i].start != SEPL_NULL && com->direct[i].func == func)
+            com->direct[i].end = com->mod->bpos;
+    }
 
     com->mod->vpos = ovp + 1;
+    seplc__unbind(com, ovp + 1);
 }
 
 SEPL_LIB void sepl_com_call(SeplCompiler *com) {
-    sepl_size ovp = com->mod->vpos;
+    sepl_size ovp = com->mod->vpos, index, args, direct = 0;
     int vtyp = seplc__peekval(com, ovp - 1);
+    char callee = seplc__callee(com, ovp - 1, &index);
 
     while (seplc__nexttok(com).type != SEPL_TOK_RPAREN) {
         sepl_com_expr(com);
@@ -720,7 +1662,25 @@ SEPL_LIB void sepl_com_call(SeplCompiler *com) {
         seplc__check_tok(com, SEPL_TOK_COMMA);
     }
 
-    seplc__writesized(com, SEPL_BC_CALL, com->mod->vpos - ovp);
+    /* The arguments may have assigned the callee */
+    args = com->mod->vpos - ovp;
+    if (callee)
+        direct = seplc__direct(com, index);
+
+    if (direct != 0 && args <= com->direct[direct - 1].params) {
+        /* Missing arguments are passed as NONE */
+        seplc__reach(com, ovp + com->direct[direct - 1].params);
+        for (; args < com->direct[direct - 1].params; args++) {
+            seplc__writebyte(com, SEPL_BC_NONE);
+        }
+        seplc__writebyte(com, SEPL_BC_CALL_DIRECT);
+        sepl_mod_bcaddr(com->mod, com->direct[direct - 1].body, &com->error);
+        seplc__writesize(com, args);
+    } else if (!seplc__fusecall(com, args)) {
+        seplc__writesized(com, SEPL_BC_CALL, args);
+    }
+    /* Script functions return to the next instruction */
+    seplc__label(com, com->mod->bpos);
     seplc__check_tok(com, SEPL_TOK_RPAREN);
 
     com->mod->vpos = ovp - 1;
@@ -741,7 +1701,10 @@ SEPL_LIB void sepl_com_grouping(SeplCompiler *com) {
 }
 
 SEPL_LIB void sepl_com_expr(SeplCompiler *com) {
+    char tail = com->tail;
+    com->tail = 0;
     seplc__parse(com, SEPL_PRE_EXPR);
+    com->tail = tail;
 }
 
 SEPL_LIB void sepl_com_return(SeplCompiler *com) {
@@ -752,18 +1715,21 @@ SEPL_LIB void sepl_com_return(SeplCompiler *com) {
         if (ovp == com->mod->vpos) {
             seplc__writebyte(com, SEPL_BC_NONE);
             seplc__markval(com, SEPL_VAL_NONE);
+        } else if (com->tail) {
+            seplc__tailcall(com);
         }
     } else {
         seplc__writebyte(com, SEPL_BC_NONE);
         seplc__markval(com, SEPL_VAL_NONE);
     }
-    seplc__writebyte(com, SEPL_BC_RETURN);
+    seplc__writereturn(com);
 }
 
 SEPL_LIB void sepl_com_if(SeplCompiler *com) {
     sepl_size ovp = com->mod->vpos;
-    unsigned char *if_jump = SEPL_NULL;
-    unsigned char *end_jump = SEPL_NULL;
+    sepl_size if_jump = 0;
+    sepl_size end_jump = 0;
+    double num;
     int vtyp;
 
     seplc__nexttok(com);
@@ -782,30 +1748,56 @@ SEPL_LIB void sepl_com_if(SeplCompiler *com) {
         sepl_err_new(&com->error, SEPL_ERR_OPER);
         return;
     }
-    seplc__writebyte(com, SEPL_BC_JUMPIF);
-    if_jump = seplc__writeplaceholder(com);
 
-    sepl_com_block(com);
-    seplc__check(com);
+    if (seplc__foldnum(com, &num)) {
+        /* Only the branch that can run is kept */
+        if (num) {
+            if (seplc__body(com)) {
+                seplc__check(com);
+                if (com->block_ret) {
+                    /* Propagate return value */
+                    seplc__writereturn(com);
+                }
+                seplc__writepop(com);
+            }
+            seplc__check(com);
+        } else {
+            seplc__dead(com, sepl_com_block);
+            seplc__check(com);
+        }
+
+        if (seplc__peektok(com).type == SEPL_TOK_ELSE) {
+            seplc__nexttok(com);
+            seplc__nexttok(com);
+            if (!num)
+                seplc__elsebranch(com);
+            else if (seplc__currtok(com).type == SEPL_TOK_IF)
+                seplc__dead(com, sepl_com_if);
+            else
+                seplc__dead(com, sepl_com_block);
+        }
+        return;
+    }
+
+    if_jump = seplc__writejumpif(com);
 
-    if (com->block_ret) {
-        /* Propagate return value */
-        seplc__writebyte(com, SEPL_BC_RETURN);
+    if (seplc__body(com)) {
+        seplc__check(com);
+        if (com->block_ret) {
+            /* Propagate return value */
+            seplc__writereturn(com);
+        }
+        seplc__writepop(com);
     }
+    seplc__check(com);
 
     sepl_com_else(com, if_jump, &end_jump);
 }
 
-SEPL_LIB void sepl_com_else(SeplCompiler *com, unsigned char *if_jump,
-                            unsigned char **end_jump) {
-    unsigned char *pop_skip;
-    seplc__writepop(com);
-
+SEPL_LIB void sepl_com_else(SeplCompiler *com, sepl_size if_jump,
+                            sepl_size *end_jump) {
     if (seplc__peektok(com).type != SEPL_TOK_ELSE) {
-        seplc__writebyte(com, SEPL_BC_JUMP);
-        pop_skip = seplc__writeplaceholder(com);
         seplc__setpholder(com, if_jump);
-        seplc__setpholder(com, pop_skip);
         return;
     }
 
@@ -816,18 +1808,7 @@ SEPL_LIB void sepl_com_else(SeplCompiler *com, unsigned char *if_jump,
     seplc__nexttok(com);
 
     seplc__setpholder(com, if_jump);
-
-    if (seplc__currtok(com).type == SEPL_TOK_IF) {
-        sepl_com_if(com);
-    } else {
-        sepl_com_block(com);
-        if (com->block_ret) {
-            /* Propagate return value */
-            seplc__writebyte(com, SEPL_BC_RETURN);
-        } else {
-            seplc__writepop(com);
-        }
-    }
+    seplc__elsebranch(com);
 
     seplc__check(com);
     seplc__setpholder(com, *end_jump);
@@ -835,10 +1816,15 @@ SEPL_LIB void sepl_com_else(SeplCompiler *com, unsigned char *if_jump,
 
 SEPL_LIB void sepl_com_while(SeplCompiler *com) {
     sepl_size ovp = com->mod->vpos;
-    unsigned char *cond_jump = SEPL_NULL;
-    sepl_size loop_start = com->mod->bpos, scope_jump;
+    sepl_size cond_jump = 0;
+    sepl_size loop_start = com->mod->bpos, scope_jump, oloop = com->loop;
+    double num;
     int vtyp;
+    char scoped;
 
+    seplc__label(com, loop_start);
+    if (oloop == 0)
+        com->loop = loop_start + 1;
     seplc__nexttok(com);
     sepl_com_grouping(com);
     seplc__nexttok(com);
@@ -855,18 +1841,28 @@ SEPL_LIB void sepl_com_while(SeplCompiler *com) {
         sepl_err_new(&com->error, SEPL_ERR_OPER);
         return;
     }
-    seplc__writebyte(com, SEPL_BC_JUMPIF);
-    cond_jump = seplc__writeplaceholder(com);
+    if (!seplc__foldnum(com, &num)) {
+        cond_jump = seplc__writejumpif(com);
+    } else if (!num) {
+        /* The loop never runs */
+        seplc__dead(com, sepl_com_block);
+        com->loop = oloop;
+        return;
+    }
     scope_jump = com->mod->bpos;
 
-    sepl_com_block(com);
+    scoped = seplc__body(com);
     seplc__check(com);
 
-    if (com->block_ret) {
-        seplc__writebyte(com, SEPL_BC_RETURN);
+    if (!scoped) {
+        seplc__writesized(com, SEPL_BC_JUMP, loop_start);
+    } else if (com->block_ret) {
+        /* The loop is left with no value when the condition fails */
+        seplc__writereturn(com);
+        com->mod->vpos--;
     } else if (!com->block_ret && com->inner_ret) {
         /* Remove implicit RETURN NONE */
-        com->mod->bpos -= 1 + 1;
+        seplc__rewind(com, seplc__op(com, 1));
 
         /* Simulate RETURN for while loop end */
         while (com->block_size != ovp) {
@@ -876,15 +1872,19 @@ SEPL_LIB void sepl_com_while(SeplCompiler *com) {
         com->mod->vpos--;
         seplc__writesized(com, SEPL_BC_JUMP, loop_start);
 
-        /* Return the value from other control structures to outer scope */
-        *(sepl_size *)(com->mod->bytes + scope_jump + 1) = com->mod->bpos;
-        seplc__writebyte(com, SEPL_BC_RETURN);
+        /* Return the value from other control structures to outer scope,
+         * it takes the place of the scope */
+        seplc__label(com, com->mod->bpos);
+        sepl_mod_setaddr(com->mod, scope_jump + 1, com->mod->bpos);
+        seplc__writesized(com, SEPL_BC_RETURN, com->mod->vpos - com->scope);
     } else {
         seplc__writepop(com);
         seplc__writesized(com, SEPL_BC_JUMP, loop_start);
     }
 
-    seplc__setpholder(com, cond_jump);
+    if (cond_jump != 0)
+        seplc__setpholder(com, cond_jump);
+    com->loop = oloop;
 }
 
 SEPL_LIB void sepl_com_statement(SeplCompiler *com) {
@@ -920,8 +1920,8 @@ SEPL_LIB void sepl_com_statement(SeplCompiler *com) {
 SEPL_LIB void sepl_com_block(SeplCompiler *com) {
     char ret = 0;
     SeplToken tok;
-    sepl_size ovp = com->mod->vpos;
-    unsigned char *scope_end = SEPL_NULL;
+    sepl_size ovp = com->mod->vpos, oscope = com->scope;
+    sepl_size scope_end = 0;
 
     seplc__check_tok(com, SEPL_TOK_LCURLY);
     tok = seplc__nexttok(com);
@@ -929,6 +1929,7 @@ SEPL_LIB void sepl_com_block(SeplCompiler *com) {
     seplc__writebyte(com, SEPL_BC_SCOPE);
     scope_end = seplc__writeplaceholder(com);
     seplc__markval(com, SEPL_VAL_SCOPE);
+    com->scope = ovp;
     com->inner_ret = 0;
 
     while (tok.type != SEPL_TOK_RCURLY) {
@@ -951,15 +1952,17 @@ SEPL_LIB void sepl_com_block(SeplCompiler *com) {
 
     if (!ret) {
         seplc__writebyte(com, SEPL_BC_NONE);
-        seplc__writebyte(com, SEPL_BC_RETURN);
         seplc__markval(com, SEPL_VAL_NONE);
+        seplc__writereturn(com);
     }
+    com->scope = oscope;
 
     com->block_size = com->mod->vpos - 1;
     com->block_ret = ret;
 
     com->mod->values[ovp + 1] = com->mod->values[com->mod->vpos - 1];
     com->mod->vpos = ovp + 1;
+    seplc__unbind(com, ovp + 1);
 
     seplc__setpholder(com, scope_end);
 }
@@ -986,10 +1989,12 @@ SEPL_LIB SeplCompiler sepl_com_init(const char *source, SeplModule *mod,
 
     com.lex = sepl_lex_init(source);
     com.mod = mod;
+    com.label = mod->bpos;
+    mod->verified = 0;
     com.env = env;
     for (i = 0; i < env.predef_len; i++) {
         seplc__markvar(&com, env.predef[i].key);
-        seplc__updtvar(&com, i, env.predef[i].value.type);
+        seplc__updtvar(&com, i, sepl_val_gettype(env.predef[i].value));
     }
     for (i = 0; i < mod->esize; i++) {
         seplc__markvar(&com, mod->exports[i]);
@@ -999,13 +2004,99 @@ SEPL_LIB SeplCompiler sepl_com_init(const char *source, SeplModule *mod,
     return com;
 }
 
+/*
+ * Lets the compiler resolve variables through a hashed symbol table kept in
+ * buf, which must be aligned for pointers. Only the variables on the value
+ * stack take space, they are dropped as their scopes end. Returns 0 when buf
+ * is too small for a table. Without one, or once it is full and sym_full of
+ * the compiler is set, variables are found by scanning the value stack.
+ */
+SEPL_LIB char sepl_com_symtab(SeplCompiler *com, void *buf, sepl_size size) {
+    sepl_size cap = 2, pos;
+    const sepl_size unit = sizeof(SeplComSym) + sizeof(SeplComBind);
+
+    /* Largest power of two that fits the table, bindings and marks */
+    while ((cap * 2) * unit + cap * sizeof(sepl_size) <= size) {
+        cap *= 2;
+    }
+    if (cap * unit + (cap / 2) * sizeof(sepl_size) > size) {
+        com->syms = SEPL_NULL;
+        return 0;
+    }
+
+    com->syms = (SeplComSym *)buf;
+    com->binds = (SeplComBind *)(com->syms + cap);
+    com->marks = (sepl_size *)(com->binds + cap);
+    com->sym_cap = com->bind_cap = cap;
+    com->mark_cap = cap / 2;
+    com->sym_len = com->bind_len = com->mark_len = 0;
+    com->sym_full = 0;
+    for (pos = 0; pos < cap; pos++) {
+        com->syms[pos].name = SEPL_NULL;
+    }
+
+    /* Index the values pushed so far, the predefined and exported names */
+    for (pos = 0; pos < com->mod->vpos && com->syms != SEPL_NULL; pos++) {
+        seplc__bindval(com, com->mod->values[pos], pos);
+    }
+    return 1;
+}
+
 SEPL_LIB SeplError sepl_com_finish(SeplCompiler *com) {
     if (com->error.code != SEPL_ERR_OK) {
-        com->error.line = com->lex.line;
+        com->error.line = com->lex.current.line;
     }
     com->mod->vpos = 0;
     return com->error;
 }
 
+SEPL_LIB SeplError sepl_com_measure(const char *source, SeplModule *mod,
+                                    SeplEnv env,
+                                    void (*entry)(SeplCompiler *),
+                                    SeplComSizes *sizes) {
+    SeplModule m = *mod;
+    SeplSink sink;
+    SeplCompiler com;
+    SeplError err;
+    sepl_size need;
+
+    /* Addresses start out as wide as they get and narrow down */
+    m.bytes = SEPL_NULL;
+    m.bsize = (sepl_size)-1 / 2;
+    m.sink = &sink;
+    for (;;) {
+        m.bpos = 0;
+        m.kpos = m.bsize;
+        m.vpos = 0;
+        m.pc = 0;
+        sink.bbase = 0;
+        sink.kbase = m.bsize - sizeof(sink.bytes);
+        sink.need = 0;
+        com = sepl_com_init(source, &m, env);
+        entry(&com);
+        err = sepl_com_finish(&com);
+        if (err.code != SEPL_ERR_OK)
+            return err;
+
+        need = sink.need;
+#ifdef SEPL_ALIGNED
+        /* sepl_mod_new may trim that much to align the constant pool */
+        need += SEPL_KSLOT - 1;
+#endif
+        if (sepl__varlen(need) == sepl__varlen(m.bsize))
+            break;
+        /* Addresses are narrower in a buffer of that size, compile again */
+        if (need > m.bsize) {
+            sepl_err_new(&err, SEPL_ERR_BOVERFLOW);
+            return err;
+        }
+        m.bsize = need;
+    }
+
+    sizes->bsize = need;
+    sizes->vsize = com.vmax;
+    return err;
+}
+
 #endif
 #endif
@@ -129,4 +129,57 @@ void while_tests() {
         10);  // while condition false, skip loop
 }
 
-SEPL_TEST_GROUP(if_tests, else_tests, if_else_tests, while_tests)
+void constant_tests() {
+    // Branches that can never run are removed
+    assert(tst_size("{ if (0) { @a = 2; return a * 3; } return 1; }") ==
+           tst_size("{ return 1; }"));
+    assert(tst_size("{ while (1 > 2) { return 3.5; } return 1; }") ==
+           tst_size("{ return 1; }"));
+    assert(tst_size("{ return 0 && 10.5 + 2; }") == tst_size("{ return 0; }"));
+    assert(tst_size("{ return 2.5 * 4 - 1; }") == tst_size("{ return 9; }"));
+
+    assert_sepl(
+        {
+            @a = 3;
+            if (0) {
+                a = 1;
+            } else if (a == 3) {
+                a = 9;
+            } else {
+                a = 2;
+            }
+            return a;
+        },
+        9);  // dead if with live else-if
+    assert_sepl(
+        {
+            @a = 3;
+            if (2 > 1) {
+                a = a + 1;
+            } else {
+                return 0;
+            }
+            return a;
+        },
+        4);  // live if with dead else
+    assert_sepl(
+        {
+            @i = 0;
+            while (1) {
+                i = i + 1;
+                if (i == 5) {
+                    return i;
+                }
+            }
+        },
+        5);  // infinite loop left by return
+    assert_sepl(
+        {
+            @a = 2;
+            return (0 && a) + (1 || a) * 2 + (a && 1) * 4 + (a || 0) * 8;
+        },
+        14);  // partially known && and ||
+}
+
+SEPL_TEST_GROUP(if_tests, else_tests, if_else_tests, while_tests,
+                constant_tests)
@@ -12,8 +12,10 @@
 SeplError compile_s(const char *src, unsigned char bytes[], size_t n1,
                     SeplValue values[], size_t n2) {
     SeplEnv env = {0};
+    void *symtab[256];
     SeplModule mod = sepl_mod_new(bytes, n1, values, n2);
     SeplCompiler com = sepl_com_init(src, &mod, env);
+    sepl_com_symtab(&com, symtab, sizeof(symtab));
     sepl_com_block(&com);
     SeplError err = sepl_com_finish(&com);
     return err;
@@ -41,6 +43,9 @@ void memory_errors() {
     SeplValue values[100];
     // Not enough bytecode buffer
     assert(compile("{ return 10 + 20 + 30; }", 1, 100) == SEPL_ERR_BOVERFLOW);
+    // Not enough bytecode buffer for the constant pool
+    assert(compile("{ return \"a string longer than the code\"; }", 24, 100) ==
+           SEPL_ERR_BOVERFLOW);
     // Not enough value buffer
     assert(compile("{ return 10 + 20 + 30; }", 1024, 1) == SEPL_ERR_VOVERFLOW);
     // Not enough value buffer
@@ -70,6 +75,10 @@ void compile_time_errors() {
     // Undefined Variable Init
     assert(compile("{ @a = b; }") == SEPL_ERR_IDEN_NDEF);
 
+    // Branches removed as dead code are still checked
+    assert(compile("{ if (0) { value; } }") == SEPL_ERR_IDEN_NDEF);
+    assert(compile("{ 0 && value; }") == SEPL_ERR_IDEN_NDEF);
+
     // Invalid operation
     assert(compile("{ NONE + 1;}"));
     assert(compile("{ \"\"+ 1;}"));
@@ -101,6 +110,11 @@ void compile_time_errors() {
     assert(compile("{ @a = $(){ @b = $(){}; }; }") == SEPL_ERR_CLOSURE);
     // Function cannot be set to upvalue
     assert(compile("{ @a; { a = $(){}; }; }") == SEPL_ERR_FUNC_UPV);
+    assert(compile("{ @a = 1; while (a) { a = $(){}; }; }") ==
+           SEPL_ERR_FUNC_UPV);
+    // Variable Redefinition in a body without return
+    assert(compile("{ @a = 1; if (a) { @b = 1; @b = 2; }; }") ==
+           SEPL_ERR_IDEN_RDEF);
 
 }
 
@@ -113,10 +127,29 @@ void run_time_errors() {
     assert(run("{ 120(); }") == SEPL_ERR_FUNC_CALL);
     // Attempting to call non function variable
     assert(run("{ @a = 20; a(); }") == SEPL_ERR_FUNC_CALL);
+    // Calling a function variable assigned something else
+    assert(run("{ @a = $(){}; @b = $(){ a(); }; a = 1; b(); }") ==
+           SEPL_ERR_FUNC_CALL);
+    // Tail call of a non function
+    assert(run("{ @f = $(a){ return a(1); }; f(2); }") == SEPL_ERR_FUNC_CALL);
     // Attempting return function. Not supported
     assert(run("{ @a = $(){}; return a; }") == SEPL_ERR_FUNC_RET);
     // Overwriting function name in param and calling the param
     assert(run("{ @a = $(a){ a(2); }; a(1); }") == SEPL_ERR_FUNC_CALL);
+    // Fused instructions on non number operands
+    assert(run("{ @f = $(a){ a = a + 1; }; f(\"s\"); }") == SEPL_ERR_OPER);
+    assert(run("{ @f = $(a){ return a - 1; }; f(\"s\"); }") == SEPL_ERR_OPER);
+    assert(run("{ @f = $(a){ if (a < 1) {} }; f(\"s\"); }") == SEPL_ERR_OPER);
+    // Instructions specialized to numbers by earlier calls
+    assert(run("{ @f = $(a){ return a + 1; }; f(1); f(2); f(\"s\"); }") ==
+           SEPL_ERR_OPER);
+    assert(run("{ @f = $(a, b){ if (a < b) {} }; f(1, 2); f(\"s\", 2); }") ==
+           SEPL_ERR_OPER);
+    // Variables whose type is not the same on every path keep their checks
+    assert(run("{ @x = \"s\"; if (1 > 2) { x = 1; }; return x + 1; }") ==
+           SEPL_ERR_OPER);
+    assert(run("{ @x = 1; @y = 0; while (y < 3) { y = x + 1; x = \"s\"; }; }") ==
+           SEPL_ERR_OPER);
 }
 
 SEPL_TEST_GROUP(memory_errors, compile_time_errors, run_time_errors)
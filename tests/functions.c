@@ -80,6 +80,94 @@ void recursive_test() {
         10);  // function shadowed by param
 }
 
+void direct_test() {
+    assert_sepl(
+        {
+            @fib = $(n) {
+                if (n < 2) {
+                    return n;
+                };
+                return fib(n - 1) + fib(n - 2);
+            };
+            @pair = $(a, b) {
+                return b;
+            };
+            return fib(10) + pair(1, 2);
+        },
+        57);  // calls to declared functions jump to the body
+
+    assert_sepl_none({
+        @a = $(b, c) {
+            return c;
+        };
+        return a(1);
+    });  // missing arguments of a direct call are NONE
+
+    assert_sepl(
+        {
+            @f = $(n) {
+                return n;
+            };
+            @g = $() {
+                return f(1);
+            };
+            f = $(n) {
+                return n + 10;
+            };
+            return g() + f(2);
+        },
+        23);  // reassigned function called through the variable
+}
+
+void tail_test() {
+    assert_sepl(
+        {
+            @sum = $(n, acc) {
+                if (n < 1) {
+                    return acc;
+                };
+                return sum(n - 1, acc + n);
+            };
+            return sum(10000, 0);
+        },
+        50005000);  // tail calls run deeper than the value stack
+
+    assert_sepl(
+        {
+            @walk = $(n, acc) {
+                while (n > 2000) {
+                    return walk(n - 1, acc + 1);
+                };
+                if (n == 0) {
+                    return acc;
+                } else {
+                    return walk(n - 1, acc + 2);
+                };
+            };
+            return walk(3000, 0);
+        },
+        5000);  // tail calls from if, else and while bodies
+
+    assert_sepl(
+        {
+            @f = $(n) {
+                return n;
+            };
+            @g = $(n) {
+                if (n) {
+                    if (n) {
+                        return f(1);
+                    };
+                    @x = 2;
+                };
+                @b = { return f(3); };
+                return b;
+            };
+            return g(1);
+        },
+        3);  // returns leaving only a block are not tail calls
+}
+
 void upvalue_tests() {
     assert_sepl(
         {
@@ -113,4 +201,5 @@ void upvalue_tests() {
         20);  // function uses updated value of captured variable
 }
 
-SEPL_TEST_GROUP(basic_test, params_test, recursive_test, upvalue_tests)
+SEPL_TEST_GROUP(basic_test, params_test, recursive_test, direct_test,
+                tail_test, upvalue_tests)
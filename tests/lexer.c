@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 #define SEPL_IMPLEMENTATION
 #include "../sepl.h"
@@ -69,9 +70,40 @@ void check_num() {
     assert(first("10.a").type == SEPL_TOK_ERROR);
     assert(first("10.1.").type == SEPL_TOK_ERROR);
     assert(first(".12").type == SEPL_TOK_ERROR);
+    assert(first("1e").type == SEPL_TOK_ERROR);
+    assert(first("1e+").type == SEPL_TOK_ERROR);
+    assert(first("0x").type == SEPL_TOK_ERROR);
+    assert(first("0x1G").type == SEPL_TOK_ERROR);
+    assert(first("0x1.5").type == SEPL_TOK_ERROR);
+    assert(first("1__0").type == SEPL_TOK_ERROR);
+    assert(first("1_").type == SEPL_TOK_ERROR);
+    assert(first("1_.5").type == SEPL_TOK_ERROR);
+    assert(first("1._5").type == SEPL_TOK_ERROR);
 
     assert(sepl_lex_num(first("10")) == 10.0);
     assert(sepl_lex_num(first("3.14")) == 3.14);
+    assert(sepl_lex_num(first("10.")) == 10.0);
+    assert(sepl_lex_num(first("1e-9")) == 1e-9);
+    assert(sepl_lex_num(first("2.5E+3")) == 2.5e3);
+    assert(sepl_lex_num(first("0x1F")) == 31.0);
+    assert(sepl_lex_num(first("0Xff_ff")) == 65535.0);
+    assert(sepl_lex_num(first("1_000_000")) == 1e6);
+    assert(sepl_lex_num(first("1e400")) == 1.0 / 0.0);
+    assert(sepl_lex_num(first("1e-400")) == 0.0);
+
+    // Rounded correctly past the digits a double holds
+    assert(sepl_lex_num(first("3.14159265358979323846264338327950288")) ==
+           3.14159265358979323846264338327950288);
+    assert(sepl_lex_num(first("0.1000000000000000055511151231257827")) ==
+           0.1000000000000000055511151231257827);
+    assert(sepl_lex_num(first("9007199254740993")) == 9007199254740992.0);
+    assert(sepl_lex_num(first("0x20000000000003")) == 9007199254740996.0);
+    assert(sepl_lex_num(first("2.2250738585072011e-308")) ==
+           2.2250738585072011e-308);
+    assert(sepl_lex_num(first("4.9406564584124654e-324")) ==
+           4.9406564584124654e-324);
+    assert(sepl_lex_num(first("1.7976931348623157e308")) ==
+           1.7976931348623157e308);
     assert(
         sepl_lex_num(first(
             "1797693134862316300000000000000000000000000000000000000000000000"
@@ -123,5 +155,46 @@ void check_identifier() {
     assert(first("returnq 1").type == SEPL_TOK_IDENTIFIER);
 }
 
+void check_ahead() {
+    first("a\n+ 1\n;");
+    assert(sepl_lex_ahead(&lex, 2).type == SEPL_TOK_SEMICOLON);
+    assert(sepl_lex_ahead(&lex, 0).type == SEPL_TOK_ADD);
+    assert(peek().type == SEPL_TOK_ADD);
+    assert(curr().type == SEPL_TOK_IDENTIFIER && curr().line == 0);
+
+    // Peeked tokens are returned in order and keep their line
+    assert(next().type == SEPL_TOK_ADD && curr().line == 1);
+    assert(next().type == SEPL_TOK_NUM && sepl_lex_num(curr()) == 1);
+    assert(next().type == SEPL_TOK_SEMICOLON && curr().line == 2);
+    assert(next().type == SEPL_TOK_EOF);
+    assert(sepl_lex_ahead(&lex, SEPL_LEX_AHEAD).type == SEPL_TOK_EOF);
+}
+
+void check_runs() {
+    const char *toks = "identifier_with_a_name_longer_than_32 "
+                       "\"a string \\\" with \\\\ escapes {}\" +";
+    char src[256];
+    size_t i, j, lines;
+
+    // Whitespace, identifiers and strings starting at every vector offset
+    for (i = 0; i < 64; i++) {
+        for (j = 0, lines = 0; j < i; j++) {
+            src[j] = j % 7 == 3 ? '\n' : (j % 2 ? ' ' : '\t');
+            lines += src[j] == '\n';
+        }
+        strcpy(src + i, toks);
+        lex = sepl_lex_init(src);
+
+        assert(next().type == SEPL_TOK_IDENTIFIER && curr().line == lines);
+        assert(curr().start == src + i && curr().end - curr().start == 37);
+        assert(next().type == SEPL_TOK_STRING);
+        assert(curr().end - curr().start == 32);
+        assert(next().type == SEPL_TOK_ADD);
+        assert(next().type == SEPL_TOK_EOF);
+    }
+
+    assert(first("\"escaped end\\").type == SEPL_TOK_ERROR);
+}
+
 SEPL_TEST_GROUP(check_eof, check_toks, check_num, check_string,
-                check_identifier);
+                check_identifier, check_ahead, check_runs);
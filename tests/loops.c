@@ -44,6 +44,50 @@ void while_loop() {
             return a;
         },
         7);  // return propagated from if statement
+
+    assert_sepl(
+        {
+            @a = 0;
+            @s = 0;
+            while (a != 10) {
+                @d = a * 2;
+                s = s + d;
+                a = a + 1;
+                if (d > 10) {
+                    @b = 1;
+                    s = s + b;
+                }
+            }
+            return s;
+        },
+        94);  // variables declared in loop bodies are dropped each iteration
+
+    assert_sepl(
+        {
+            @a = 0;
+            while (a < 3) { while (a < 3) { while (a < 3) { while (a < 3) {
+            while (a < 3) { while (a < 3) { while (a < 3) { while (a < 3) {
+            while (a < 3) { while (a < 3) { while (a < 3) { while (a < 3) {
+            while (a < 3) { while (a < 3) { while (a < 3) { while (a < 3) {
+            while (a < 3) { @b = a; a = b + 1; }
+            } } } } } } } } } } } } } } } }
+            return a;
+        },
+        3);  // nesting deeper than the bodies compiled without scope
+
+    assert_sepl(
+        {
+            @a = 0;
+            @returns = 0;
+            while (a < 4) {
+                @s = "{ return }";
+                returns = returns + 2;
+                a = a + 1;
+            }
+            if (a > 1) { @s = "}"; return returns + 1; }
+            return 0;
+        },
+        9);  // braces and return in strings and identifiers
 }
 
 SEPL_TEST_GROUP(while_loop);
@@ -12,9 +12,11 @@
 SeplEnv env = {0};
 unsigned char bytes[1024];
 SeplValue values[100];
+unsigned char objmap[sepl_mod_mapsize(100)];
 
 static inline SeplModule new_mod() {
     SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    sepl_mod_setobjmap(&mod, objmap, sizeof(objmap));
     return mod;
 }
 
@@ -38,7 +40,7 @@ static SeplValue exec_main(const char *source, SeplArgs args) {
 
     exec_mod(source, &mod);
     SeplValue main = sepl_mod_getexport(&mod, env, "main");
-    assert(main.type == SEPL_VAL_FUNC);
+    assert(sepl_val_isfun(main));
 
     sepl_mod_initfunc(&mod, &err, main, args);
     return sepl_mod_exec(&mod, &err, env);
@@ -49,9 +51,9 @@ static SeplValue exec_main(const char *source, SeplArgs args) {
         SeplModule mod = new_mod();                        \
         assert((exec_mod(#expr, &mod), mod.vpos == size)); \
     } while (0)
-#define assert_main(expr, args, value)                  \
-    do {                                                \
-        assert(exec_main(#expr, args).as.num == value); \
+#define assert_main(expr, args, value)                            \
+    do {                                                          \
+        assert(sepl_val_getnum(exec_main(#expr, args)) == value); \
     } while (0)
 
 void vpos_test() {
@@ -69,11 +71,42 @@ void export_tests() {
              &mod);
 
     assert(mod.vpos == 5);
-    assert(sepl_mod_getexport(&mod, env, "a").as.num == 10.0);
-    assert(sepl_mod_getexport(&mod, env, "b").type == SEPL_VAL_NUM);
-    assert(sepl_mod_getexport(&mod, env, "c").type == SEPL_VAL_NONE);
-    assert(sepl_mod_getexport(&mod, env, "d").as.num == 20.0);
-    assert(sepl_mod_getexport(&mod, env, "main").type == SEPL_VAL_FUNC);
+    assert(sepl_val_getnum(sepl_mod_getexport(&mod, env, "a")) == 10.0);
+    assert(sepl_val_isnum(sepl_mod_getexport(&mod, env, "b")));
+    assert(sepl_val_isnone(sepl_mod_getexport(&mod, env, "c")));
+    assert(sepl_val_getnum(sepl_mod_getexport(&mod, env, "d")) == 20.0);
+    assert(sepl_val_isfun(sepl_mod_getexport(&mod, env, "main")));
+}
+
+void export_index_tests() {
+    static const char *names[] = {"e0", "e1", "e2", "e3", "e4", "e5",
+                                  "e6", "e7", "e8", "e9", "e10", "main"};
+    const char *src = "e0 = 0; e1 = 1; e2 = 2; e3 = 3; e4 = 4; e5 = 5; "
+                      "e6 = 6; e7 = 7; e8 = 8; e9 = 9; e10 = 10; main = 11;";
+    SeplModule mod = new_mod();
+    sepl_size tab[32], i;
+    int pass;
+    mod.exports = names;
+    mod.esize = 12;
+    exec_mod(src, &mod);
+
+    for (pass = 0; pass < 3; pass++) {
+        // Scanned, hashed, and scanned again with a table too small
+        if (pass == 1)
+            sepl_mod_exporttab(&mod, tab, sizeof(tab));
+        else if (pass == 2)
+            sepl_mod_exporttab(&mod, tab, sizeof(sepl_size) * 8);
+        assert((mod.etab != SEPL_NULL) == (pass == 1));
+
+        for (i = 0; i < 12; i++) {
+            assert(sepl_mod_export_index(&mod, names[i]) == i);
+            assert(sepl_val_getnum(sepl_mod_export(&mod, env, i)) == i);
+        }
+        assert(sepl_mod_export_index(&mod, "e") == 12);
+        assert(sepl_mod_export_index(&mod, "e11") == 12);
+        assert(sepl_val_isnone(sepl_mod_export(&mod, env, 12)));
+        assert(sepl_val_getnum(sepl_mod_getexport(&mod, env, "main")) == 11);
+    }
 }
 
 void main_test() {
@@ -98,4 +131,474 @@ void main_test() {
     assert_main(main = $(a, b) { return a && b; };, args, 0);
 }
 
-SEPL_TEST_GROUP(vpos_test, export_tests, main_test);
+static SeplValue twice(SeplArgs args, SeplError *e) {
+    (void)e;
+    return sepl_val_number(sepl_val_getnum(args.values[0]) * 2);
+}
+
+void call_site_test() {
+    SeplModule mod = new_mod();
+    SeplError err = {0};
+    const char *exports[] = {"inc", "main"};
+    SeplValue args_values[2];
+    SeplArgs args = {0};
+    SeplValue main, inc;
+    int i;
+    mod.exports = exports;
+    mod.esize = 2;
+    args.values = args_values;
+    args.size = 2;
+
+    // The same call and operators see a cfunc and a function in turns
+    exec_mod("inc = $(n){ return n + 1; };"
+             "main = $(f, n){ @s = 0; @i = 0;"
+             "  while (i < 3) { s = s + f(n); i = i + 1; };"
+             "  return s + n * 2; };",
+             &mod);
+    inc = sepl_mod_getexport(&mod, env, "inc");
+    main = sepl_mod_getexport(&mod, env, "main");
+
+    for (i = 0; i < 4; i++) {
+        args_values[0] = i % 2 ? inc : sepl_val_cfunc(twice);
+        args_values[1] = sepl_val_number(5);
+        sepl_mod_initfunc(&mod, &err, main, args);
+        assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, env)) ==
+               (i % 2 ? 28 : 40));
+        assert(err.code == SEPL_ERR_OK);
+    }
+}
+
+void batch_test() {
+    SeplModule mod = new_mod();
+    SeplError err = {0};
+    const char *exports[] = {"score"};
+    SeplValue rows[6 * 3], results[6];
+    SeplCall call;
+    sepl_size vpos, i;
+    mod.exports = exports;
+    mod.esize = 1;
+
+    exec_mod("score = $(a, b) { if (b == 0) { return a(); }; return a * b; };",
+             &mod);
+    call =
+        sepl_mod_prepare(&mod, &err, sepl_mod_getexport(&mod, env, "score"));
+    vpos = mod.vpos;
+
+    // Rows of two arguments and a column the call does not take
+    for (i = 0; i < 6; i++) {
+        rows[i * 3] = sepl_val_number(i);
+        rows[i * 3 + 1] = sepl_val_number(i == 3 ? 0 : 2);
+        rows[i * 3 + 2] = SEPL_NONE;
+    }
+
+    assert(sepl_mod_callbatch(&mod, &err, env, call, rows, 3, results, 6, 0) ==
+           5);
+    assert(err.code == SEPL_ERR_FUNC_CALL && mod.vpos == vpos);
+    for (i = 0; i < 6; i++) {
+        if (i == 3)
+            assert(sepl_val_isnone(results[i]));
+        else
+            assert(sepl_val_getnum(results[i]) == i * 2);
+    }
+
+    // Stops at the failing row
+    results[4] = SEPL_NONE;
+    assert(sepl_mod_callbatch(&mod, &err, env, call, rows, 3, results, 6, 1) ==
+           3);
+    assert(err.code == SEPL_ERR_FUNC_CALL && mod.vpos == vpos);
+    assert(sepl_val_isnone(results[4]));
+
+    assert(sepl_mod_callbatch(&mod, &err, env, call, rows, 3, results, 3, 1) ==
+           3);
+    assert(err.code == SEPL_ERR_OK);
+}
+
+static int freed;
+static void count_free(SeplValue v) {
+    (void)v;
+    freed++;
+}
+static SeplValue new_obj(SeplArgs args, SeplError *e) {
+    (void)args;
+    (void)e;
+    return sepl_val_object(&freed);
+}
+
+/* Sums f(i) for i below n by calling back into the module */
+static SeplValue sum_map(SeplArgs args, SeplError *e) {
+    SeplValue i = sepl_val_number(0), v;
+    SeplArgs fargs = {0};
+    double sum = 0;
+    fargs.values = &i;
+    fargs.size = 1;
+
+    while (sepl_val_getnum(i) < sepl_val_getnum(args.values[1])) {
+        v = sepl_mod_reenter(args.mod, e, *args.env, args.values[0], fargs);
+        if (e->code != SEPL_ERR_OK)
+            return SEPL_NONE;
+        sum += sepl_val_getnum(v);
+        i = sepl_val_number(sepl_val_getnum(i) + 1);
+    }
+    return sepl_val_number(sum);
+}
+
+/* Calls f(m) by calling back into the module */
+static SeplValue call_with(SeplArgs args, SeplError *e) {
+    SeplArgs fargs = {0};
+    fargs.values = args.values + 1;
+    fargs.size = 1;
+    return sepl_mod_reenter(args.mod, e, *args.env, args.values[0], fargs);
+}
+
+void reenter_test() {
+    SeplModule mod = new_mod();
+    SeplError err = {0};
+    const char *exports[] = {"map", "sq", "nest", "bad", "main"};
+    SeplValue args_values[2];
+    SeplArgs args = {0};
+    SeplValuePair predef[] = {{"call", SEPL_NONE}, {"mk", SEPL_NONE}};
+    SeplEnv obj_env = {0};
+    SeplValue main;
+    sepl_size vpos;
+    int pass;
+    mod.exports = exports;
+    mod.esize = 5;
+    predef[0].value = sepl_val_cfunc(call_with);
+    predef[1].value = sepl_val_cfunc(new_obj);
+    obj_env.free = count_free;
+    obj_env.predef = predef;
+    obj_env.predef_len = 2;
+    args.values = args_values;
+    args.size = 2;
+
+    exec_mod("sq = $(n){ @m = n * n; return m; };"
+             "nest = $(n){ return map(sq, n) + n; };"
+             "bad = $(n){ return n(); };"
+             "main = $(f, n){ @k = 100; return map(f, n) + k; };",
+             &mod);
+    mod.values[0] = sepl_val_cfunc(sum_map);
+    main = sepl_mod_getexport(&mod, env, "main");
+    vpos = mod.vpos;
+
+    args_values[0] = sepl_mod_getexport(&mod, env, "sq");
+    args_values[1] = sepl_val_number(4);
+    sepl_mod_initfunc(&mod, &err, main, args);
+    assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, env)) == 114);
+    assert(err.code == SEPL_ERR_OK && mod.vpos == vpos);
+
+    // Calls back in from a function called back into
+    args_values[0] = sepl_mod_getexport(&mod, env, "nest");
+    args_values[1] = sepl_val_number(3);
+    sepl_mod_initfunc(&mod, &err, main, args);
+    assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, env)) == 104);
+    assert(err.code == SEPL_ERR_OK && mod.vpos == vpos);
+
+    // Errors of the inner call stop the outer one
+    args_values[0] = sepl_mod_getexport(&mod, env, "bad");
+    sepl_mod_initfunc(&mod, &err, main, args);
+    sepl_mod_exec(&mod, &err, env);
+    assert(err.code == SEPL_ERR_FUNC_CALL);
+
+    // Objects the inner call stores in the outer frames are freed with them
+    for (pass = 0; pass < 2; pass++) {
+        mod = new_mod();
+        if (pass == 0)
+            mod.objmap = SEPL_NULL;
+        freed = 0;
+        SeplCompiler com = sepl_com_init(
+            "{ @o = 0; @g = $(m) { o = m(); return 0; };"
+            "  call(g, mk); return 1; }",
+            &mod, obj_env);
+        sepl_com_block(&com);
+        assert(sepl_com_finish(&com).code == SEPL_ERR_OK);
+        sepl_mod_init(&mod, &err, obj_env);
+        assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, obj_env)) == 1);
+        assert(err.code == SEPL_ERR_OK && freed == 1);
+    }
+}
+
+void object_frames_test() {
+    SeplEnv obj_env = {0};
+    SeplError err = {0};
+    const char *exports[] = {"plain", "main"};
+    SeplValue args_values[1];
+    SeplArgs args = {0};
+    int pass;
+    args.values = args_values;
+    args.size = 1;
+    args_values[0] = sepl_val_cfunc(new_obj);
+    obj_env.free = count_free;
+
+    // Without and with the object bitmap
+    for (pass = 0; pass < 2; pass++) {
+        SeplModule mod = new_mod();
+        mod.exports = exports;
+        mod.esize = 2;
+        if (pass == 0)
+            mod.objmap = SEPL_NULL;
+        freed = 0;
+
+        // Scopes holding objects free them on return, the others are dropped
+        SeplCompiler com = sepl_com_init(
+            "plain = $(n){ if (n > 0) { @b = n + 1; return b * 2; };"
+            "  return 0; };"
+            "main = $(mk){ @s = 0; @i = 0;"
+            "  while (i < 3) { @o = mk(); s = s + plain(i); i = i + 1; };"
+            "  @p = { @q = mk(); return plain(s); }; return p; };",
+            &mod, obj_env);
+        sepl_com_module(&com);
+        assert(sepl_com_finish(&com).code == SEPL_ERR_OK);
+        sepl_mod_init(&mod, &err, obj_env);
+        sepl_mod_exec(&mod, &err, obj_env);
+        assert(err.code == SEPL_ERR_OK);
+
+        sepl_mod_initfunc(&mod, &err,
+                          sepl_mod_getexport(&mod, obj_env, "main"), args);
+        assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, obj_env)) == 22);
+        assert(err.code == SEPL_ERR_OK);
+        assert(freed == 4);
+        assert(mod.vpos == 2);
+    }
+}
+
+static int batches, batched;
+static void count_batch(SeplValue *objs, sepl_size n) {
+    sepl_size i;
+    batches++;
+    for (i = 0; i < n; i++) {
+        assert(sepl_val_getobj(objs[i]) == (void *)&freed);
+        batched++;
+    }
+}
+
+void object_batch_test() {
+    SeplModule mod = new_mod();
+    SeplEnv obj_env = {0};
+    SeplError err = {0};
+    const char *exports[] = {"keep", "main"};
+    SeplValue args_values[1];
+    SeplArgs args = {0};
+    mod.exports = exports;
+    mod.esize = 2;
+    args.values = args_values;
+    args.size = 1;
+    args_values[0] = sepl_val_cfunc(new_obj);
+    obj_env.free = count_free;
+    obj_env.free_batch = count_batch;
+    freed = 0;
+
+    // The objects of a scope are freed together, so are the ones left over
+    SeplCompiler com = sepl_com_init(
+        "keep = 0; main = $(mk){ @a = mk(); @b = 1; @c = mk(); @d = 2;"
+        "  keep = mk(); return b + d; };",
+        &mod, obj_env);
+    sepl_com_module(&com);
+    assert(sepl_com_finish(&com).code == SEPL_ERR_OK);
+    sepl_mod_init(&mod, &err, obj_env);
+    sepl_mod_exec(&mod, &err, obj_env);
+    assert(err.code == SEPL_ERR_OK);
+
+    sepl_mod_initfunc(&mod, &err,
+                      sepl_mod_getexport(&mod, obj_env, "main"), args);
+    assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, obj_env)) == 3);
+    assert(err.code == SEPL_ERR_OK);
+    assert(batches == 1 && batched == 2);
+
+    sepl_mod_cleanup(&mod, obj_env);
+    assert(batches == 2 && batched == 3);
+    assert(freed == 0);
+}
+
+static const char *sized_exports[] = {"k", "f", "main"};
+
+/* Compiles src into buffers of the given sizes and calls main with 4 */
+static SeplErrorCode run_sized(const char *src, sepl_size bsize,
+                               sepl_size vsize, SeplValue *result) {
+    unsigned char *b = malloc(bsize);
+    SeplValue *v = malloc(vsize * sizeof(SeplValue));
+    SeplModule mod = sepl_mod_new(b, bsize, v, vsize);
+    SeplValue args_values[] = {sepl_val_number(4)};
+    SeplArgs args = {0};
+    SeplError err = {0};
+    mod.exports = sized_exports;
+    mod.esize = 3;
+    args.values = args_values;
+    args.size = 1;
+
+    SeplCompiler com = sepl_com_init(src, &mod, env);
+    sepl_com_module(&com);
+    err = sepl_com_finish(&com);
+    if (err.code == SEPL_ERR_OK) {
+        sepl_mod_init(&mod, &err, env);
+        sepl_mod_exec(&mod, &err, env);
+        sepl_mod_initfunc(&mod, &err, sepl_mod_getexport(&mod, env, "main"),
+                          args);
+        *result = sepl_mod_exec(&mod, &err, env);
+    }
+    free(b);
+    free(v);
+    return err.code;
+}
+
+void measure_test() {
+    const char *src = "k = 1.5; f = $(m){ @a = m * 2; return a + k; };"
+                      "main = $(n){ @x = 1; @y = 2; return f(n) + x + y; };";
+    SeplModule mod = new_mod();
+    // Far too small for the code, which is only counted
+    unsigned char tiny[4] = {0};
+    SeplModule scratch = sepl_mod_new(tiny, sizeof(tiny), values, 100);
+    SeplComSizes sizes;
+    SeplValue result;
+    char long_src[4096];
+    int i, n;
+    mod.exports = sized_exports;
+    mod.esize = 3;
+    scratch.exports = sized_exports;
+    scratch.esize = 3;
+
+    assert(sepl_com_measure(src, &scratch, env, sepl_com_module, &sizes)
+               .code == SEPL_ERR_OK);
+    for (i = 0; i < 4; i++) {
+        assert(tiny[i] == 0);
+    }
+    assert(run_sized(src, sizes.bsize, sizes.vsize + 10, &result) ==
+           SEPL_ERR_OK);
+    assert(sepl_val_getnum(result) == 12.5);
+#ifndef SEPL_ALIGNED
+    assert(run_sized(src, sizes.bsize - 1, sizes.vsize + 10, &result) ==
+           SEPL_ERR_BOVERFLOW);
+#endif
+    assert(run_sized(src, sizes.bsize, sizes.vsize - 1, &result) ==
+           SEPL_ERR_VOVERFLOW);
+
+    // The call of f is deeper than its body was compiled, FRAME catches it
+    exec_mod(src, &mod);
+    assert(sepl_mod_funcsize(&mod, sepl_mod_getexport(&mod, env, "f")) == 6);
+    assert(sepl_mod_funcsize(&mod, sepl_mod_getexport(&mod, env, "main")) ==
+           7);
+    assert(run_sized(src, sizes.bsize, sizes.vsize, &result) ==
+           SEPL_ERR_VOVERFLOW);
+    // A value buffer of just the values the calls take is enough
+    assert(run_sized(src, sizes.bsize, 3 + 7 + 6, &result) == SEPL_ERR_OK);
+
+    // Code and constants well past what the sink keeps
+    n = sprintf(long_src, "k = 0; f = 0; main = $(n){ @s = \"%0200d\"; s = n;",
+                0);
+    for (i = 0; i < 100; i++) {
+        n += sprintf(long_src + n, " s = s + %d.5 * k;", i % 20);
+    }
+    sprintf(long_src + n, " return s; };");
+    assert(sepl_com_measure(long_src, &scratch, env, sepl_com_module, &sizes)
+               .code == SEPL_ERR_OK);
+    assert(sizes.bsize > SEPL_SINK_CODE + SEPL_SINK_POOL);
+    assert(run_sized(long_src, sizes.bsize, sizes.vsize + 10, &result) ==
+           SEPL_ERR_OK);
+    assert(sepl_val_getnum(result) == 4);
+#ifndef SEPL_ALIGNED
+    assert(run_sized(long_src, sizes.bsize - 1, sizes.vsize + 10, &result) ==
+           SEPL_ERR_BOVERFLOW);
+#endif
+}
+
+void image_test() {
+    SeplModule mod = new_mod();
+    SeplValue ctx_values[2][64];
+    SeplModule ctx[2];
+    SeplError err = {0};
+    SeplValue arg = sepl_val_number(4), result;
+    SeplArgs args = {0};
+    const char *exports[] = {"k", "main"};
+    unsigned char code[1024];
+    SeplImage img;
+    sepl_size i;
+    args.values = &arg;
+    args.size = 1;
+    mod.exports = exports;
+    mod.esize = 2;
+
+    // Quickens the code before it is taken
+    exec_mod("k = 3; main = $(n){ @s = 0; while (n) { s = s + k; n = n - 1; };"
+             " return s; };",
+             &mod);
+    sepl_mod_initfunc(&mod, &err, sepl_mod_getexport(&mod, env, "main"), args);
+    assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, env)) == 12);
+
+    img = sepl_mod_image(&mod);
+    for (i = 0; i < img.bpos; i++) {
+        code[i] = img.bytes[i];
+    }
+    for (i = 0; i < 2; i++) {
+        ctx[i] = sepl_mod_context(&img, ctx_values[i], 64);
+        sepl_mod_init(&ctx[i], &err, env);
+        sepl_mod_exec(&ctx[i], &err, env);
+        assert(err.code == SEPL_ERR_OK);
+        sepl_mod_initfunc(&ctx[i], &err,
+                          sepl_mod_getexport(&ctx[i], env, "main"), args);
+    }
+
+    // Each context keeps its own pc and values while the other runs
+    for (i = 0; i < 10; i++) {
+        sepl_mod_step(&ctx[0], &err, env);
+    }
+    arg = sepl_val_number(5);
+    sepl_mod_initfunc(&ctx[1], &err, sepl_mod_getexport(&ctx[1], env, "main"),
+                      args);
+    assert(sepl_val_getnum(sepl_mod_exec(&ctx[1], &err, env)) == 15);
+    result = sepl_mod_exec(&ctx[0], &err, env);
+    assert(err.code == SEPL_ERR_OK && sepl_val_getnum(result) == 12);
+
+    // The shared code is never written
+    for (i = 0; i < img.bpos; i++) {
+        assert(code[i] == img.bytes[i]);
+    }
+}
+
+void prepared_call_test() {
+    SeplModule mod = new_mod();
+    SeplError err = {0};
+    const char *exports[] = {"k", "score", "fail"};
+    SeplValue args[2], result;
+    SeplCall call, fail;
+    sepl_size vpos, i;
+    mod.exports = exports;
+    mod.esize = 3;
+
+    exec_mod("k = 1; score = $(a, b) { @s = a * b; return s + k; };"
+             "fail = $(a, b) { @c = 1; @d = 2; return a(b); };",
+             &mod);
+    call = sepl_mod_prepare(&mod, &err, sepl_mod_getexport(&mod, env, "k"));
+    assert(err.code == SEPL_ERR_FUNC_CALL);
+    call =
+        sepl_mod_prepare(&mod, &err, sepl_mod_getexport(&mod, env, "score"));
+    assert(call.params == 2);
+    fail = sepl_mod_prepare(&mod, &err, sepl_mod_getexport(&mod, env, "fail"));
+
+    vpos = mod.vpos;
+    for (i = 0; i < 100; i++) {
+        args[0] = sepl_val_number(i);
+        args[1] = sepl_val_number(3);
+        sepl_mod_call(&mod, &err, env, call, args, &result);
+        assert(err.code == SEPL_ERR_OK);
+        assert(sepl_val_getnum(result) == i * 3 + 1);
+        assert(mod.vpos == vpos);
+    }
+
+    // Failed calls leave no values behind
+    for (i = 0; i < 100; i++) {
+        sepl_mod_call(&mod, &err, env, fail, args, &result);
+        assert(err.code == SEPL_ERR_FUNC_CALL && mod.vpos == vpos);
+        assert(sepl_val_isnone(result));
+    }
+    sepl_mod_call(&mod, &err, env, call, args, &result);
+    assert(err.code == SEPL_ERR_OK && sepl_val_getnum(result) == 99 * 3 + 1);
+
+    // No room for the return scope and arguments
+    mod.vsize = vpos + 2;
+    sepl_mod_call(&mod, &err, env, call, args, &result);
+    assert(err.code == SEPL_ERR_VOVERFLOW && mod.vpos == vpos);
+}
+
+SEPL_TEST_GROUP(vpos_test, export_tests, export_index_tests, main_test,
+                call_site_test, object_frames_test, object_batch_test,
+                measure_test, image_test, prepared_call_test, batch_test,
+                reenter_test);
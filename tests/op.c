@@ -12,7 +12,8 @@
 /* Check to see if sepl and c expressions have the same output */
 #define assert_sepl_to_c(expr)                                        \
     do {                                                              \
-        double sepl_result = tst_run("{return " #expr ";}").as.num;   \
+        double sepl_result =                                          \
+            sepl_val_getnum(tst_run("{return " #expr ";}"));          \
         double c_result = (expr);                                     \
         if (sepl_result != c_result) {                                \
             fprintf(stderr, "\n%lf == %lf\n", sepl_result, c_result); \
@@ -79,4 +80,90 @@ void check_expr() {
     assert_sepl_to_c(-2 > 3 && 94 < 20 || 2 / 0.0 < 0.0 && 23 * 32 - 32 == 23);
 }
 
-SEPL_TEST_GROUP(check_arithmetic, check_logical, check_relational, check_expr)
+void check_constants() {
+    // Small integers are inline, the rest come from the constant pool
+    assert_sepl_to_c(127 + 128);
+    assert_sepl_to_c(255 * 256);
+    assert_sepl_to_c(0.5 + 0.5 + 0.5);
+    assert_sepl_to_c(1000000 - 3.25);
+    assert_sepl_to_c(10000000000.0 / 7);
+}
+
+void check_fused() {
+    // Fused instructions must behave like the sequences they replace
+    assert_sepl(
+        {
+            @a = 10;
+            @b = a + 5;
+            @c = a - 3;
+            a = a - 1;
+            b = b + 127;
+            return a * 10000 + b * 10 + c;
+        },
+        91427);  // add-local-int and increment-local
+    assert_sepl(
+        {
+            @n = 0;
+            @i = 0;
+            while (i < 5) { n = n + 1; i = i + 1; }
+            while (i <= 9) { n = n + 1; i = i + 1; }
+            while (i > 3) { n = n + 1; i = i - 1; }
+            while (i >= 1) { n = n + 1; i = i - 1; }
+            while (i != 4) { n = n + 1; i = i + 1; }
+            if (i == 4) { n = n + 100; }
+            return n;
+        },
+        124);  // compare and branch
+    assert_sepl({
+        @a = 1;
+        @b = 0;
+        return (a && b) + (a && 2) * 2 + (b || b) * 4 + (b || 3) * 8 +
+               (a && a && a) * 16 + (b || b || a) * 32;
+    }, 58);  // short circuit ladders
+    assert_sepl(
+        {
+            @f = $(a, b) { return a - b; };
+            @g = $() { return 3; };
+            @x = 5;
+            return f(10, x) + f(x, 1) * 10 + g() * 100;
+        },
+        345);  // get and call
+}
+
+void check_typed() {
+    // Locals that only ever hold numbers use the unchecked instructions
+    assert_sepl(
+        {
+            @s = 0;
+            @i = 0;
+            while (i < 10) {
+                s = s + i * 2 - 1;
+                if (s >= 20 && s / 2 != 11) { s = s - 5; }
+                i = i + 1;
+            };
+            return s;
+        },
+        55);
+    assert_sepl(
+        {
+            @f = $(n) {
+                @s = 1;
+                @i = n;
+                while (i > 0) { s = s * 2; i = i - 1; };
+                return s;
+            };
+            return f(10) + f(3);
+        },
+        1032);  // parameters are never typed, locals of functions are
+    assert_sepl(
+        {
+            @x = 4;
+            @y = x;
+            while (y <= 8) { y = y + x; x = x - 1; };
+            return x * 100 + y;
+        },
+        211);  // typed copies
+}
+
+SEPL_TEST_GROUP(check_arithmetic, check_logical, check_relational, check_expr,
+                check_constants, check_fused, check_typed)
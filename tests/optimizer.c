@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SEPL_IMPLEMENTATION
+#include "../sepl.h"
+#include "../sepl_com.h"
+
+#include "tests.h"
+
+SeplEnv env = {0};
+unsigned char bytes[1024];
+SeplValue values[100];
+
+/* Compiles the module, optimizes it and returns the error of running it */
+static SeplErrorCode run_opt(const char *src, SeplOptStats *stats) {
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    SeplCompiler com = sepl_com_init(src, &mod, env);
+    sepl_com_block(&com);
+    SeplError err = sepl_com_finish(&com);
+    assert(err.code == SEPL_ERR_OK);
+
+    *stats = sepl_opt_peephole(&mod);
+    sepl_mod_exec(&mod, &err, env);
+    return err.code;
+}
+
+#define assert_opt(expr, expected, removed)                              \
+    do {                                                                 \
+        SeplOptStats stats;                                              \
+        assert(sepl_val_getnum(tst_run(#expr)) == expected);             \
+        assert(sepl_val_getnum(tst_run_opt(#expr, &stats)) == expected); \
+        assert(stats.instrs == removed);                                 \
+    } while (0)
+
+void removed_tests() {
+    // NONE SET of each declaration
+    assert_opt({
+        @a = 1 + 2;
+        @b = a * 3;
+        return b;
+    }, 9, 4);
+    // Else jump to the loop start threaded
+    assert_opt({
+        @x = 0;
+        while (x < 5) {
+            if (x < 2) { x = x + 1; } else { x = x + 2; };
+        };
+        return x;
+    }, 6, 2);
+    // Block statement scope and its NONE POP
+    assert_opt({
+        @a = 1;
+        { a = 2; };
+        return a;
+    }, 2, 6);
+    // Block values
+    assert_opt({
+        @a = 2;
+        @b = { return a + 1; };
+        return b;
+    }, 3, 6);
+    // Nothing to remove
+    assert_opt({ return 1; }, 1, 0);
+
+    // More declarations than a pass takes
+    char src[2048];
+    int i, n = sprintf(src, "{ @v0 = 0; ");
+    for (i = 1; i < 80; i++) {
+        n += sprintf(src + n, "@v%d = v%d + 1; ", i, i - 1);
+    }
+    sprintf(src + n, "return v79; }");
+    SeplOptStats stats;
+    assert(sepl_val_getnum(tst_run_opt(src, &stats)) == 79);
+    assert(stats.instrs == 160);
+}
+
+void kept_tests() {
+    SeplOptStats stats;
+
+    // Variables referring to objects keep their declaration
+    assert(sepl_val_isstr(
+        tst_run_opt("{ @s = \"ab\"; @t = s; return t; }", &stats)));
+    assert(stats.instrs == 2);
+
+    // Blocks declaring variables keep their scope
+    assert_opt({
+        @a = { @b = 2; return b + 1; };
+        return a;
+    }, 3, 2);
+
+    // Recursive functions keep the absolute index of their slot
+    assert_opt({
+        @f = $(n) {
+            if (n < 1) { return 0; };
+            return f(n - 1) + 2;
+        };
+        return f(5);
+    }, 10, 4);
+
+    // Loops left by an inner return keep the scope they return from
+    assert_opt({
+        @t = 0;
+        if (t < 1) {
+            while (t < 3) {
+                if (t > 1) { return 7; };
+                t = t + 1;
+            };
+            return 5;
+        };
+        return t;
+    }, 7, 4);
+
+    // Blocks returning functions must still fail
+    assert(run_opt("{ @a = { @f = $(){}; return f; }; return 1; }", &stats) ==
+           SEPL_ERR_FUNC_RET);
+}
+
+void module_tests() {
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    const char *exports[] = {"a", "main"};
+    SeplError err = {0};
+    SeplOptStats stats;
+    SeplValue main;
+    mod.exports = exports;
+    mod.esize = 2;
+
+    SeplCompiler com = sepl_com_init(
+        "a = 10; main = $(n){ @b = a + n; while (b < 100) { b = b * 2; };"
+        "return b; };",
+        &mod, env);
+    sepl_com_module(&com);
+    assert(sepl_com_finish(&com).code == SEPL_ERR_OK);
+
+    stats = sepl_opt_peephole(&mod);
+    assert(stats.instrs > 0 && stats.bytes > 0);
+
+    sepl_mod_init(&mod, &err, env);
+    sepl_mod_exec(&mod, &err, env);
+    assert(err.code == SEPL_ERR_OK);
+    assert(sepl_val_getnum(sepl_mod_getexport(&mod, env, "a")) == 10);
+
+    main = sepl_mod_getexport(&mod, env, "main");
+    SeplValue args_values[] = {sepl_val_number(3)};
+    SeplArgs args = {0};
+    args.values = args_values;
+    args.size = 1;
+    sepl_mod_initfunc(&mod, &err, main, args);
+    assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, env)) == 104);
+}
+
+SEPL_TEST_GROUP(removed_tests, kept_tests, module_tests)
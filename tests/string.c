@@ -11,7 +11,8 @@
 #include "tests.h"
 
 #define str_eq(s1, s2) (strcmp(s1, s2) == 0)
-#define assert_seplstr(expr, s) (assert(str_eq(tst_run(#expr).as.obj, s)))
+#define assert_seplstr(expr, s) \
+    (assert(str_eq(sepl_val_getobj(tst_run(#expr)), s)))
 
 void basic_test() {
     assert_seplstr({ return "Hello"; }, "Hello");
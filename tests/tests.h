@@ -8,13 +8,64 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Runs the module one instruction at a time with sepl_mod_step, which stops
+ * the engine after each one and resumes it from pc and vpos */
+static inline SeplValue tst_step(SeplModule *mod, SeplError *err, SeplEnv env) {
+    SeplValue val = SEPL_NONE;
+    while (mod->pc < mod->bpos) {
+        val = sepl_mod_step(mod, err, env);
+        if (err->code != SEPL_ERR_OK)
+            return SEPL_NONE;
+    }
+    return val;
+}
+
+/* Runs sepl_ver_module over the module, which must accept it */
+static inline void tst_verify(SeplModule *mod, SeplEnv env, const char *src) {
+    static sepl_size buf[1024 * 2];
+    SeplError err = sepl_ver_module(mod, env, buf, sizeof(buf));
+    if (err.code != SEPL_ERR_OK) {
+        fprintf(stderr, "\nFailed to verify:\n%s\nOpcode: %d\n", src,
+                err.info.bc);
+        assert(err.code == SEPL_ERR_OK);
+    }
+}
+
+/* Compiles src again, runs sepl_opt_peephole over it and executes it */
+static inline SeplValue tst_run_opt(const char *src, SeplOptStats *stats) {
+    SeplEnv env = {0};
+    static unsigned char bytes[1024];
+    static SeplValue values[100];
+
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    SeplCompiler com = sepl_com_init(src, &mod, env);
+    sepl_com_block(&com);
+    SeplError err = sepl_com_finish(&com);
+    assert(err.code == SEPL_ERR_OK);
+
+    *stats = sepl_opt_peephole(&mod);
+    tst_verify(&mod, env, src);
+    SeplValue val = sepl_mod_exec(&mod, &err, env);
+    if (err.code != SEPL_ERR_OK) {
+        fprintf(stderr, "\nFailed to run optimized:\n%s\nError code: %d\n",
+                src, err.code);
+        assert(err.code == SEPL_ERR_OK);
+    }
+    return val;
+}
+
 static inline SeplValue tst_run(const char *src) {
     SeplEnv env = {0};
-    unsigned char bytes[1024];
-    SeplValue values[100];
+    /* Static so that strings returned from the module outlive the call */
+    static unsigned char bytes[1024];
+    static SeplValue values[100];
+    SeplValue step_values[100];
+    SeplModule step_mod;
+    static void *symtab[1024];
 
-    SeplModule mod = sepl_mod_new(bytes, 1024, values, 1024);
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
     SeplCompiler com = sepl_com_init(src, &mod, env);
+    sepl_com_symtab(&com, symtab, sizeof(symtab));
     sepl_com_block(&com);
     SeplError err = sepl_com_finish(&com);
 
@@ -23,6 +74,9 @@ static inline SeplValue tst_run(const char *src) {
         assert(err.code == SEPL_ERR_OK);
     }
 
+    tst_verify(&mod, env, src);
+    step_mod = mod;
+    step_mod.values = step_values;
     SeplValue val = sepl_mod_exec(&mod, &err, env);
 
     if (err.code != SEPL_ERR_OK) {
@@ -30,12 +84,42 @@ static inline SeplValue tst_run(const char *src) {
                 err.code);
         assert(err.code == SEPL_ERR_OK);
     }
+
+    /* Stopping after every instruction and resuming from the saved pc and
+     * vpos must give what one sepl_mod_exec does */
+    SeplValue step_val = tst_step(&step_mod, &err, env);
+    assert(err.code == SEPL_ERR_OK);
+    assert(sepl_val_gettype(step_val) == sepl_val_gettype(val));
+    assert(!sepl_val_isnum(step_val) ||
+           sepl_val_getnum(step_val) == sepl_val_getnum(val));
+
+    /* So must the module rewritten by the peephole optimizer, which is
+     * compiled without the symbol table */
+    SeplOptStats stats;
+    SeplValue opt_val = tst_run_opt(src, &stats);
+    assert(sepl_val_gettype(opt_val) == sepl_val_gettype(val));
+    assert(!sepl_val_isnum(opt_val) ||
+           sepl_val_getnum(opt_val) == sepl_val_getnum(val));
     return val;
 }
 
-#define assert_str(expr, expected) assert(tst_run(expr).as.num == expected)
+/* Size of the bytecode compiled from src */
+static inline sepl_size tst_size(const char *src) {
+    SeplEnv env = {0};
+    static unsigned char bytes[1024];
+    static SeplValue values[100];
+
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    SeplCompiler com = sepl_com_init(src, &mod, env);
+    sepl_com_block(&com);
+    assert(sepl_com_finish(&com).code == SEPL_ERR_OK);
+    return mod.bpos + (mod.bsize - mod.kpos);
+}
+
+#define assert_str(expr, expected) \
+    assert(sepl_val_getnum(tst_run(expr)) == expected)
 #define assert_sepl(expr, expected) assert_str(#expr, expected)
-#define assert_sepl_none(expr) assert(tst_run(#expr).type == SEPL_VAL_NONE)
+#define assert_sepl_none(expr) assert(sepl_val_isnone(tst_run(#expr)))
 
 #define SEPL_TEST_GROUP(...)                                                  \
     int main() {                                                              \
@@ -11,11 +11,11 @@
 #define str_eq(s1, s2) (strcmp(s1, s2) == 0)
 
 void conversions() {
-    assert(sepl_val_number(3.14).as.num == 3.14);
-    assert(sepl_val_object(NULL).as.obj == NULL);
+    assert(sepl_val_getnum(sepl_val_number(3.14)) == 3.14);
+    assert(sepl_val_getobj(sepl_val_object(NULL)) == NULL);
     char *str = "Hello";
-    assert(sepl_val_object(str).as.obj == str);
-    assert(str_eq(sepl_val_str("Hello").as.obj, "Hello"));
+    assert(sepl_val_getobj(sepl_val_object(str)) == str);
+    assert(str_eq(sepl_val_getobj(sepl_val_str("Hello")), "Hello"));
 }
 
 void type_check_null() {
@@ -39,4 +39,32 @@ void type_check_obj() {
     assert(sepl_val_isobj(sepl_val_object("Hello")));
 }
 
-SEPL_TEST_GROUP(conversions, type_check_null, type_check_num, type_check_obj)
+static SeplValue nop(SeplArgs args, SeplError *err) {
+    (void)args;
+    (void)err;
+    return SEPL_NONE;
+}
+
+/* Values that share bits with NaNs when SEPL_NANBOX is defined */
+void special_values() {
+    double zero = 0.0, nan = zero / zero, inf = 1 / zero;
+    char *str = "Hello";
+
+    assert(sepl_val_isnum(sepl_val_number(nan)));
+    assert(sepl_val_isnum(sepl_val_number(-nan)));
+    assert(sepl_val_getnum(sepl_val_number(nan)) !=
+           sepl_val_getnum(sepl_val_number(nan)));
+    assert(sepl_val_getnum(sepl_val_number(inf)) == inf);
+    assert(sepl_val_getnum(sepl_val_number(-inf)) == -inf);
+    assert(1 / sepl_val_getnum(sepl_val_number(-0.0)) == -inf);
+
+    assert(sepl_val_isscp(sepl_val_scope(0)));
+    assert(sepl_val_getpos(sepl_val_func(1234)) == 1234);
+    assert(sepl_val_getcfunc(sepl_val_cfunc(nop)) == nop);
+    assert(sepl_val_isref(sepl_val_asref(str)));
+    assert(sepl_val_gettype(sepl_val_type(str, 20)) == SEPL_VAL_OBJ + 20);
+    assert(sepl_val_getobj(sepl_val_type(str, 20)) == str);
+}
+
+SEPL_TEST_GROUP(conversions, type_check_null, type_check_num, type_check_obj,
+                special_values)
@@ -259,4 +259,78 @@ void var_oper() {
         1);
 }
 
-SEPL_TEST_GROUP(single_var, var_conditional, var_assign_block, multi_var, var_oper);
+/* Compiles and runs src with n predefined numbers p0, p1, ... */
+static double run_symtab(const char *src, sepl_size n, void *symtab,
+                         sepl_size size, char *hashed) {
+    static char keys[2000][8];
+    static SeplValuePair predef[2000];
+    static unsigned char bytes[1 << 16];
+    static SeplValue values[1 << 13];
+    SeplEnv env = {0};
+    SeplError err;
+    SeplValue v;
+    sepl_size i;
+    char set;
+
+    for (i = 0; i < n; i++) {
+        sprintf(keys[i], "p%lu", (unsigned long)i);
+        predef[i].key = keys[i];
+        predef[i].value = sepl_val_number((double)i);
+    }
+    env.predef = predef;
+    env.predef_len = n;
+
+    SeplModule mod = sepl_mod_new(bytes, sizeof(bytes), values, 1 << 13);
+    SeplCompiler com = sepl_com_init(src, &mod, env);
+    set = sepl_com_symtab(&com, symtab, size);
+    sepl_com_block(&com);
+    *hashed = set && !com.sym_full;
+    err = sepl_com_finish(&com);
+    assert(err.code == SEPL_ERR_OK);
+
+    sepl_mod_init(&mod, &err, env);
+    v = sepl_mod_exec(&mod, &err, env);
+    assert(err.code == SEPL_ERR_OK);
+    return sepl_val_getnum(v);
+}
+
+void var_symtab() {
+    static void *symtab[1 << 17];
+    static char src[1 << 16];
+    char hashed, *p = src;
+    int i;
+
+    // predefined symbols
+    assert(run_symtab("{ return p1999 + p3; }", 2000, symtab,
+                      sizeof(symtab), &hashed) == 2002);
+    assert(hashed);
+
+    // thousands of locals, shadowed in nested blocks
+    p += sprintf(p, "{ @v0 = 1;");
+    for (i = 1; i < 3000; i++) {
+        p += sprintf(p, " @v%d = v%d + 1;", i, i - 1);
+    }
+    p += sprintf(p, " @p0 = v2999 + p1; { @v0 = 10; p0 = p0 + v0; };");
+    sprintf(p, " return p0 + v0; }");
+    assert(run_symtab(src, 2, symtab, sizeof(symtab), &hashed) == 3012);
+    assert(hashed);
+
+    // a table too small falls back to scanning the value stack
+    assert(run_symtab(src, 2, symtab, 1024, &hashed) == 3012);
+    assert(!hashed);
+    assert(run_symtab(src, 2, symtab, 16, &hashed) == 3012);
+    assert(!hashed);
+
+    // names leave the table with their scope, only the live ones take space
+    p = src;
+    p += sprintf(p, "{ @s = 0;");
+    for (i = 0; i < 1000; i++) {
+        p += sprintf(p, " { @v%d = %d; s = s + v%d; };", i, i, i);
+    }
+    sprintf(p, " return s + p1; }");
+    assert(run_symtab(src, 2, symtab, 1024, &hashed) == 499501);
+    assert(hashed);
+}
+
+SEPL_TEST_GROUP(single_var, var_conditional, var_assign_block, multi_var, var_oper,
+                var_symtab);
@@ -0,0 +1,140 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SEPL_IMPLEMENTATION
+#include "../sepl.h"
+#include "../sepl_com.h"
+
+#include "tests.h"
+
+SeplEnv env = {0};
+unsigned char bytes[1024];
+SeplValue values[100];
+sepl_size buf[1024 * 2];
+
+/* Verifies the hand written code src of len bytes */
+static SeplErrorCode verify(const unsigned char *src, sepl_size len) {
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    sepl_size i;
+    for (i = 0; i < len; i++) {
+        bytes[i] = src[i];
+    }
+    mod.bpos = len;
+    return sepl_ver_module(&mod, env, buf, sizeof(buf)).code;
+}
+
+#define assert_code(expected, ...)                          \
+    do {                                                    \
+        const unsigned char src[] = {__VA_ARGS__};          \
+        assert(verify(src, sizeof(src)) == (expected));     \
+    } while (0)
+
+void code_tests() {
+    assert_code(SEPL_ERR_OK, SEPL_BC_NONE, SEPL_BC_POP);
+    assert_code(SEPL_ERR_OK, SEPL_BC_NONE, SEPL_BC_JUMP, 4, SEPL_BC_NONE,
+                SEPL_BC_POP);
+
+    // Unknown opcode
+    assert_code(SEPL_ERR_BC, 255);
+    // Operand running past the code
+    assert_code(SEPL_ERR_BC, SEPL_BC_JUMP, 0x80);
+    // Constant outside of the pool
+    assert_code(SEPL_ERR_BC, SEPL_BC_CONST, 1, SEPL_BC_POP);
+    // Popping an empty stack
+    assert_code(SEPL_ERR_BC, SEPL_BC_POP);
+    assert_code(SEPL_ERR_BC, SEPL_BC_NONE, SEPL_BC_ADD);
+    // Jumping past the code and into an operand
+    assert_code(SEPL_ERR_BC, SEPL_BC_JUMP, 100);
+    assert_code(SEPL_ERR_BC, SEPL_BC_JUMP, 3, SEPL_BC_INT, 5, 0, SEPL_BC_POP);
+    // Paths joining with different depths
+    assert_code(SEPL_ERR_BC, SEPL_BC_NONE, SEPL_BC_NONE, SEPL_BC_JUMPIF, 5,
+                SEPL_BC_NONE, SEPL_BC_POP);
+    // Reading above the stack
+    assert_code(SEPL_ERR_BC, SEPL_BC_GET, 1);
+    // Function body without a FRAME
+    assert_code(SEPL_ERR_BC, SEPL_BC_FUNC, 4, 0, SEPL_BC_NONE, SEPL_BC_POP);
+}
+
+void compiled_tests() {
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    SeplError err = {0};
+    SeplCompiler com =
+        sepl_com_init("{ @f = $(n) { return n * 2; }; return f(21); }", &mod,
+                      env);
+    sepl_com_block(&com);
+    err = sepl_com_finish(&com);
+    assert(err.code == SEPL_ERR_OK);
+
+#ifdef SEPL_UNCHECKED
+    // Modules that are not verified do not run
+    sepl_mod_exec(&mod, &err, env);
+    assert(err.code == SEPL_ERR_BC);
+    err.code = SEPL_ERR_OK;
+    mod.pc = 0;
+    mod.vpos = 0;
+#endif
+
+    // The buffer must hold the scratch memory
+    err = sepl_ver_module(&mod, env, buf, sepl_ver_bufsize(&mod) - 1);
+    assert(err.code == SEPL_ERR_BOVERFLOW && mod.verified == 0);
+
+    err = sepl_ver_module(&mod, env, buf, sepl_ver_bufsize(&mod));
+    assert(err.code == SEPL_ERR_OK && mod.verified != 0);
+    assert(sepl_val_getnum(sepl_mod_exec(&mod, &err, env)) == 42);
+    assert(err.code == SEPL_ERR_OK);
+
+    // Optimizing the code needs another check
+    sepl_opt_peephole(&mod);
+    assert(mod.verified == 0);
+}
+
+static SeplValue twice(SeplArgs args, SeplError *e) {
+    (void)e;
+    return sepl_val_number(sepl_val_getnum(args.values[0]) * 2);
+}
+
+/* Compiles src with the predef twice, verifies it and returns its result */
+static double run_verified(const char *src) {
+    SeplValuePair predef[] = {{"twice", SEPL_NONE}};
+    SeplEnv penv = {0};
+    SeplModule mod = sepl_mod_new(bytes, 1024, values, 100);
+    SeplError err = {0};
+    SeplValue val;
+    predef[0].value = sepl_val_cfunc(twice);
+    penv.predef = predef;
+    penv.predef_len = 1;
+
+    SeplCompiler com = sepl_com_init(src, &mod, penv);
+    sepl_com_block(&com);
+    err = sepl_com_finish(&com);
+    assert(err.code == SEPL_ERR_OK);
+    err = sepl_ver_module(&mod, penv, buf, sizeof(buf));
+    assert(err.code == SEPL_ERR_OK);
+
+    sepl_mod_init(&mod, &err, penv);
+    val = sepl_mod_exec(&mod, &err, penv);
+    assert(err.code == SEPL_ERR_OK);
+    return sepl_val_getnum(val);
+}
+
+void outer_tests() {
+    // Functions calling a predef
+    assert(run_verified("{ @f = $(x) { return twice(x); }; return f(9); }") ==
+           18);
+    assert(run_verified("{ @f = $(x) { @g = twice; return g(x) + 1; };"
+                        "  return f(3); }") == 7);
+    // Variables outside a function reached through a scope around it
+    assert(run_verified("{ @x = 4; @r = { @f = $(n) { x = x + n;"
+                        "  if (n > 0) { @k = f(n - 1); return k; };"
+                        "  return x; }; @a = f(3); return x; }; return r; }") ==
+           10);
+}
+
+int main() {
+    code_tests();
+    compiled_tests();
+    outer_tests();
+    return 0;
+}